@@ -0,0 +1,64 @@
+﻿#include "alloccount.h"
+
+#ifdef MESSENGER_COUNT_ALLOCS
+
+#include <atomic>
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+namespace {
+
+thread_local uint64_t t_allocations = 0; // Постоянная инициализация: обращение не вызывает operator new
+std::atomic<uint64_t> g_allocations{ 0 };
+
+void* allocate(std::size_t size, std::size_t alignment) {
+    ++t_allocations;
+    g_allocations.fetch_add(1, std::memory_order_relaxed);
+    if (size == 0) size = 1;
+    for (;;) {
+        void* p = alignment <= alignof(std::max_align_t) ? std::malloc(size)
+            : std::aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment);
+        if (p) return p;
+        std::new_handler handler = std::get_new_handler();
+        if (!handler) return nullptr;
+        handler();
+    }
+}
+
+void* allocateOrThrow(std::size_t size, std::size_t alignment) {
+    void* p = allocate(size, alignment);
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+
+} // namespace
+
+uint64_t threadAllocations() { return t_allocations; }
+uint64_t totalAllocations() { return g_allocations.load(std::memory_order_relaxed); }
+
+void* operator new(std::size_t size) { return allocateOrThrow(size, 0); }
+void* operator new[](std::size_t size) { return allocateOrThrow(size, 0); }
+void* operator new(std::size_t size, std::align_val_t al) { return allocateOrThrow(size, static_cast<std::size_t>(al)); }
+void* operator new[](std::size_t size, std::align_val_t al) { return allocateOrThrow(size, static_cast<std::size_t>(al)); }
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept { try { return allocate(size, 0); } catch (...) { return nullptr; } }
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept { try { return allocate(size, 0); } catch (...) { return nullptr; } }
+
+// malloc и aligned_alloc освобождаются одним free
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::size_t) noexcept { std::free(p); }
+void operator delete(void* p, std::align_val_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::align_val_t) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t, std::align_val_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::size_t, std::align_val_t) noexcept { std::free(p); }
+void operator delete(void* p, const std::nothrow_t&) noexcept { std::free(p); }
+void operator delete[](void* p, const std::nothrow_t&) noexcept { std::free(p); }
+
+#else
+
+uint64_t threadAllocations() { return 0; }
+uint64_t totalAllocations() { return 0; }
+
+#endif
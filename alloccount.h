@@ -0,0 +1,20 @@
+﻿// alloccount.h : счетчик выделений памяти в куче - для проверки, что путь одного сообщения не выделяет память.
+// Включается при сборке (cmake -DMESSENGER_COUNT_ALLOCS=ON): тогда alloccount.cpp заменяет глобальные
+// operator new/delete, и каждое выделение увеличивает счетчик своего потока и общий. Без этого флага
+// функции возвращают 0, а operator new остается стандартным: в обычной сборке счетчик ничего не стоит.
+// Замена действует во всей программе, которая компонуется с этим файлом (а не только в messenger).
+
+#pragma once
+
+#include <cstdint>
+
+#ifdef MESSENGER_COUNT_ALLOCS
+constexpr bool kAllocCountEnabled = true;
+#else
+constexpr bool kAllocCountEnabled = false;
+#endif
+
+// Выделения, сделанные вызывающим потоком с его начала
+uint64_t threadAllocations();
+// Выделения всех потоков с начала программы
+uint64_t totalAllocations();
@@ -0,0 +1,16 @@
+﻿#include "backoff.h"
+
+#include <algorithm>
+
+Backoff::Backoff(std::chrono::milliseconds initial, std::chrono::milliseconds maximum)
+    : m_initial(initial), m_maximum(std::max(initial, maximum)), m_random(std::random_device{}()) {}
+
+std::chrono::milliseconds Backoff::next() {
+    // Сдвиг ограничен, чтобы не переполнить; дальше все равно упираемся в maximum
+    unsigned shift = std::min(m_attempts, 20u);
+    long long ceiling = std::min<long long>(m_initial.count() << shift, m_maximum.count());
+    ++m_attempts;
+    long long half = ceiling / 2;
+    std::uniform_int_distribution<long long> jitter(0, ceiling - half);
+    return std::chrono::milliseconds(half + jitter(m_random));
+}
@@ -0,0 +1,26 @@
+﻿// backoff.h : задержки между попытками переподключения.
+// Экспоненциальный рост с разбросом ("equal jitter"): половина задержки фиксирована, половина случайна -
+// клиенты, потерявшие сервер одновременно, не приходят к нему снова одной толпой.
+
+#pragma once
+
+#include <chrono>
+#include <random>
+
+class Backoff {
+public:
+    explicit Backoff(std::chrono::milliseconds initial = std::chrono::milliseconds(100),
+        std::chrono::milliseconds maximum = std::chrono::milliseconds(5000));
+
+    // Задержка перед следующей попыткой: [d/2, d], где d удваивается с каждой неудачей до maximum
+    std::chrono::milliseconds next();
+    // Попытка удалась - следующая серия начнется с initial
+    void reset() { m_attempts = 0; }
+    unsigned attempts() const { return m_attempts; }
+
+private:
+    std::chrono::milliseconds m_initial;
+    std::chrono::milliseconds m_maximum;
+    unsigned m_attempts = 0;
+    std::minstd_rand m_random;
+};
@@ -0,0 +1,181 @@
+﻿// alloc_bench.cpp : выделения памяти в куче на одно входящее сообщение. Настоящая Session читает из сокета
+// строки или кадры, разбирает их и кладет события в SessionEventQueue; слушатель на другом конце делает
+// то же, что вывод клиента на каждом сообщении: учет непрочитанных и сборка строки с временем.
+// После прогрева (буферы чтения, слоты кольца, таблицы имен достигли своего размера) путь сообщения через
+// кольцо не должен выделять ничего: иначе код возврата 1. Отдельно - путь через запасной буфер, когда
+// читатель отстал: там строки берутся из арены, и выделений - доли на сообщение.
+// Собирается только с -DMESSENGER_COUNT_ALLOCS=ON.
+//
+// Запуск: alloc_bench [сообщений_в_пачке] [пачек]
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <string_view>
+
+#include "alloccount.h"
+#include "frame.h"
+#include "protocol.h"
+#include "session.h"
+#include "sessionevents.h"
+#include "timeformat.h"
+#include "unreadindex.h"
+
+namespace {
+
+constexpr int kGroups = 300;
+constexpr int kUsers = 50;
+constexpr int kWarmupBatches = 10;
+
+// Что вывод клиента делает с каждым сообщением, без самого терминала
+struct ViewLike : SessionListener {
+    UnreadIndex unread;
+    std::string line;
+    uint64_t messages = 0;
+
+    void onMessage(const ChatMessage& message) override {
+        ++messages;
+        unread.add(message.kind, message.conversationId, message.conversation, message.sender, message.text);
+        line.clear();
+        line += currentLocalTimeForDisplay().view();
+        line += message.conversation;
+        line += message.sender;
+        line += ": ";
+        line += message.text;
+    }
+};
+
+struct Loopback {
+    int listener = -1;
+    int server = -1;
+    unsigned short port = 0;
+
+    bool listen() {
+        listener = socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in address{};
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t length = sizeof(address);
+        if (listener < 0 || bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 ||
+            ::listen(listener, 1) != 0 || getsockname(listener, reinterpret_cast<sockaddr*>(&address), &length) != 0) return false;
+        port = ntohs(address.sin_port);
+        return true;
+    }
+    bool send(const std::string& data) {
+        for (size_t sent = 0; sent < data.size();) {
+            ssize_t count = ::send(server, data.data() + sent, data.size() - sent, 0);
+            if (count <= 0) return false;
+            sent += static_cast<size_t>(count);
+        }
+        return true;
+    }
+    ~Loopback() {
+        if (server >= 0) close(server);
+        if (listener >= 0) close(listener);
+    }
+};
+
+// Пачка сообщений вперемешку: группы и личные, разные отправители
+void buildBatch(std::string& out, bool frames, int count, int base) {
+    out.clear();
+    std::string group, user;
+    for (int i = 0; i < count; ++i) {
+        int n = base + i;
+        group = "group" + std::to_string(n % kGroups);
+        user = "user" + std::to_string(n % kUsers);
+        std::string_view groupFields[] = { "GROUP_MSG_FROM", group, user, "some text of the message" };
+        std::string_view privateFields[] = { "MSG_FROM", user, "a private message text" };
+        const std::string_view* fields = n % 4 ? groupFields : privateFields;
+        size_t fieldCount = n % 4 ? 4 : 3;
+        if (frames) appendFrame(out, fields, fieldCount);
+        else { appendServerText(out, fields, fieldCount); out += '\n'; }
+    }
+}
+
+struct Result {
+    double ringPerMessage = 0;    // Установившийся режим, читатель успевает
+    double receivePerMessage = 0; // Из них - поток приема
+    double spillPerMessage = 0;   // Читатель отстал: все через запасной буфер
+    uint64_t steadyAllocations = 0;
+};
+
+bool run(bool frames, int batchSize, int batches, Result& result) {
+    Loopback loopback;
+    if (!loopback.listen()) { std::fprintf(stderr, "Не удалось открыть локальный порт\n"); return false; }
+    Session session;
+    SessionEventQueue queue; // Емкость как у клиента: один recv() в нее помещается
+    ViewLike view;
+    session.setListener(&queue);
+    int error = 0;
+    if (!session.connect("127.0.0.1", loopback.port, error)) { std::fprintf(stderr, "Нет соединения: %d\n", error); return false; }
+    loopback.server = accept(loopback.listener, nullptr, nullptr);
+    std::string out;
+    if (frames && !loopback.send("CAPS binary_frames\n")) return false;
+
+    // Читатель успевает: прием и вывод по очереди небольшими порциями, кольцо не переполняется
+    uint64_t steady = 0, steadyReceive = 0, steadyMessages = 0;
+    for (int batch = 0; batch < kWarmupBatches + batches; ++batch) {
+        buildBatch(out, frames, batchSize, batch * batchSize);
+        if (!loopback.send(out)) return false;
+        uint64_t before = threadAllocations(), receive = 0, start = view.messages;
+        while (view.messages - start < static_cast<uint64_t>(batchSize)) {
+            uint64_t receiveBefore = threadAllocations();
+            ReadStatus status = session.receive();
+            if (status == ReadStatus::Closed || status == ReadStatus::Error) return false;
+            queue.refill();
+            receive += threadAllocations() - receiveBefore;
+            while (queue.drain(view, 256)) {}
+        }
+        if (batch >= kWarmupBatches) {
+            steady += threadAllocations() - before;
+            steadyReceive += receive;
+            steadyMessages += static_cast<uint64_t>(batchSize);
+        }
+    }
+    result.steadyAllocations = steady;
+    result.ringPerMessage = static_cast<double>(steady) / static_cast<double>(steadyMessages);
+    result.receivePerMessage = static_cast<double>(steadyReceive) / static_cast<double>(steadyMessages);
+
+    // Читатель отстал: вся пачка (два кольца) принимается до вывода, сверх кольца - в запасной буфер
+    int spillBatch = static_cast<int>(queue.stats().capacity) * 2;
+    uint64_t before = threadAllocations(), spillMessages = 0;
+    for (int batch = 0; batch < batches; ++batch) {
+        buildBatch(out, frames, spillBatch, batch * spillBatch);
+        if (!loopback.send(out)) return false;
+        uint64_t queued = queue.stats().queued + static_cast<uint64_t>(spillBatch);
+        while (queue.stats().queued < queued) {
+            ReadStatus status = session.receive();
+            if (status == ReadStatus::Closed || status == ReadStatus::Error) return false;
+        }
+        do queue.refill(); while (queue.drain(view, 1024) || queue.overflowing());
+        spillMessages += static_cast<uint64_t>(spillBatch);
+    }
+    result.spillPerMessage = static_cast<double>(threadAllocations() - before) / static_cast<double>(spillMessages);
+    return true;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    int batchSize = argc > 1 ? std::atoi(argv[1]) : 2000;
+    int batches = argc > 2 ? std::atoi(argv[2]) : 20;
+    if (batchSize <= 0 || batches <= 0) { std::fprintf(stderr, "Использование: alloc_bench [сообщений_в_пачке] [пачек]\n"); return 1; }
+
+    std::printf("Выделений на сообщение (%d пачек по %d после %d пачек прогрева):\n", batches, batchSize, kWarmupBatches);
+    uint64_t steady = 0;
+    for (bool frames : { false, true }) {
+        Result result;
+        if (!run(frames, batchSize, batches, result)) return 1;
+        steady += result.steadyAllocations;
+        std::printf("  %s: через кольцо %.4f (из них прием %.4f), через запасной буфер %.4f\n", frames ? "кадры " : "строки",
+            result.ringPerMessage, result.receivePerMessage, result.spillPerMessage);
+    }
+    if (steady > 0) { std::printf("ОШИБКА: в установившемся режиме выделено %llu раз\n", static_cast<unsigned long long>(steady)); return 1; }
+    std::printf("Установившийся режим без выделений\n");
+    return 0;
+}
@@ -0,0 +1,267 @@
+﻿// e2e_bench.cpp : сквозной замер клиента против локального mockserver.
+// Запускает mockserver и настоящий client (через MESSENGER_SERVER), управляет клиентом через stdin
+// и засекает по его выводу: вход, время до первого сообщения истории, полное открытие истории
+// и устойчивую скорость приема потока сообщений. --page N - клиент показывает при открытии только последние
+// N сообщений (страницы истории, --history-page), по умолчанию - всю историю.
+//
+// Запуск: e2e_bench [--history N] [--page N] [--flood N] [--runs N] [--write-chunk байт --write-delay-ms мс] [--frames on|off]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/wait.h>
+
+#include "messengerclient.h"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct BenchOptions {
+    std::string history = "20000";  // Сообщений в истории чата
+    unsigned long page = 0;          // --history-page клиента (0 - вся история)
+    unsigned long flood = 100000;    // Сообщений в замере пропускной способности
+    int runs = 3;
+    std::string writeChunk;          // Пробрасываются в mockserver
+    std::string writeDelayMs;
+    bool frames = true;              // Двоичные кадры (off - mockserver только с текстовым протоколом)
+    int timeoutSec = 60;             // На каждый шаг
+};
+
+// Дочерний процесс со stdin/stdout через каналы. Вывод копится, пока в нем не найдется ожидаемая строка
+class ChildProcess {
+public:
+    ~ChildProcess() { stop(); }
+
+    bool spawn(const std::vector<std::string>& args, const std::vector<std::string>& env) {
+        int inPipe[2], outPipe[2];
+        if (pipe(inPipe) != 0 || pipe(outPipe) != 0) return false;
+        m_pid = fork();
+        if (m_pid < 0) return false;
+        if (m_pid == 0) {
+            dup2(inPipe[0], STDIN_FILENO);
+            dup2(outPipe[1], STDOUT_FILENO);
+            dup2(outPipe[1], STDERR_FILENO);
+            close(inPipe[0]); close(inPipe[1]); close(outPipe[0]); close(outPipe[1]);
+            for (const std::string& var : env) putenv(const_cast<char*>(var.c_str()));
+            std::vector<char*> argv;
+            for (const std::string& arg : args) argv.push_back(const_cast<char*>(arg.c_str()));
+            argv.push_back(nullptr);
+            execv(argv[0], argv.data());
+            _exit(127);
+        }
+        close(inPipe[0]); close(outPipe[1]);
+        m_stdin = inPipe[1];
+        m_stdout = outPipe[0];
+        fcntl(m_stdout, F_SETFL, fcntl(m_stdout, F_GETFL, 0) | O_NONBLOCK);
+        return true;
+    }
+
+    void write(const std::string& text) {
+        size_t written = 0;
+        while (written < text.size()) {
+            ssize_t n = ::write(m_stdin, text.data() + written, text.size() - written);
+            if (n <= 0) return;
+            written += static_cast<size_t>(n);
+        }
+    }
+
+    // Ждет появления needle в выводе после последнего найденного места; текст перед ним - в before.
+    // Возвращает false по таймауту или EOF
+    bool waitFor(const std::string& needle, int timeoutSec, Clock::time_point& foundAt, std::string* before = nullptr) {
+        auto deadline = Clock::now() + std::chrono::seconds(timeoutSec);
+        for (;;) {
+            size_t pos = m_output.find(needle, m_searchFrom);
+            if (pos != std::string::npos) {
+                if (before) before->assign(m_output, 0, pos);
+                m_output.erase(0, pos + needle.size()); // Все, что раньше, уже не нужно
+                m_searchFrom = 0;
+                foundAt = m_lastReadAt;
+                return true;
+            }
+            m_searchFrom = m_output.size() >= needle.size() ? m_output.size() - needle.size() + 1 : 0;
+
+            int remainingMs = static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(deadline - Clock::now()).count());
+            if (remainingMs <= 0) return false;
+            pollfd pfd{ m_stdout, POLLIN, 0 };
+            if (poll(&pfd, 1, remainingMs) <= 0) return false;
+            char buffer[64 * 1024];
+            ssize_t n = read(m_stdout, buffer, sizeof(buffer));
+            if (n == 0) return false;
+            if (n < 0) continue;
+            m_lastReadAt = Clock::now();
+            m_outputBytes += static_cast<size_t>(n);
+            // Держим в памяти только хвост, иначе поток в миллионы строк раздует буфер
+            if (m_searchFrom > 1024 * 1024) { m_output.erase(0, m_searchFrom); m_searchFrom = 0; }
+            m_output.append(buffer, static_cast<size_t>(n));
+        }
+    }
+
+    size_t outputBytes() const { return m_outputBytes; }
+
+    // Закрывает stdin и ждет выхода; не вышел за timeoutMs - SIGKILL
+    bool finish(int timeoutMs) {
+        if (m_stdin >= 0) { close(m_stdin); m_stdin = -1; }
+        for (int waited = 0; waited < timeoutMs; waited += 10) {
+            // Вывод нужно вычитывать, иначе ребенок может зависнуть на записи в полный канал
+            char buffer[64 * 1024];
+            while (read(m_stdout, buffer, sizeof(buffer)) > 0) {}
+            int status = 0;
+            if (waitpid(m_pid, &status, WNOHANG) == m_pid) { m_pid = -1; return WIFEXITED(status) && WEXITSTATUS(status) == 0; }
+            usleep(10 * 1000);
+        }
+        stop();
+        return false;
+    }
+
+    void stop() {
+        if (m_pid > 0) { kill(m_pid, SIGKILL); waitpid(m_pid, nullptr, 0); m_pid = -1; }
+        if (m_stdin >= 0) { close(m_stdin); m_stdin = -1; }
+        if (m_stdout >= 0) { close(m_stdout); m_stdout = -1; }
+    }
+
+private:
+    pid_t m_pid = -1;
+    int m_stdin = -1;
+    int m_stdout = -1;
+    std::string m_output;
+    size_t m_searchFrom = 0;
+    size_t m_outputBytes = 0;
+    Clock::time_point m_lastReadAt;
+};
+
+// Ждет от mockserver строку "MOCKSERVER LISTENING host:port"
+bool readListenLine(ChildProcess& process, std::string& endpoint, int timeoutSec) {
+    static const std::string kMarker = "MOCKSERVER LISTENING ";
+    Clock::time_point unused;
+    if (!process.waitFor(kMarker, timeoutSec, unused)) return false;
+    return process.waitFor("\n", timeoutSec, unused, &endpoint) && !endpoint.empty();
+}
+
+struct RunResult {
+    double loginMs = 0;
+    double firstMessageMs = 0;
+    double historyOpenMs = 0;
+    double floodMsgPerSec = 0;
+    double floodMbPerSec = 0;
+};
+
+double msBetween(Clock::time_point from, Clock::time_point to) {
+    return std::chrono::duration<double, std::milli>(to - from).count();
+}
+
+bool runOnce(const BenchOptions& options, const std::string& endpoint, int runIndex, RunResult& result) {
+    char cacheDir[] = "/tmp/e2e_bench_cache_XXXXXX"; // Пустой кэш - каждый прогон грузит историю целиком
+    if (!mkdtemp(cacheDir)) { std::cerr << "[E2E] mkdtemp не удался." << std::endl; return false; }
+
+    ChildProcess client;
+    Clock::time_point start = Clock::now(), found;
+    if (!client.spawn({ CLIENT_PATH, "--history-page", std::to_string(options.page) }, { "MESSENGER_SERVER=" + endpoint, std::string("MESSENGER_CACHE_DIR=") + cacheDir })) return false;
+    client.write("LOGIN e2e_user" + std::to_string(runIndex) + " bench\n");
+    if (!client.waitFor("Вы успешно вошли как", options.timeoutSec, found)) { std::cerr << "[E2E] Нет входа." << std::endl; return false; }
+    result.loginMs = msBetween(start, found);
+
+    // Индекс 0 - первое сообщение истории, history-1 - последнее. Со страницами первое показанное - history-page
+    unsigned long total = std::strtoul(options.history.c_str(), nullptr, 10), lastIndex = total - 1;
+    unsigned long firstIndex = options.page && options.page < total ? total - options.page : 0;
+    Clock::time_point chatStart = Clock::now();
+    client.write("CHAT e2e_peer\n");
+    if (!client.waitFor("сообщение истории номер " + std::to_string(firstIndex) + "\n", options.timeoutSec, found)) { std::cerr << "[E2E] Нет истории." << std::endl; return false; }
+    result.firstMessageMs = msBetween(chatStart, found);
+    if (!client.waitFor("сообщение истории номер " + std::to_string(lastIndex) + "\n", options.timeoutSec, found)) {
+        std::cerr << "[E2E] История не догружена." << std::endl;
+        return false;
+    }
+    result.historyOpenMs = msBetween(chatStart, found);
+
+    size_t bytesBefore = client.outputBytes();
+    Clock::time_point floodStart = Clock::now();
+    client.write("!flood " + std::to_string(options.flood) + "\n");
+    if (!client.waitFor("flood done", options.timeoutSec, found)) { std::cerr << "[E2E] Поток сообщений не дошел." << std::endl; return false; }
+    double floodSec = std::chrono::duration<double>(found - floodStart).count();
+    result.floodMsgPerSec = options.flood / floodSec;
+    result.floodMbPerSec = (client.outputBytes() - bytesBefore) / floodSec / (1024.0 * 1024.0);
+
+    client.write("/exit_chat\nEXIT\n");
+    client.finish(3000);
+    std::string cleanup = std::string("rm -rf ") + cacheDir;
+    if (std::system(cleanup.c_str()) != 0) {}
+    return true;
+}
+
+bool parseOptions(int argc, char* argv[], BenchOptions& options) {
+    for (int i = 1; i + 1 < argc; i += 2) {
+        std::string arg = argv[i], value = argv[i + 1];
+        if (arg == "--history") options.history = value;
+        else if (arg == "--page") options.page = std::strtoul(value.c_str(), nullptr, 10);
+        else if (arg == "--flood") options.flood = std::strtoul(value.c_str(), nullptr, 10);
+        else if (arg == "--runs") options.runs = std::atoi(value.c_str());
+        else if (arg == "--write-chunk") options.writeChunk = value;
+        else if (arg == "--write-delay-ms") options.writeDelayMs = value;
+        else if (arg == "--timeout") options.timeoutSec = std::atoi(value.c_str());
+        else if (arg == "--frames") options.frames = value != "off";
+        else return false;
+    }
+    return (argc % 2) == 1 && options.runs > 0 && std::strtoul(options.history.c_str(), nullptr, 10) > 0 && options.flood > 0;
+}
+
+// Медиана и минимум по прогонам
+void printMetric(const char* name, std::vector<double> values, const char* unit) {
+    std::sort(values.begin(), values.end());
+    std::cout << name << ": медиана " << values[values.size() / 2] << " " << unit
+        << ", мин " << values.front() << ", макс " << values.back() << std::endl;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    BenchOptions options;
+    if (!parseOptions(argc, argv, options)) {
+        std::cerr << "Использование: e2e_bench [--history N] [--page N] [--flood N] [--runs N] [--write-chunk байт] [--write-delay-ms мс] [--timeout сек] [--frames on|off]" << std::endl;
+        return 2;
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    std::vector<std::string> serverArgs = { MOCKSERVER_PATH, "--port", "0", "--history", options.history };
+    if (!options.writeChunk.empty()) { serverArgs.push_back("--write-chunk"); serverArgs.push_back(options.writeChunk); }
+    if (!options.writeDelayMs.empty()) { serverArgs.push_back("--write-delay-ms"); serverArgs.push_back(options.writeDelayMs); }
+    if (!options.frames) serverArgs.push_back("--no-frames");
+    ChildProcess server;
+    std::string endpoint;
+    if (!server.spawn(serverArgs, {}) || !readListenLine(server, endpoint, 10)) {
+        std::cerr << "[E2E] mockserver не запустился." << std::endl;
+        return 1;
+    }
+    std::cout << "mockserver: " << endpoint << ", история " << options.history << " сообщений, поток " << options.flood
+        << " сообщений, прогонов " << options.runs << (options.frames ? "" : ", без кадров");
+    if (options.page) std::cout << ", страница " << options.page;
+    std::cout << std::endl;
+
+    std::vector<double> login, firstMessage, historyOpen, floodRate, floodBandwidth;
+    for (int run = 0; run < options.runs; ++run) {
+        RunResult result;
+        if (!runOnce(options, endpoint, run, result)) { server.stop(); return 1; }
+        std::cout << "прогон " << run + 1 << ": вход " << result.loginMs << " мс, первое сообщение " << result.firstMessageMs
+            << " мс, история " << result.historyOpenMs << " мс, поток " << static_cast<long>(result.floodMsgPerSec) << " сообщ/с" << std::endl;
+        login.push_back(result.loginMs);
+        firstMessage.push_back(result.firstMessageMs);
+        historyOpen.push_back(result.historyOpenMs);
+        floodRate.push_back(result.floodMsgPerSec);
+        floodBandwidth.push_back(result.floodMbPerSec);
+    }
+    server.stop();
+
+    printMetric("Запуск и вход            ", login, "мс");
+    printMetric("Время до первого сообщения", firstMessage, "мс");
+    printMetric("Открытие истории          ", historyOpen, "мс");
+    printMetric("Прием потока              ", floodRate, "сообщ/с");
+    printMetric("Вывод потока              ", floodBandwidth, "МБ/с");
+    return 0;
+}
@@ -0,0 +1,150 @@
+﻿// eventqueue_stress.cpp : запасной буфер SessionEventQueue, когда читатель все время чуть отстает. Писатель кладет
+// сообщения в очередь не быстрее заданной скорости, читатель забирает не больше заданной доли (по умолчанию 95%)
+// того, что писатель уже положил: кольцо переполнено, запасной буфер растет до kOverflowLimitBytes и дальше
+// не пустеет никогда - как бы быстро ни работал писатель на этой машине.
+// Память при этом должна следовать за объемом буфера и перестать расти, как только он дошел до предела:
+// куски запасного буфера, которые перешли в кольцо, освобождаются сразу. Прогон идет, пока буфер не дойдет
+// до предела, и еще заданное число секунд. Код возврата 1, если наибольший RSS перерос kMaxRssOverLimit
+// пределов буфера, после выхода на предел вырос больше чем на kAllowedGrowthBytes или буфер перерос предел;
+// 2 - буфер не дошел до предела за kFillTimeoutSeconds, и память не проверена.
+//
+// Запуск: eventqueue_stress [секунд_на_пределе] [сообщений_в_секунду] [доля_читателя_в_процентах]
+
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+
+#include "sessionevents.h"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr size_t kMegabyte = 1024 * 1024;
+// Запас на куски в пути, слоты кольца и фрагментацию кучи
+constexpr size_t kAllowedGrowthBytes = 16 * kMegabyte;
+// Арены выделяют блоками с запасом, а объем буфера считает только строки и сами события
+constexpr size_t kMaxRssOverLimit = 2;
+// Дольше буфер до предела не заполняется только на очень медленной машине
+constexpr int kFillTimeoutSeconds = 120;
+constexpr int kGroups = 300;
+constexpr int kUsers = 50;
+
+// Наибольший RSS процесса (ru_maxrss - в килобайтах)
+size_t maxRssBytes() {
+    rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+    return static_cast<size_t>(usage.ru_maxrss) * 1024;
+}
+
+// Сколько событий должно быть к этому моменту при скорости perSecond
+uint64_t due(Clock::time_point start, double perSecond) {
+    return static_cast<uint64_t>(std::chrono::duration<double>(Clock::now() - start).count() * perSecond);
+}
+
+struct Counter : SessionListener {
+    uint64_t messages = 0;
+    uint64_t dropped = 0;
+
+    void onMessage(const ChatMessage&) override { ++messages; }
+    void onEventsDropped(size_t count) override { dropped += count; }
+};
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    int seconds = argc > 1 ? std::atoi(argv[1]) : 5;
+    int rate = argc > 2 ? std::atoi(argv[2]) : 500000;
+    int readerPercent = argc > 3 ? std::atoi(argv[3]) : 95;
+    if (seconds <= 0 || rate <= 0 || readerPercent <= 0 || readerPercent >= 100) {
+        std::fprintf(stderr, "Использование: eventqueue_stress [секунд_на_пределе] [сообщений_в_секунду] [доля_читателя_в_процентах (1-99)]\n");
+        return 1;
+    }
+    double writerRate = rate;
+
+    SessionEventQueue queue;
+    std::atomic<uint64_t> produced{ 0 };
+    std::atomic<bool> stop{ false };
+    size_t startRss = maxRssBytes();
+    Clock::time_point start = Clock::now();
+
+    // Писатель: сообщения в группы от разных отправителей, как их разбирает Session
+    std::thread writer([&] {
+        std::string line, group, user, text;
+        for (uint64_t n = 0; !stop.load(std::memory_order_relaxed); ++n) {
+            while (n >= due(start, writerRate) && !stop.load(std::memory_order_relaxed)) std::this_thread::yield();
+            group = "group" + std::to_string(n % kGroups);
+            user = "user" + std::to_string(n % kUsers);
+            text = "message number " + std::to_string(n) + " with some ordinary text";
+            line = "GROUP_MSG_FROM " + group + " " + user + ": " + text;
+            ChatMessage message;
+            message.kind = ConversationKind::Group;
+            message.conversation = group;
+            message.sender = user;
+            message.text = text;
+            message.line = line;
+            message.parsed = true;
+            queue.onMessage(message);
+            produced.store(n + 1, std::memory_order_release);
+        }
+    });
+
+    // Читатель: не больше readerPercent% того, что писатель уже положил (а не его заданной скорости: писатель
+    // может ее не держать, и тогда читатель успевал бы за ним)
+    Counter counter;
+    std::atomic<uint64_t> consumed{ 0 };
+    std::thread reader([&] {
+        uint64_t taken = 0;
+        while (!stop.load(std::memory_order_relaxed)) {
+            uint64_t allowed = produced.load(std::memory_order_acquire) * static_cast<uint64_t>(readerPercent) / 100;
+            if (allowed <= taken) { std::this_thread::yield(); continue; }
+            taken += queue.drain(counter, static_cast<size_t>(std::min<uint64_t>(allowed - taken, 256)));
+            consumed.store(taken, std::memory_order_relaxed);
+        }
+    });
+
+    std::printf("Писатель - до %d сообщений/с, читатель - %d%% написанного, предел запасного буфера %zu МБ\n", rate, readerPercent,
+        SessionEventQueue::kOverflowLimitBytes / kMegabyte);
+    size_t plateauRss = 0; // Наибольший RSS, когда буфер впервые дошел до предела
+    int plateauSecond = 0;
+    for (int second = 1; plateauRss ? second <= plateauSecond + seconds : second <= kFillTimeoutSeconds; ++second) {
+        std::this_thread::sleep_until(start + std::chrono::seconds(second));
+        SessionEventQueueStats stats = queue.stats();
+        size_t rss = maxRssBytes();
+        if (!plateauRss && stats.dropped > 0) { plateauRss = rss; plateauSecond = second; }
+        std::printf("  %2d с: написано %llu, прочитано %llu, в запасном буфере %.1f МБ, отброшено %llu, наибольший RSS %.1f МБ\n",
+            second, static_cast<unsigned long long>(produced.load()), static_cast<unsigned long long>(consumed.load()),
+            static_cast<double>(stats.overflowBytes) / kMegabyte, static_cast<unsigned long long>(stats.dropped),
+            static_cast<double>(rss) / kMegabyte);
+    }
+    stop = true;
+    writer.join();
+    reader.join();
+
+    SessionEventQueueStats stats = queue.stats();
+    size_t finalRss = maxRssBytes();
+    std::printf("Наибольший объем запасного буфера %.1f МБ\n", static_cast<double>(stats.maxOverflowBytes) / kMegabyte);
+    if (!plateauRss) {
+        std::printf("ОШИБКА: запасной буфер не дошел до предела за %d с - память не проверена\n", kFillTimeoutSeconds);
+        return 2;
+    }
+    size_t used = finalRss > startRss ? finalRss - startRss : 0;
+    size_t growth = finalRss > plateauRss ? finalRss - plateauRss : 0;
+    std::printf("RSS вырос на %.1f МБ (допустимо %zu МБ), из них после выхода на предел - на %.1f МБ (допустимо %zu МБ)\n",
+        static_cast<double>(used) / kMegabyte, kMaxRssOverLimit * SessionEventQueue::kOverflowLimitBytes / kMegabyte,
+        static_cast<double>(growth) / kMegabyte, kAllowedGrowthBytes / kMegabyte);
+    // Предел проверяется до приема события, поэтому буфер может перерасти его на одно событие
+    if (used > kMaxRssOverLimit * SessionEventQueue::kOverflowLimitBytes || growth > kAllowedGrowthBytes ||
+        stats.maxOverflowBytes > SessionEventQueue::kOverflowLimitBytes + kMegabyte) {
+        std::printf("ОШИБКА: память растет, хотя запасной буфер ограничен\n");
+        return 1;
+    }
+    std::printf("Память не растет\n");
+    return 0;
+}
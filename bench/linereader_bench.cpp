@@ -0,0 +1,147 @@
+﻿// linereader_bench.cpp : пропускная способность приема строк протокола.
+// Сравнивает старое чтение по одному байту (recv(&ch, 1)) с буферизованным LineReader
+// на потоке HIST_MSG через socketpair, а разбор строк на поля - с разбором двоичных кадров (binary_frames).
+//
+// Запуск: linereader_bench [количество_строк]
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <thread>
+
+#include "frame.h"
+#include "linereader.h"
+#include "protocol.h"
+
+namespace {
+
+// Генерирует "историю" из lineCount строк HIST_MSG, как при открытии большого чата
+std::string makeHistoryBurst(size_t lineCount) {
+    std::string burst = "HISTORY_START bob\n";
+    for (size_t i = 0; i < lineCount; ++i) {
+        burst += "HIST_MSG 2025-05-29 12:34:56:alice:сообщение номер " + std::to_string(i) + " из истории чата\n";
+    }
+    burst += "HISTORY_END bob\n";
+    return burst;
+}
+
+// Та же история двоичными кадрами
+std::string makeHistoryFrames(size_t lineCount) {
+    std::string burst;
+    appendFrame(burst, { "HISTORY_START", "bob" });
+    for (size_t i = 0; i < lineCount; ++i) {
+        std::string text = "сообщение номер " + std::to_string(i) + " из истории чата";
+        appendFrame(burst, { "HIST_MSG", "2025-05-29 12:34:56", "alice", text });
+    }
+    appendFrame(burst, { "HISTORY_END", "bob" });
+    return burst;
+}
+
+void writeAll(SocketType socket, const std::string& data) {
+    size_t sent = 0;
+    while (sent < data.size()) {
+        ssize_t n = send(socket, data.data() + sent, data.size() - sent, 0);
+        if (n <= 0) return;
+        sent += static_cast<size_t>(n);
+    }
+    shutdown(socket, SHUT_WR);
+}
+
+// Старый вариант clientReadLine: один recv() на байт
+size_t readLegacy(SocketType socket, size_t& syscalls) {
+    size_t lines = 0;
+    std::string line;
+    char ch;
+    for (;;) {
+        ++syscalls;
+        if (recv(socket, &ch, 1, 0) <= 0) break;
+        if (ch == '\n') { ++lines; line.clear(); continue; }
+        if (ch != '\r') line += ch;
+    }
+    return lines;
+}
+
+size_t readBuffered(SocketType socket, size_t& syscalls) {
+    LineReader reader;
+    size_t lines = 0;
+    std::string_view line;
+    for (;;) {
+        ++syscalls;
+        ReadStatus status = reader.fill(socket);
+        if (status == ReadStatus::Closed || status == ReadStatus::Error) break;
+        while (reader.next(line) == ReadStatus::Line) ++lines;
+    }
+    return lines;
+}
+
+// Строки с разбором HIST_MSG на поля, как в Session
+size_t readParsedLines(SocketType socket, size_t& syscalls) {
+    LineReader reader;
+    size_t entries = 0;
+    std::string_view line;
+    for (;;) {
+        ++syscalls;
+        ReadStatus status = reader.fill(socket);
+        if (status == ReadStatus::Closed || status == ReadStatus::Error) break;
+        while (reader.next(line) == ReadStatus::Line) {
+            ServerLine parsed = splitServerLine(line);
+            HistoryEntry entry;
+            if (parsed.prefix == "HIST_MSG" && parseHistoryEntry(parsed.payload, entry)) entries += !entry.text.empty();
+        }
+    }
+    return entries;
+}
+
+// Кадры с разбором на поля
+size_t readParsedFrames(SocketType socket, size_t& syscalls) {
+    LineReader reader;
+    size_t entries = 0;
+    std::string_view body;
+    Frame frame;
+    for (;;) {
+        ++syscalls;
+        ReadStatus status = reader.fill(socket);
+        if (status == ReadStatus::Closed || status == ReadStatus::Error) break;
+        while (reader.nextFrame(body) == ReadStatus::Line) {
+            if (!parseFrame(body, frame)) continue;
+            ServerLine parsed = splitServerFrame(frame);
+            if (parsed.prefix == "HIST_MSG") entries += !parsed.arg(2).empty();
+        }
+    }
+    return entries;
+}
+
+template <typename ReadFunc>
+void runCase(const char* name, const std::string& burst, ReadFunc readFunc) {
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) { std::cerr << "socketpair: " << strerror(errno) << std::endl; std::exit(1); }
+
+    auto start = std::chrono::steady_clock::now();
+    std::thread writer(writeAll, fds[0], std::cref(burst));
+    size_t syscalls = 0;
+    size_t lines = readFunc(fds[1], syscalls);
+    auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    writer.join();
+    CLOSE_SOCKET(fds[0]); CLOSE_SOCKET(fds[1]);
+
+    std::cout << name << ": " << lines << " строк за " << elapsed * 1000.0 << " мс, "
+        << (burst.size() / elapsed) / (1024.0 * 1024.0) << " МБ/с, "
+        << lines / elapsed << " строк/с, recv() вызовов: " << syscalls << std::endl;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    size_t lineCount = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 200000;
+    std::string burst = makeHistoryBurst(lineCount);
+    std::cout << "Поток истории: " << lineCount << " строк, " << burst.size() << " байт" << std::endl;
+
+    runCase("recv по байту", burst, readLegacy);
+    runCase("LineReader   ", burst, readBuffered);
+    runCase("строки + поля", burst, readParsedLines);
+    std::string frames = makeHistoryFrames(lineCount);
+    std::cout << "Та же история кадрами: " << frames.size() << " байт" << std::endl;
+    runCase("кадры + поля ", frames, readParsedFrames);
+    return 0;
+}
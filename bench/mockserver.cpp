@@ -0,0 +1,538 @@
+﻿// mockserver.cpp : локальная замена сервера мессенджера для бенчмарков и ручной проверки клиента.
+// Понимает команды клиента (HELLO, REGISTRATION, LOGIN, GET_HISTORY[_SINCE|_PAGE], GROUPCHAT[_SINCE|_PAGE],
+// SEND_PRIVATE, SEND_GROUP, GET_CHAT_PARTNERS, LIST_MY_GROUPS, CREATE_GROUP, JOIN_GROUP, LOGOUT)
+// строками или двоичными кадрами (binary_frames, см. protocol.h)
+// и умеет создавать нагрузку: синтетическая история любой длины, поток сообщений, медленная запись кусками.
+//
+// Запуск: mockserver [--host 127.0.0.1] [--port 8081] [--history N] [--write-chunk байт --write-delay-ms мс] ...
+// В чате сообщение "!flood N" заставляет сервер прислать N сообщений от собеседника и затем "flood done".
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <functional>
+#include <initializer_list>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "eventloop.h"
+#include "frame.h"
+#include "linereader.h"
+#include "netutil.h"
+#include "protocol.h"
+#include "streamcodec.h"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct MockOptions {
+    std::string host = "127.0.0.1";
+    unsigned short port = kDefaultServerPort; // 0 - любой свободный
+    size_t history = 50;          // Сообщений в истории каждого чата и группы
+    int friends = 3;              // Синтетических друзей в GET_CHAT_PARTNERS
+    int groups = 2;               // Синтетических групп в LIST_MY_GROUPS
+    bool caps = true;             // Отвечать CAPS на HELLO (иначе - как старый сервер)
+    bool frames = true;           // Предлагать в CAPS двоичные кадры
+    bool compress = true;         // И сжатие истории и списков поверх них
+    bool pages = true;            // Отдавать историю страницами (history_pages)
+    size_t writeChunk = 0;        // Не больше стольких байт за один send (0 - без ограничения)
+    int writeDelayMs = 0;         // Пауза между кусками
+    double floodRate = 0;         // Фоновых MSG_FROM в секунду каждому вошедшему пользователю
+    int floodGroups = 0;          // Фоновые сообщения - GROUP_MSG_FROM по очереди в столько групп (0 - личные)
+    bool verbose = false;
+};
+
+void printUsage() {
+    std::cout << "Использование: mockserver [параметры]\n"
+        << "  --host <ip>             Адрес (127.0.0.1)\n"
+        << "  --port <n>              Порт, 0 - любой свободный (" << kDefaultServerPort << ")\n"
+        << "  --history <n>           Сообщений в истории чата/группы (50)\n"
+        << "  --friends <n>           Друзей в списке (3)\n"
+        << "  --groups <n>            Групп в списке (2)\n"
+        << "  --no-caps               Не знать HELLO (как старый сервер)\n"
+        << "  --no-frames             Только текстовый протокол (без binary_frames в CAPS)\n"
+        << "  --no-compress           Кадры без сжатия истории и списков (без compressed_streams)\n"
+        << "  --no-pages              История только целиком (без history_pages)\n"
+        << "  --write-chunk <байт>    Писать кусками не больше N байт\n"
+        << "  --write-delay-ms <мс>   Пауза между кусками\n"
+        << "  --flood-rate <n>        Фоновых сообщений в секунду каждому пользователю\n"
+        << "  --flood-groups <n>      Фоновые сообщения - в n групп по очереди (group0.., как в списке), а не личные\n"
+        << "  --verbose               Печатать входящие команды\n";
+}
+
+bool parseOptions(int argc, char* argv[], MockOptions& options) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--no-caps") { options.caps = false; continue; }
+        if (arg == "--no-frames") { options.frames = false; continue; }
+        if (arg == "--no-compress") { options.compress = false; continue; }
+        if (arg == "--no-pages") { options.pages = false; continue; }
+        if (arg == "--verbose") { options.verbose = true; continue; }
+        if (arg == "--help" || i + 1 >= argc) return false;
+        std::string value = argv[++i];
+        if (arg == "--host") options.host = value;
+        else if (arg == "--port") options.port = static_cast<unsigned short>(std::atoi(value.c_str()));
+        else if (arg == "--history") options.history = static_cast<size_t>(std::strtoull(value.c_str(), nullptr, 10));
+        else if (arg == "--friends") options.friends = std::atoi(value.c_str());
+        else if (arg == "--groups") options.groups = std::atoi(value.c_str());
+        else if (arg == "--write-chunk") options.writeChunk = static_cast<size_t>(std::strtoull(value.c_str(), nullptr, 10));
+        else if (arg == "--write-delay-ms") options.writeDelayMs = std::atoi(value.c_str());
+        else if (arg == "--flood-rate") options.floodRate = std::atof(value.c_str());
+        else if (arg == "--flood-groups") options.floodGroups = std::atoi(value.c_str());
+        else { std::cerr << "[MOCK] Неизвестный параметр: " << arg << std::endl; return false; }
+    }
+    return true;
+}
+
+// Метка времени i-го сообщения синтетической истории: раз в минуту, начиная с 2024-01-01 00:00:00
+constexpr std::time_t kHistoryEpoch = 1704067200;
+
+void appendHistoryTimestamp(std::string& out, size_t index) {
+    std::time_t time = kHistoryEpoch + static_cast<std::time_t>(index) * 60;
+    std::tm utc;
+#ifdef _WIN32
+    gmtime_s(&utc, &time);
+#else
+    gmtime_r(&time, &utc);
+#endif
+    char buffer[72]; // С запасом на любые значения полей (6 int по 11 знаков): иначе -Wformat-truncation
+    std::snprintf(buffer, sizeof(buffer), "%04d-%02d-%02d %02d:%02d:%02d",
+        utc.tm_year + 1900, utc.tm_mon + 1, utc.tm_mday, utc.tm_hour, utc.tm_min, utc.tm_sec);
+    out += buffer;
+}
+
+// Индекс первого сообщения истории не старше since (метки растут монотонно)
+size_t firstHistoryIndexSince(std::string_view since, size_t total) {
+    size_t low = 0, high = total;
+    std::string stamp;
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        stamp.clear();
+        appendHistoryTimestamp(stamp, mid);
+        if (std::string_view(stamp) < since) low = mid + 1;
+        else high = mid;
+    }
+    return low;
+}
+
+// Конец страницы, которая заканчивается меткой until включительно (пусто - конец истории)
+size_t historyPageEnd(std::string_view until, size_t total) {
+    if (until.empty()) return total;
+    size_t end = firstHistoryIndexSince(until, total);
+    std::string stamp;
+    if (end < total) appendHistoryTimestamp(stamp, end);
+    return end < total && stamp == until ? end + 1 : end;
+}
+
+// Дописывает в out сообщение сервера из полей: кадром или строкой текстового протокола
+void appendMessage(std::string& out, bool frames, std::initializer_list<std::string_view> fields) {
+    if (frames) { appendFrame(out, fields); return; }
+    appendServerText(out, fields.begin(), fields.size());
+    out += '\n';
+}
+
+// Постепенная генерация длинного ответа: дописывает в out следующую порцию, false - ответ закончен.
+// Так история из миллиона строк не держится в памяти целиком, а подкладывается по мере отправки
+using StreamProducer = std::function<bool(std::string& out)>;
+
+struct Connection {
+    SocketType socket = INVALID_SOCKET_VALUE;
+    LineReader reader;
+    std::string outbox;
+    size_t outboxOffset = 0;              // Уже отправленная часть outbox
+    std::vector<StreamProducer> producers; // Очередь длинных ответов, [0] - текущий
+    std::string user;                     // Пусто до LOGIN/REGISTRATION
+    Clock::time_point nextWriteAt;        // Медленная запись: раньше этого момента не пишем
+    bool writeBlocked = false;            // Ждем EPOLLOUT
+    bool framesIn = false;                // Клиент прислал FRAMES: дальше его команды - кадры
+    bool framesOut = false;               // После CAPS с binary_frames отвечаем кадрами
+    bool compressOut = false;             // Записи истории и списков - сжатыми кадрами
+};
+
+class MockServer {
+public:
+    explicit MockServer(const MockOptions& options) : m_options(options) {}
+    bool start();
+    void run();
+    unsigned short port() const { return m_port; }
+
+private:
+    void acceptClients();
+    void readFrom(Connection& conn);
+    void handleCommand(Connection& conn, std::string_view verb, std::string_view first, std::string_view rest);
+    void queue(Connection& conn, std::string_view text);
+    void reply(Connection& conn, std::initializer_list<std::string_view> fields);
+    void queueStream(Connection& conn, StreamProducer producer);
+    void pump(Connection& conn, Clock::time_point now);
+    void closeConnection(SocketType socket);
+    void sendHistory(Connection& conn, bool group, std::string_view name, size_t firstIndex, size_t endIndex);
+    void sendFriendList(Connection& conn);
+    void sendGroupList(Connection& conn);
+    void floodTick(Clock::time_point now);
+    int nextTimeoutMs(Clock::time_point now) const;
+
+    const MockOptions& m_options;
+    EventLoop m_loop;
+    SocketType m_listener = INVALID_SOCKET_VALUE;
+    unsigned short m_port = 0;
+    std::unordered_map<SocketType, std::unique_ptr<Connection>> m_connections;
+    std::unordered_map<std::string, SocketType> m_online;   // Пользователь -> соединение
+    std::set<std::string> m_registered;
+    std::map<std::string, std::set<std::string>> m_groups;   // Группа -> участники
+    Clock::time_point m_nextFloodAt;
+    uint64_t m_floodSeq = 0;
+};
+
+bool MockServer::start() {
+    if (!m_loop.valid()) { std::cerr << "[MOCK] Не удалось создать цикл событий." << std::endl; return false; }
+    int errorCode = 0;
+    m_listener = listenTcp(m_options.host, m_options.port, m_port, errorCode);
+    if (m_listener == INVALID_SOCKET_VALUE) {
+        std::cerr << "[MOCK] Не удалось слушать " << m_options.host << ":" << m_options.port << ": " << errorCode << std::endl;
+        return false;
+    }
+    setSocketNonBlocking(m_listener);
+    m_loop.add(m_listener);
+    m_nextFloodAt = Clock::now();
+    // Первая строка вывода - для скриптов и e2e_bench, которые запускают сервер с --port 0
+    std::cout << "MOCKSERVER LISTENING " << m_options.host << ":" << m_port << std::endl;
+    return true;
+}
+
+void MockServer::run() {
+    std::vector<IoEvent> events;
+    for (;;) {
+        if (m_loop.wait(events, nextTimeoutMs(Clock::now())) < 0) return;
+        for (const IoEvent& event : events) {
+            if (event.socket == m_listener) { acceptClients(); continue; }
+            auto it = m_connections.find(event.socket);
+            if (it == m_connections.end()) continue;
+            Connection& conn = *it->second;
+            if (event.writable) conn.writeBlocked = false;
+            if (event.readable || event.error) readFrom(conn);
+        }
+        Clock::time_point now = Clock::now();
+        floodTick(now);
+        // pump может закрыть соединение - собираем сокеты заранее
+        std::vector<SocketType> sockets;
+        sockets.reserve(m_connections.size());
+        for (auto& entry : m_connections) sockets.push_back(entry.first);
+        for (SocketType socket : sockets) {
+            auto it = m_connections.find(socket);
+            if (it != m_connections.end()) pump(*it->second, now);
+        }
+    }
+}
+
+int MockServer::nextTimeoutMs(Clock::time_point now) const {
+    Clock::time_point next = Clock::time_point::max();
+    if (m_options.floodRate > 0 && !m_online.empty()) next = m_nextFloodAt;
+    for (auto& entry : m_connections) {
+        const Connection& conn = *entry.second;
+        bool hasData = conn.outboxOffset < conn.outbox.size() || !conn.producers.empty();
+        if (hasData && !conn.writeBlocked) next = std::min(next, conn.nextWriteAt);
+    }
+    if (next == Clock::time_point::max()) return -1;
+    if (next <= now) return 0;
+    return static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(next - now).count()) + 1;
+}
+
+void MockServer::acceptClients() {
+    for (;;) {
+        SocketType socket = accept(m_listener, nullptr, nullptr);
+        if (socket == INVALID_SOCKET_VALUE) return;
+        setSocketNonBlocking(socket);
+        auto conn = std::make_unique<Connection>();
+        conn->socket = socket;
+        conn->nextWriteAt = Clock::now();
+        m_loop.add(socket);
+        m_connections[socket] = std::move(conn);
+        if (m_options.verbose) std::cout << "[MOCK] Новое подключение" << std::endl;
+    }
+}
+
+void MockServer::readFrom(Connection& conn) {
+    ReadStatus status = conn.reader.fill(conn.socket);
+    if (status == ReadStatus::Closed || status == ReadStatus::Error) { closeConnection(conn.socket); return; }
+    for (;;) {
+        bool framed = conn.framesIn; // FRAMES переключает разбор посреди буфера
+        std::string_view data;
+        status = framed ? conn.reader.nextFrame(data) : conn.reader.next(data);
+        if (status == ReadStatus::NeedMore) return;
+        if (status != ReadStatus::Line) continue;
+        if (framed) { // Поля: глагол, аргументы
+            Frame frame;
+            if (!parseFrame(data, frame)) continue;
+            std::string rest(frame.fields[2]); // Остальные поля - через пробел, как в строке
+            for (size_t i = 3; i < frame.count; ++i) rest.append(" ").append(frame.fields[i]);
+            handleCommand(conn, frame.verb(), frame.fields[1], rest);
+            continue;
+        }
+        auto [verb, args] = splitFirstWord(data);
+        auto [first, rest] = splitFirstWord(args);
+        handleCommand(conn, verb, first, rest);
+    }
+}
+
+void MockServer::queue(Connection& conn, std::string_view text) {
+    if (!conn.producers.empty()) { // Не вклиниваемся в середину длинного ответа
+        std::string pending(text);
+        queueStream(conn, [pending](std::string& out) { out += pending; return false; });
+        return;
+    }
+    conn.outbox += text;
+}
+
+void MockServer::reply(Connection& conn, std::initializer_list<std::string_view> fields) {
+    std::string out;
+    appendMessage(out, conn.framesOut, fields);
+    queue(conn, out);
+}
+
+void MockServer::queueStream(Connection& conn, StreamProducer producer) {
+    conn.producers.push_back(std::move(producer));
+}
+
+// Отправляет накопленное и подкладывает следующие порции длинных ответов
+void MockServer::pump(Connection& conn, Clock::time_point now) {
+    constexpr size_t kRefillBytes = 256 * 1024;
+    for (;;) {
+        while (conn.outbox.size() - conn.outboxOffset < kRefillBytes && !conn.producers.empty()) {
+            if (!conn.producers.front()(conn.outbox)) conn.producers.erase(conn.producers.begin());
+        }
+        size_t pending = conn.outbox.size() - conn.outboxOffset;
+        if (pending == 0 || conn.writeBlocked || now < conn.nextWriteAt) return;
+
+        size_t limit = m_options.writeChunk ? std::min(pending, m_options.writeChunk) : pending;
+        int sent = send(conn.socket, conn.outbox.data() + conn.outboxOffset, static_cast<int>(limit), kSendFlags);
+        if (sent < 0) {
+            if (isWouldBlockError(GET_LAST_ERROR)) { conn.writeBlocked = true; m_loop.setWantWrite(conn.socket, true); return; }
+            closeConnection(conn.socket);
+            return;
+        }
+        conn.outboxOffset += static_cast<size_t>(sent);
+        if (conn.outboxOffset == conn.outbox.size()) { conn.outbox.clear(); conn.outboxOffset = 0; }
+        else if (conn.outboxOffset > kRefillBytes) { conn.outbox.erase(0, conn.outboxOffset); conn.outboxOffset = 0; }
+        m_loop.setWantWrite(conn.socket, false);
+        if (m_options.writeChunk) { // Медленный сервер: следующий кусок - после паузы
+            conn.nextWriteAt = now + std::chrono::milliseconds(m_options.writeDelayMs);
+            if (m_options.writeDelayMs > 0) return;
+        }
+    }
+}
+
+void MockServer::closeConnection(SocketType socket) {
+    auto it = m_connections.find(socket);
+    if (it == m_connections.end()) return;
+    const std::string& user = it->second->user;
+    auto online = m_online.find(user);
+    if (!user.empty() && online != m_online.end() && online->second == socket) m_online.erase(online);
+    m_loop.remove(socket);
+    CLOSE_SOCKET(socket);
+    m_connections.erase(it);
+    if (m_options.verbose) std::cout << "[MOCK] Подключение закрыто" << std::endl;
+}
+
+// HISTORY_START/HIST_MSG/HISTORY_END (или GROUP_...): сообщения [firstIndex, endIndex) синтетической истории
+void MockServer::sendHistory(Connection& conn, bool group, std::string_view name, size_t firstIndex, size_t endIndex) {
+    std::string_view messageVerb = group ? "GROUP_HIST_MSG" : "HIST_MSG";
+    std::string_view endVerb = group ? "GROUP_HISTORY_END" : "HISTORY_END";
+    size_t total = std::min(endIndex, m_options.history);
+    if (firstIndex >= total) {
+        reply(conn, { group ? "NO_GROUP_HISTORY" : "NO_HISTORY", name });
+        return;
+    }
+    reply(conn, { group ? "GROUP_HISTORY_START" : "HISTORY_START", name });
+    std::string chatName(name), self = conn.user;
+    bool frames = conn.framesOut;
+    bool compress = conn.compressOut;
+    StreamEncoder encoder(compressedStreamStartedBy(group ? "GROUP_HISTORY_START" : "HISTORY_START"));
+    size_t index = firstIndex;
+    queueStream(conn, [=](std::string& out) mutable {
+        constexpr size_t kLinesPerChunk = 1024;
+        std::string stamp, sender, text;
+        for (size_t n = 0; n < kLinesPerChunk && index < total; ++n, ++index) {
+            stamp.clear();
+            appendHistoryTimestamp(stamp, index);
+            if (group) sender = "member" + std::to_string(index % 7);
+            else sender = (index % 2) ? self : chatName;
+            text = "сообщение истории номер " + std::to_string(index);
+            if (compress) encoder.appendEntry(out, { stamp, sender, text });
+            else appendMessage(out, frames, { messageVerb, stamp, sender, text });
+        }
+        if (index < total) return true;
+        appendMessage(out, frames, { endVerb, chatName });
+        return false;
+    });
+}
+
+void MockServer::sendFriendList(Connection& conn) {
+    bool frames = conn.framesOut;
+    StreamEncoder encoder(compressedStreamStartedBy("FRIEND_LIST_START"));
+    auto appendFriend = [&](std::string& out, std::string_view name, std::string_view status) {
+        if (conn.compressOut) encoder.appendEntry(out, { name, status });
+        else appendMessage(out, frames, { "FRIEND", name, status });
+    };
+    std::string out;
+    appendMessage(out, frames, { "FRIEND_LIST_START" });
+    for (int i = 0; i < m_options.friends; ++i) {
+        std::string name = "friend" + std::to_string(i);
+        appendFriend(out, name, m_online.count(name) ? "online" : "offline");
+    }
+    for (auto& entry : m_online) {
+        if (entry.first != conn.user) appendFriend(out, entry.first, "online");
+    }
+    appendMessage(out, frames, { "FRIEND_LIST_END" });
+    queue(conn, out);
+}
+
+void MockServer::sendGroupList(Connection& conn) {
+    bool frames = conn.framesOut;
+    StreamEncoder encoder(compressedStreamStartedBy("MY_GROUPS_START"));
+    auto appendGroup = [&](std::string& out, std::string_view group) {
+        if (conn.compressOut) encoder.appendEntry(out, { group });
+        else appendMessage(out, frames, { "MY_GROUP_ENTRY", group });
+    };
+    std::string entries;
+    for (int i = 0; i < m_options.groups; ++i) appendGroup(entries, "group" + std::to_string(i));
+    for (auto& entry : m_groups) {
+        if (entry.second.count(conn.user)) appendGroup(entries, entry.first);
+    }
+    if (entries.empty()) { reply(conn, { "NO_GROUPS_JOINED" }); return; }
+    std::string out;
+    appendMessage(out, frames, { "MY_GROUPS_START" });
+    out += entries;
+    appendMessage(out, frames, { "MY_GROUPS_END" });
+    queue(conn, out);
+}
+
+// Фоновый поток сообщений от "flood" всем вошедшим: личных или по очереди в группы group0..
+void MockServer::floodTick(Clock::time_point now) {
+    if (m_options.floodRate <= 0 || m_online.empty() || now < m_nextFloodAt) return;
+    auto interval = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / m_options.floodRate));
+    while (m_nextFloodAt <= now) {
+        uint64_t seq = m_floodSeq++;
+        std::string text = "фоновое сообщение " + std::to_string(seq);
+        if (m_options.floodGroups > 0) {
+            std::string group = "group" + std::to_string(seq % static_cast<uint64_t>(m_options.floodGroups));
+            for (auto& entry : m_online) reply(*m_connections[entry.second], { "GROUP_MSG_FROM", group, "flood", text });
+        }
+        else {
+            for (auto& entry : m_online) reply(*m_connections[entry.second], { "MSG_FROM", "flood", text });
+        }
+        m_nextFloodAt += interval;
+    }
+}
+
+void MockServer::handleCommand(Connection& conn, std::string_view verb, std::string_view first, std::string_view rest) {
+    if (m_options.verbose) std::cout << "[MOCK] < " << verb << (conn.framesIn ? " [кадр] " : " ") << first << " " << rest << std::endl;
+    std::string name(first);
+
+    if (verb == "HELLO") {
+        if (!m_options.caps) { reply(conn, { "ERROR_CMD", "Unknown command" }); return; }
+        uint32_t offered = parseCapabilities(first) | parseCapabilities(rest);
+        bool frames = m_options.frames && (offered & kCapBinaryFrames);
+        bool compress = frames && m_options.compress && (offered & kCapCompressedStreams);
+        std::string caps = "history_since";
+        if (m_options.pages) caps += " history_pages";
+        if (frames) caps += " binary_frames";
+        if (compress) caps += " compressed_streams";
+        reply(conn, { "CAPS", caps });
+        conn.framesOut = frames; // Все после строки CAPS - кадрами
+        conn.compressOut = compress;
+    }
+    else if (verb == kFramesCommand && !conn.framesIn) {
+        conn.framesIn = true;
+    }
+    else if (verb == "REGISTRATION" || verb == "LOGIN") {
+        if (name.empty()) { reply(conn, { "ERROR_CMD", "Usage: " + std::string(verb) + " <user> <password>" }); return; }
+        bool registration = verb == "REGISTRATION";
+        if (registration && !m_registered.insert(name).second) { reply(conn, { "ERROR_USER_EXISTS" }); return; }
+        m_registered.insert(name);
+        conn.user = name;
+        m_online[name] = conn.socket;
+        reply(conn, { registration ? "OK_REGISTERED" : "OK_LOGIN", name });
+    }
+    else if (conn.user.empty()) {
+        reply(conn, { "ERROR_NOT_LOGGED_IN" });
+    }
+    else if (verb == "LOGOUT") {
+        reply(conn, { "OK_LOGOUT", conn.user });
+        m_online.erase(conn.user);
+        conn.user.clear();
+    }
+    else if (verb == "GET_HISTORY" || verb == "GROUPCHAT") {
+        sendHistory(conn, verb == "GROUPCHAT", name, 0, m_options.history);
+    }
+    else if (verb == "GET_HISTORY_SINCE" || verb == "GROUPCHAT_SINCE") {
+        sendHistory(conn, verb == "GROUPCHAT_SINCE", name, firstHistoryIndexSince(rest, m_options.history), m_options.history);
+    }
+    else if ((verb == "GET_HISTORY_PAGE" || verb == "GROUPCHAT_PAGE") && m_options.pages) { // <имя> <число> [<метка>]
+        auto [count, until] = splitFirstWord(rest);
+        size_t end = historyPageEnd(until, m_options.history);
+        size_t pageSize = static_cast<size_t>(std::strtoull(std::string(count).c_str(), nullptr, 10));
+        sendHistory(conn, verb == "GROUPCHAT_PAGE", name, end - std::min(end, pageSize), end);
+    }
+    else if (verb == "SEND_PRIVATE") {
+        reply(conn, { "OK_SENT" });
+        if (startsWith(rest, "!flood ")) { // Поток сообщений от собеседника для замера пропускной способности
+            uint64_t total = std::strtoull(std::string(rest.substr(7)).c_str(), nullptr, 10);
+            bool frames = conn.framesOut;
+            uint64_t seq = 0;
+            queueStream(conn, [=](std::string& out) mutable {
+                std::string text;
+                for (int n = 0; n < 1024 && seq < total; ++n, ++seq) {
+                    text = "flood " + std::to_string(seq);
+                    appendMessage(out, frames, { "MSG_FROM", name, text });
+                }
+                if (seq < total) return true;
+                appendMessage(out, frames, { "MSG_FROM", name, "flood done" });
+                return false;
+            });
+            return;
+        }
+        auto target = m_online.find(name);
+        if (target != m_online.end()) reply(*m_connections[target->second], { "MSG_FROM", conn.user, rest });
+    }
+    else if (verb == "SEND_GROUP") {
+        reply(conn, { "OK_GROUP_MSG_SENT" });
+        for (const std::string& member : m_groups[name]) {
+            auto target = m_online.find(member);
+            if (member != conn.user && target != m_online.end()) reply(*m_connections[target->second], { "GROUP_MSG_FROM", name, conn.user, rest });
+        }
+    }
+    else if (verb == "CREATE_GROUP") {
+        if (m_groups.count(name)) { reply(conn, { "ERROR_GROUP_EXISTS", name }); return; }
+        m_groups[name].insert(conn.user);
+        reply(conn, { "OK_GROUP_CREATED", name });
+    }
+    else if (verb == "JOIN_GROUP") {
+        m_groups[name].insert(conn.user);
+        reply(conn, { "OK_JOINED_GROUP", name });
+    }
+    else if (verb == "GET_CHAT_PARTNERS") sendFriendList(conn);
+    else if (verb == "LIST_MY_GROUPS") sendGroupList(conn);
+    else reply(conn, { "ERROR_CMD", "Unknown command" });
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+#ifdef _WIN32
+    WSADATA wsaData; if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0) { std::cerr << "[MOCK] WSAStartup не удался." << std::endl; return 1; }
+#endif
+    MockOptions options;
+    if (!parseOptions(argc, argv, options)) { printUsage(); return 2; }
+    MockServer server(options);
+    if (!server.start()) return 1;
+    server.run();
+    return 0;
+}
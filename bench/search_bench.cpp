@@ -0,0 +1,178 @@
+﻿// search_bench.cpp : индекс поиска (searchindex.h) на синтетической переписке.
+// Сотни бесед, слова с распределением Ципфа (частые и редкие, как в живых текстах). Печатает цену
+// add() для вызывающего потока (поток приемника), скорость индексации, размер индекса на диске,
+// время открытия готового индекса и задержку запросов: редкое слово, частое, несколько слов, с "in <чат>".
+//
+// Запуск: search_bench [сообщений] [каталог]
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "searchindex.h"
+
+namespace fs = std::filesystem;
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+double secondsSince(Clock::time_point start) {
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+// Слова из русских слогов: первые - самые частые
+std::vector<std::string> makeVocabulary(size_t count) {
+    static const char* const kSyllables[] = { "ка", "ро", "ми", "на", "то", "ле", "ва", "су", "де", "по", "ри", "ло",
+        "ны", "же", "ба", "го", "ту", "ше", "за", "ве" };
+    std::mt19937 random(7);
+    std::vector<std::string> words;
+    words.reserve(count);
+    for (size_t i = 0; i < count; ++i) {
+        std::string word;
+        size_t syllables = 1 + i % 4;
+        for (size_t s = 0; s < syllables; ++s) word += kSyllables[random() % 20];
+        word += std::to_string(i % 97); // Различает слова из одинаковых слогов
+        words.push_back(word);
+    }
+    return words;
+}
+
+// Номер слова по закону Ципфа (s = 1): таблица накопленных вероятностей и двоичный поиск
+class ZipfWords {
+public:
+    explicit ZipfWords(size_t count) : m_cumulative(count) {
+        double total = 0;
+        for (size_t i = 0; i < count; ++i) m_cumulative[i] = total += 1.0 / static_cast<double>(i + 1);
+        for (double& value : m_cumulative) value /= total;
+    }
+    size_t next(std::mt19937& random) {
+        double value = std::uniform_real_distribution<double>(0, 1)(random);
+        return static_cast<size_t>(std::lower_bound(m_cumulative.begin(), m_cumulative.end(), value) - m_cumulative.begin());
+    }
+
+private:
+    std::vector<double> m_cumulative;
+};
+
+std::string timestampOf(size_t index) {
+    long long minutes = static_cast<long long>(index); // Раз в минуту с 2024-01-01
+    long long days = minutes / 1440;
+    char buffer[128]; // С запасом на любые значения полей (5 long long по 20 знаков): иначе -Wformat-truncation
+    std::snprintf(buffer, sizeof(buffer), "%04lld-%02lld-%02lld %02lld:%02lld:00", 2024 + days / 336, 1 + days / 28 % 12, 1 + days % 28,
+        minutes / 60 % 24, minutes % 60);
+    return buffer;
+}
+
+template <typename Func>
+double medianMs(size_t runs, Func&& func) {
+    std::vector<double> samples;
+    for (size_t i = 0; i < runs; ++i) {
+        auto start = Clock::now();
+        func();
+        samples.push_back(secondsSince(start) * 1000.0);
+    }
+    std::sort(samples.begin(), samples.end());
+    return samples[samples.size() / 2];
+}
+
+uint64_t directorySize(const fs::path& dir) {
+    uint64_t total = 0;
+    std::error_code ec;
+    for (const auto& entry : fs::recursive_directory_iterator(dir, ec)) {
+        if (entry.is_regular_file(ec)) total += entry.file_size(ec);
+    }
+    return total;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    size_t messages = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 1000000;
+    fs::path root = argc > 2 ? fs::path(argv[2]) : fs::temp_directory_path() / "search_bench";
+    if (messages == 0) {
+        std::cerr << "Использование: search_bench [сообщений] [каталог]" << std::endl;
+        return 2;
+    }
+    std::error_code ec;
+    fs::remove_all(root, ec);
+
+    constexpr size_t kGroups = 300, kVocabulary = 50000;
+    std::vector<std::string> vocabulary = makeVocabulary(kVocabulary);
+    ZipfWords zipf(kVocabulary);
+    std::mt19937 random(42);
+    std::vector<std::string> groups;
+    for (size_t i = 0; i < kGroups; ++i) groups.push_back("group" + std::to_string(i));
+
+    // Переписка заранее: в замер add() входит только сама очередь
+    struct Message { size_t group; std::string timestamp, sender, text; };
+    std::vector<Message> history;
+    history.reserve(messages);
+    uint64_t textBytes = 0;
+    for (size_t i = 0; i < messages; ++i) {
+        Message message{ random() % kGroups, timestampOf(i), "user" + std::to_string(random() % 50), {} };
+        size_t words = 2 + random() % 12;
+        for (size_t w = 0; w < words; ++w) {
+            if (w) message.text += ' ';
+            message.text += vocabulary[zipf.next(random)];
+        }
+        textBytes += message.text.size();
+        history.push_back(std::move(message));
+    }
+
+    SearchIndex index;
+    index.open(root.string(), "bench");
+    index.sync();
+    // Приемник не обгоняет индекс на весь архив: add() замеряется порциями, между ними очередь разбирается
+    constexpr size_t kChunk = 4096;
+    double addSec = 0;
+    auto start = Clock::now();
+    for (size_t first = 0; first < history.size(); first += kChunk) {
+        auto chunkStart = Clock::now();
+        for (size_t i = first; i < std::min(history.size(), first + kChunk); ++i) {
+            const Message& message = history[i];
+            index.add(ConversationKind::Group, groups[message.group], message.timestamp, message.sender, message.text);
+        }
+        addSec += secondsSince(chunkStart);
+        index.sync();
+    }
+    double indexSec = secondsSince(start);
+    index.close(); // Сбрасывает сегмент в памяти
+    uint64_t diskBytes = directorySize(root);
+
+    start = Clock::now();
+    index.open(root.string(), "bench");
+    index.sync();
+    double openSec = secondsSince(start);
+
+    std::cout << "Сообщений: " << messages << ", бесед: " << kGroups << ", словарь: " << kVocabulary << " слов" << std::endl;
+    std::cout << "add() в потоке приемника : " << addSec * 1e9 / static_cast<double>(messages) << " нс/сообщение" << std::endl;
+    std::cout << "индексация               : " << static_cast<double>(messages) / indexSec << " сообщ/с" << std::endl;
+    std::cout << "на диске                 : " << diskBytes / (1024 * 1024) << " МБ (" << static_cast<double>(diskBytes) / static_cast<double>(messages)
+        << " байт/сообщение, текст " << static_cast<double>(textBytes) / static_cast<double>(messages) << ")" << std::endl;
+    std::cout << "открытие индекса         : " << openSec * 1000.0 << " мс, документов " << index.documents() << std::endl;
+
+    struct Query { const char* name; std::string text; std::string conversation; };
+    std::vector<Query> queries = {
+        { "редкое слово     ", vocabulary[kVocabulary - 3], {} },
+        { "частое слово     ", vocabulary[0], {} },
+        { "три слова        ", vocabulary[5] + " " + vocabulary[300] + " " + vocabulary[9000], {} },
+        { "частое in <чат>  ", vocabulary[1], groups[7] },
+        { "нет в индексе    ", "несуществующее", {} },
+    };
+    for (const Query& query : queries) {
+        size_t hits = 0;
+        double ms = medianMs(21, [&] { hits = index.search(query.text, query.conversation).size(); });
+        std::cout << "поиск: " << query.name << ": " << ms << " мс, найдено " << hits << std::endl;
+    }
+    index.close();
+    fs::remove_all(root, ec);
+    return 0;
+}
@@ -0,0 +1,165 @@
+﻿// sessionstate_stress.cpp : снимки SessionState под нагрузкой. Писатель без пауз проходит переходы сессии
+// (вход, открытие беседы, показ истории, /exit_chat, выход) так же, как Session: update() под внешним
+// мьютексом. Читатели тем временем делают то, что поток вывода делает на каждом сообщении: сверяют беседу
+// и имя пользователя - и проверяют, что снимок согласован (беседа принадлежит тому, кто вошел; без входа
+// нет ни имени, ни беседы). Любое несогласованное чтение - ошибка, код возврата 1.
+// Сначала - цена одной проверки в одном потоке: SnapshotReader, SnapshotCell::load и прежний способ
+// (мьютекс и копия имени на каждое сообщение).
+//
+// Запуск: sessionstate_stress [секунд] [читателей]
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "session.h"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+std::atomic<uint64_t> g_sink{ 0 }; // Чтобы компилятор не выбросил проверки
+
+double nsPer(Clock::duration elapsed, uint64_t count) {
+    return std::chrono::duration<double, std::nano>(elapsed).count() / static_cast<double>(count);
+}
+
+std::string roomOf(const std::string& username) { return username + "-room"; }
+
+// Снимок, который Session никогда не публикует
+bool consistent(const SessionState& state) {
+    if (!state.loggedIn) return state.username.empty() && state.conversation.name.empty() && !state.conversation.active;
+    if (state.username.empty()) return false;
+    return state.conversation.name.empty() ? !state.conversation.active : state.conversation.name == roomOf(state.username);
+}
+
+// Проверки потока вывода на входящем сообщении
+uint64_t messageChecks(const SessionState& state, const std::string& group, const std::string& sender) {
+    return (state.conversation.isActive(ConversationKind::Group, group) ? 1 : 0) + (sender == state.username ? 2 : 0);
+}
+
+// Прежнее состояние: отдельные поля под мьютексом, на каждое сообщение - блокировка и копия имени
+struct LockedState {
+    mutable std::mutex mutex;
+    std::string username;
+    Conversation conversation;
+
+    std::string copyUsername() const { std::lock_guard<std::mutex> lock(mutex); return username; }
+    bool isActive(ConversationKind kind, std::string_view name) const { std::lock_guard<std::mutex> lock(mutex); return conversation.isActive(kind, name); }
+};
+
+void singleThread(uint64_t count) {
+    SnapshotCell<SessionState> cell;
+    cell.update([](SessionState& state) { state = SessionState{ true, "alice", kNoName, Conversation{ ConversationKind::Group, roomOf("alice"), true } }; });
+    LockedState locked;
+    locked.username = "alice";
+    locked.conversation = Conversation{ ConversationKind::Group, roomOf("alice"), true };
+    std::string group = roomOf("alice"), sender = "bob";
+
+    SnapshotReader<SessionState> reader(cell);
+    uint64_t sum = 0;
+    Clock::time_point start = Clock::now();
+    for (uint64_t i = 0; i < count; ++i) sum += messageChecks(reader.get(), group, sender);
+    double readerNs = nsPer(Clock::now() - start, count);
+
+    start = Clock::now();
+    for (uint64_t i = 0; i < count; ++i) sum += messageChecks(*cell.load(), group, sender);
+    double loadNs = nsPer(Clock::now() - start, count);
+
+    start = Clock::now();
+    for (uint64_t i = 0; i < count; ++i) sum += (locked.isActive(ConversationKind::Group, group) ? 1 : 0) + (sender == locked.copyUsername() ? 2 : 0);
+    double lockedNs = nsPer(Clock::now() - start, count);
+    g_sink += sum;
+
+    std::printf("Одна проверка сообщения, один поток (%llu повторов):\n", static_cast<unsigned long long>(count));
+    std::printf("  SnapshotReader::get   %7.2f нс\n", readerNs);
+    std::printf("  SnapshotCell::load    %7.2f нс\n", loadNs);
+    std::printf("  мьютекс и копия имени %7.2f нс\n", lockedNs);
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    double seconds = argc > 1 ? std::atof(argv[1]) : 2.0;
+    unsigned readers = argc > 2 ? static_cast<unsigned>(std::atoi(argv[2])) : 3;
+    if (seconds <= 0 || readers == 0) { std::fprintf(stderr, "Использование: sessionstate_stress [секунд] [читателей]\n"); return 1; }
+
+    singleThread(20000000);
+
+    SnapshotCell<SessionState> cell;
+    std::mutex writerMutex; // Как m_stateMutex у Session
+    std::atomic<bool> running{ true };
+    std::atomic<uint64_t> transitions{ 0 };
+
+    std::thread writer([&] {
+        uint64_t user = 0;
+        while (running.load(std::memory_order_relaxed)) {
+            std::string username = "user" + std::to_string(user % 1000);
+            ConversationKind kind = user % 2 ? ConversationKind::Group : ConversationKind::Private;
+            std::lock_guard<std::mutex> lock(writerMutex);
+            cell.update([&](SessionState& state) { state.loggedIn = true; state.username = username; });                  // Вход
+            cell.update([&](SessionState& state) { state.conversation = Conversation{ kind, roomOf(username), false }; }); // CHAT/GROUPCHAT
+            cell.update([](SessionState& state) { state.conversation.active = true; });                                    // История показана
+            cell.update([](SessionState& state) { state.conversation = Conversation(); });                                 // /exit_chat
+            cell.update([&](SessionState& state) { state.conversation = Conversation{ kind, roomOf(username), true }; });  // Снова в беседе
+            cell.update([](SessionState& state) { state = SessionState(); });                                              // Выход
+            transitions.fetch_add(6, std::memory_order_relaxed);
+            ++user;
+        }
+    });
+
+    struct ReaderResult { uint64_t checks = 0; uint64_t refreshes = 0; uint64_t inconsistent = 0; uint64_t held = 0; };
+    std::vector<ReaderResult> results(readers);
+    std::vector<std::thread> workers;
+    for (unsigned r = 0; r < readers; ++r) {
+        workers.emplace_back([&, r] {
+            SnapshotReader<SessionState> reader(cell);
+            ReaderResult& result = results[r];
+            std::string group = roomOf("user1"), sender = "user2";
+            uint64_t lastVersion = 0, sum = 0;
+            std::shared_ptr<const SessionState> held = cell.load(); // Старый снимок, который держат долго
+            while (running.load(std::memory_order_relaxed)) {
+                for (int i = 0; i < 256; ++i) { // Пачка сообщений между проверками флага
+                    const SessionState& state = reader.get();
+                    if (!consistent(state)) ++result.inconsistent;
+                    sum += messageChecks(state, group, sender);
+                    ++result.checks;
+                }
+                uint64_t version = cell.version();
+                if (version != lastVersion) { ++result.refreshes; lastVersion = version; }
+                if (result.checks % (1 << 16) == 0) { // Удержанный снимок не меняется и не освобождается
+                    if (!consistent(*held)) ++result.inconsistent;
+                    held = cell.load();
+                    ++result.held;
+                }
+            }
+            g_sink += sum;
+        });
+    }
+
+    Clock::time_point start = Clock::now();
+    std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+    running = false;
+    writer.join();
+    for (std::thread& worker : workers) worker.join();
+    double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+
+    uint64_t inconsistent = 0;
+    std::printf("\nПереходы и чтение одновременно, %.1f с: %.0f переходов/с, %u читателей\n", elapsed,
+        static_cast<double>(transitions.load()) / elapsed, readers);
+    for (unsigned r = 0; r < readers; ++r) {
+        const ReaderResult& result = results[r];
+        inconsistent += result.inconsistent;
+        std::printf("  читатель %u: %.1f млн проверок/с (%.1f нс), новых версий замечено %llu, несогласованных снимков %llu\n", r,
+            static_cast<double>(result.checks) / elapsed / 1e6, elapsed * 1e9 / static_cast<double>(result.checks),
+            static_cast<unsigned long long>(result.refreshes), static_cast<unsigned long long>(result.inconsistent));
+    }
+    if (inconsistent > 0) { std::printf("ОШИБКА: несогласованных снимков %llu\n", static_cast<unsigned long long>(inconsistent)); return 1; }
+    std::printf("Все снимки согласованы\n");
+    return 0;
+}
@@ -0,0 +1,172 @@
+﻿// streamcodec_bench.cpp : размер истории группы на проводе и цена ее разбора на сообщение.
+// Одна и та же история (несколько участников, неравномерные метки времени, тексты разной длины)
+// кодируется строками текстового протокола, кадрами и сжатыми кадрами (compressed_streams).
+// Для каждого вида - байт всего и на сообщение, время передачи по медленному каналу и нс на разбор
+// одного сообщения до полей (метка, отправитель, текст) из уже принятого буфера.
+//
+// Запуск: streamcodec_bench [сообщений] [канал_кбит/с]
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "frame.h"
+#include "protocol.h"
+#include "streamcodec.h"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct Message {
+    std::string timestamp;
+    std::string sender;
+    std::string text;
+};
+
+// Синтетическая, но похожая на живую история группы
+std::vector<Message> makeGroupHistory(size_t count) {
+    static const char* const kMembers[] = { "alice", "bob", "charlie", "dmitry", "elena", "fedor", "galina", "ivan_petrov" };
+    static const char* const kWords[] = { "привет", "как", "дела", "сегодня", "встреча", "в", "офисе", "завтра", "ok",
+        "созвон", "через", "пять", "минут", "посмотри", "ссылку", "release", "build", "упал", "на", "тестах", "починил",
+        "спасибо", "да", "нет", "может", "быть", "позже", "отправил", "файл", "review", "please", ":)" };
+    std::mt19937 random(42);
+    std::vector<Message> history;
+    history.reserve(count);
+    long long seconds = 0;
+    for (size_t i = 0; i < count; ++i) {
+        seconds += 1 + static_cast<long long>(random() % (i % 50 == 0 ? 36000 : 240)); // Паузы и оживленные куски
+        long long total = 1735689600 + seconds; // С 2025-01-01
+        std::time_t time = static_cast<std::time_t>(total);
+        std::tm utc{};
+#ifdef _WIN32
+        gmtime_s(&utc, &time);
+#else
+        gmtime_r(&time, &utc);
+#endif
+        char stamp[72]; // С запасом на любые значения полей (6 int по 11 знаков): иначе -Wformat-truncation
+        std::snprintf(stamp, sizeof(stamp), "%04d-%02d-%02d %02d:%02d:%02d",
+            utc.tm_year + 1900, utc.tm_mon + 1, utc.tm_mday, utc.tm_hour, utc.tm_min, utc.tm_sec);
+        Message message;
+        message.timestamp = stamp;
+        // Собеседники пишут сериями
+        message.sender = kMembers[(random() % 3 == 0 ? random() : i / 4) % (sizeof(kMembers) / sizeof(kMembers[0]))];
+        size_t words = 1 + random() % 14;
+        for (size_t w = 0; w < words; ++w) {
+            if (w) message.text += ' ';
+            message.text += kWords[random() % (sizeof(kWords) / sizeof(kWords[0]))];
+        }
+        history.push_back(std::move(message));
+    }
+    return history;
+}
+
+std::string encodeText(const std::vector<Message>& history) {
+    std::string out = "GROUP_HISTORY_START team\n";
+    for (const Message& m : history) out += "GROUP_HIST_MSG " + m.timestamp + ":" + m.sender + ":" + m.text + "\n";
+    out += "GROUP_HISTORY_END team\n";
+    return out;
+}
+
+std::string encodeFrames(const std::vector<Message>& history, bool compress) {
+    std::string out;
+    appendFrame(out, { "GROUP_HISTORY_START", "team" });
+    StreamEncoder encoder(compressedStreamStartedBy("GROUP_HISTORY_START"));
+    for (const Message& m : history) {
+        if (compress) encoder.appendEntry(out, { m.timestamp, m.sender, m.text });
+        else appendFrame(out, { "GROUP_HIST_MSG", m.timestamp, m.sender, m.text });
+    }
+    appendFrame(out, { "GROUP_HISTORY_END", "team" });
+    return out;
+}
+
+// Разбор как в Session: строка -> глагол -> поля HIST_MSG. Возвращает контрольную сумму длин
+size_t decodeText(std::string_view data, size_t& entries) {
+    size_t checksum = 0;
+    while (!data.empty()) {
+        const char* nl = static_cast<const char*>(std::memchr(data.data(), '\n', data.size()));
+        size_t length = nl ? static_cast<size_t>(nl - data.data()) : data.size();
+        ServerLine line = splitServerLine(data.substr(0, length));
+        HistoryEntry entry;
+        if (line.prefix == "GROUP_HIST_MSG" && parseHistoryEntry(line.payload, entry)) {
+            checksum += entry.timestamp.size() + entry.sender.size() + entry.text.size();
+            ++entries;
+        }
+        data.remove_prefix(nl ? length + 1 : length);
+    }
+    return checksum;
+}
+
+size_t decodeFrames(std::string_view data, size_t& entries) {
+    size_t checksum = 0;
+    std::array<StreamDecoder, kCompressedStreamCount> decoders;
+    Frame frame, decoded;
+    while (data.size() >= kFrameHeaderSize) {
+        size_t length = readFrameLength(data.data());
+        std::string_view body = data.substr(kFrameHeaderSize, length);
+        data.remove_prefix(kFrameHeaderSize + length);
+        if (!parseFrame(body, frame)) continue;
+        const Frame* entry = &frame;
+        size_t stream = compressedStreamOf(frame);
+        if (stream != kCompressedStreamCount) {
+            if (!decoders[stream].decode(frame, decoded)) continue;
+            entry = &decoded;
+        }
+        else if ((stream = compressedStreamStartedBy(frame.verb())) != kCompressedStreamCount) decoders[stream].reset();
+        ServerLine line = splitServerFrame(*entry);
+        if (line.prefix == "GROUP_HIST_MSG") {
+            checksum += line.arg(0).size() + line.arg(1).size() + line.arg(2).size();
+            ++entries;
+        }
+    }
+    return checksum;
+}
+
+template <typename DecodeFunc>
+void runCase(const char* name, const std::string& data, size_t messages, double linkKbps, size_t baseline, DecodeFunc decode) {
+    // Повторяем разбор, пока не наберется ~0.3 с, и берем среднее
+    size_t entries = 0, checksum = 0, rounds = 0;
+    auto start = Clock::now();
+    double elapsed = 0;
+    do {
+        checksum += decode(data, entries);
+        ++rounds;
+        elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+    } while (elapsed < 0.3);
+    if (entries != messages * rounds) { std::cerr << name << ": разобрано " << entries / rounds << " из " << messages << std::endl; std::exit(1); }
+
+    double transferSec = data.size() * 8.0 / (linkKbps * 1000.0);
+    std::cout << name << ": " << data.size() << " байт (" << static_cast<double>(data.size()) / messages << " на сообщение, "
+        << static_cast<double>(baseline) / data.size() << "x к тексту), передача " << transferSec << " с, разбор "
+        << elapsed * 1e9 / (static_cast<double>(messages) * rounds) << " нс/сообщение" << (checksum ? "" : " ") << std::endl;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    size_t messages = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 100000;
+    double linkKbps = argc > 2 ? std::atof(argv[2]) : 1000.0; // Мобильный интернет через телефон
+    if (messages == 0 || linkKbps <= 0) {
+        std::cerr << "Использование: streamcodec_bench [сообщений] [канал_кбит/с]" << std::endl;
+        return 2;
+    }
+    std::vector<Message> history = makeGroupHistory(messages);
+    std::string text = encodeText(history);
+    std::string frames = encodeFrames(history, false);
+    std::string compressed = encodeFrames(history, true);
+
+    std::cout << "История группы: " << messages << " сообщений, канал " << linkKbps << " кбит/с" << std::endl;
+    runCase("строки        ", text, messages, linkKbps, text.size(), decodeText);
+    runCase("кадры         ", frames, messages, linkKbps, text.size(), decodeFrames);
+    runCase("сжатые кадры  ", compressed, messages, linkKbps, text.size(), decodeFrames);
+    return 0;
+}
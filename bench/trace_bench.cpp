@@ -0,0 +1,92 @@
+﻿// trace_bench.cpp : цена трассы на горячем пути - нс на TRACE_SCOPE и на TRACE_LOCK без конкуренции,
+// в одном потоке и в нескольких сразу (у каждого свой буфер, общих записей нет), и время traceDump.
+// Собирается только с -DMESSENGER_TRACE=ON; без него те же макросы не стоят ничего.
+//
+// Запуск: trace_bench [отрезков_на_поток] [потоков]
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "trace.h"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+std::atomic<uint64_t> g_sink{ 0 }; // Чтобы компилятор не выбросил пустой цикл
+
+double nsPer(Clock::duration elapsed, size_t count) {
+    return std::chrono::duration<double, std::nano>(elapsed).count() / static_cast<double>(count);
+}
+
+double emptyLoop(size_t count) {
+    Clock::time_point start = Clock::now();
+    uint64_t sum = 0;
+    for (size_t i = 0; i < count; ++i) { sum += i; asm volatile("" : "+r"(sum)); }
+    g_sink += sum;
+    return nsPer(Clock::now() - start, count);
+}
+
+double scopeLoop(size_t count) {
+    Clock::time_point start = Clock::now();
+    uint64_t sum = 0;
+    for (size_t i = 0; i < count; ++i) {
+        TRACE_SCOPE("bench");
+        sum += i;
+        asm volatile("" : "+r"(sum));
+    }
+    g_sink += sum;
+    return nsPer(Clock::now() - start, count);
+}
+
+double lockLoop(size_t count, bool traced) {
+    std::mutex mutex;
+    Clock::time_point start = Clock::now();
+    for (size_t i = 0; i < count; ++i) {
+        if (traced) { TRACE_LOCK(lock, mutex, "bench lock"); }
+        else { std::lock_guard<std::mutex> lock(mutex); }
+    }
+    return nsPer(Clock::now() - start, count);
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    size_t count = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 10000000;
+    unsigned threads = argc > 2 ? static_cast<unsigned>(std::atoi(argv[2])) : 4;
+    if (count == 0 || threads == 0) { std::fprintf(stderr, "Использование: trace_bench [отрезков_на_поток] [потоков]\n"); return 1; }
+
+    traceThreadName("bench");
+    scopeLoop(count / 10); // Прогрев: регистрация буфера потока, страницы кольца
+    double empty = emptyLoop(count);
+    double scope = scopeLoop(count);
+    double lockPlain = lockLoop(count, false);
+    double lockTraced = lockLoop(count, true);
+    std::printf("Один поток, %zu повторов:\n", count);
+    std::printf("  пустой цикл          %6.2f нс\n", empty);
+    std::printf("  TRACE_SCOPE          %6.2f нс (+%.2f)\n", scope, scope - empty);
+    std::printf("  lock_guard           %6.2f нс\n", lockPlain);
+    std::printf("  TRACE_LOCK           %6.2f нс (+%.2f)\n", lockTraced, lockTraced - lockPlain);
+
+    std::vector<double> perThread(threads);
+    std::vector<std::thread> workers;
+    for (unsigned t = 0; t < threads; ++t) workers.emplace_back([&perThread, t, count] { scopeLoop(count / 10); perThread[t] = scopeLoop(count); });
+    for (std::thread& worker : workers) worker.join();
+    double worst = 0;
+    for (double ns : perThread) worst = ns > worst ? ns : worst;
+    std::printf("%u потоков одновременно: TRACE_SCOPE до %.2f нс\n", threads, worst);
+
+    std::string path = "trace_bench.json";
+    Clock::time_point start = Clock::now();
+    bool ok = traceDump(path);
+    std::printf("traceDump (%zu отрезков на поток, %u потоков): %.1f мс%s\n", static_cast<size_t>(kTraceEventsPerThread), threads + 1,
+        std::chrono::duration<double, std::milli>(Clock::now() - start).count(), ok ? "" : " - ОШИБКА записи");
+    std::remove(path.c_str());
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,306 @@
+﻿#include "consolerenderer.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <iostream>
+
+#include "messengerclient.h"
+
+#ifndef _WIN32
+#include <csignal>
+#include <termios.h>
+#endif
+
+namespace {
+
+// Очистка строки ввода без ESC-последовательностей (старая консоль Windows)
+constexpr std::string_view kBlankRow = "\r                                                                                                                        \r";
+
+// Больше стертых символов выгоднее перерисовать строку целиком (Ctrl+U)
+constexpr size_t kMaxBackspaces = 8;
+
+bool startsWith(std::string_view text, std::string_view prefix) {
+    return text.size() >= prefix.size() && text.compare(0, prefix.size(), prefix) == 0;
+}
+
+// Символов UTF-8 в text (байты продолжения 10xxxxxx не считаются)
+size_t countCodepoints(std::string_view text) {
+    size_t count = 0;
+    for (char c : text) if ((static_cast<unsigned char>(c) & 0xC0) != 0x80) ++count;
+    return count;
+}
+
+#ifdef _WIN32
+void clearNativeConsole() {
+    HANDLE hStdOut = GetStdHandle(STD_OUTPUT_HANDLE);
+    CONSOLE_SCREEN_BUFFER_INFO csbi;
+    DWORD count;
+    DWORD cellCount;
+    COORD homeCoords = { 0, 0 };
+
+    if (hStdOut == INVALID_HANDLE_VALUE) return;
+    if (!GetConsoleScreenBufferInfo(hStdOut, &csbi)) return;
+    cellCount = csbi.dwSize.X * csbi.dwSize.Y;
+    if (!FillConsoleOutputCharacter(hStdOut, (TCHAR)' ', cellCount, homeCoords, &count)) return;
+    if (!FillConsoleOutputAttribute(hStdOut, csbi.wAttributes, cellCount, homeCoords, &count)) return;
+    SetConsoleCursorPosition(hStdOut, homeCoords);
+}
+#else
+termios G_savedTermios; // Режим терминала до перевода в посимвольный ввод
+
+// Ctrl+C и прочие сигналы завершения не должны оставлять терминал без эха
+void restoreTerminalOnSignal(int signal) {
+    tcsetattr(STDIN_FILENO, TCSAFLUSH, &G_savedTermios);
+    std::signal(signal, SIG_DFL);
+    std::raise(signal);
+}
+
+constexpr int kTerminatingSignals[] = { SIGINT, SIGTERM, SIGHUP, SIGQUIT };
+#endif
+
+} // namespace
+
+// --- Область сообщений как std::ostream ---
+
+ConsoleRenderer::PaneBuffer::int_type ConsoleRenderer::PaneBuffer::overflow(int_type ch) {
+    if (!traits_type::eq_int_type(ch, traits_type::eof())) m_renderer.m_pane.push_back(traits_type::to_char_type(ch));
+    return traits_type::not_eof(ch);
+}
+
+std::streamsize ConsoleRenderer::PaneBuffer::xsputn(const char* s, std::streamsize n) {
+    m_renderer.m_pane.append(s, static_cast<size_t>(n));
+    return n;
+}
+
+ConsoleRenderer::ConsoleRenderer()
+    : m_paneBuffer(*this), m_out(&m_paneBuffer) {
+}
+
+void ConsoleRenderer::enableTerminal() {
+#ifdef _WIN32
+#ifndef ENABLE_VIRTUAL_TERMINAL_PROCESSING
+#define ENABLE_VIRTUAL_TERMINAL_PROCESSING 0x0004
+#endif
+    HANDLE hStdOut = GetStdHandle(STD_OUTPUT_HANDLE);
+    DWORD mode = 0;
+    m_vt = hStdOut != INVALID_HANDLE_VALUE && GetConsoleMode(hStdOut, &mode) &&
+        SetConsoleMode(hStdOut, mode | ENABLE_VIRTUAL_TERMINAL_PROCESSING);
+#else
+    m_vt = true;
+#endif
+}
+
+void ConsoleRenderer::print(std::string_view text) {
+    m_pane.append(text);
+}
+
+void ConsoleRenderer::clearScreen() {
+    m_pane.clear(); // Все равно было бы стерто
+    m_committed.clear();
+    m_clearPending = true;
+}
+
+// --- Строка ввода ---
+
+void ConsoleRenderer::setPrompt(std::string_view prompt) {
+    m_prompt.assign(prompt); // Промпт задается на каждую порцию вывода: память строки переиспользуется
+}
+
+void ConsoleRenderer::insertInput(std::string_view text) {
+    m_input.append(text);
+}
+
+void ConsoleRenderer::eraseInputChar() {
+    while (!m_input.empty()) {
+        unsigned char last = static_cast<unsigned char>(m_input.back());
+        m_input.pop_back();
+        if ((last & 0xC0) != 0x80) break; // Дошли до первого байта символа
+    }
+}
+
+void ConsoleRenderer::clearInput() {
+    m_input.clear();
+}
+
+std::string ConsoleRenderer::commitInput() {
+    m_committed = m_prompt + m_input;
+    std::string line = std::move(m_input);
+    m_input.clear();
+    return line;
+}
+
+void ConsoleRenderer::inputSubmitted(bool terminalEchoedNewline) {
+    m_input.clear();
+    if (terminalEchoedNewline) m_shownRow.clear(); // Промпт с эхом ввода ушел вверх вместе со строкой
+}
+
+// --- Кадры ---
+
+bool ConsoleRenderer::dirty() const {
+    if (m_clearPending || !m_pane.empty() || !m_committed.empty()) return true;
+    return m_shownRow.size() != m_prompt.size() + m_input.size() ||
+        !startsWith(m_shownRow, m_prompt) || m_shownRow.compare(m_prompt.size(), std::string::npos, m_input) != 0;
+}
+
+// Лимит кадров - GCRA: m_frameSchedule уходит вперед на kFrameInterval с каждым кадром. Кадр можно
+// выводить, пока расписание опережает текущее время не больше чем на kFrameBurst - 1 интервалов:
+// одиночные события рисуются сразу, а поток сообщений - не чаще kFrameInterval
+ConsoleRenderer::Clock::time_point ConsoleRenderer::nextFrameAllowed() const {
+    return m_frameSchedule - kFrameInterval * (kFrameBurst - 1);
+}
+
+int ConsoleRenderer::msUntilFrame(Clock::time_point now) const {
+    if (!dirty()) return -1;
+    Clock::duration left = nextFrameAllowed() - now;
+    if (left <= Clock::duration::zero()) return 0;
+    return static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(left).count()) + 1;
+}
+
+void ConsoleRenderer::present(bool force) {
+    if (!dirty()) return;
+    Clock::time_point now = Clock::now();
+    if (!force && now < nextFrameAllowed()) return; // Кадр выведет следующий вызов по msUntilFrame()
+#ifdef _WIN32
+    if (m_clearPending && !m_vt) clearNativeConsole();
+#endif
+    buildFrame(m_frame);
+    // Внеочередные кадры (эхо ввода, ответ на команду) в лимит не входят: иначе первое сообщение
+    // после нажатия клавиши ждало бы целый интервал
+    if (!force) m_frameSchedule = std::max(m_frameSchedule, now) + kFrameInterval;
+    if (!m_frame.empty()) writeFrame(m_frame);
+}
+
+// Кадр - разница между моделью и экраном: стирается только строка ввода, новые сообщения
+// дописываются под старыми, а строка ввода дописывается или укорачивается на месте
+void ConsoleRenderer::buildFrame(std::string& frame) {
+    frame.clear(); // Память остается от прошлых кадров
+    std::string_view clearRow = m_vt ? std::string_view("\r\033[K") : kBlankRow;
+
+    if (m_clearPending) {
+        if (m_vt) frame += "\033[2J\033[1;1H";
+        m_shownRow.clear();
+        m_clearPending = false;
+    }
+    if (!m_committed.empty()) { // Отправленная строка остается на экране, как при обычном вводе
+        if (m_shownRow == m_committed) frame += '\n';
+        else {
+            if (!m_shownRow.empty()) frame += clearRow;
+            frame += m_committed;
+            frame += '\n';
+        }
+        m_shownRow.clear();
+        m_committed.clear();
+    }
+    if (!m_pane.empty()) {
+        if (!m_shownRow.empty()) { frame += clearRow; m_shownRow.clear(); }
+        frame += m_pane;
+        if (m_pane.back() != '\n') frame += '\n'; // Строка ввода - всегда с начала строки
+        m_pane.clear();
+    }
+
+    std::string& row = m_row;
+    row.assign(m_prompt);
+    row += m_input;
+    if (row == m_shownRow) return;
+    size_t erased = !row.empty() && startsWith(m_shownRow, row) ? countCodepoints(std::string_view(m_shownRow).substr(row.size())) : 0;
+    if (startsWith(row, m_shownRow)) { // Набран текст - дописываем только его
+        frame.append(row, m_shownRow.size(), std::string::npos);
+    }
+    else if (erased > 0 && erased <= kMaxBackspaces) { // Стерты символы с конца
+        for (size_t i = 0; i < erased; ++i) frame += "\b \b";
+    }
+    else {
+        if (!m_shownRow.empty()) frame += clearRow;
+        frame += row;
+    }
+    m_shownRow.swap(row); // Обе строки сохраняют память: кадр не выделяет ее заново
+}
+
+// Одна запись на кадр: fwrite большого блока идет мимо буфера stdio одним write()
+void ConsoleRenderer::writeFrame(const std::string& frame) {
+    std::fwrite(frame.data(), 1, frame.size(), stdout);
+    std::fflush(stdout);
+}
+
+
+// --- Ввод ---
+
+ConsoleInput::ConsoleInput(ConsoleRenderer& renderer, std::mutex& mutex)
+    : m_renderer(renderer), m_mutex(mutex) {
+#ifdef _WIN32
+    m_stdinIsTerminal = GetFileType(GetStdHandle(STD_INPUT_HANDLE)) == FILE_TYPE_CHAR;
+#else
+    m_stdinIsTerminal = isatty(STDIN_FILENO) != 0;
+    if (m_stdinIsTerminal && isatty(STDOUT_FILENO) && tcgetattr(STDIN_FILENO, &G_savedTermios) == 0) {
+        termios raw = G_savedTermios;
+        raw.c_lflag &= ~(ICANON | ECHO); // ISIG остается: Ctrl+C работает как раньше
+        raw.c_cc[VMIN] = 1;
+        raw.c_cc[VTIME] = 0;
+        if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw) == 0) {
+            m_raw = true;
+            for (int signal : kTerminatingSignals) std::signal(signal, restoreTerminalOnSignal);
+        }
+    }
+#endif
+}
+
+ConsoleInput::~ConsoleInput() {
+#ifndef _WIN32
+    if (m_raw) {
+        tcsetattr(STDIN_FILENO, TCSAFLUSH, &G_savedTermios);
+        for (int signal : kTerminatingSignals) std::signal(signal, SIG_DFL);
+    }
+#endif
+}
+
+bool ConsoleInput::readLine(std::string& line) {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_renderer.present(true); // Все, что напечатано до ожидания ввода
+    }
+    if (m_raw) return readRawLine(line);
+    if (!std::getline(std::cin, line)) { m_eof = std::cin.eof(); return false; }
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_renderer.inputSubmitted(m_stdinIsTerminal);
+    return true;
+}
+
+bool ConsoleInput::readRawLine(std::string& line) {
+#ifdef _WIN32
+    (void)line;
+    return false;
+#else
+    for (;;) {
+        if (m_pending.empty()) {
+            char buffer[256];
+            ssize_t received = ::read(STDIN_FILENO, buffer, sizeof(buffer));
+            if (received < 0 && errno == EINTR) continue;
+            if (received <= 0) { m_eof = received == 0; return false; }
+            m_pending.assign(buffer, static_cast<size_t>(received));
+        }
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        size_t used = 0;
+        bool done = false;
+        while (used < m_pending.size() && !done) {
+            char c = m_pending[used++];
+            unsigned char byte = static_cast<unsigned char>(c);
+            if (m_escape == Escape::Start) { m_escape = (c == '[' || c == 'O') ? Escape::Sequence : Escape::None; continue; }
+            if (m_escape == Escape::Sequence) { if (byte >= 0x40 && byte <= 0x7E) m_escape = Escape::None; continue; }
+
+            if (c == '\n' || c == '\r') { line = m_renderer.commitInput(); done = true; }
+            else if (byte == 0x7F || c == '\b') m_renderer.eraseInputChar();
+            else if (byte == 0x15) m_renderer.clearInput(); // Ctrl+U
+            else if (byte == 0x04) { // Ctrl+D на пустой строке - конец ввода
+                if (m_renderer.input().empty()) { m_pending.clear(); m_eof = true; return false; }
+            }
+            else if (byte == 0x1B) m_escape = Escape::Start; // Стрелки и F-клавиши не редактируем - пропускаем
+            else if (byte >= 0x20) m_renderer.insertInput(std::string_view(&m_pending[used - 1], 1));
+        }
+        m_pending.erase(0, used);
+        m_renderer.present(true); // Эхо набранного - без ограничения частоты кадров
+        if (done) return true;
+    }
+#endif
+}
@@ -0,0 +1,110 @@
+﻿// consolerenderer.h : вывод консольного клиента кадрами.
+// Рендер держит модель экрана - область сообщений (все, что напечатано после последнего кадра) и строку
+// ввода (промпт + набранный текст) - и пишет в терминал только разницу с тем, что уже на экране, одной
+// записью на кадр. Кадры под потоком сообщений идут не чаще kFrameInterval, а набранный текст
+// перерисовывается под новыми сообщениями, а не теряется.
+// Все методы вызываются под G_coutMutex (кроме конструкторов/деструкторов).
+
+#pragma once
+
+#include <chrono>
+#include <mutex>
+#include <ostream>
+#include <streambuf>
+#include <string>
+#include <string_view>
+
+class ConsoleRenderer {
+public:
+    using Clock = std::chrono::steady_clock;
+    // ~60 кадров в секунду: чаще глаз не различает, а терминал тратит время на перерисовку
+    static constexpr std::chrono::milliseconds kFrameInterval{ 16 };
+    // Сколько кадров подряд можно вывести без ожидания, если до этого было тихо
+    static constexpr int kFrameBurst = 4;
+
+    ConsoleRenderer();
+    ConsoleRenderer(const ConsoleRenderer&) = delete;
+    ConsoleRenderer& operator=(const ConsoleRenderer&) = delete;
+
+    // Включает управляющие последовательности терминала (на Windows - режим VT консоли)
+    void enableTerminal();
+
+    // Поток в область сообщений: текст попадает на экран со следующим кадром
+    std::ostream& out() { return m_out; }
+    void print(std::string_view text);
+    // Очистить экран в следующем кадре (ненапечатанное до этого отбрасывается)
+    void clearScreen();
+
+    // --- Строка ввода ---
+    void setPrompt(std::string_view prompt);
+    const std::string& input() const { return m_input; }
+    void insertInput(std::string_view text);
+    void eraseInputChar(); // Последний символ UTF-8
+    void clearInput();
+    // Enter при вводе через рендер: строка ввода остается на экране как часть истории, ввод очищается
+    std::string commitInput();
+    // Enter при вводе, который терминал отобразил сам (построчный режим): курсор уже на новой строке
+    void inputSubmitted(bool terminalEchoedNewline);
+
+    // Выводит кадр, если есть изменения и лимит кадров позволяет (force - сразу и вне лимита)
+    void present(bool force = false);
+    // Миллисекунд до следующего кадра (-1 - изменений нет)
+    int msUntilFrame(Clock::time_point now) const;
+
+private:
+    class PaneBuffer : public std::streambuf {
+    public:
+        explicit PaneBuffer(ConsoleRenderer& renderer) : m_renderer(renderer) {}
+    protected:
+        int_type overflow(int_type ch) override;
+        std::streamsize xsputn(const char* s, std::streamsize n) override;
+    private:
+        ConsoleRenderer& m_renderer;
+    };
+
+    bool dirty() const;
+    Clock::time_point nextFrameAllowed() const;
+    void buildFrame(std::string& frame);
+    void writeFrame(const std::string& frame);
+
+    PaneBuffer m_paneBuffer;
+    std::ostream m_out;
+    bool m_vt = true;              // Терминал понимает ESC-последовательности
+
+    std::string m_pane;            // Напечатанное после последнего кадра
+    bool m_clearPending = false;
+    std::string m_prompt;
+    std::string m_input;           // Набранный, еще не отправленный текст
+    std::string m_committed;       // Отправленная строка ввода, которую нужно оставить на экране
+
+    std::string m_shownRow;        // Строка ввода в том виде, в каком она сейчас на экране
+    std::string m_row;             // Строка ввода для кадра; меняется местами с m_shownRow
+    std::string m_frame;           // Буфер кадра (память переиспользуется)
+    Clock::time_point m_frameSchedule{}; // Расписание кадров для лимита (см. nextFrameAllowed)
+};
+
+// Ввод строки команд. В интерактивном терминале (Unix) - посимвольно без эха терминала: набранное
+// рисует рендер, поэтому входящие сообщения его не затирают. Иначе (канал, файл, Windows) - std::getline.
+class ConsoleInput {
+public:
+    ConsoleInput(ConsoleRenderer& renderer, std::mutex& mutex);
+    ~ConsoleInput();
+    ConsoleInput(const ConsoleInput&) = delete;
+    ConsoleInput& operator=(const ConsoleInput&) = delete;
+
+    // Выводит накопленное и ждет строку. false - конец ввода или ошибка
+    bool readLine(std::string& line);
+    bool eof() const { return m_eof; }
+
+private:
+    bool readRawLine(std::string& line);
+
+    ConsoleRenderer& m_renderer;
+    std::mutex& m_mutex;
+    bool m_raw = false;         // Терминал переведен в посимвольный режим
+    bool m_stdinIsTerminal = false;
+    bool m_eof = false;
+    std::string m_pending;      // Прочитанное после Enter (вставка нескольких строк сразу)
+    enum class Escape { None, Start, Sequence };
+    Escape m_escape = Escape::None; // Разбор ESC-последовательности (стрелки, F-клавиши), которую пропускаем
+};
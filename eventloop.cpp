@@ -0,0 +1,199 @@
+﻿#include "eventloop.h"
+
+#include <algorithm> // std::find_if
+
+#if defined(__linux__)
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#elif !defined(_WIN32)
+#include <fcntl.h>
+#endif
+
+#if defined(__linux__)
+
+// --- Linux: epoll + eventfd ---
+
+EventLoop::EventLoop() {
+    m_epollFd = epoll_create1(EPOLL_CLOEXEC);
+    m_wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (m_epollFd < 0 || m_wakeFd < 0) return;
+
+    epoll_event ev{};
+    ev.events = EPOLLIN;
+    ev.data.fd = m_wakeFd;
+    m_valid = epoll_ctl(m_epollFd, EPOLL_CTL_ADD, m_wakeFd, &ev) == 0;
+}
+
+EventLoop::~EventLoop() {
+    if (m_wakeFd >= 0) close(m_wakeFd);
+    if (m_epollFd >= 0) close(m_epollFd);
+}
+
+bool EventLoop::add(SocketType socket, bool wantWrite) {
+    epoll_event ev{};
+    ev.events = EPOLLIN | EPOLLRDHUP | (wantWrite ? EPOLLOUT : 0u);
+    ev.data.fd = socket;
+    return epoll_ctl(m_epollFd, EPOLL_CTL_ADD, socket, &ev) == 0;
+}
+
+bool EventLoop::setWantWrite(SocketType socket, bool wantWrite) {
+    epoll_event ev{};
+    ev.events = EPOLLIN | EPOLLRDHUP | (wantWrite ? EPOLLOUT : 0u);
+    ev.data.fd = socket;
+    return epoll_ctl(m_epollFd, EPOLL_CTL_MOD, socket, &ev) == 0;
+}
+
+void EventLoop::remove(SocketType socket) {
+    epoll_ctl(m_epollFd, EPOLL_CTL_DEL, socket, nullptr);
+}
+
+int EventLoop::wait(std::vector<IoEvent>& events, int timeoutMs) {
+    events.clear();
+    epoll_event ready[64];
+    int n = epoll_wait(m_epollFd, ready, 64, timeoutMs);
+    if (n < 0) return errno == EINTR ? 0 : -1;
+    for (int i = 0; i < n; ++i) {
+        if (ready[i].data.fd == m_wakeFd) { drainWakeup(); continue; }
+        uint32_t e = ready[i].events;
+        events.push_back({ ready[i].data.fd, (e & (EPOLLIN | EPOLLRDHUP)) != 0, (e & EPOLLOUT) != 0, (e & (EPOLLERR | EPOLLHUP)) != 0 });
+    }
+    return static_cast<int>(events.size());
+}
+
+void EventLoop::wake() {
+    uint64_t one = 1;
+    ssize_t ignored = write(m_wakeFd, &one, sizeof(one));
+    (void)ignored;
+}
+
+void EventLoop::drainWakeup() {
+    uint64_t value;
+    ssize_t ignored = read(m_wakeFd, &value, sizeof(value));
+    (void)ignored;
+}
+
+#elif defined(_WIN32)
+
+// --- Windows: WSAPoll + UDP-сокет, отправляющий датаграммы сам себе ---
+
+EventLoop::EventLoop() {
+    m_wakeSocket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (m_wakeSocket == INVALID_SOCKET_VALUE) return;
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = 0;
+    int addrLen = sizeof(addr);
+    if (bind(m_wakeSocket, (sockaddr*)&addr, sizeof(addr)) == SOCKET_ERROR_VALUE) return;
+    if (getsockname(m_wakeSocket, (sockaddr*)&addr, &addrLen) == SOCKET_ERROR_VALUE) return;
+    if (connect(m_wakeSocket, (sockaddr*)&addr, sizeof(addr)) == SOCKET_ERROR_VALUE) return;
+    u_long nonBlocking = 1;
+    ioctlsocket(m_wakeSocket, FIONBIO, &nonBlocking);
+    m_pollFds.push_back({ m_wakeSocket, POLLRDNORM, 0 });
+    m_valid = true;
+}
+
+EventLoop::~EventLoop() {
+    if (m_wakeSocket != INVALID_SOCKET_VALUE) CLOSE_SOCKET(m_wakeSocket);
+}
+
+bool EventLoop::add(SocketType socket, bool wantWrite) {
+    m_pollFds.push_back({ socket, static_cast<SHORT>(POLLRDNORM | (wantWrite ? POLLWRNORM : 0)), 0 });
+    return true;
+}
+
+bool EventLoop::setWantWrite(SocketType socket, bool wantWrite) {
+    auto it = std::find_if(m_pollFds.begin() + 1, m_pollFds.end(), [socket](const WSAPOLLFD& p) { return p.fd == socket; });
+    if (it == m_pollFds.end()) return false;
+    it->events = static_cast<SHORT>(POLLRDNORM | (wantWrite ? POLLWRNORM : 0));
+    return true;
+}
+
+void EventLoop::remove(SocketType socket) {
+    auto it = std::find_if(m_pollFds.begin() + 1, m_pollFds.end(), [socket](const WSAPOLLFD& p) { return p.fd == socket; });
+    if (it != m_pollFds.end()) m_pollFds.erase(it);
+}
+
+int EventLoop::wait(std::vector<IoEvent>& events, int timeoutMs) {
+    events.clear();
+    int n = WSAPoll(m_pollFds.data(), static_cast<ULONG>(m_pollFds.size()), timeoutMs);
+    if (n < 0) return -1;
+    if (m_pollFds[0].revents) drainWakeup();
+    for (size_t i = 1; i < m_pollFds.size(); ++i) {
+        SHORT e = m_pollFds[i].revents;
+        if (!e) continue;
+        events.push_back({ m_pollFds[i].fd, (e & POLLRDNORM) != 0, (e & POLLWRNORM) != 0, (e & (POLLERR | POLLHUP | POLLNVAL)) != 0 });
+    }
+    return static_cast<int>(events.size());
+}
+
+void EventLoop::wake() {
+    char one = 1;
+    send(m_wakeSocket, &one, 1, 0);
+}
+
+void EventLoop::drainWakeup() {
+    char buf[64];
+    while (recv(m_wakeSocket, buf, sizeof(buf), 0) > 0) {}
+}
+
+#else
+
+// --- Прочие Unix: poll + self-pipe ---
+
+EventLoop::EventLoop() {
+    if (pipe(m_wakePipe) != 0) return;
+    for (int fd : m_wakePipe) {
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+    }
+    m_pollFds.push_back({ m_wakePipe[0], POLLIN, 0 });
+    m_valid = true;
+}
+
+EventLoop::~EventLoop() {
+    for (int fd : m_wakePipe) if (fd >= 0) close(fd);
+}
+
+bool EventLoop::add(SocketType socket, bool wantWrite) {
+    m_pollFds.push_back({ socket, static_cast<short>(POLLIN | (wantWrite ? POLLOUT : 0)), 0 });
+    return true;
+}
+
+bool EventLoop::setWantWrite(SocketType socket, bool wantWrite) {
+    auto it = std::find_if(m_pollFds.begin() + 1, m_pollFds.end(), [socket](const pollfd& p) { return p.fd == socket; });
+    if (it == m_pollFds.end()) return false;
+    it->events = static_cast<short>(POLLIN | (wantWrite ? POLLOUT : 0));
+    return true;
+}
+
+void EventLoop::remove(SocketType socket) {
+    auto it = std::find_if(m_pollFds.begin() + 1, m_pollFds.end(), [socket](const pollfd& p) { return p.fd == socket; });
+    if (it != m_pollFds.end()) m_pollFds.erase(it);
+}
+
+int EventLoop::wait(std::vector<IoEvent>& events, int timeoutMs) {
+    events.clear();
+    int n = poll(m_pollFds.data(), static_cast<nfds_t>(m_pollFds.size()), timeoutMs);
+    if (n < 0) return errno == EINTR ? 0 : -1;
+    if (m_pollFds[0].revents) drainWakeup();
+    for (size_t i = 1; i < m_pollFds.size(); ++i) {
+        short e = m_pollFds[i].revents;
+        if (!e) continue;
+        events.push_back({ m_pollFds[i].fd, (e & POLLIN) != 0, (e & POLLOUT) != 0, (e & (POLLERR | POLLHUP | POLLNVAL)) != 0 });
+    }
+    return static_cast<int>(events.size());
+}
+
+void EventLoop::wake() {
+    char one = 1;
+    ssize_t ignored = write(m_wakePipe[1], &one, 1);
+    (void)ignored;
+}
+
+void EventLoop::drainWakeup() {
+    char buf[64];
+    while (read(m_wakePipe[0], buf, sizeof(buf)) > 0) {}
+}
+
+#endif
@@ -0,0 +1,56 @@
+﻿// eventloop.h : ожидание событий на сокетах с мгновенным пробуждением из других потоков.
+// Linux: epoll + eventfd, прочие Unix: poll + self-pipe, Windows: WSAPoll + loopback UDP-сокет.
+
+#pragma once
+
+#include <vector>
+
+#include "messengerclient.h"
+
+#ifndef _WIN32
+#include <poll.h>
+#endif
+
+// Событие на зарегистрированном сокете
+struct IoEvent {
+    SocketType socket;
+    bool readable;
+    bool writable;
+    bool error;    // Ошибка или разрыв (HUP) - чтение вернет Closed/Error
+};
+
+class EventLoop {
+public:
+    EventLoop();
+    ~EventLoop();
+    EventLoop(const EventLoop&) = delete;
+    EventLoop& operator=(const EventLoop&) = delete;
+
+    bool valid() const { return m_valid; }
+
+    bool add(SocketType socket, bool wantWrite = false);
+    bool setWantWrite(SocketType socket, bool wantWrite);
+    void remove(SocketType socket);
+
+    // Блокируется до событий на сокетах, вызова wake() или таймаута (timeoutMs < 0 - без таймаута).
+    // Возвращает число событий в events, 0 при пробуждении/таймауте, -1 при ошибке.
+    int wait(std::vector<IoEvent>& events, int timeoutMs = -1);
+
+    // Будит поток, находящийся в wait(). Потокобезопасно; на Unix можно вызывать из обработчика сигнала
+    void wake();
+
+private:
+    void drainWakeup();
+
+    bool m_valid = false;
+#if defined(__linux__)
+    int m_epollFd = -1;
+    int m_wakeFd = -1;        // eventfd
+#elif defined(_WIN32)
+    SocketType m_wakeSocket = INVALID_SOCKET_VALUE; // UDP-сокет, подключенный сам к себе
+    std::vector<WSAPOLLFD> m_pollFds;               // [0] - сокет пробуждения
+#else
+    int m_wakePipe[2] = { -1, -1 };
+    std::vector<pollfd> m_pollFds;                  // [0] - читающий конец self-pipe
+#endif
+};
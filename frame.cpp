@@ -0,0 +1,62 @@
+﻿#include "frame.h"
+
+namespace {
+
+constexpr size_t kMaxVarintBytes = 5; // uint32_t по 7 бит
+
+} // namespace
+
+void appendVarint(std::string& out, uint32_t value) {
+    while (value >= 0x80) {
+        out.push_back(static_cast<char>((value & 0x7F) | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<char>(value));
+}
+
+size_t readVarint(std::string_view data, uint32_t& value) {
+    value = 0;
+    size_t limit = data.size() < kMaxVarintBytes ? data.size() : kMaxVarintBytes;
+    for (size_t i = 0; i < limit; ++i) {
+        auto byte = static_cast<unsigned char>(data[i]);
+        value |= uint32_t(byte & 0x7F) << (7 * i);
+        if (!(byte & 0x80)) return i + 1;
+    }
+    return 0;
+}
+
+bool parseFrame(std::string_view body, Frame& frame) {
+    frame.count = 0;
+    while (!body.empty()) {
+        if (frame.count == kMaxFrameFields) return false;
+        uint32_t length = 0;
+        size_t prefix = readVarint(body, length);
+        if (prefix == 0 || body.size() - prefix < length) return false;
+        frame.fields[frame.count++] = body.substr(prefix, length);
+        body.remove_prefix(prefix + length);
+    }
+    return frame.count > 0;
+}
+
+size_t beginFrame(std::string& out) {
+    size_t header = out.size();
+    out.append(kFrameHeaderSize, '\0'); // Длину тела заполним, когда оно будет записано
+    return header;
+}
+
+void appendFrame(std::string& out, const std::string_view* fields, size_t count) {
+    size_t header = beginFrame(out);
+    for (size_t i = 0; i < count; ++i) {
+        appendVarint(out, static_cast<uint32_t>(fields[i].size()));
+        out.append(fields[i]);
+    }
+    finishFrame(out, header);
+}
+
+void finishFrame(std::string& out, size_t header) {
+    auto length = static_cast<uint32_t>(out.size() - header - kFrameHeaderSize);
+    out[header] = static_cast<char>(length >> 24);
+    out[header + 1] = static_cast<char>(length >> 16);
+    out[header + 2] = static_cast<char>(length >> 8);
+    out[header + 3] = static_cast<char>(length);
+}
@@ -0,0 +1,47 @@
+﻿// frame.h : двоичные кадры протокола (расширение binary_frames).
+// Кадр - 4 байта длины тела (big-endian), затем поля подряд: длина поля (varint, 7 бит на байт,
+// младшие первыми) и байты поля. Поле 0 - глагол, дальше - аргументы в порядке, заданном для глагола.
+// Разделители внутри полей не нужны, поэтому в тексте могут быть ':', пробелы и переводы строк.
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <string>
+#include <string_view>
+
+constexpr size_t kFrameHeaderSize = 4;  // Длина тела кадра
+constexpr size_t kMaxFrameFields = 8;   // Глагол и до 7 аргументов
+
+// Поля кадра: string_view внутрь тела, действительны, пока живо тело
+struct Frame {
+    std::array<std::string_view, kMaxFrameFields> fields;
+    size_t count = 0;
+
+    std::string_view verb() const { return count ? fields[0] : std::string_view(); }
+};
+
+inline uint32_t readFrameLength(const char* header) {
+    const auto* bytes = reinterpret_cast<const unsigned char*>(header);
+    return (uint32_t(bytes[0]) << 24) | (uint32_t(bytes[1]) << 16) | (uint32_t(bytes[2]) << 8) | uint32_t(bytes[3]);
+}
+
+// Длина в формате полей кадра (varint). readVarint возвращает число прочитанных байт, 0 - varint обрезан
+void appendVarint(std::string& out, uint32_t value);
+size_t readVarint(std::string_view data, uint32_t& value);
+
+// Разбирает тело кадра (без заголовка длины). false - поле обрезано или полей больше kMaxFrameFields
+bool parseFrame(std::string_view body, Frame& frame);
+
+// Кадр, который пишется в out по частям: beginFrame оставляет место под заголовок и возвращает его
+// позицию, finishFrame проставляет длину всего, что дописано после него
+size_t beginFrame(std::string& out);
+void finishFrame(std::string& out, size_t header);
+
+// Дописывает в out кадр из полей (с заголовком длины)
+void appendFrame(std::string& out, const std::string_view* fields, size_t count);
+inline void appendFrame(std::string& out, std::initializer_list<std::string_view> fields) {
+    appendFrame(out, fields.begin(), fields.size());
+}
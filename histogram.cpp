@@ -0,0 +1,94 @@
+﻿#include "histogram.h"
+
+#include <algorithm> // std::min, std::max
+#include <cmath>     // std::ceil
+
+namespace {
+
+inline unsigned highestBit(uint64_t value) {
+    unsigned bit = 0;
+    while (value >>= 1) ++bit;
+    return bit;
+}
+
+} // namespace
+
+size_t LatencyHistogram::bucketIndex(uint64_t value) {
+    if (value < kSubBucketCount) return static_cast<size_t>(value);
+    unsigned shift = highestBit(value) - kSubBucketBits;
+    size_t index = (static_cast<size_t>(shift) + 1) * kSubBucketCount + static_cast<size_t>((value >> shift) - kSubBucketCount);
+    return std::min(index, kBucketCount - 1); // Все, что больше диапазона, - в последнюю корзину
+}
+
+uint64_t LatencyHistogram::bucketLowerBound(size_t index) {
+    if (index < kSubBucketCount) return index;
+    unsigned shift = static_cast<unsigned>(index / kSubBucketCount - 1);
+    return (kSubBucketCount + index % kSubBucketCount) << shift;
+}
+
+void LatencyHistogram::record(uint64_t value) {
+    ++m_buckets[bucketIndex(value)];
+    ++m_count;
+    m_sum += value;
+    m_min = std::min(m_min, value);
+    m_max = std::max(m_max, value);
+}
+
+void LatencyHistogram::merge(const LatencyHistogram& other) {
+    for (size_t i = 0; i < kBucketCount; ++i) m_buckets[i] += other.m_buckets[i];
+    m_count += other.m_count;
+    m_sum += other.m_sum;
+    m_min = std::min(m_min, other.m_min);
+    m_max = std::max(m_max, other.m_max);
+}
+
+void LatencyHistogram::reset() {
+    m_buckets.fill(0);
+    m_count = m_sum = m_max = 0;
+    m_min = UINT64_MAX;
+}
+
+uint64_t LatencyHistogram::percentile(double p) const {
+    if (m_count == 0) return 0;
+    uint64_t rank = static_cast<uint64_t>(std::ceil(p * static_cast<double>(m_count)));
+    rank = std::max<uint64_t>(rank, 1);
+    uint64_t seen = 0;
+    for (size_t i = 0; i < kBucketCount; ++i) {
+        seen += m_buckets[i];
+        if (seen >= rank) {
+            uint64_t low = bucketLowerBound(i);
+            uint64_t high = i + 1 < kBucketCount ? bucketLowerBound(i + 1) : m_max + 1;
+            return std::min((low + high - 1) / 2, m_max);
+        }
+    }
+    return m_max;
+}
+
+void ConcurrentHistogram::record(uint64_t value) {
+    m_buckets[LatencyHistogram::bucketIndex(value)].fetch_add(1, std::memory_order_relaxed);
+    m_sum.fetch_add(value, std::memory_order_relaxed);
+    uint64_t current = m_min.load(std::memory_order_relaxed);
+    while (value < current && !m_min.compare_exchange_weak(current, value, std::memory_order_relaxed)) {}
+    current = m_max.load(std::memory_order_relaxed);
+    while (value > current && !m_max.compare_exchange_weak(current, value, std::memory_order_relaxed)) {}
+}
+
+LatencyHistogram ConcurrentHistogram::snapshot() const {
+    LatencyHistogram result;
+    for (size_t i = 0; i < LatencyHistogram::kBucketCount; ++i) {
+        uint64_t count = m_buckets[i].load(std::memory_order_relaxed);
+        result.m_buckets[i] = count;
+        result.m_count += count; // Итог - по корзинам, чтобы перцентили с ним сходились
+    }
+    result.m_sum = m_sum.load(std::memory_order_relaxed);
+    result.m_min = m_min.load(std::memory_order_relaxed);
+    result.m_max = m_max.load(std::memory_order_relaxed);
+    return result;
+}
+
+void ConcurrentHistogram::reset() {
+    for (auto& bucket : m_buckets) bucket.store(0, std::memory_order_relaxed);
+    m_sum.store(0, std::memory_order_relaxed);
+    m_min.store(UINT64_MAX, std::memory_order_relaxed);
+    m_max.store(0, std::memory_order_relaxed);
+}
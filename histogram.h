@@ -0,0 +1,56 @@
+﻿// histogram.h : гистограмма задержек с логарифмически-линейными корзинами (в духе HdrHistogram).
+// Относительная погрешность перцентилей < 1%, память фиксированная, запись - O(1) без выделений.
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+class LatencyHistogram {
+public:
+    static constexpr unsigned kSubBucketBits = 7;                          // 128 корзин на каждую степень двойки
+    static constexpr unsigned kMaxValueBits = 40;                          // До ~1100 секунд в наносекундах
+    static constexpr size_t kSubBucketCount = size_t(1) << kSubBucketBits;
+    static constexpr size_t kBucketCount = (kMaxValueBits - kSubBucketBits + 1) * kSubBucketCount;
+
+    void record(uint64_t value);
+    void merge(const LatencyHistogram& other);
+    void reset();
+
+    uint64_t count() const { return m_count; }
+    uint64_t min() const { return m_count ? m_min : 0; }
+    uint64_t max() const { return m_max; }
+    double mean() const { return m_count ? static_cast<double>(m_sum) / static_cast<double>(m_count) : 0.0; }
+    // Значение, не меньше которого p (0..1) всех записей; середина корзины
+    uint64_t percentile(double p) const;
+
+    static size_t bucketIndex(uint64_t value);
+    static uint64_t bucketLowerBound(size_t index);
+
+private:
+    friend class ConcurrentHistogram;
+
+    std::array<uint64_t, kBucketCount> m_buckets{};
+    uint64_t m_count = 0;
+    uint64_t m_sum = 0;
+    uint64_t m_min = UINT64_MAX;
+    uint64_t m_max = 0;
+};
+
+// Та же гистограмма для записи из одних потоков и чтения из других: корзины и итоги - атомарные
+// счетчики (relaxed), запись не блокируется. Снимок не атомарен целиком, но для вывода статистики
+// расхождение в несколько записей между корзинами и итогами неважно
+class ConcurrentHistogram {
+public:
+    void record(uint64_t value);
+    LatencyHistogram snapshot() const;
+    void reset();
+
+private:
+    std::array<std::atomic<uint64_t>, LatencyHistogram::kBucketCount> m_buckets{};
+    std::atomic<uint64_t> m_sum{ 0 };
+    std::atomic<uint64_t> m_min{ UINT64_MAX };
+    std::atomic<uint64_t> m_max{ 0 };
+};
@@ -0,0 +1,93 @@
+﻿#include "historypage.h"
+
+#include "protocol.h"
+
+namespace {
+
+std::string_view recordTimestamp(std::string_view record) {
+    HistoryEntry entry;
+    parseHistoryEntry(record, entry);
+    return entry.timestamp;
+}
+
+// Первая запись records (без '\n')
+std::string_view firstRecord(std::string_view records) {
+    return records.substr(0, records.find('\n'));
+}
+
+} // namespace
+
+size_t historyPageStart(std::string_view records, size_t end, size_t count) {
+    if (end > records.size()) end = records.size();
+    size_t start = end;
+    // end стоит сразу за '\n' последней записи: ищем count + 1 переводов строк назад от него
+    for (size_t found = 0; start > 0; --start) {
+        if (records[start - 1] == '\n' && start != end && ++found == count) break;
+    }
+    return start;
+}
+
+size_t countHistoryRecords(std::string_view records) {
+    size_t count = 0;
+    for (char c : records) count += c == '\n';
+    if (!records.empty() && records.back() != '\n') ++count;
+    return count;
+}
+
+void HistoryCursor::shown(std::string_view records) {
+    if (records.empty()) return;
+    std::string_view first = recordTimestamp(firstRecord(records));
+    size_t same = 0; // Записей с меткой первой - они идут подряд в начале
+    while (!records.empty()) {
+        size_t nl = records.find('\n');
+        if (recordTimestamp(records.substr(0, nl)) != first) break;
+        ++same;
+        if (nl == std::string_view::npos) break;
+        records.remove_prefix(nl + 1);
+    }
+    if (first == oldest) oldestShown += same; // Вся страница - в ту же секунду, что и граница
+    else { oldest.assign(first); oldestShown = same; }
+}
+
+size_t HistoryCursor::dropRepeats(std::string& records) const {
+    size_t dropped = 0;
+    while (dropped < oldestShown && !records.empty()) {
+        size_t start = historyPageStart(records, records.size(), 1);
+        std::string_view last = std::string_view(records).substr(start);
+        if (!last.empty() && last.back() == '\n') last.remove_suffix(1);
+        if (recordTimestamp(last) != oldest) break;
+        records.resize(start);
+        ++dropped;
+    }
+    return dropped;
+}
+
+void HistoryWindow::reset(size_t capacity, size_t offset) {
+    m_capacity = capacity;
+    if (m_records.size() < capacity) { m_records.resize(capacity); m_offsets.resize(capacity); }
+    m_head = m_size = m_dropped = 0;
+    m_nextOffset = offset;
+}
+
+void HistoryWindow::push(std::string_view record) {
+    if (m_capacity == 0) return;
+    size_t slot;
+    if (m_size < m_capacity) slot = (m_head + m_size++) % m_capacity;
+    else { slot = m_head; m_head = (m_head + 1) % m_capacity; ++m_dropped; } // Вытесняем самую раннюю
+    m_records[slot].assign(record);
+    m_offsets[slot] = m_nextOffset;
+    m_nextOffset += record.size() + 1;
+}
+
+size_t HistoryWindow::firstOffset() const {
+    return m_size ? m_offsets[m_head] : m_nextOffset;
+}
+
+std::string_view HistoryWindow::records() {
+    m_joined.clear();
+    for (size_t i = 0; i < m_size; ++i) {
+        m_joined += m_records[(m_head + i) % m_capacity];
+        m_joined += '\n';
+    }
+    return m_joined;
+}
@@ -0,0 +1,56 @@
+﻿// historypage.h : история беседы страницами. Беседа с многолетней историей не выводится целиком: при
+// открытии показываются последние N записей, более ранние - по команде /more, по N за раз.
+// HistoryWindow держит последние N записей потока истории с сервера, сколько бы их ни пришло, - память
+// открытой беседы ограничена N. HistoryCursor - граница уже показанного: с какого места кэша и с какой
+// метки времени продолжать. Записи - строки кэша (historystore.h) с '\n' в конце.
+
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Начало последних count записей, которые заканчиваются на смещении end
+size_t historyPageStart(std::string_view records, size_t end, size_t count);
+size_t countHistoryRecords(std::string_view records);
+
+struct HistoryCursor {
+    size_t cacheOffset = 0;  // Записи кэша до этого смещения еще не показаны (0 - кэш показан целиком)
+    std::string oldest;      // Метка самой ранней показанной записи (пусто - ничего не показано)
+    size_t oldestShown = 0;  // Показано записей с этой меткой: сервер отдает страницу по метку включительно
+    bool serverMore = true;  // У сервера могут быть записи раньше oldest
+
+    // Показаны records - раньше всего, что уже показано
+    void shown(std::string_view records);
+    // Сколько записей просить у сервера, чтобы после dropRepeats() осталось count
+    size_t requestCount(size_t count) const { return count + oldestShown; }
+    // Убирает из конца страницы сервера записи, которые уже показаны. Возвращает, сколько убрано
+    size_t dropRepeats(std::string& records) const;
+};
+
+// Последние capacity записей потока и их смещения в файле кэша (поток дописывается в кэш)
+class HistoryWindow {
+public:
+    // Новый поток: его первая запись ляжет в кэш по смещению offset
+    void reset(size_t capacity, size_t offset);
+    void push(std::string_view record);
+    size_t capacity() const { return m_capacity; } // 0 - окна нет (история целиком)
+    size_t size() const { return m_size; }
+    bool full() const { return m_capacity > 0 && m_size == m_capacity; }
+    std::string_view front() const { return m_records[m_head]; } // Самая ранняя запись (следующая на вытеснение)
+    size_t dropped() const { return m_dropped; } // Вытеснено более поздними записями
+    size_t firstOffset() const;                  // Смещение в кэше самой ранней записи окна
+    // Записи окна подряд, по возрастанию времени. Действительны до следующего изменения окна
+    std::string_view records();
+
+private:
+    std::vector<std::string> m_records; // Кольцо, [m_head] - самая ранняя; строки переиспользуются
+    std::vector<size_t> m_offsets;
+    size_t m_capacity = 0;
+    size_t m_head = 0;
+    size_t m_size = 0;
+    size_t m_dropped = 0;
+    size_t m_nextOffset = 0;
+    std::string m_joined;
+};
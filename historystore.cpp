@@ -0,0 +1,185 @@
+﻿#include "historystore.h"
+
+#include <cstdlib>      // std::getenv
+#include <filesystem>
+#include <system_error>
+
+#include "protocol.h"
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace fs = std::filesystem;
+
+namespace {
+
+// Имя пользователя/группы -> безопасное имя файла (все, кроме [A-Za-z0-9_-], кодируется как %XX)
+std::string encodeFileName(std::string_view name) {
+    static constexpr char kHex[] = "0123456789ABCDEF";
+    std::string encoded;
+    encoded.reserve(name.size());
+    for (unsigned char c : name) {
+        if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_' || c == '-') {
+            encoded += static_cast<char>(c);
+        }
+        else {
+            encoded += '%';
+            encoded += kHex[c >> 4];
+            encoded += kHex[c & 0x0F];
+        }
+    }
+    return encoded;
+}
+
+std::string_view recordTimestamp(std::string_view record) {
+    HistoryEntry entry;
+    parseHistoryEntry(record, entry);
+    return entry.timestamp;
+}
+
+} // namespace
+
+// --- MappedFile ---
+
+#ifdef _WIN32
+
+bool MappedFile::map(const std::string& path) {
+    unmap();
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+        nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) return false;
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size) || size.QuadPart == 0) { CloseHandle(file); return size.QuadPart == 0; }
+    HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!mapping) { CloseHandle(file); return false; }
+    void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (!view) { CloseHandle(mapping); CloseHandle(file); return false; }
+    m_file = file; m_mapping = mapping;
+    m_data = static_cast<const char*>(view);
+    m_size = static_cast<size_t>(size.QuadPart);
+    return true;
+}
+
+void MappedFile::unmap() {
+    if (m_data) UnmapViewOfFile(m_data);
+    if (m_mapping) CloseHandle(m_mapping);
+    if (m_file) CloseHandle(m_file);
+    m_data = nullptr; m_size = 0; m_mapping = nullptr; m_file = nullptr;
+}
+
+#else
+
+bool MappedFile::map(const std::string& path) {
+    unmap();
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0) { ::close(fd); return false; }
+    if (st.st_size > 0) {
+        void* data = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) { ::close(fd); return false; }
+        m_data = static_cast<const char*>(data);
+        m_size = static_cast<size_t>(st.st_size);
+    }
+    ::close(fd); // Отображение остается действительным и после закрытия дескриптора
+    return true;
+}
+
+void MappedFile::unmap() {
+    if (m_data) munmap(const_cast<char*>(m_data), m_size);
+    m_data = nullptr; m_size = 0;
+}
+
+#endif
+
+// --- HistoryStore ---
+
+std::string HistoryStore::defaultRoot() {
+    if (const char* dir = std::getenv("MESSENGER_CACHE_DIR"); dir && *dir) return dir;
+#ifdef _WIN32
+    if (const char* dir = std::getenv("LOCALAPPDATA"); dir && *dir) return (fs::path(dir) / "Dinogram" / "history").string();
+#else
+    if (const char* dir = std::getenv("XDG_CACHE_HOME"); dir && *dir) return (fs::path(dir) / "dinogram" / "history").string();
+    if (const char* home = std::getenv("HOME"); home && *home) return (fs::path(home) / ".cache" / "dinogram" / "history").string();
+#endif
+    return (fs::temp_directory_path() / "dinogram-history").string();
+}
+
+std::string HistoryStore::accountDirectory(const std::string& root, std::string_view account) {
+    return (fs::path(root) / encodeFileName(account)).string();
+}
+
+bool HistoryStore::open(const std::string& root, std::string_view account, ConversationKind kind, std::string_view name) {
+    close();
+    if (account.empty() || name.empty()) return false;
+    std::error_code ec;
+    fs::path dir = accountDirectory(root, account);
+    fs::create_directories(dir, ec);
+    if (ec) return false;
+
+    std::string fileName = (kind == ConversationKind::Group ? "g_" : "p_") + encodeFileName(name) + ".hist";
+    m_path = (dir / fileName).string();
+    if (!openForAppend("ab") || !m_mapped.map(m_path)) { close(); return false; }
+    return true;
+}
+
+void HistoryStore::close() {
+    if (m_file) { std::fclose(m_file); m_file = nullptr; }
+    m_mapped.unmap();
+    m_path.clear();
+}
+
+bool HistoryStore::openForAppend(const char* mode) {
+    if (m_file) std::fclose(m_file);
+    m_file = std::fopen(m_path.c_str(), mode);
+    return m_file != nullptr;
+}
+
+std::string_view HistoryStore::lastTimestamp() const {
+    std::string_view records = m_mapped.contents();
+    while (!records.empty() && records.back() == '\n') records.remove_suffix(1);
+    if (records.empty()) return {};
+    size_t nl = records.rfind('\n');
+    return recordTimestamp(nl == std::string_view::npos ? records : records.substr(nl + 1));
+}
+
+bool HistoryStore::hasRecordAtTail(std::string_view record) const {
+    std::string_view timestamp = recordTimestamp(record);
+    std::string_view records = m_mapped.contents();
+    while (!records.empty() && records.back() == '\n') records.remove_suffix(1);
+    // Идем с конца, пока метки времени совпадают (записи упорядочены по времени)
+    while (!records.empty()) {
+        size_t nl = records.rfind('\n');
+        std::string_view stored = nl == std::string_view::npos ? records : records.substr(nl + 1);
+        if (stored == record) return true;
+        if (recordTimestamp(stored) != timestamp) return false;
+        if (nl == std::string_view::npos) break;
+        records = records.substr(0, nl);
+    }
+    return false;
+}
+
+bool HistoryStore::append(std::string_view record) {
+    if (!m_file || record.empty()) return false;
+    bool ok = std::fwrite(record.data(), 1, record.size(), m_file) == record.size();
+    return std::fputc('\n', m_file) != EOF && ok;
+}
+
+bool HistoryStore::truncate() {
+    if (!isOpen()) return false;
+    m_mapped.unmap(); // Windows не дает обрезать отображенный файл
+    return openForAppend("wb");
+}
+
+void HistoryStore::flush() {
+    if (m_file) std::fflush(m_file);
+}
@@ -0,0 +1,85 @@
+﻿// historystore.h : локальный кэш истории переписки на диске.
+// Один файл на беседу (личный чат или группа) каждого аккаунта. Файл только дописывается:
+// каждая строка - запись в формате HIST_MSG ("timestamp:sender:text\n"), чтение идет через mmap.
+// Переводы строк внутри текста (многострочные сообщения из кадров) хранятся как '\r': в строках
+// текстового протокола '\r' не бывает, поэтому замена однозначна.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdio>
+#include <string>
+#include <string_view>
+
+enum class ConversationKind { Private, Group };
+
+// Файл, отображенный в память только для чтения
+class MappedFile {
+public:
+    MappedFile() = default;
+    ~MappedFile() { unmap(); }
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool map(const std::string& path);
+    void unmap();
+    std::string_view contents() const { return std::string_view(m_data, m_size); }
+
+private:
+    const char* m_data = nullptr;
+    size_t m_size = 0;
+#ifdef _WIN32
+    void* m_file = nullptr;    // HANDLE
+    void* m_mapping = nullptr; // HANDLE
+#endif
+};
+
+class HistoryStore {
+public:
+    HistoryStore() = default;
+    ~HistoryStore() { close(); }
+    HistoryStore(const HistoryStore&) = delete;
+    HistoryStore& operator=(const HistoryStore&) = delete;
+
+    // Каталог кэша: MESSENGER_CACHE_DIR, иначе XDG_CACHE_HOME/HOME (Unix) или LOCALAPPDATA (Windows)
+    static std::string defaultRoot();
+    // Каталог аккаунта в root: в нем файлы бесед и индекс поиска (searchindex.h)
+    static std::string accountDirectory(const std::string& root, std::string_view account);
+
+    // Открывает (создает) файл беседы и отображает уже сохраненные записи в память
+    bool open(const std::string& root, std::string_view account, ConversationKind kind, std::string_view name);
+    void close();
+    bool isOpen() const { return !m_path.empty(); }
+
+    // Записи, сохраненные до open(). Действительны до close()
+    std::string_view records() const { return m_mapped.contents(); }
+    bool empty() const { return m_mapped.contents().empty(); }
+    // Метка времени последней сохраненной записи (пусто, если записей нет)
+    std::string_view lastTimestamp() const;
+    // Есть ли такая запись среди последних записей с той же меткой времени
+    // (сервер отдает дельту начиная с этой метки включительно)
+    bool hasRecordAtTail(std::string_view record) const;
+
+    bool append(std::string_view record);
+    bool truncate(); // Перед полной перезаписью истории с сервера
+    void flush();
+
+private:
+    bool openForAppend(const char* mode);
+
+    std::string m_path;
+    MappedFile m_mapped;
+    std::FILE* m_file = nullptr;
+};
+
+// Перебирает строки-записи кэша (без '\n')
+template <typename Func>
+void forEachHistoryRecord(std::string_view records, Func&& func) {
+    while (!records.empty()) {
+        size_t nl = records.find('\n');
+        std::string_view record = records.substr(0, nl);
+        if (!record.empty()) func(record);
+        if (nl == std::string_view::npos) break;
+        records.remove_prefix(nl + 1);
+    }
+}
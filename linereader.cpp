@@ -0,0 +1,119 @@
+﻿#include "linereader.h"
+
+#include <algorithm> // std::remove
+#include <cstring>   // std::memchr, std::memmove
+
+#include "frame.h"
+
+namespace {
+
+// Поиск '\n'. memchr в glibc/MSVC CRT векторизован (SSE2/AVX2), поэтому
+// сканирование идет по 16-32 байта за такт, а не побайтно.
+inline const char* findNewline(const char* from, size_t length) {
+    return static_cast<const char*>(std::memchr(from, '\n', length));
+}
+
+} // namespace
+
+LineReader::LineReader(size_t maxLineLength)
+    : m_maxLineLength(maxLineLength) {
+}
+
+void LineReader::reset() {
+    m_begin = m_end = m_scanned = 0;
+    m_discarding = false;
+    m_skipBytes = 0;
+}
+
+// Переносит непрочитанный хвост в начало буфера
+void LineReader::compact() {
+    if (m_begin == 0) return;
+    size_t pending = m_end - m_begin;
+    if (pending > 0) std::memmove(m_buffer.data(), m_buffer.data() + m_begin, pending);
+    m_scanned -= m_begin;
+    m_begin = 0;
+    m_end = pending;
+}
+
+ReadStatus LineReader::fill(SocketType socket) {
+    if (m_begin == m_end) { m_begin = m_end = m_scanned = 0; }
+    else if (m_buffer.size() - m_end < kChunkSize) compact();
+    if (m_buffer.size() - m_end < kChunkSize) m_buffer.resize(m_end + kChunkSize);
+
+    m_lastRead = 0;
+    int bytesReceived = recv(socket, m_buffer.data() + m_end, static_cast<int>(m_buffer.size() - m_end), 0);
+    if (bytesReceived == 0) return ReadStatus::Closed; // Сервер закрыл соединение
+    if (bytesReceived < 0) {
+#ifdef _WIN32
+        int error_code = WSAGetLastError();
+        if (error_code == WSAEWOULDBLOCK || error_code == WSAEINTR) return ReadStatus::NeedMore;
+#else
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) return ReadStatus::NeedMore;
+#endif
+        return ReadStatus::Error;
+    }
+    m_lastRead = static_cast<size_t>(bytesReceived);
+    m_end += m_lastRead;
+    return ReadStatus::NeedMore;
+}
+
+ReadStatus LineReader::next(std::string_view& line) {
+    char* data = m_buffer.data();
+
+    if (m_discarding) { // Дочитываем и выбрасываем хвост слишком длинной строки
+        const char* nl = findNewline(data + m_begin, m_end - m_begin);
+        if (!nl) { m_begin = m_end = m_scanned = 0; return ReadStatus::NeedMore; }
+        m_begin = m_scanned = static_cast<size_t>(nl - data) + 1;
+        m_discarding = false;
+    }
+
+    size_t from = std::max(m_scanned, m_begin);
+    const char* nl = findNewline(data + from, m_end - from);
+    if (!nl) {
+        m_scanned = m_end;
+        if (m_end - m_begin > m_maxLineLength) { // Конца строки не видно, а лимит уже превышен
+            m_begin = m_end = m_scanned = 0;
+            m_discarding = true;
+            return ReadStatus::TooLong;
+        }
+        return ReadStatus::NeedMore;
+    }
+
+    size_t start = m_begin;
+    size_t lineEnd = static_cast<size_t>(nl - data);
+    m_begin = m_scanned = lineEnd + 1;
+    if (lineEnd - start > m_maxLineLength) return ReadStatus::TooLong;
+
+    // Игнорируем '\r' (CRLF от сервера); строка правится прямо в буфере
+    char* lineStart = data + start;
+    size_t length = lineEnd - start;
+    if (length > 0 && std::memchr(lineStart, '\r', length)) {
+        length = static_cast<size_t>(std::remove(lineStart, lineStart + length, '\r') - lineStart);
+    }
+    line = std::string_view(lineStart, length);
+    return ReadStatus::Line;
+}
+
+ReadStatus LineReader::nextFrame(std::string_view& body) {
+    if (m_skipBytes > 0) { // Дочитываем и выбрасываем слишком длинный кадр
+        size_t skipped = std::min(m_skipBytes, m_end - m_begin);
+        m_begin += skipped;
+        m_skipBytes -= skipped;
+        if (m_skipBytes > 0) { m_begin = m_end = m_scanned = 0; return ReadStatus::NeedMore; }
+    }
+
+    size_t available = m_end - m_begin;
+    if (available < kFrameHeaderSize) return ReadStatus::NeedMore;
+    const char* header = m_buffer.data() + m_begin;
+    size_t length = readFrameLength(header);
+    if (length > m_maxLineLength) {
+        m_begin += kFrameHeaderSize;
+        m_skipBytes = length;
+        return ReadStatus::TooLong;
+    }
+    if (available - kFrameHeaderSize < length) return ReadStatus::NeedMore; // fill() дочитает, буфер растет сам
+
+    body = std::string_view(header + kFrameHeaderSize, length);
+    m_begin = m_scanned = m_begin + kFrameHeaderSize + length;
+    return ReadStatus::Line;
+}
@@ -0,0 +1,54 @@
+﻿// linereader.h : буферизованное чтение строк протокола ('\n') и двоичных кадров (frame.h) из сокета.
+
+#pragma once
+
+#include <cstddef>
+#include <string_view>
+#include <vector>
+
+#include "messengerclient.h"
+
+// Результат операций LineReader
+enum class ReadStatus {
+    Line,     // Извлечена полная строка (кадр)
+    NeedMore, // В буфере нет полной строки, нужен fill()
+    Closed,   // Сервер закрыл соединение
+    Error,    // Ошибка сокета
+    TooLong   // Строка (кадр) превысила лимит длины и была отброшена
+};
+
+// Приемный буфер соединения: читает сокет большими кусками и нарезает его на строки.
+// Строки возвращаются как string_view внутрь буфера и действительны до следующего fill() или reset().
+// Строки и кадры можно чередовать: после согласования кадров поток переключается посреди буфера.
+class LineReader {
+public:
+    static constexpr size_t kDefaultMaxLineLength = 64 * 1024; // Максимальная длина строки по умолчанию
+    static constexpr size_t kChunkSize = 64 * 1024;            // Сколько байт запрашиваем за один recv()
+
+    explicit LineReader(size_t maxLineLength = kDefaultMaxLineLength);
+
+    // Один вызов recv() в свободную часть буфера. Возвращает NeedMore, если данные прочитаны
+    ReadStatus fill(SocketType socket);
+    // Извлекает следующую строку из уже прочитанных данных (без '\n' и '\r')
+    ReadStatus next(std::string_view& line);
+    // Извлекает следующий кадр: тело без заголовка длины, для parseFrame()
+    ReadStatus nextFrame(std::string_view& body);
+
+    bool hasBufferedData() const { return m_end > m_begin; }
+    size_t lastRead() const { return m_lastRead; } // Байт, прочитанных последним fill()
+    size_t maxLineLength() const { return m_maxLineLength; }
+    void setMaxLineLength(size_t maxLineLength) { m_maxLineLength = maxLineLength; }
+    void reset();
+
+private:
+    void compact();
+
+    std::vector<char> m_buffer;
+    size_t m_begin = 0;      // Начало непрочитанных данных
+    size_t m_end = 0;        // Конец прочитанных из сокета данных
+    size_t m_scanned = 0;    // До этой позиции '\n' уже точно нет (чтобы не сканировать хвост повторно)
+    size_t m_maxLineLength;
+    bool m_discarding = false; // Пропускаем остаток слишком длинной строки до следующего '\n'
+    size_t m_skipBytes = 0;    // Сколько байт слишком длинного кадра еще пропустить
+    size_t m_lastRead = 0;
+};
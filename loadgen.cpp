@@ -0,0 +1,462 @@
+﻿#include "loadgen.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <queue>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "eventloop.h"
+#include "histogram.h"
+#include "linereader.h"
+#include "netutil.h"
+#include "protocol.h"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+enum class TrafficPattern { Private, Group, Mixed };
+
+struct LoadGenOptions {
+    std::string host = kDefaultServerIp;
+    unsigned short port = kDefaultServerPort;
+    int users = 10;                 // Синтетических пользователей
+    int threads = 2;                // Потоков с циклами событий
+    double durationSec = 10.0;      // Длительность отправки
+    double drainSec = 2.0;          // Сколько ждать запоздавших доставок после остановки отправки
+    double rate = 1.0;              // Сообщений в секунду на пользователя
+    int burst = 1;                  // Сообщений подряд за один "тик" (имитация вставки многострочного текста)
+    TrafficPattern pattern = TrafficPattern::Private;
+    std::string group = "loadtest";
+    std::string userPrefix = "lg_user";
+    std::string password = "bench";
+};
+
+void printUsage() {
+    std::cout << "Использование: client --bench [параметры]\n"
+        << "  --host <ip>          IP сервера (по умолчанию " << kDefaultServerIp << ")\n"
+        << "  --port <n>           Порт сервера (по умолчанию " << kDefaultServerPort << ")\n"
+        << "  --users <n>          Число синтетических пользователей (10)\n"
+        << "  --threads <n>        Потоков с циклами событий (2)\n"
+        << "  --duration <сек>     Длительность отправки (10)\n"
+        << "  --drain <сек>        Ожидание запоздавших доставок (2)\n"
+        << "  --rate <n>           Сообщений в секунду на пользователя (1)\n"
+        << "  --burst <n>          Сообщений подряд за один тик (1)\n"
+        << "  --pattern <p>        private | group | mixed (private)\n"
+        << "  --group <имя>        Группа для group/mixed (loadtest)\n"
+        << "  --prefix <имя>       Префикс имен пользователей (lg_user)\n"
+        << "  --password <пароль>  Пароль пользователей (bench)\n";
+}
+
+bool parseOptions(int argc, char* argv[], LoadGenOptions& options) {
+    for (int i = 2; i < argc; ++i) { // argv[1] == "--bench"
+        std::string arg = argv[i];
+        if (arg == "--help") return false;
+        if (i + 1 >= argc) { std::cerr << "[НАГРУЗКА] Нет значения для " << arg << std::endl; return false; }
+        std::string value = argv[++i];
+        if (arg == "--host") options.host = value;
+        else if (arg == "--port") options.port = static_cast<unsigned short>(std::atoi(value.c_str()));
+        else if (arg == "--users") options.users = std::atoi(value.c_str());
+        else if (arg == "--threads") options.threads = std::atoi(value.c_str());
+        else if (arg == "--duration") options.durationSec = std::atof(value.c_str());
+        else if (arg == "--drain") options.drainSec = std::atof(value.c_str());
+        else if (arg == "--rate") options.rate = std::atof(value.c_str());
+        else if (arg == "--burst") options.burst = std::atoi(value.c_str());
+        else if (arg == "--group") options.group = value;
+        else if (arg == "--prefix") options.userPrefix = value;
+        else if (arg == "--password") options.password = value;
+        else if (arg == "--pattern") {
+            if (value == "private") options.pattern = TrafficPattern::Private;
+            else if (value == "group") options.pattern = TrafficPattern::Group;
+            else if (value == "mixed") options.pattern = TrafficPattern::Mixed;
+            else { std::cerr << "[НАГРУЗКА] Неизвестный шаблон: " << value << std::endl; return false; }
+        }
+        else { std::cerr << "[НАГРУЗКА] Неизвестный параметр: " << arg << std::endl; return false; }
+    }
+    if (options.users < 1 || options.threads < 1 || options.rate <= 0 || options.burst < 1 || options.durationSec <= 0) {
+        std::cerr << "[НАГРУЗКА] Некорректные параметры." << std::endl;
+        return false;
+    }
+    if (options.pattern != TrafficPattern::Group && options.users < 2) {
+        std::cerr << "[НАГРУЗКА] Для личных сообщений нужно минимум 2 пользователя." << std::endl;
+        return false;
+    }
+    return true;
+}
+
+const char* patternName(TrafficPattern pattern) {
+    switch (pattern) {
+    case TrafficPattern::Group: return "group";
+    case TrafficPattern::Mixed: return "mixed";
+    default: return "private";
+    }
+}
+
+// Этапы жизни синтетического пользователя
+enum class Phase { Registering, LoggingIn, JoiningGroup, Ready, Failed };
+
+struct BenchUser {
+    int index = 0;
+    std::string name;
+    SocketType socket = INVALID_SOCKET_VALUE;
+    LineReader reader;
+    std::string outbox;          // Еще не отправленные байты
+    Phase phase = Phase::Registering;
+    int pendingJoinReplies = 0;  // Ответов на CREATE_GROUP/JOIN_GROUP, которые еще ждем
+    uint64_t seq = 0;
+};
+
+// Общее состояние прогона
+struct RunState {
+    const LoadGenOptions* options = nullptr;
+    Clock::time_point epoch;               // Точка отсчета для меток в тексте сообщений
+    std::atomic<int> readyUsers{ 0 };
+    std::atomic<int> failedUsers{ 0 };
+    std::atomic<bool> sending{ false };
+    std::atomic<bool> stopping{ false };
+    Clock::time_point sendStart;           // Записывается до sending = true
+};
+
+struct WorkerStats {
+    LatencyHistogram latency;  // Наносекунды от отправки до получения
+    uint64_t sent = 0;
+    uint64_t received = 0;     // Сопоставленные доставки (с меткой времени в тексте)
+    uint64_t bytesOut = 0;
+    uint64_t bytesIn = 0;
+    uint64_t disconnects = 0;
+};
+
+class Worker {
+public:
+    explicit Worker(RunState& run) : m_run(run) {}
+
+    bool valid() const { return m_loop.valid(); }
+    void addUser(std::unique_ptr<BenchUser> user) {
+        m_bySocket[user->socket] = user.get();
+        m_users.push_back(std::move(user));
+    }
+    void start() { m_thread = std::thread(&Worker::run, this); }
+    void wake() { m_loop.wake(); }
+    void join() { if (m_thread.joinable()) m_thread.join(); }
+    const WorkerStats& stats() const { return m_stats; }
+
+private:
+    struct SendTimer {
+        Clock::time_point when;
+        BenchUser* user;
+        bool operator>(const SendTimer& other) const { return when > other.when; }
+    };
+
+    void run();
+    void scheduleSends();
+    void sendTick(BenchUser& user, Clock::time_point now);
+    void queueLine(BenchUser& user, const std::string& line);
+    void flushOutbox(BenchUser& user);
+    void readFrom(BenchUser& user);
+    void handleLine(BenchUser& user, std::string_view line);
+    void recordDelivery(std::string_view text);
+    void markReady(BenchUser& user);
+    void markFailed(BenchUser& user);
+    void dropUser(BenchUser& user);
+
+    RunState& m_run;
+    EventLoop m_loop;
+    std::thread m_thread;
+    std::vector<std::unique_ptr<BenchUser>> m_users;
+    std::unordered_map<SocketType, BenchUser*> m_bySocket;
+    std::priority_queue<SendTimer, std::vector<SendTimer>, std::greater<SendTimer>> m_timers;
+    bool m_sendingStarted = false;
+    WorkerStats m_stats;
+};
+
+void Worker::run() {
+    for (auto& user : m_users) {
+        m_loop.add(user->socket);
+        queueLine(*user, "REGISTRATION " + user->name + " " + m_run.options->password);
+    }
+
+    std::vector<IoEvent> events;
+    while (!m_run.stopping.load()) {
+        if (!m_sendingStarted && m_run.sending.load()) scheduleSends();
+        if (m_sendingStarted && !m_run.sending.load()) { m_timers = {}; m_sendingStarted = false; } // Фаза дренажа
+
+        int timeoutMs = 50; // До начала отправки - только проверка флагов
+        if (!m_timers.empty()) {
+            auto untilNext = std::chrono::duration_cast<std::chrono::milliseconds>(m_timers.top().when - Clock::now()).count();
+            timeoutMs = static_cast<int>(std::max<long long>(0, std::min<long long>(untilNext, 50)));
+        }
+        if (m_loop.wait(events, timeoutMs) < 0) break;
+
+        for (const IoEvent& event : events) {
+            auto it = m_bySocket.find(event.socket);
+            if (it == m_bySocket.end()) continue;
+            BenchUser& user = *it->second;
+            if (event.writable) flushOutbox(user);
+            if (event.readable || event.error) readFrom(user);
+        }
+
+        Clock::time_point now = Clock::now();
+        while (!m_timers.empty() && m_timers.top().when <= now) {
+            SendTimer timer = m_timers.top();
+            m_timers.pop();
+            if (timer.user->phase != Phase::Ready) continue;
+            sendTick(*timer.user, now);
+            // Следующий тик по расписанию; если сильно отстали - не пытаемся догнать очередью
+            auto interval = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / m_run.options->rate));
+            Clock::time_point next = timer.when + interval;
+            if (next + std::chrono::seconds(1) < now) next = now + interval;
+            m_timers.push({ next, timer.user });
+        }
+    }
+
+    for (auto& user : m_users) {
+        if (user->socket != INVALID_SOCKET_VALUE) { m_loop.remove(user->socket); CLOSE_SOCKET(user->socket); }
+    }
+}
+
+// Разносим первые отправки пользователей равномерно по интервалу, чтобы не было залпа
+void Worker::scheduleSends() {
+    m_sendingStarted = true;
+    const LoadGenOptions& options = *m_run.options;
+    auto interval = std::chrono::duration<double>(1.0 / options.rate);
+    for (auto& user : m_users) {
+        auto offset = std::chrono::duration_cast<Clock::duration>(interval * (static_cast<double>(user->index) / options.users));
+        m_timers.push({ m_run.sendStart + offset, user.get() });
+    }
+}
+
+void Worker::sendTick(BenchUser& user, Clock::time_point now) {
+    const LoadGenOptions& options = *m_run.options;
+    for (int i = 0; i < options.burst; ++i) {
+        uint64_t seq = user.seq++;
+        uint64_t sentNs = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(now - m_run.epoch).count());
+        // Текст несет метку отправки - по ней получатель считает задержку
+        std::string text = "lg " + std::to_string(sentNs) + " " + std::to_string(seq);
+        bool toGroup = options.pattern == TrafficPattern::Group || (options.pattern == TrafficPattern::Mixed && (seq & 1));
+        if (toGroup) {
+            queueLine(user, "SEND_GROUP " + options.group + " " + text);
+        }
+        else {
+            int peer = (user.index + 1) % options.users;
+            queueLine(user, "SEND_PRIVATE " + options.userPrefix + std::to_string(peer) + " " + text);
+        }
+        ++m_stats.sent;
+    }
+}
+
+void Worker::queueLine(BenchUser& user, const std::string& line) {
+    if (user.socket == INVALID_SOCKET_VALUE) return;
+    bool wasEmpty = user.outbox.empty();
+    user.outbox += line;
+    user.outbox += '\n';
+    if (wasEmpty) flushOutbox(user);
+}
+
+void Worker::flushOutbox(BenchUser& user) {
+    while (!user.outbox.empty() && user.socket != INVALID_SOCKET_VALUE) {
+        int sent = send(user.socket, user.outbox.data(), static_cast<int>(user.outbox.size()), kSendFlags);
+        if (sent > 0) {
+            m_stats.bytesOut += static_cast<uint64_t>(sent);
+            user.outbox.erase(0, static_cast<size_t>(sent));
+            continue;
+        }
+        if (sent < 0 && isWouldBlockError(GET_LAST_ERROR)) {
+            m_loop.setWantWrite(user.socket, true); // Допишем, когда сокет освободится
+            return;
+        }
+        dropUser(user);
+        return;
+    }
+    if (user.socket != INVALID_SOCKET_VALUE) m_loop.setWantWrite(user.socket, false);
+}
+
+void Worker::readFrom(BenchUser& user) {
+    ReadStatus status = user.reader.fill(user.socket);
+    if (status == ReadStatus::Closed || status == ReadStatus::Error) { dropUser(user); return; }
+    std::string_view line;
+    while ((status = user.reader.next(line)) != ReadStatus::NeedMore) {
+        if (status == ReadStatus::Line) {
+            m_stats.bytesIn += line.size() + 1;
+            handleLine(user, line);
+        }
+    }
+}
+
+void Worker::handleLine(BenchUser& user, std::string_view message) {
+    ServerLine line = splitServerLine(message);
+    const LoadGenOptions& options = *m_run.options;
+    bool isError = startsWith(line.prefix, "ERROR_");
+
+    switch (user.phase) {
+    case Phase::Registering:
+        if (line.prefix == "OK_REGISTERED" || line.prefix == "OK_LOGIN") markReady(user);
+        else if (isError) { // Уже зарегистрирован - входим
+            user.phase = Phase::LoggingIn;
+            queueLine(user, "LOGIN " + user.name + " " + options.password);
+        }
+        return;
+    case Phase::LoggingIn:
+        if (line.prefix == "OK_LOGIN") markReady(user);
+        else if (isError) markFailed(user);
+        return;
+    case Phase::JoiningGroup:
+        // CREATE_GROUP у всех, кроме первого, вернет ошибку; JOIN_GROUP у создателя - тоже может
+        if (startsWith(line.prefix, "OK_") || isError) {
+            if (--user.pendingJoinReplies == 0) {
+                user.phase = Phase::Ready;
+                m_run.readyUsers.fetch_add(1);
+            }
+        }
+        return;
+    default:
+        break;
+    }
+
+    if (line.prefix == "MSG_FROM") {
+        SenderText msg;
+        if (parseSenderText(line.payload, msg)) recordDelivery(msg.text);
+    }
+    else if (line.prefix == "GROUP_MSG_FROM") {
+        GroupMessage msg = parseGroupMessage(line.payload);
+        if (msg.hasMessage) recordDelivery(msg.message.text);
+    }
+}
+
+void Worker::recordDelivery(std::string_view text) {
+    if (!startsWith(text, "lg ")) return; // Не наше сообщение
+    auto [stamp, rest] = splitFirstWord(text.substr(3));
+    uint64_t sentNs = 0;
+    for (char c : stamp) {
+        if (c < '0' || c > '9') return;
+        sentNs = sentNs * 10 + static_cast<uint64_t>(c - '0');
+    }
+    uint64_t nowNs = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - m_run.epoch).count());
+    m_stats.latency.record(nowNs > sentNs ? nowNs - sentNs : 0);
+    ++m_stats.received;
+}
+
+void Worker::markReady(BenchUser& user) {
+    if (m_run.options->pattern == TrafficPattern::Private) {
+        user.phase = Phase::Ready;
+        m_run.readyUsers.fetch_add(1);
+        return;
+    }
+    user.phase = Phase::JoiningGroup;
+    user.pendingJoinReplies = 2;
+    queueLine(user, "CREATE_GROUP " + m_run.options->group);
+    queueLine(user, "JOIN_GROUP " + m_run.options->group);
+}
+
+void Worker::markFailed(BenchUser& user) {
+    if (user.phase == Phase::Failed) return;
+    bool wasReady = user.phase == Phase::Ready;
+    user.phase = Phase::Failed;
+    if (!wasReady) m_run.failedUsers.fetch_add(1);
+}
+
+void Worker::dropUser(BenchUser& user) {
+    if (user.socket == INVALID_SOCKET_VALUE) return;
+    ++m_stats.disconnects;
+    markFailed(user);
+    m_loop.remove(user.socket);
+    m_bySocket.erase(user.socket);
+    CLOSE_SOCKET(user.socket);
+    user.socket = INVALID_SOCKET_VALUE;
+    user.outbox.clear();
+}
+
+double toMs(uint64_t ns) { return static_cast<double>(ns) / 1e6; }
+
+} // namespace
+
+int runLoadGenerator(int argc, char* argv[]) {
+    LoadGenOptions options;
+    if (!parseOptions(argc, argv, options)) { printUsage(); return 2; }
+
+    RunState run;
+    run.options = &options;
+    run.epoch = Clock::now();
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    for (int i = 0; i < options.threads; ++i) {
+        workers.push_back(std::make_unique<Worker>(run));
+        if (!workers.back()->valid()) { std::cerr << "[НАГРУЗКА] Не удалось создать цикл событий." << std::endl; return 1; }
+    }
+
+    std::cout << "[НАГРУЗКА] Подключение " << options.users << " пользователей к " << options.host << ":" << options.port << "..." << std::endl;
+    auto connectStart = Clock::now();
+    for (int i = 0; i < options.users; ++i) {
+        int errorCode = 0;
+        SocketType socketFd = connectTcp(options.host, options.port, errorCode);
+        if (socketFd == INVALID_SOCKET_VALUE) {
+            std::cerr << "[НАГРУЗКА] Подключение пользователя " << i << " не удалось: " << errorCode << std::endl;
+            return 1;
+        }
+        setSocketNonBlocking(socketFd);
+        auto user = std::make_unique<BenchUser>();
+        user->index = i;
+        user->name = options.userPrefix + std::to_string(i);
+        user->socket = socketFd;
+        workers[static_cast<size_t>(i % options.threads)]->addUser(std::move(user));
+    }
+    double connectSec = std::chrono::duration<double>(Clock::now() - connectStart).count();
+
+    auto loginStart = Clock::now();
+    for (auto& worker : workers) worker->start();
+    // Ждем, пока все войдут (или не смогут), не дольше 30 секунд
+    while (run.readyUsers.load() + run.failedUsers.load() < options.users && Clock::now() - loginStart < std::chrono::seconds(30)) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    double loginSec = std::chrono::duration<double>(Clock::now() - loginStart).count();
+    int ready = run.readyUsers.load();
+    std::cout << "[НАГРУЗКА] Подключение: " << connectSec * 1000 << " мс, вход: " << loginSec * 1000 << " мс, готовы "
+        << ready << " из " << options.users << std::endl;
+    if (ready == 0) {
+        run.stopping = true;
+        for (auto& worker : workers) { worker->wake(); worker->join(); }
+        std::cerr << "[НАГРУЗКА] Ни один пользователь не вошел." << std::endl;
+        return 1;
+    }
+
+    std::cout << "[НАГРУЗКА] Отправка: " << options.durationSec << " с, " << options.rate << " сообщ/с на пользователя, шаблон "
+        << patternName(options.pattern) << ", потоков " << options.threads << std::endl;
+    run.sendStart = Clock::now();
+    run.sending = true;
+    for (auto& worker : workers) worker->wake();
+    std::this_thread::sleep_for(std::chrono::duration<double>(options.durationSec));
+    run.sending = false;
+    std::this_thread::sleep_for(std::chrono::duration<double>(options.drainSec)); // Ждем запоздавшие доставки
+    run.stopping = true;
+    for (auto& worker : workers) { worker->wake(); worker->join(); }
+
+    WorkerStats total;
+    for (auto& worker : workers) {
+        const WorkerStats& stats = worker->stats();
+        total.latency.merge(stats.latency);
+        total.sent += stats.sent;
+        total.received += stats.received;
+        total.bytesOut += stats.bytesOut;
+        total.bytesIn += stats.bytesIn;
+        total.disconnects += stats.disconnects;
+    }
+
+    double seconds = options.durationSec;
+    std::cout << std::fixed << std::setprecision(2);
+    std::cout << "[НАГРУЗКА] Отправлено: " << total.sent << " (" << total.sent / seconds << " сообщ/с), доставлено: "
+        << total.received << " (" << total.received / seconds << " сообщ/с)" << std::endl;
+    std::cout << "[НАГРУЗКА] Трафик: исходящий " << total.bytesOut / seconds / 1024 << " КБ/с, входящий "
+        << total.bytesIn / seconds / 1024 << " КБ/с, разрывов: " << total.disconnects << std::endl;
+    std::cout << "[НАГРУЗКА] Задержка доставки (мс): p50=" << toMs(total.latency.percentile(0.50))
+        << " p99=" << toMs(total.latency.percentile(0.99))
+        << " p999=" << toMs(total.latency.percentile(0.999))
+        << " max=" << toMs(total.latency.max())
+        << " среднее=" << total.latency.mean() / 1e6 << std::endl;
+    return total.disconnects == 0 ? 0 : 1;
+}
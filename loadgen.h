@@ -0,0 +1,8 @@
+﻿// loadgen.h : нагрузочный режим клиента (--bench).
+// Один процесс логинит N синтетических пользователей, гоняет между ними SEND_PRIVATE/SEND_GROUP
+// с заданной частотой и меряет сквозную задержку доставки по входящим MSG_FROM/GROUP_MSG_FROM.
+
+#pragma once
+
+// Разбирает параметры после --bench, выполняет прогон и печатает отчет. Возвращает код завершения процесса
+int runLoadGenerator(int argc, char* argv[]);
@@ -1,100 +1,67 @@
 ﻿#include <iostream>
 #include <string>
 #include <thread>
-#include <sstream>
 #include <chrono>
 #include <atomic>    // std::atomic_bool
 #include <mutex>     // std::mutex
-#include <algorithm> // std::remove, std::transform
+#include <algorithm> // std::remove, std::replace, std::transform
 #include <vector>    // std::vector
 #include <cctype>    // std::toupper
-#include <iomanip>   // std::put_time
-#include <map>       // std::map (для будущих непрочитанных)
-
-#ifdef _WIN32
-#ifndef WIN32_LEAN_AND_MEAN
-#define WIN32_LEAN_AND_MEAN
-#endif
-#include <winsock2.h>
-#include <ws2tcpip.h>
-#include <windows.h> 
-#pragma comment(lib, "ws2_32.lib")
-#else
-#include <sys/socket.h>
-#include <netinet/in.h>
-#include <arpa/inet.h>
-#include <unistd.h>
-#include <errno.h> 
-#include <string.h> 
-#include <sys/ioctl.h> 
-#include <sys/select.h> 
-#endif
-
-// Кросс-платформенные определения
-#ifdef _WIN32
-typedef SOCKET SocketType;
-#define INVALID_SOCKET_VALUE INVALID_SOCKET
-#define SOCKET_ERROR_VALUE SOCKET_ERROR
-#define CLOSE_SOCKET closesocket
-#define GET_LAST_ERROR WSAGetLastError()
-#else
-typedef int SocketType;
-#define INVALID_SOCKET_VALUE -1
-#define SOCKET_ERROR_VALUE -1
-#define CLOSE_SOCKET close
-#define GET_LAST_ERROR errno
-#endif
-
-// Глобальные переменные состояния клиента
-SocketType G_clientSocket = INVALID_SOCKET_VALUE;
+#include <cstdlib>   // std::getenv
+#include <array>     // std::array
+#include <optional>  // std::optional
+#include <memory>    // std::shared_ptr
+#include <cstdio>    // std::snprintf, std::FILE
+#include <ctime>     // std::time
+#include <csignal>   // SIGUSR1
+
+#include "messengerclient.h"
+#include "alloccount.h"
+#include "backoff.h"
+#include "consolerenderer.h"
+#include "eventloop.h"
+#include "protocol.h"
+#include "timeformat.h"
+#include "loadgen.h"
+#include "netutil.h"
+#include "searchindex.h"
+#include "session.h"
+#include "sessionevents.h"
+#include "sessionlistener.h"
+#include "trace.h"
+#include "unreadindex.h"
+
+// Глобальные переменные консольного интерфейса. Соединение, вход и открытая беседа - в Session
 std::atomic<bool> G_clientRunning(true);            // Управляет основным циклом клиента и потоком приемника
 std::atomic<bool> G_programShouldExit(false);       // Флаг для полного завершения программы
-std::mutex G_coutMutex;                             // Защита для std::cout
-std::atomic<bool> G_loggedIn(false);                // Статус логина
-std::string G_currentUsername;                      // Имя текущего пользователя
-std::atomic<bool> G_inChatMode(false);              // Флаг: активен личный чат
-std::string G_currentChatPartner;                   // Имя собеседника в личном чате
-std::atomic<bool> G_inGroupChatMode(false);         // Флаг: активен групповой чат
-std::string G_currentGroupName;                     // Имя текущей группы
-std::atomic<bool> G_waitingForChatInitiation(false);// Флаг: ожидается ответ сервера на открытие чата (история)
-std::atomic<bool> G_isReceivingFriendList(false);   // Флаг: идет прием списка друзей
-std::atomic<bool> G_isReceivingGroupList(false);    // Флаг: идет прием списка групп
+std::mutex G_coutMutex;                             // Защита для G_renderer/G_screen
+ConsoleRenderer G_renderer;                         // Экран: сообщения и строка ввода, вывод кадрами
+std::ostream& G_screen = G_renderer.out();          // Печать в область сообщений (под G_coutMutex)
+std::atomic<uint64_t> G_receiverAllocations(0);     // threadAllocations() потоков приемника и вывода для /stats
+std::atomic<uint64_t> G_renderAllocations(0);       // (только в сборке с MESSENGER_COUNT_ALLOCS)
+#if defined(MESSENGER_TRACE) && defined(SIGUSR1)
+std::atomic<bool> G_traceDumpRequested(false);     // SIGUSR1: приемник пишет трассу, не дожидаясь выхода
+EventLoop* G_traceEventLoop = nullptr;             // Его будит обработчик сигнала (wake() - один write())
+#endif
 
 
 // --- Прототипы функций UI ---
 void clearConsoleScreen();
 void printWelcomeMessage();
 void printHelp(bool isLoggedIn, bool isInChatMode, bool isInGroupChatMode, const std::string& currentChatTarget);
-void displayPrompt();
-void printInitialScreen();
-void displayChatMessageClient(const std::string& timestamp_str, const std::string& sender, const std::string& message_text);
-std::string formatTimestampForDisplay(const std::string& full_timestamp_from_server);
-std::string getCurrentLocalTimestampForChatDisplay();
+void printSessionHelp(const Session& session);
+void displayPrompt(const Session& session);
+void printInitialScreen(const Session& session);
+void displayChatMessageClient(std::string_view self, std::string_view timestamp_str, std::string_view sender, std::string_view message_text);
 // --- Конец прототипов UI ---
 
 
 void clearConsoleScreen() {
-#ifdef _WIN32
-    HANDLE hStdOut = GetStdHandle(STD_OUTPUT_HANDLE);
-    CONSOLE_SCREEN_BUFFER_INFO csbi;
-    DWORD count;
-    DWORD cellCount;
-    COORD homeCoords = { 0, 0 };
-
-    if (hStdOut == INVALID_HANDLE_VALUE) return;
-    if (!GetConsoleScreenBufferInfo(hStdOut, &csbi)) return;
-    cellCount = csbi.dwSize.X * csbi.dwSize.Y;
-    if (!FillConsoleOutputCharacter(hStdOut, (TCHAR)' ', cellCount, homeCoords, &count)) return;
-    if (!FillConsoleOutputAttribute(hStdOut, csbi.wAttributes, cellCount, homeCoords, &count)) return;
-    SetConsoleCursorPosition(hStdOut, homeCoords);
-#else
-    // ANSI-последовательность для очистки экрана и перемещения курсора в начало
-    std::cout << "\033[2J\033[1;1H" << std::flush;
-#endif
+    G_renderer.clearScreen(); // Экран очистится со следующим кадром
 }
 
 void printWelcomeMessage() {
-    std::cout << R"(
+    G_screen << R"(
 ================================================================================
  Добро пожаловать в наш Консольный Мессенджер!
 ================================================================================
@@ -117,673 +84,1151 @@ void printWelcomeMessage() {
 }
 
 void printHelp(bool isLoggedIn, bool isInChatMode, bool isInGroupChatMode, const std::string& currentChatTarget) {
-    std::cout << "\n--- Доступные команды ---\n";
+    G_screen << "\n--- Доступные команды ---\n";
     if (isInGroupChatMode) {
-        std::cout << "  Вы находитесь в групповом чате '" << currentChatTarget << "'.\n";
-        std::cout << "  Просто вводите текст и нажимайте Enter для отправки сообщения.\n";
-        std::cout << "  /exit_chat - Покинуть текущий чат.\n";
+        G_screen << "  Вы находитесь в групповом чате '" << currentChatTarget << "'.\n";
+        G_screen << "  Просто вводите текст и нажимайте Enter для отправки сообщения.\n";
+        G_screen << "  /more - Показать более ранние сообщения.\n";
+        G_screen << "  /exit_chat - Покинуть текущий чат.\n";
+        G_screen << "  /stats - Статистика клиента: задержки, трафик, счетчики.\n";
     }
     else if (isInChatMode) {
-        std::cout << "  Вы находитесь в чате с " << currentChatTarget << ".\n";
-        std::cout << "  Просто вводите текст и нажимайте Enter для отправки сообщения.\n";
-        std::cout << "  /exit_chat - Покинуть текущий чат.\n";
+        G_screen << "  Вы находитесь в чате с " << currentChatTarget << ".\n";
+        G_screen << "  Просто вводите текст и нажимайте Enter для отправки сообщения.\n";
+        G_screen << "  /more - Показать более ранние сообщения.\n";
+        G_screen << "  /exit_chat - Покинуть текущий чат.\n";
+        G_screen << "  /stats - Статистика клиента: задержки, трафик, счетчики.\n";
     }
     else if (!isLoggedIn) {
-        std::cout << "  LOGIN <имя_пользователя> <пароль> - Войти в систему\n";
-        std::cout << "  REGISTRATION <имя_пользователя> <пароль> - Зарегистрировать нового пользователя\n";
-        std::cout << "  HELP - Показать это сообщение помощи\n";
-        std::cout << "  EXIT - Выйти из программы\n";
+        G_screen << "  LOGIN <имя_пользователя> <пароль> - Войти в систему\n";
+        G_screen << "  REGISTRATION <имя_пользователя> <пароль> - Зарегистрировать нового пользователя\n";
+        G_screen << "  HELP - Показать это сообщение помощи\n";
+        G_screen << "  EXIT - Выйти из программы\n";
     }
     else { // Залогинен, не в чате
-        std::cout << "  CREATE_GROUP <название_группы> - Создать новую группу.\n";
-        std::cout << "  JOIN_GROUP <название_группы> - Присоединиться к существующей группе.\n";
-        std::cout << "  GROUPCHAT <название_группы> - Открыть групповой чат.\n";
-        std::cout << "  LIST_MY_GROUPS - Показать список ваших групп.\n";
-        std::cout << "  CHAT <имя_пользователя> - Открыть личный чат.\n";
-        std::cout << "  FRIENDS - Показать список ваших личных чатов и их статус.\n"; // Сервер поддерживает GET_CHAT_PARTNERS
-        std::cout << "  HELP - Показать это сообщение помощи\n";
-        std::cout << "  EXIT - Выйти из текущей учетной записи (LOGOUT)\n";
+        G_screen << "  CREATE_GROUP <название_группы> - Создать новую группу.\n";
+        G_screen << "  JOIN_GROUP <название_группы> - Присоединиться к существующей группе.\n";
+        G_screen << "  GROUPCHAT <название_группы> - Открыть групповой чат.\n";
+        G_screen << "  LIST_MY_GROUPS - Показать список ваших групп.\n";
+        G_screen << "  CHAT <имя_пользователя> - Открыть личный чат.\n";
+        G_screen << "  FRIENDS - Показать список ваших личных чатов и их статус.\n"; // Сервер поддерживает GET_CHAT_PARTNERS
+        G_screen << "  UNREAD - Показать беседы с непрочитанными сообщениями.\n";
+        G_screen << "  SEARCH <слова> [in <чат>] - Поиск по полученным сообщениям.\n";
+        G_screen << "  /stats - Статистика клиента: задержки, трафик, счетчики.\n";
+        G_screen << "  HELP - Показать это сообщение помощи\n";
+        G_screen << "  EXIT - Выйти из текущей учетной записи (LOGOUT)\n";
     }
-    std::cout << "-------------------------\n" << std::endl;
+    G_screen << "-------------------------\n" << std::endl;
 }
 
 
-void displayPrompt() {
-    // Очистка текущей строки перед выводом промпта (для красоты при асинхронных сообщениях)
-    std::cout << "\r" << std::string(120, ' ') << "\r";
-    if (G_inGroupChatMode.load()) {
-        std::cout << "[" << G_currentUsername << " @ Group:" << G_currentGroupName << "] > " << std::flush;
-    }
-    else if (G_inChatMode.load()) {
-        std::cout << "[" << G_currentUsername << " @ " << G_currentChatPartner << "] > " << std::flush;
+// Справка для текущего состояния сессии
+void printSessionHelp(const Session& session) {
+    std::shared_ptr<const SessionState> state = session.state(); // Вход и беседа - из одного снимка
+    const Conversation& conversation = state->conversation;
+    bool inGroupChat = conversation.active && conversation.kind == ConversationKind::Group;
+    bool inChat = conversation.active && conversation.kind == ConversationKind::Private;
+    printHelp(state->loggedIn, inChat, inGroupChat, conversation.active ? conversation.name : "");
+}
+
+void displayPrompt(const Session& session) {
+    // Строку ввода перерисовывает рендер: промпт только задается. Вызывается на каждую порцию вывода,
+    // поэтому собирается в одной строке (все вызовы - под G_coutMutex)
+    static std::string prompt;
+    std::shared_ptr<const SessionState> state = session.state(); // Имя и беседа - из одного снимка
+    const Conversation& conversation = state->conversation;
+    if (conversation.active) {
+        prompt.assign("[");
+        prompt += state->username;
+        prompt += conversation.kind == ConversationKind::Group ? " @ Group:" : " @ ";
+        prompt += conversation.name;
+        prompt += "] > ";
     }
-    else if (G_loggedIn.load()) {
-        std::cout << "[" << G_currentUsername << "] > " << std::flush;
+    else if (state->loggedIn) {
+        prompt.assign("[");
+        prompt += state->username;
+        prompt += "] > ";
     }
     else {
-        std::cout << "Messenger > " << std::flush;
+        prompt.assign("Messenger > ");
     }
+    G_renderer.setPrompt(prompt);
 }
 
-void printInitialScreen() {
+void printInitialScreen(const Session& session) {
     std::lock_guard<std::mutex> lock(G_coutMutex);
     clearConsoleScreen();
     printWelcomeMessage();
-    std::string target = G_inGroupChatMode.load() ? G_currentGroupName : (G_inChatMode.load() ? G_currentChatPartner : "");
-    printHelp(G_loggedIn.load(), G_inChatMode.load(), G_inGroupChatMode.load(), target);
-    displayPrompt();
-}
-
-// Форматирует серверный timestamp (YYYY-MM-DD HH:MM:SS) для отображения.
-// Если сегодня, то HH:MM, иначе [DD.MM | HH:MM]
-std::string formatTimestampForDisplay(const std::string& full_timestamp_from_server) {
-    // Проверка базового формата YYYY-MM-DD HH:MM:SS
-    if (full_timestamp_from_server.length() == 19 &&
-        full_timestamp_from_server[4] == '-' && full_timestamp_from_server[7] == '-' &&
-        full_timestamp_from_server[10] == ' ' &&
-        full_timestamp_from_server[13] == ':' && full_timestamp_from_server[16] == ':') {
-
-        std::string month_str = full_timestamp_from_server.substr(5, 2);
-        std::string day_str = full_timestamp_from_server.substr(8, 2);
-        std::string hour_str = full_timestamp_from_server.substr(11, 2);
-        std::string minute_str = full_timestamp_from_server.substr(14, 2);
-
-        std::string formatted_date = day_str + "." + month_str;
-        std::string formatted_time = hour_str + ":" + minute_str;
-
-        // Получаем текущую дату для сравнения
-        auto now = std::chrono::system_clock::now();
-        auto in_time_t = std::chrono::system_clock::to_time_t(now);
-        std::tm buf_today;
-#ifdef _WIN32
-        localtime_s(&buf_today, &in_time_t);
-#else
-        localtime_r(&in_time_t, &buf_today); // Потокобезопасно
-#endif
-        std::stringstream today_ss;
-        today_ss << std::setfill('0') << std::setw(2) << buf_today.tm_mday << "."
-            << std::setfill('0') << std::setw(2) << (buf_today.tm_mon + 1);
-        std::string today_date_str = today_ss.str();
+    printSessionHelp(session);
+    displayPrompt(session);
+}
+
+// Форматирует сообщение чата в строку вывода (с '\n' в конце). self - имя текущего пользователя
+// own - сообщение пользователя ("Вы: "); входящие сверяют номера имен, а не строки
+void appendChatMessage(std::string& out, bool own, std::string_view timestamp_str, std::string_view sender, std::string_view message_text) {
+    out += formatTimestampForDisplay(timestamp_str).view();
+    out += ' ';
+    if (own) { // Свои сообщения
+        out += "Вы: ";
+    }
+    else { // Сообщения от других
+        out += sender;
+        out += ": ";
+    }
+    out += message_text;
+    out += '\n';
+}
+
+void appendChatMessage(std::string& out, std::string_view self, std::string_view timestamp_str, std::string_view sender, std::string_view message_text) {
+    appendChatMessage(out, sender == self, timestamp_str, sender, message_text);
+}
+
+// Отображает сообщение чата в консоли
+void displayChatMessageClient(std::string_view self, std::string_view timestamp_str, std::string_view sender, std::string_view message_text) {
+    TRACE_SCOPE("displayChatMessage");
+    std::string line;
+    appendChatMessage(line, self, timestamp_str, sender, message_text);
+    G_renderer.print(line);
+}
+
+// "sender: text" входящего сообщения для уведомлений. У кадра строки сервера нет - собираем из полей
+void printMessageBody(const ChatMessage& message) {
+    if (!message.body.empty() || !message.parsed) G_screen << message.body;
+    else G_screen << message.sender << ": " << message.text;
+}
+
+
+// Порог очереди исходящих, после которого пользователь видит предупреждение о медленной сети. Снова
+// предупреждение возможно, только когда очередь опустилась ниже половины порога
+constexpr size_t kSendQueueWarnDepth = 1000;
+constexpr size_t kSendQueueRearmDepth = kSendQueueWarnDepth / 2;
+
+// Предупреждает, если очередь исходящих растет быстрее, чем уходит в сеть (вызывается без G_coutMutex, из main).
+// Глубина может перескочить порог (несколько команд за раз, flush() пачками), поэтому сравнение - не на равенство
+void warnIfSendBacklog(const Session& session) {
+    static bool warned = false;
+    const SendQueue& queue = session.sendQueue();
+    size_t depth = queue.depth();
+    if (depth < kSendQueueRearmDepth) warned = false;
+    if (warned || depth < kSendQueueWarnDepth) return;
+    warned = true;
+    std::lock_guard<std::mutex> lock(G_coutMutex);
+    G_screen << "[СИСТЕМА] Сеть не успевает: в очереди " << depth << " сообщений ("
+        << queue.pendingBytes() / 1024 << " КБ)." << std::endl;
+    displayPrompt(session);
+}
+
 
-        if (formatted_date == today_date_str) {
-            return formatted_time; // Сообщение от сегодня - только время
+// Команда SEARCH: "<слова> [in <чат>]". Поиск идет без G_coutMutex - приемник в это время выводит дальше
+void runSearch(SearchIndex& search, const Session& session, const std::string& args) {
+    std::string_view query = args, chat;
+    size_t in = args.rfind(" in ");
+    if (in != std::string::npos && in + 4 < args.size()) { query = std::string_view(args).substr(0, in); chat = std::string_view(args).substr(in + 4); }
+    bool loaded = search.loaded();
+    auto start = std::chrono::steady_clock::now();
+    std::vector<SearchHit> hits = search.search(query, chat);
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    std::lock_guard<std::mutex> lock(G_coutMutex);
+    if (!loaded) G_screen << "[СИСТЕМА] Индекс поиска еще загружается, попробуйте чуть позже." << std::endl;
+    else if (hits.empty()) G_screen << "[СИСТЕМА] Ничего не найдено." << std::endl;
+    else {
+        char elapsed[32];
+        std::snprintf(elapsed, sizeof(elapsed), "%.2f", ms);
+        G_screen << "--- Поиск: " << query;
+        if (!chat.empty()) G_screen << " (в '" << chat << "')";
+        G_screen << " - " << hits.size() << " за " << elapsed << " мс ---" << std::endl;
+        std::string line;
+        for (const SearchHit& hit : hits) { // Беседа, затем сообщение как в чате
+            line.assign(hit.kind == ConversationKind::Group ? "  [группа '" + hit.conversation + "'] " : "  [" + hit.conversation + "] ");
+            appendChatMessage(line, session.username(), hit.timestamp, hit.sender, hit.text);
+            G_screen << line;
         }
-        else {
-            return "[" + formatted_date + " | " + formatted_time + "]"; // Иначе - дата и время
+        G_screen << "-----------------" << std::endl;
+    }
+    displayPrompt(session);
+}
+
+
+// Очередь событий между приемником и выводом: строка для /stats и объект для дампа
+void appendQueueReport(std::string& out, const SessionEventQueueStats& queue) {
+    out += "Очередь вывода: событий " + std::to_string(queue.queued) + ", сейчас " + std::to_string(queue.depth) + ", максимум "
+        + std::to_string(queue.maxDepth) + " из " + std::to_string(queue.capacity) + ", через запасной буфер " + std::to_string(queue.spilled)
+        + " (сейчас " + std::to_string(queue.overflowBytes / 1024) + " КБ, максимум " + std::to_string(queue.maxOverflowBytes / 1024)
+        + " КБ), отброшено " + std::to_string(queue.dropped) + '\n';
+}
+
+void appendQueueJson(std::string& out, const SessionEventQueueStats& queue) {
+    out += "{\"queued\":" + std::to_string(queue.queued) + ",\"spilled\":" + std::to_string(queue.spilled) + ",\"dropped\":"
+        + std::to_string(queue.dropped) + ",\"depth\":" + std::to_string(queue.depth) + ",\"max_depth\":" + std::to_string(queue.maxDepth)
+        + ",\"capacity\":" + std::to_string(queue.capacity) + ",\"overflow_bytes\":" + std::to_string(queue.overflowBytes)
+        + ",\"max_overflow_bytes\":" + std::to_string(queue.maxOverflowBytes) + "}";
+}
+
+// Выделения памяти в куче с начала работы на одно принятое событие: почти все они - прогрев
+// (буферы, слоты кольца, таблицы имен), в установившемся режиме путь сообщения их не делает
+double allocationsPerEvent(uint64_t allocations, const SessionEventQueueStats& queue) {
+    return queue.queued ? static_cast<double>(allocations) / static_cast<double>(queue.queued) : 0.0;
+}
+
+void appendAllocReport(std::string& out, const SessionEventQueueStats& queue) {
+    char line[160];
+    std::snprintf(line, sizeof(line), "Выделений памяти на событие: приемник %.3f, вывод %.3f (всего выделений %llu)\n",
+        allocationsPerEvent(G_receiverAllocations.load(), queue), allocationsPerEvent(G_renderAllocations.load(), queue),
+        static_cast<unsigned long long>(totalAllocations()));
+    out += line;
+}
+
+void appendAllocJson(std::string& out, const SessionEventQueueStats& queue) {
+    char json[160];
+    std::snprintf(json, sizeof(json), "{\"receiver_per_event\":%.4f,\"render_per_event\":%.4f,\"total\":%llu}",
+        allocationsPerEvent(G_receiverAllocations.load(), queue), allocationsPerEvent(G_renderAllocations.load(), queue),
+        static_cast<unsigned long long>(totalAllocations()));
+    out += json;
+}
+
+// Команда /stats (вызывается без G_coutMutex)
+void printStats(const Session& session, const SessionEventQueue& events) {
+    std::string report;
+    session.metrics().appendReport(report);
+    SessionEventQueueStats queue = events.stats();
+    appendQueueReport(report, queue);
+    if (kAllocCountEnabled) appendAllocReport(report, queue);
+    std::lock_guard<std::mutex> lock(G_coutMutex);
+    G_screen << report << "-----------------" << std::endl;
+    displayPrompt(session);
+}
+
+// Периодический дамп метрик (--stats-dump): строка JSON раз в interval, дописывается в файл.
+// Пишет поток приемника (и main - последнюю строку при выходе)
+struct StatsDump {
+    std::string path; // Пусто - дампа нет
+    std::chrono::seconds interval{ 10 };
+    std::chrono::steady_clock::time_point next;
+
+    int msUntilDue(std::chrono::steady_clock::time_point now) const {
+        if (path.empty()) return -1;
+        if (now >= next) return 0;
+        return static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(next - now).count()) + 1;
+    }
+    void write(const Session& session, const SessionEventQueue& events) {
+        std::string line = "{\"unix_time\":" + std::to_string(static_cast<long long>(std::time(nullptr))) + ",\"stats\":";
+        session.metrics().appendJson(line);
+        SessionEventQueueStats queue = events.stats();
+        line += ",\"render_queue\":";
+        appendQueueJson(line, queue);
+        if (kAllocCountEnabled) {
+            line += ",\"allocations\":";
+            appendAllocJson(line, queue);
         }
+        line += "}\n";
+        if (std::FILE* file = std::fopen(path.c_str(), "ab")) {
+            std::fwrite(line.data(), 1, line.size(), file);
+            std::fclose(file);
+        }
+        next = std::chrono::steady_clock::now() + interval;
     }
-    // Если пришел уже короткий формат HH:MM (например, от displayChatMessageClient для своих сообщений)
-    if (full_timestamp_from_server.length() == 5 && full_timestamp_from_server[2] == ':') {
-        return full_timestamp_from_server;
+    void writeIfDue(const Session& session, const SessionEventQueue& events) {
+        if (msUntilDue(std::chrono::steady_clock::now()) == 0) write(session, events);
     }
-    return full_timestamp_from_server; // Если формат неизвестен, вернуть как есть
+};
+
+
+// Порог, после которого накопленная история выводится, не дожидаясь ее конца
+constexpr size_t kRenderBatchFlushBytes = 64 * 1024;
+// Сообщений, которые показываются при открытии чата и на каждый /more (--history-page)
+constexpr int kDefaultHistoryPage = 100;
+
+// Уведомления о сообщениях неактивных бесед выводятся сводкой не чаще этого
+constexpr std::chrono::milliseconds kUnreadSummaryInterval{ 2000 };
+// Строк в одной сводке; остальные беседы - одной строкой итога
+constexpr size_t kUnreadSummaryMaxLines = 5;
+
+// Консольное представление событий сессии. Все обработчики вызываются под G_coutMutex: поток вывода
+// передает ему события из SessionEventQueue, main - историю из кэша в openConversation. События приходят
+// с опозданием относительно сессии, поэтому то, что принимается история, представление помнит само
+class ConsoleView : public SessionListener {
+public:
+    ConsoleView(Session& session, SearchIndex& search) : m_session(session), m_state(session.stateCell()), m_search(search) {}
+
+    // Конец пачки событий: выводит недополученную историю и возвращает промпт
+    void finishBatch();
+    // Соединение потеряно - недовыведенное уже не нужно
+    void reset();
+    // Сводка новых сообщений неактивных бесед: через сколько мс ее выводить (-1 - нечего) и вывод
+    int msUntilUnreadSummary(std::chrono::steady_clock::time_point now) const;
+    void printUnreadSummary(std::chrono::steady_clock::time_point now);
+    // Команда UNREAD
+    void printUnread();
+    // Команда /more
+    void showOlderHistory();
+    // Задержка "прием -> экран": данные прочитаны в receivedAt и, возможно, ждут кадра.
+    // После вывода кадра outputPresented() записывает ее, если все принятое уже на экране
+    void outputReceived(std::chrono::steady_clock::time_point receivedAt);
+    void outputPresented();
+
+    void onLoggedIn(std::string_view username) override;
+    void onLoggedOut() override;
+    void onDisconnected() override;
+    void onConnected(std::string_view endpoint, std::string_view resumeUsername) override;
+    void onConnectFailed(std::string_view endpoint, int errorCode, std::chrono::milliseconds retryIn) override;
+    void onSendError(int errorCode) override;
+    void onEventLoopError(int errorCode) override;
+    void onMessage(const ChatMessage& message) override;
+    void onHistoryBegin(ConversationKind kind, std::string_view name, HistorySource source) override;
+    void onHistoryEntry(ConversationKind kind, std::string_view name, const HistoryEntry& entry) override;
+    void onHistoryEnd(ConversationKind kind, std::string_view name, HistorySource source, size_t entries) override;
+    void onHistoryStored(ConversationKind kind, std::string_view name, const HistoryEntry& entry) override;
+    void onFriendListBegin() override { m_listHeaderShown = false; }
+    void onFriend(std::string_view name, std::string_view status) override;
+    void onFriendListEnd(size_t count) override;
+    void onGroupListBegin() override { m_listHeaderShown = false; }
+    void onGroupListEntry(std::string_view group) override;
+    void onGroupListEnd(size_t count) override;
+    void onGroupCreated(std::string_view group) override;
+    void onGroupJoined(std::string_view group) override;
+    void onUserJoinedGroup(std::string_view group, std::string_view user) override;
+    void onError(std::string_view message, const PendingRequest* request, bool conversationClosed) override;
+    void onRequestTimeout(const PendingRequest& request, bool conversationClosed) override;
+    void onUnknownLine(std::string_view line, bool idle) override;
+    void onLineTooLong(size_t maxLength) override;
+    void onEventsDropped(size_t count) override;
+
+private:
+    void beginOutput();
+    void flushRenderBatch();
+    void addUnread(ConversationKind kind, NameId id, std::string_view name, const ChatMessage& message);
+    void printChatMessage(const ChatMessage& message);
+    bool receivingActiveHistory() const { return m_receivingHistory && m_state.get().conversation.isActive(m_historyKind, m_historyName); }
+    void printUnreadMarker(ConversationKind kind, std::string_view name);
+    void indexCachedHistory(ConversationKind kind, std::string_view name);
+
+    Session& m_session;
+    // Вход и беседа для проверок на каждом событии (без блокировки, пока они не меняются). Ссылка из get()
+    // живет до следующего get() - в том числе внутри beginOutput(), поэтому ее не держат через вывод
+    mutable SnapshotReader<SessionState> m_state;
+    SearchIndex& m_search;          // Принятые сообщения индексируются для SEARCH (индекс открыт на время входа)
+    HistorySource m_historySource = HistorySource::Cache; // Что выводится сейчас: в индекс идет только история с сервера
+    bool m_olderHeaderPending = false; // Заголовок более ранней страницы - перед ее первой записью
+    std::string m_renderBatch;      // Строки истории, еще не выведенные на экран
+    std::string m_self;             // Имя пользователя на время вывода истории ("Вы: ")
+    std::string m_line;             // Строка входящего сообщения (память переиспользуется)
+    bool m_replayingCache = false;  // Выводится история из кэша (openConversation в main)
+    bool m_receivingHistory = false; // Между началом и концом истории с сервера (или страницы /more) - для беседы m_historyKind/m_historyName
+    ConversationKind m_historyKind = ConversationKind::Private;
+    std::string m_historyName;
+    bool m_redrawPrompt = false;    // В этой пачке что-то выведено - промпт нужно вернуть
+    bool m_listHeaderShown = false; // Заголовок текущего списка уже выведен
+    UnreadIndex m_unread;           // Непрочитанные неактивных бесед (под G_coutMutex, как и все обработчики)
+    std::string m_unreadUser;       // Чьи это непрочитанные: после переподключения под тем же именем они сохраняются
+    std::chrono::steady_clock::time_point m_unreadSummaryAt; // Срок сводки, если в очереди сводки что-то есть
+    bool m_outputPending = false;   // Принятое ждет кадра с m_outputReceivedAt
+    std::chrono::steady_clock::time_point m_outputReceivedAt;
+};
+
+// Перед выводом события: сначала уже накопленная история (чтобы не нарушить порядок).
+// Промпт (он мог измениться) обновит finishBatch()
+void ConsoleView::beginOutput() {
+    flushRenderBatch();
+    m_redrawPrompt = true;
 }
 
-// Возвращает текущее локальное время в формате HH:MM для отображения собственных сообщений
-std::string getCurrentLocalTimestampForChatDisplay() {
-    auto now = std::chrono::system_clock::now();
-    auto in_time_t = std::chrono::system_clock::to_time_t(now);
-    std::tm buf;
-#ifdef _WIN32
-    localtime_s(&buf, &in_time_t);
-#else
-    localtime_r(&in_time_t, &buf);
-#endif
-    std::stringstream ss;
-    ss << std::put_time(&buf, "%H:%M");
-    return ss.str();
+// Выводит накопленную историю одной записью
+void ConsoleView::flushRenderBatch() {
+    if (m_renderBatch.empty()) return;
+    if (!m_replayingCache && !receivingActiveHistory()) { m_renderBatch.clear(); return; } // Пользователь уже покинул этот чат
+    G_renderer.print(m_renderBatch);
+    m_renderBatch.clear(); // Память буфера остается для следующей порции
 }
 
-// Отображает сообщение чата в консоли
-void displayChatMessageClient(const std::string& timestamp_str, const std::string& sender, const std::string& message_text) {
-    std::string display_ts = formatTimestampForDisplay(timestamp_str);
-    std::cout << display_ts << " ";
-    if (sender == G_currentUsername) { // Свои сообщения
-        std::cout << "Вы: ";
+void ConsoleView::finishBatch() {
+    flushRenderBatch(); // История пришла не целиком - показываем то, что уже есть
+    // Во время загрузки истории промпт не перерисовываем: это сделает конец истории
+    if (m_redrawPrompt && !receivingActiveHistory() && G_clientRunning.load() && !G_programShouldExit.load()) {
+        displayPrompt(m_session);
+        m_redrawPrompt = false;
     }
-    else { // Сообщения от других
-        std::cout << sender << ": ";
+}
+
+void ConsoleView::reset() {
+    m_renderBatch.clear();
+    m_outputPending = false;
+    m_replayingCache = false;
+    m_receivingHistory = false;
+    m_redrawPrompt = false;
+}
+
+void ConsoleView::outputReceived(std::chrono::steady_clock::time_point receivedAt) {
+    if (!m_outputPending && G_renderer.msUntilFrame(receivedAt) >= 0) { m_outputReceivedAt = receivedAt; m_outputPending = true; }
+}
+
+void ConsoleView::outputPresented() {
+    if (!m_outputPending) return;
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    if (G_renderer.msUntilFrame(now) >= 0) return; // Кадр еще впереди (лимит частоты кадров)
+    m_session.metrics().recordLatency(LatencyMetric::Render, now - m_outputReceivedAt);
+    m_outputPending = false;
+}
+
+void printConversationHeader(ConversationKind kind, std::string_view name) {
+    clearConsoleScreen();
+    if (kind == ConversationKind::Group) G_screen << "--- Групповой чат: " << name << " ---" << std::endl;
+    else G_screen << "--- Чат с " << name << " ---" << std::endl;
+    G_screen << "(Для выхода: /exit_chat)" << std::endl << std::endl;
+}
+
+void ConsoleView::onHistoryBegin(ConversationKind kind, std::string_view name, HistorySource source) {
+    m_historySource = source;
+    m_self = m_state.get().username;
+    if (source == HistorySource::Older) { // Страница /more: под уже выведенным, без заголовка беседы
+        beginOutput();
+        m_receivingHistory = true;
+        m_historyKind = kind;
+        m_historyName = name;
+        m_olderHeaderPending = true;
+        return;
+    }
+    if (NameId id = m_session.names().find(name)) m_unread.markRead(kind, id); // Беседа открыта - ее сообщения на экране
+    if (source == HistorySource::Cache) { // Строка ввода уже очищена в main
+        m_renderBatch.clear();
+        m_replayingCache = true;
+        if (!m_search.hasHistory(kind, name)) indexCachedHistory(kind, name); // Например, кэш старше индекса
     }
-    std::cout << message_text << std::endl;
+    else {
+        beginOutput();
+        m_receivingHistory = true;
+        m_historyKind = kind;
+        m_historyName = name;
+    }
+    if (source != HistorySource::ServerDelta) printConversationHeader(kind, name); // При дельте заголовок и кэш уже на экране
 }
 
+void ConsoleView::onHistoryEntry(ConversationKind kind, std::string_view name, const HistoryEntry& entry) {
+    bool fromServer = m_historySource == HistorySource::Server || m_historySource == HistorySource::ServerDelta;
+    if (fromServer) m_search.add(kind, name, entry.timestamp, entry.sender, entry.text);
+    if (m_olderHeaderPending) {
+        m_renderBatch += "--- Более ранние сообщения ---\n";
+        m_olderHeaderPending = false;
+    }
+    appendChatMessage(m_renderBatch, m_self, entry.timestamp, entry.sender, entry.text); // Выводится пачкой
+    if (m_renderBatch.size() >= kRenderBatchFlushBytes) flushRenderBatch();
+}
 
-// Читает строку от сервера (до '\n')
-std::string clientReadLine(SocketType socket) {
-    std::string line;
-    char ch;
-    while (G_clientRunning.load()) { // Проверка флага для корректного завершения потока
-        int bytesReceived = recv(socket, &ch, 1, 0);
-        if (bytesReceived == 0) { /* Сервер закрыл соединение */ return ""; }
-        if (bytesReceived < 0) {   /* Ошибка сокета */
-#ifdef _WIN32 // Типичные ошибки разрыва/закрытия сокета
-            if (WSAGetLastError() == WSAECONNRESET || WSAGetLastError() == WSAESHUTDOWN || WSAGetLastError() == WSAENOTSOCK || WSAGetLastError() == WSAEINTR) return "";
-#else
-            if (errno == ECONNRESET || errno == EPIPE || errno == EBADF || errno == EINTR) return "";
-#endif
-            return ""; // Другая ошибка
+// Записи истории с сервера, не вошедшие в страницу, на экран не выводятся, но ищутся
+void ConsoleView::onHistoryStored(ConversationKind kind, std::string_view name, const HistoryEntry& entry) {
+    m_search.add(kind, name, entry.timestamp, entry.sender, entry.text);
+}
+
+// Со страницами из кэша выводится только конец: в индекс поиска - весь кэш
+void ConsoleView::indexCachedHistory(ConversationKind kind, std::string_view name) {
+    std::string records; // Копия: файл кэша может обрезать поток приемника
+    if (!m_session.copyHistoryCache(kind, name, records)) return;
+    std::string multiline;
+    forEachHistoryRecord(records, [&](std::string_view record) {
+        HistoryEntry entry;
+        parseHistoryEntry(record, entry);
+        if (entry.text.find('\r') != std::string_view::npos) { // Многострочное сообщение (см. historystore.h)
+            multiline.assign(entry.text);
+            std::replace(multiline.begin(), multiline.end(), '\r', '\n');
+            entry.text = multiline;
         }
-        if (ch == '\n') break;
-        if (ch != '\r') line += ch; // Игнорируем '\r'
+        m_search.add(kind, name, entry.timestamp, entry.sender, entry.text);
+    });
+}
+
+void ConsoleView::onHistoryEnd(ConversationKind kind, std::string_view name, HistorySource source, size_t entries) {
+    if (source == HistorySource::Cache) { flushRenderBatch(); m_replayingCache = false; return; }
+    beginOutput(); // Если чат уже покинут, накопленное просто отбрасывается
+    m_receivingHistory = false;
+    m_olderHeaderPending = false;
+    if (source == HistorySource::Older) {
+        if (entries == 0 && m_state.get().conversation.isActive(kind, name)) G_screen << "[СИСТЕМА] Более ранних сообщений нет." << std::endl;
+        return;
     }
-    return line;
+    if (entries > 0 || source != HistorySource::Server || !m_state.get().conversation.isActive(kind, name)) return;
+    if (kind == ConversationKind::Group) G_screen << "[СИСТЕМА] Нет сообщений в группе '" << name << "'." << std::endl;
+    else G_screen << "[СИСТЕМА] Нет сообщений с '" << name << "'." << std::endl;
 }
 
-// Отправляет сообщение серверу, добавляя '\n'
-void clientSendMessage(SocketType socket, const std::string& message) {
-    if (socket == INVALID_SOCKET_VALUE || !G_clientRunning.load()) return;
+// Входящее сообщение открытой беседы: свое ли оно - по номеру имени, строка собирается в m_line
+void ConsoleView::printChatMessage(const ChatMessage& message) {
+    TRACE_SCOPE("displayChatMessage");
+    NameId self = m_state.get().usernameId;
+    m_line.clear();
+    appendChatMessage(m_line, self != kNoName && message.senderId == self, currentLocalTimeForDisplay().view(), message.sender, message.text);
+    G_renderer.print(m_line);
+}
 
-    std::string cleanedMessage = message;
-    // Убираем '\r' на всякий случай, если ввод содержит CRLF
-    cleanedMessage.erase(std::remove(cleanedMessage.begin(), cleanedMessage.end(), '\r'), cleanedMessage.end());
+// Вызывается под G_coutMutex. Страница из кэша или подгруженная заранее выводится сразу
+void ConsoleView::showOlderHistory() {
+    // Конец истории с сервера еще в очереди вывода: страница легла бы посреди нее
+    OlderHistory result = m_receivingHistory ? OlderHistory::Busy : m_session.showOlderHistory(this);
+    if (result == OlderHistory::Requested) G_screen << "[СИСТЕМА] Загрузка более ранних сообщений..." << std::endl;
+    else if (result == OlderHistory::NoMore) G_screen << "[СИСТЕМА] Более ранних сообщений нет." << std::endl;
+    else if (result == OlderHistory::Busy) G_screen << "[СИСТЕМА] История еще загружается, повторите /more позже." << std::endl;
+    displayPrompt(m_session);
+}
 
-    std::string msg_to_send = cleanedMessage + "\n";
-    if (send(socket, msg_to_send.c_str(), static_cast<int>(msg_to_send.length()), 0) == SOCKET_ERROR_VALUE) {
-        std::lock_guard<std::mutex> lock(G_coutMutex);
-        std::cout << "\r" << std::string(120, ' ') << "\r"; // Очистка строки ввода
-        std::cerr << "[СИСТЕМА] Ошибка отправки: " << GET_LAST_ERROR << ". Соединение может быть разорвано." << std::endl;
-        displayPrompt();
+void ConsoleView::onMessage(const ChatMessage& message) {
+    if (message.parsed) m_search.add(message.kind, message.conversation, {}, message.sender, message.text); // Для SEARCH
+    if (message.kind == ConversationKind::Group) {
+        if (m_state.get().conversation.isActive(ConversationKind::Group, message.conversationId)) { // Сообщение для текущей активной группы
+            beginOutput();
+            if (message.parsed) printChatMessage(message);
+        }
+        else addUnread(ConversationKind::Group, message.conversationId, message.conversation, message); // Другая группа - в сводку
+        return;
+    }
+    const Conversation& conversation = m_state.get().conversation;
+    bool inPrivateChat = conversation.active && conversation.kind == ConversationKind::Private;
+    bool fromPartner = conversation.isActive(ConversationKind::Private, message.senderId);
+    if (inPrivateChat && !message.parsed) return; // Ошибка формата, сервер должен слать "sender: text"
+    if (fromPartner) { // Сообщение от текущего собеседника
+        beginOutput();
+        printChatMessage(message);
+    }
+    else if (message.parsed) addUnread(ConversationKind::Private, message.senderId, message.sender, message); // Другой собеседник - в сводку
+    else { // Отправитель неизвестен - показать строку сервера как есть
+        beginOutput();
+        G_screen << "<< ";
+        if (!message.line.empty()) G_screen << message.line;
+        else { G_screen << "MSG_FROM "; printMessageBody(message); }
+        G_screen << " >>" << std::endl;
     }
 }
 
-// Извлекает имя пользователя из приветственного сообщения сервера
-std::string parseUsernameFromWelcome(const std::string& serverResponse) {
-    std::string prefix1 = "OK_LOGIN Welcome, ";
-    std::string prefix2 = "OK_REGISTERED Welcome, ";
-    std::string suffix = "!";
-    std::string username = "";
-    size_t startPos = std::string::npos;
+// --- Непрочитанные: сообщения неактивных бесед считаются в индексе и выводятся сводкой ---
+void ConsoleView::addUnread(ConversationKind kind, NameId id, std::string_view name, const ChatMessage& message) {
+    if (!m_unread.hasPending()) m_unreadSummaryAt = std::chrono::steady_clock::now() + kUnreadSummaryInterval;
+    if (message.parsed) m_unread.add(kind, id, name, message.sender, message.text);
+    else m_unread.add(kind, id, name, {}, message.body); // Группа известна, отправитель - нет
+}
+
+int ConsoleView::msUntilUnreadSummary(std::chrono::steady_clock::time_point now) const {
+    if (!m_unread.hasPending()) return -1;
+    if (now >= m_unreadSummaryAt) return 0;
+    return static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(m_unreadSummaryAt - now).count()) + 1;
+}
+
+// Последнее сообщение беседы: "sender: text" (у сообщения без отправителя - строка сервера)
+void printLastUnread(const UnreadConversation& conversation) {
+    if (!conversation.lastSender.empty()) G_screen << conversation.lastSender << ": ";
+    G_screen << conversation.lastText;
+}
 
-    if (serverResponse.rfind(prefix1, 0) == 0) { // rfind с 0 == starts_with
-        startPos = prefix1.length();
+void ConsoleView::printUnreadSummary(std::chrono::steady_clock::time_point now) {
+    if (!m_unread.hasPending() || now < m_unreadSummaryAt) return;
+    beginOutput();
+    size_t lines = 0, restConversations = 0, restMessages = 0;
+    m_unread.drainPending([&](const UnreadConversation& conversation) {
+        if (lines == kUnreadSummaryMaxLines) { ++restConversations; restMessages += conversation.pending; return; }
+        ++lines;
+        bool group = conversation.kind == ConversationKind::Group;
+        if (conversation.pending == 1) { // Одно сообщение - как раньше, целиком
+            G_screen << "<< ";
+            if (group) G_screen << "Новое в группе '" << conversation.name << "': ";
+            printLastUnread(conversation);
+        }
+        else if (group) {
+            G_screen << "<< Группа '" << conversation.name << "': " << conversation.pending << " новых";
+            if (!conversation.lastSender.empty()) G_screen << " (последнее от " << conversation.lastSender << ")";
+        }
+        else G_screen << "<< " << conversation.name << ": " << conversation.pending << " новых сообщений";
+        if (conversation.count > conversation.pending) G_screen << ", всего непрочитанных " << conversation.count;
+        G_screen << " >>" << std::endl;
+    });
+    if (restConversations > 0) {
+        G_screen << "<< И еще в " << restConversations << " беседах: " << restMessages << " новых (UNREAD - список) >>" << std::endl;
     }
-    else if (serverResponse.rfind(prefix2, 0) == 0) {
-        startPos = prefix2.length();
+}
+
+void ConsoleView::printUnread() {
+    m_unread.drainPending([](const UnreadConversation&) {}); // Список покажет все - сводка уже не нужна
+    std::vector<const UnreadConversation*> conversations = m_unread.list();
+    if (conversations.empty()) { G_screen << "[СИСТЕМА] Непрочитанных сообщений нет." << std::endl; return; }
+    G_screen << "--- Непрочитанные (" << m_unread.total() << ") ---" << std::endl;
+    for (const UnreadConversation* conversation : conversations) {
+        if (conversation->kind == ConversationKind::Group) G_screen << "  группа '" << conversation->name << "': ";
+        else G_screen << "  " << conversation->name << ": ";
+        G_screen << conversation->count << " (последнее: ";
+        printLastUnread(*conversation);
+        G_screen << ")" << std::endl;
     }
+    G_screen << "-----------------" << std::endl;
+}
 
-    if (startPos != std::string::npos) {
-        size_t endPos = serverResponse.rfind(suffix); // Ищем '!' с конца
-        if (endPos != std::string::npos && endPos > startPos) {
-            username = serverResponse.substr(startPos, endPos - startPos);
-        }
+// Отметка непрочитанных в строке списка друзей и групп
+void ConsoleView::printUnreadMarker(ConversationKind kind, std::string_view name) {
+    NameId id = m_session.names().find(name); // Имени, которого не было в сообщениях, нет и в непрочитанных
+    size_t count = id == kNoName ? 0 : m_unread.count(kind, id);
+    if (count > 0) G_screen << " [непрочитанных: " << count << "]";
+}
+
+void ConsoleView::onUserJoinedGroup(std::string_view group, std::string_view user) {
+    beginOutput();
+    if (m_state.get().conversation.isActive(ConversationKind::Group, group)) { // Уведомление для текущей группы
+        G_screen << "[ГРУППА] " << user << " присоединился." << std::endl;
+    }
+    else { // Уведомление для другой группы
+        G_screen << "[СИСТЕМА] " << user << " присоединился к '" << group << "'." << std::endl;
     }
-    return username;
 }
 
+// --- Списки: заголовок выводится с первой записью, пустой список - одной строкой ---
+void ConsoleView::onFriend(std::string_view name, std::string_view status) {
+    beginOutput();
+    if (!m_listHeaderShown) { G_screen << "--- Ваши личные чаты (друзья) ---" << std::endl; m_listHeaderShown = true; }
+    G_screen << "  " << name << " (" << status << ")";
+    printUnreadMarker(ConversationKind::Private, name);
+    G_screen << std::endl;
+}
 
-// Поток для приема сообщений от сервера
-void receiveMessagesThreadFunc() {
-    fd_set readSet;
-    timeval timeout;
-    bool chat_history_loading = false; // Флаг: идет ли загрузка истории чата
-    std::string chat_target_loading;   // Для какого чата/группы грузится история
+void ConsoleView::onFriendListEnd(size_t count) {
+    beginOutput();
+    if (count == 0) G_screen << "[СИСТЕМА] Нет активных личных чатов." << std::endl;
+    else G_screen << "--------------------------------" << std::endl;
+}
 
-    while (G_clientRunning.load()) {
-        if (G_programShouldExit.load()) break; // Полный выход из программы
-        if (G_clientSocket == INVALID_SOCKET_VALUE) {
-            std::this_thread::sleep_for(std::chrono::milliseconds(100));
-            continue;
+void ConsoleView::onGroupListEntry(std::string_view group) {
+    beginOutput();
+    if (!m_listHeaderShown) { G_screen << "--- Ваши группы ---" << std::endl; m_listHeaderShown = true; }
+    G_screen << "  - " << group;
+    printUnreadMarker(ConversationKind::Group, group);
+    G_screen << std::endl;
+}
+
+void ConsoleView::onGroupListEnd(size_t count) {
+    beginOutput();
+    if (count == 0) G_screen << "[СИСТЕМА] Вы не состоите в группах." << std::endl;
+    else G_screen << "-----------------" << std::endl;
+}
+
+// --- Вход, выход и подтверждения ---
+void ConsoleView::onLoggedIn(std::string_view username) {
+    beginOutput();
+    if (username != m_unreadUser) { // Непрочитанные и индекс поиска другого пользователя
+        m_unread.clear();
+        m_unreadUser = username;
+        m_search.open(HistoryStore::defaultRoot(), username);
+    }
+    clearConsoleScreen(); printWelcomeMessage();
+    G_screen << "Вы успешно вошли как " << username << "!" << std::endl;
+    printSessionHelp(m_session);
+}
+
+// Ответ на LOGOUT (если пришел до того, как основной поток обработал G_clientRunning = false)
+void ConsoleView::onLoggedOut() {
+    beginOutput();
+    m_unread.clear();
+    m_unreadUser.clear();
+    m_search.close();
+    G_screen << "[СИСТЕМА] Вы вышли из учетной записи." << std::endl;
+    printHelp(false, false, false, ""); // Показать справку для неавторизованного
+}
+
+void ConsoleView::onGroupCreated(std::string_view group) {
+    beginOutput();
+    G_screen << "[СИСТЕМА] Группа '" << group << "' успешно создана." << std::endl;
+}
+
+void ConsoleView::onGroupJoined(std::string_view group) {
+    beginOutput();
+    G_screen << "[СИСТЕМА] Вы присоединились к группе '" << group << "'." << std::endl;
+}
+
+// --- Ошибки ---
+void ConsoleView::onError(std::string_view message, const PendingRequest* request, bool conversationClosed) {
+    beginOutput();
+    if (conversationClosed) { // Не открылся чат/группа (не найдены, нет доступа)
+        G_screen << "[СИСТЕМА] Не удалось войти в чат/группу '" << request->target << "'. Сервер: " << message << std::endl;
+        return;
+    }
+    // В том числе ошибки внутри чата (например, ERROR_NOT_MEMBER при отправке)
+    G_screen << "[ОТВЕТ СЕРВЕРА] " << message << std::endl;
+}
+
+void ConsoleView::onRequestTimeout(const PendingRequest& request, bool) {
+    beginOutput();
+    G_screen << "[СИСТЕМА] Сервер не ответил: " << describeRequest(request.kind);
+    if (!request.target.empty()) G_screen << " '" << request.target << "'";
+    G_screen << "." << std::endl;
+}
+
+void ConsoleView::onUnknownLine(std::string_view line, bool idle) {
+    // Неопознанное печатаем, только если при приеме не были в чате и не ждали ответа на запрос
+    if (!idle) return;
+    beginOutput();
+    G_screen << "[НЕИЗВЕСТНЫЙ ОТВЕТ СЕРВЕРА] " << line << std::endl;
+}
+
+void ConsoleView::onLineTooLong(size_t maxLength) {
+    beginOutput();
+    G_screen << "[ПРИЕМНИК] Строка от сервера длиннее " << maxLength << " байт, пропущена." << std::endl;
+}
+
+void ConsoleView::onEventsDropped(size_t count) {
+    beginOutput();
+    G_screen << "[СИСТЕМА] Вывод не успевает за сетью: пропущено событий: " << count << ". История беседы сохранена в кэше." << std::endl;
+}
+
+// Соединение закрыто. Разрыв (приемник) сообщаем здесь, а не в приемнике: после всего, что пришло до него.
+// Когда соединение закрывает main (выход, LOGOUT), G_clientRunning уже сброшен
+void ConsoleView::onDisconnected() {
+    reset();
+    if (!G_clientRunning.load() || G_programShouldExit.load()) return;
+    beginOutput();
+    G_screen << "[ПРИЕМНИК] Сервер отключился или ошибка чтения. Переподключение..." << std::endl;
+}
+
+// Переподключение и ошибки отправки сообщает поток приемника через очередь: сам он консоль не ждет
+void ConsoleView::onConnected(std::string_view endpoint, std::string_view resumeUsername) {
+    beginOutput();
+    G_screen << "[СИСТЕМА] Подключено к " << endpoint << ".";
+    if (!resumeUsername.empty()) G_screen << " Восстанавливаем вход как " << resumeUsername << "...";
+    G_screen << std::endl;
+}
+
+void ConsoleView::onConnectFailed(std::string_view endpoint, int errorCode, std::chrono::milliseconds retryIn) {
+    beginOutput();
+    G_screen << "[СИСТЕМА] Подключение к " << endpoint << " не удалось (" << errorCode << "). Повтор через " << retryIn.count() << " мс." << std::endl;
+}
+
+void ConsoleView::onSendError(int errorCode) {
+    beginOutput();
+    G_screen << "[СИСТЕМА] Ошибка отправки: " << errorCode << ". Соединение может быть разорвано." << std::endl;
+}
+
+// Приемник после этого останавливается и завершает программу: промпт не нужен, ждем Enter в main
+void ConsoleView::onEventLoopError(int errorCode) {
+    clearConsoleScreen();
+    G_screen << "\n[ПРИЕМНИК] Ошибка ожидания событий " << errorCode << " или сокет закрыт." << std::endl;
+    G_screen << "Нажмите Enter для выхода..." << std::flush;
+}
+
+
+// Отправляет накопленную очередь исходящих; если буфер сокета полон - досылаем по готовности к записи
+void flushSendQueue(EventLoop& eventLoop, Session& session, SessionListener& events, bool& wantWriteRegistered) {
+    if (!session.connected()) return;
+    FlushStatus status;
+    {
+        TRACE_SCOPE("flush");
+        status = session.flush();
+    }
+    bool wantWrite = status == FlushStatus::Blocked;
+    if (wantWrite != wantWriteRegistered) { eventLoop.setWantWrite(session.socket(), wantWrite); wantWriteRegistered = wantWrite; }
+    if (status == FlushStatus::Error) events.onSendError(GET_LAST_ERROR); // Разрыв обнаружит recv(); здесь только сообщаем
+}
+
+// Соединение потеряно: сокет снимается с ожидания и закрывается, сессия сбрасывается
+void dropConnection(EventLoop& eventLoop, Session& session, SocketType& registeredSocket) {
+    if (registeredSocket != INVALID_SOCKET_VALUE) { eventLoop.remove(registeredSocket); registeredSocket = INVALID_SOCKET_VALUE; }
+    session.disconnect(); // Вход, беседа, запросы и очереди - будит main, если тот ждет logout; onDisconnected - в очередь
+}
+
+// Серверы для подключения (--server / MESSENGER_SERVER): при неудаче пробуем следующий
+struct ServerList {
+    std::vector<Endpoint> endpoints;
+    size_t current = 0;
+    std::chrono::milliseconds connectTimeout = kConnectTimeout;
+
+    const Endpoint& endpoint() const { return endpoints[current]; }
+    void advance() { current = (current + 1) % endpoints.size(); }
+};
+
+// Подключение к текущему серверу списка; при неудаче список сдвигается на следующий
+bool connectToServer(Session& session, ServerList& servers, int& errorCode) {
+    const Endpoint& endpoint = servers.endpoint();
+    if (session.connect(endpoint.host, endpoint.port, errorCode, servers.connectTimeout)) return true;
+    servers.advance();
+    return false;
+}
+
+// Ближайший из двух таймаутов (-1 - без таймаута)
+int earliestTimeout(int a, int b) {
+    if (a < 0) return b;
+    if (b < 0) return a;
+    return std::min(a, b);
+}
+
+// Таймаут ожидания событий приемника: ближайший срок ответа на запрос или дампа метрик (-1 - без таймаута)
+int nextWakeup(const Session& session, const StatsDump& stats) {
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    return earliestTimeout(session.msUntilNextDeadline(now), stats.msUntilDue(now));
+}
+
+// Таймаут потока вывода: отложенный кадр или сводка непрочитанных (-1 - без таймаута)
+int renderWakeup(const ConsoleView& view) {
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    TRACE_LOCK(lock, G_coutMutex, "lock G_coutMutex (renderWakeup)");
+    return earliestTimeout(G_renderer.msUntilFrame(now), view.msUntilUnreadSummary(now));
+}
+
+// Выводит сводку непрочитанных, если подошел ее срок, и кадр экрана
+void presentFrame(ConsoleView& view) {
+    TRACE_LOCK(lock, G_coutMutex, "lock G_coutMutex (presentFrame)");
+    TRACE_SCOPE("presentFrame");
+    view.printUnreadSummary(std::chrono::steady_clock::now());
+    view.finishBatch();
+    G_renderer.present();
+    view.outputPresented();
+}
+
+// Событий за одно взятие G_coutMutex: main (набор текста, команды) не ждет, пока выводится длинная очередь
+constexpr size_t kRenderEventsPerLock = 1024;
+
+// Передает ConsoleView порцию событий из очереди (под G_coutMutex). Возвращает, сколько передано
+size_t deliverEvents(SessionEventQueue& queue, ConsoleView& view) {
+    SessionEventQueue::Clock::time_point receivedAt;
+    size_t delivered = queue.drain(view, kRenderEventsPerLock, &receivedAt);
+    if (delivered == 0) return 0;
+    view.finishBatch();
+    view.outputReceived(receivedAt);
+    return delivered;
+}
+
+// Поток вывода: события сессии из очереди - в ConsoleView, затем кадр экрана. Терминал, который
+// не успевает, задерживает только этот поток. Будят его приемник (принято новое) и main (выход);
+// сам он просыпается к отложенному кадру и сводке непрочитанных. Освободив кольцо, будит приемник,
+// если у того есть события в запасном буфере очереди
+void renderThreadFunc(EventLoop& renderLoop, SessionEventQueue& queue, EventLoop& receiverLoop, ConsoleView& view) {
+    std::vector<IoEvent> none; // В renderLoop нет сокетов - только пробуждения
+    traceThreadName("render");
+    while (G_clientRunning.load() && !G_programShouldExit.load()) {
+        {
+            TRACE_LOCK(lock, G_coutMutex, "lock G_coutMutex (render)");
+            TRACE_SCOPE("deliverEvents");
+            deliverEvents(queue, view);
         }
+        if (kAllocCountEnabled) G_renderAllocations.store(threadAllocations(), std::memory_order_relaxed);
+        if (queue.overflowing()) receiverLoop.wake();
+        presentFrame(view);
+        if (!queue.empty()) continue; // Не уложилось в одну порцию или пришло, пока выводился кадр
+        int timeout = renderWakeup(view);
+        TRACE_SCOPE("render wait");
+        renderLoop.wait(none, timeout);
+    }
+    // При выходе из программы то, что приемник успел положить перед остановкой (например, ошибку ожидания
+    // событий), - на экран сейчас: main может ждать ввода и забрать остаток очереди только после него.
+    // Иначе остаток выводит main после сброса сессии - с промптом уже без входа
+    if (!G_programShouldExit.load()) return;
+    size_t delivered;
+    {
+        TRACE_LOCK(lock, G_coutMutex, "lock G_coutMutex (render)");
+        delivered = deliverEvents(queue, view);
+    }
+    if (delivered > 0) presentFrame(view);
+}
 
-        FD_ZERO(&readSet);
-        FD_SET(G_clientSocket, &readSet);
-        timeout.tv_sec = 1; // Таймаут для select, чтобы поток не блокировался навечно
-        timeout.tv_usec = 0;
+// Поток для приема сообщений от сервера (и отправки очереди исходящих). Принятое он только разбирает:
+// события сессии уходят в очередь потока вывода, G_coutMutex на этом пути не берется.
+// Он же переподключается после разрыва: первая попытка сразу, дальше с растущей задержкой
+void receiveMessagesThreadFunc(EventLoop& eventLoop, Session& session, SessionEventQueue& queue, EventLoop& renderLoop,
+    ServerList& servers, StatsDump& stats) {
+    using Clock = std::chrono::steady_clock;
+    std::vector<IoEvent> events;
+    SocketType registeredSocket = INVALID_SOCKET_VALUE; // Сокет, за которым сейчас следит eventLoop
+    bool wantWrite = false;                             // Очередь отправки уперлась в буфер сокета - ждем готовности к записи
+    Backoff backoff;
+    // Если main подключиться не смог, первая попытка здесь - уже с задержкой
+    Clock::time_point nextAttempt = session.connected() ? Clock::now() : Clock::now() + backoff.next();
+    traceThreadName("receiver");
 
-        int selectNfds = G_clientSocket + 1; // Для Unix-like систем
-#ifdef _WIN32
-        selectNfds = 0; // Для Windows select nfds игнорируется
+    while (G_clientRunning.load()) {
+        if (G_programShouldExit.load()) break; // Полный выход из программы
+        if (kAllocCountEnabled) G_receiverAllocations.store(threadAllocations(), std::memory_order_relaxed);
+        stats.writeIfDue(session, queue);
+#if defined(MESSENGER_TRACE) && defined(SIGUSR1)
+        if (G_traceDumpRequested.exchange(false)) traceDump(traceDefaultPath());
 #endif
-        int selectResult = select(selectNfds, &readSet, nullptr, nullptr, &timeout);
 
-        if (G_programShouldExit.load()) break; // Перепроверка после select
-        // Если клиент уже не должен работать (например, после LOGOUT), но программа еще не завершается
-        if (!G_clientRunning.load() && !G_programShouldExit.load()) {
-            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        if (!session.connected()) { // --- Переподключение ---
+            Clock::time_point now = Clock::now();
+            if (now < nextAttempt) { // Ждем срока попытки (или дампа метрик); выход из программы будит раньше
+                int untilAttempt = static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(nextAttempt - now).count()) + 1;
+                eventLoop.wait(events, earliestTimeout(untilAttempt, nextWakeup(session, stats)));
+                continue;
+            }
+            Endpoint endpoint = servers.endpoint();
+            int error_code = 0;
+            std::string address = endpoint.host + ":" + std::to_string(endpoint.port);
+            if (!connectToServer(session, servers, error_code)) {
+                std::chrono::milliseconds delay = backoff.next();
+                nextAttempt = Clock::now() + delay;
+                queue.onConnectFailed(address, error_code, delay);
+                renderLoop.wake(); // Выводит поток вывода
+                continue;
+            }
+            backoff.reset();
+            session.hello();
+            // Вход и беседа восстанавливаются сами: LOGIN уходит сразу, беседа откроется по OK_LOGIN
+            bool resuming = session.resume();
+            queue.onConnected(address, resuming ? session.resumeUsername() : std::string());
+            renderLoop.wake();
             continue;
         }
 
+        if (registeredSocket != session.socket()) {
+            if (registeredSocket != INVALID_SOCKET_VALUE) eventLoop.remove(registeredSocket);
+            registeredSocket = session.socket();
+            if (registeredSocket != INVALID_SOCKET_VALUE) eventLoop.add(registeredSocket);
+            wantWrite = false;
+        }
+        // Новые исходящие (нас разбудил Session::send) или сокет снова доступен для записи
+        uint64_t publishedBefore = queue.published();
+        flushSendQueue(eventLoop, session, queue, wantWrite);
+
+        // Ждем данных от сервера, исходящих или пробуждения (logout, выход, закрытие сокета).
+        // Таймаут - только до ближайшего срока ответа на запрос или дампа метрик
+        int timeout = nextWakeup(session, stats);
+        int waitResult;
+        {
+            TRACE_SCOPE("wait");
+            waitResult = eventLoop.wait(events, timeout);
+        }
 
-        if (selectResult < 0) { // Ошибка select или сокет закрыт
+        if (G_programShouldExit.load()) break; // Перепроверка после ожидания
+        // Клиент уже не должен работать (например, после LOGOUT) - main ждет завершения потока
+        if (!G_clientRunning.load()) break;
+
+        if (waitResult < 0) { // Ошибка ожидания событий
             int error_code = GET_LAST_ERROR;
             if (G_clientRunning.load()) { // Если ошибка произошла во время активной работы
-                std::lock_guard<std::mutex> lock(G_coutMutex);
-                clearConsoleScreen();
-                std::cerr << "\n[ПРИЕМНИК] select ошибка " << error_code << " или сокет закрыт." << std::endl;
-                std::cout << "Нажмите Enter для выхода..." << std::flush;
+                queue.onEventLoopError(error_code);
+                renderLoop.wake(); // Поток вывода выведет ее перед остановкой
             }
-            // Сброс всех состояний
-            G_loggedIn = false; G_currentUsername.clear(); G_inChatMode = false; G_currentChatPartner.clear();
-            G_inGroupChatMode = false; G_currentGroupName.clear(); G_waitingForChatInitiation = false;
-            G_isReceivingFriendList = false; G_isReceivingGroupList = false;
-            if (G_clientSocket != INVALID_SOCKET_VALUE) { CLOSE_SOCKET(G_clientSocket); G_clientSocket = INVALID_SOCKET_VALUE; }
             G_programShouldExit = true; // Инициируем полный выход
             G_clientRunning = false;    // Останавливаем этот поток и основной цикл ввода
+            dropConnection(eventLoop, session, registeredSocket); // Сброс всех состояний
             break;
         }
 
-        if (selectResult > 0 && FD_ISSET(G_clientSocket, &readSet)) { // Есть данные для чтения
-            std::string message = clientReadLine(G_clientSocket);
-            std::lock_guard<std::mutex> lock(G_coutMutex); // Защищаем вывод в консоль
-
-            // Если программа завершается и пришло пустое сообщение (например, из-за закрытия сокета) - выходим
-            if (G_programShouldExit.load() && message.empty()) break;
-
-            if (message.empty() && G_clientRunning.load()) { // Сервер отключился или ошибка чтения
-                std::cout << "\r" << std::string(120, ' ') << "\r";
-                std::cout << "[ПРИЕМНИК] Сервер отключился или ошибка чтения." << std::endl;
-                // Сброс состояний, аналогично ошибке select
-                G_loggedIn = false; G_currentUsername.clear(); G_inChatMode = false; G_currentChatPartner.clear();
-                G_inGroupChatMode = false; G_currentGroupName.clear(); G_waitingForChatInitiation = false;
-                G_isReceivingFriendList = false; G_isReceivingGroupList = false;
-                if (G_clientSocket != INVALID_SOCKET_VALUE) { CLOSE_SOCKET(G_clientSocket); G_clientSocket = INVALID_SOCKET_VALUE; }
-                // Не ставим G_programShouldExit = true здесь, даем возможность переподключиться из main
-                if (!G_inChatMode.load() && !G_inGroupChatMode.load()) displayPrompt(); // Обновить промпт, если не в чате
+        queue.refill(); // Поток вывода освободил место в кольце
+        for (const IoEvent& event : events) {
+            if (event.socket != session.socket()) continue; // Событие от уже закрытого сокета
+            if (!event.readable && !event.error) continue;  // Данные для чтения (или разрыв - recv() вернет 0)
+
+            TRACE_SCOPE("receive");
+            queue.setReceivedAt(std::chrono::steady_clock::now());
+            ReadStatus status = session.receive();
+            if (status != ReadStatus::Closed && status != ReadStatus::Error) continue;
+
+            // Если программа завершается и сокет закрылся - выходим
+            if (G_programShouldExit.load()) break;
+            if (G_clientRunning.load()) { // Сервер отключился или ошибка чтения - сообщит поток вывода (onDisconnected)
+                // Сброс состояний, аналогично ошибке ожидания событий; вход и беседу сессия запомнила
+                dropConnection(eventLoop, session, registeredSocket);
+                nextAttempt = Clock::now(); // Первая попытка - сразу
             }
-            else if (!message.empty()) { // Получено непустое сообщение
-                std::cout << "\r" << std::string(120, ' ') << "\r"; // Очистка строки ввода
-                std::string prefix, payload;
-                size_t space_pos = message.find(' ');
-                if (space_pos != std::string::npos) {
-                    prefix = message.substr(0, space_pos);
-                    payload = message.substr(space_pos + 1);
-                }
-                else {
-                    prefix = message; // Сообщение без аргументов
-                }
-
-                bool handled = false; // Флаг, что сообщение было обработано специфическим обработчиком
-
-                // --- Обработка инициации личного чата (когда ждем HISTORY_START или NO_HISTORY) ---
-                if (G_waitingForChatInitiation.load() && !G_inGroupChatMode.load() && !G_currentChatPartner.empty() && G_currentChatPartner == payload) {
-                    if (prefix == "HISTORY_START") {
-                        G_inChatMode = true; G_inGroupChatMode = false; G_waitingForChatInitiation = false;
-                        chat_history_loading = true; chat_target_loading = payload; // Запоминаем для кого грузим историю
-                        clearConsoleScreen();
-                        std::cout << "--- Чат с " << G_currentChatPartner << " ---" << std::endl;
-                        std::cout << "(Для выхода: /exit_chat)" << std::endl << std::endl;
-                        handled = true;
-                    }
-                    else if (prefix == "NO_HISTORY") {
-                        G_inChatMode = true; G_inGroupChatMode = false; G_waitingForChatInitiation = false;
-                        chat_history_loading = false; chat_target_loading.clear();
-                        clearConsoleScreen();
-                        std::cout << "--- Чат с " << G_currentChatPartner << " ---" << std::endl;
-                        std::cout << "(Для выхода: /exit_chat)" << std::endl << std::endl;
-                        std::cout << "[СИСТЕМА] Нет сообщений с '" << payload << "'." << std::endl;
-                        handled = true;
-                    }
-                }
-                // --- Обработка инициации группового чата (когда ждем GROUP_HISTORY_START или NO_GROUP_HISTORY) ---
-                else if (G_waitingForChatInitiation.load() && !G_inChatMode.load() && !G_currentGroupName.empty() && G_currentGroupName == payload) {
-                    if (prefix == "GROUP_HISTORY_START") {
-                        G_inGroupChatMode = true; G_inChatMode = false; G_waitingForChatInitiation = false;
-                        chat_history_loading = true; chat_target_loading = payload;
-                        clearConsoleScreen();
-                        std::cout << "--- Групповой чат: " << G_currentGroupName << " ---" << std::endl;
-                        std::cout << "(Для выхода: /exit_chat)" << std::endl << std::endl;
-                        handled = true;
-                    }
-                    else if (prefix == "NO_GROUP_HISTORY") {
-                        G_inGroupChatMode = true; G_inChatMode = false; G_waitingForChatInitiation = false;
-                        chat_history_loading = false; chat_target_loading.clear();
-                        clearConsoleScreen();
-                        std::cout << "--- Групповой чат: " << G_currentGroupName << " ---" << std::endl;
-                        std::cout << "(Для выхода: /exit_chat)" << std::endl << std::endl;
-                        std::cout << "[СИСТЕМА] Нет сообщений в группе '" << payload << "'." << std::endl;
-                        handled = true;
-                    }
-                }
-                // --- Ошибка при инициации чата (пользователь/группа не найдены) ---
-                else if (G_waitingForChatInitiation.load() &&
-                    (prefix == "ERROR_CMD" || prefix == "ERROR_GROUP_NOT_FOUND" || prefix == "ERROR_NOT_MEMBER")) {
-                    // Более общая проверка на ошибку, если ждем инициации
-                    std::string targetName = G_inGroupChatMode.load() ? G_currentGroupName : G_currentChatPartner;
-                    if (targetName.empty() && G_waitingForChatInitiation.load()) { // Если цель неясна, но ждем
-                        targetName = (payload.find("Group") != std::string::npos || prefix.find("GROUP") != std::string::npos) ?
-                            G_currentGroupName : G_currentChatPartner; // Пытаемся угадать
-                    }
-                    std::cout << "[СИСТЕМА] Не удалось войти в чат/группу '" << targetName << "'. Сервер: " << message << std::endl;
-                    G_inChatMode = false; G_inGroupChatMode = false;
-                    G_currentChatPartner.clear(); G_currentGroupName.clear();
-                    G_waitingForChatInitiation = false;
-                    handled = true;
-                }
-                // --- Список друзей (личные чаты) ---
-                else if (prefix == "FRIEND_LIST_START") { G_isReceivingFriendList = true; std::cout << "--- Ваши личные чаты (друзья) ---" << std::endl; handled = true; }
-                else if (prefix == "FRIEND" && G_isReceivingFriendList.load()) {
-                    std::istringstream iss(payload); std::string name, status; iss >> name >> status;
-                    std::cout << "  " << name << " (" << status << ")" << std::endl; handled = true;
-                }
-                else if (prefix == "FRIEND_LIST_END" && G_isReceivingFriendList.load()) { G_isReceivingFriendList = false; std::cout << "--------------------------------" << std::endl; handled = true; }
-                else if (prefix == "NO_FRIENDS_FOUND") { G_isReceivingFriendList = false; std::cout << "[СИСТЕМА] Нет активных личных чатов." << std::endl; handled = true; }
-
-                // --- Список групп ---
-                else if (prefix == "MY_GROUPS_START") { G_isReceivingGroupList = true; std::cout << "--- Ваши группы ---" << std::endl; handled = true; }
-                else if (prefix == "MY_GROUP_ENTRY" && G_isReceivingGroupList.load()) { std::cout << "  - " << payload << std::endl; handled = true; }
-                else if (prefix == "MY_GROUPS_END" && G_isReceivingGroupList.load()) { G_isReceivingGroupList = false; std::cout << "-----------------" << std::endl; handled = true; }
-                else if (prefix == "NO_GROUPS_JOINED") { G_isReceivingGroupList = false; std::cout << "[СИСТЕМА] Вы не состоите в группах." << std::endl; handled = true; }
-
-                // --- Сообщения в активном личном чате ---
-                else if (G_inChatMode.load() && !G_inGroupChatMode.load()) {
-                    if (prefix == "HIST_MSG" && chat_history_loading && chat_target_loading == G_currentChatPartner) {
-                        // payload это: timestamp:sender:message_text
-                        std::string ts, sender, msg_text;
-                        std::istringstream iss_hist(payload); // Используем новый istringstream
-                        std::getline(iss_hist, ts, ':');
-                        std::getline(iss_hist, sender, ':');
-                        std::getline(iss_hist, msg_text);
-                        displayChatMessageClient(ts, sender, msg_text);
-                        handled = true;
-                    }
-                    else if (prefix == "HISTORY_END" && payload == G_currentChatPartner && chat_history_loading) {
-                        chat_history_loading = false; chat_target_loading.clear();
-                        handled = true;
-                    }
-                    else if (prefix == "MSG_FROM") { // payload это: sender_user: message_text
-                        std::string sender_user, message_text;
-                        size_t colon_pos = payload.find(':');
-                        if (colon_pos != std::string::npos) {
-                            sender_user = payload.substr(0, colon_pos);
-                            // Убедимся, что есть что-то после ": "
-                            if (colon_pos + 2 <= payload.length()) message_text = payload.substr(colon_pos + 2);
-
-                            if (sender_user == G_currentChatPartner) { // Сообщение от текущего собеседника
-                                displayChatMessageClient(getCurrentLocalTimestampForChatDisplay(), sender_user, message_text);
-                            }
-                            else { // Сообщение от другого пользователя, пока мы в этом чате (редко, но возможно)
-                                std::cout << "<< " << payload << " >>" << std::endl;
-                            }
-                        }
-                        else { /* Ошибка формата, сервер должен слать "sender: text" */ }
-                        handled = true;
-                    }
-                }
-                // --- Сообщения в активном групповом чате ---
-                else if (G_inGroupChatMode.load()) {
-                    if (prefix == "GROUP_HIST_MSG" && chat_history_loading && chat_target_loading == G_currentGroupName) {
-                        // payload это: timestamp:sender:message_text
-                        std::string ts, sender, msg_text;
-                        std::istringstream iss_hist(payload);
-                        std::getline(iss_hist, ts, ':');
-                        std::getline(iss_hist, sender, ':');
-                        std::getline(iss_hist, msg_text);
-                        displayChatMessageClient(ts, sender, msg_text);
-                        handled = true;
-                    }
-                    else if (prefix == "GROUP_HISTORY_END" && payload == G_currentGroupName && chat_history_loading) {
-                        chat_history_loading = false; chat_target_loading.clear();
-                        handled = true;
-                    }
-                    else if (prefix == "GROUP_MSG_FROM") {
-                        // payload это: groupNamePart sender_user: msg_text_part
-                        std::string groupNamePart, senderAndText;
-                        std::istringstream iss_group_msg(payload);
-                        iss_group_msg >> groupNamePart; // Читаем имя группы
-                        iss_group_msg >> std::ws;       // Пропускаем пробел
-                        std::getline(iss_group_msg, senderAndText); // Остальное - "sender: text"
-
-                        if (groupNamePart == G_currentGroupName) { // Сообщение для текущей активной группы
-                            std::string sender_user, msg_text_part;
-                            size_t colon_pos = senderAndText.find(':');
-                            if (colon_pos != std::string::npos) {
-                                sender_user = senderAndText.substr(0, colon_pos);
-                                if (colon_pos + 2 <= senderAndText.length()) msg_text_part = senderAndText.substr(colon_pos + 2);
-                                displayChatMessageClient(getCurrentLocalTimestampForChatDisplay(), sender_user, msg_text_part);
-                            }
-                            else { /* Ошибка формата от сервера */ }
-                        }
-                        else { // Сообщение для другой группы, не активной сейчас
-                            std::cout << "<< Новое в группе '" << groupNamePart << "': " << senderAndText << " >>" << std::endl;
-                        }
-                        handled = true;
-                    }
-                    else if (prefix == "USER_JOINED_GROUP" || prefix == "INFO_ADDED_TO_GROUP") { // payload: <GroupName> <Username>
-                        std::string group_name, user_name;
-                        std::istringstream iss_join(payload);
-                        iss_join >> group_name >> user_name;
-                        if (group_name == G_currentGroupName) { // Уведомление для текущей группы
-                            std::cout << "[ГРУППА] " << user_name << " присоединился." << std::endl;
-                        }
-                        else { // Уведомление для другой группы
-                            std::cout << "[СИСТЕМА] " << user_name << " присоединился к '" << group_name << "'." << std::endl;
-                        }
-                        handled = true;
-                    }
-                }
-
-                // --- Общие ответы сервера, не связанные с активным чатом или списками ---
-                if (!handled) { // Если сообщение не было обработано выше
-                    if (message.rfind("OK_LOGIN", 0) == 0 || message.rfind("OK_REGISTERED", 0) == 0) {
-                        G_loggedIn = true;
-                        G_currentUsername = parseUsernameFromWelcome(message);
-                        if (G_currentUsername.empty() && G_loggedIn.load()) G_currentUsername = "User"; // Fallback
-                        clearConsoleScreen(); printWelcomeMessage();
-                        std::cout << "Вы успешно вошли как " << G_currentUsername << "!" << std::endl;
-                        std::string target = G_inGroupChatMode.load() ? G_currentGroupName : (G_inChatMode.load() ? G_currentChatPartner : "");
-                        printHelp(G_loggedIn.load(), G_inChatMode.load(), G_inGroupChatMode.load(), target);
-                    }
-                    // Ответ на LOGOUT (если пришел до того, как основной поток обработал G_clientRunning = false)
-                    else if (!G_currentUsername.empty() && message.rfind("OK_LOGOUT Goodbye, " + G_currentUsername, 0) == 0) {
-                        bool wasInAnyChat = G_inChatMode.load() || G_inGroupChatMode.load();
-                        G_loggedIn = false; G_currentUsername.clear();
-                        G_inChatMode = false; G_currentChatPartner.clear();
-                        G_inGroupChatMode = false; G_currentGroupName.clear();
-                        G_waitingForChatInitiation = false; // Сброс всех флагов
-                        G_isReceivingFriendList = false; G_isReceivingGroupList = false;
-                        chat_history_loading = false; chat_target_loading.clear();
-                        if (wasInAnyChat) clearConsoleScreen(); // Очистить экран, если были в чате
-                        std::cout << "[СИСТЕМА] Вы вышли из учетной записи." << std::endl;
-                        printHelp(G_loggedIn.load(), false, false, ""); // Показать справку для неавторизованного
-                    }
-                    else if (message.rfind("OK_GROUP_CREATED", 0) == 0) { std::cout << "[СИСТЕМА] Группа '" << payload << "' успешно создана." << std::endl; }
-                    else if (message.rfind("OK_JOINED_GROUP", 0) == 0) { std::cout << "[СИСТЕМА] Вы присоединились к группе '" << payload << "'." << std::endl; }
-                    else if (message.rfind("OK_SENT", 0) == 0) { /* Сообщение о доставке, можно игнорировать в выводе */ }
-                    else if (message.rfind("OK_GROUP_MSG_SENT", 0) == 0) { /* Сообщение о доставке в группу, можно игнорировать в выводе */ }
-                    else if (message.rfind("ERROR_", 0) == 0) { // Общие ошибки
-                        if (G_waitingForChatInitiation.load()) { // Если ошибка пришла во время ожидания открытия чата
-                            std::cout << "[ОТВЕТ СЕРВЕРА ПРИ ОТКРЫТИИ ЧАТА] " << message << std::endl;
-                            G_waitingForChatInitiation = false; // Сбросить флаг ожидания
-                            G_currentChatPartner.clear(); G_currentGroupName.clear(); // Сбросить цели чата
-                        }
-                        else if (!G_inChatMode.load() && !G_inGroupChatMode.load()) { // Если не в чате и не ждем открытия
-                            std::cout << "[ОТВЕТ СЕРВЕРА] " << message << std::endl;
-                        }
-                        // Если в чате, ошибки могут быть специфичными (например, ERROR_NOT_MEMBER при отправке)
-                        // и должны обрабатываться там, либо здесь как общий случай, если не были.
-                        // Сейчас они там не обрабатываются, поэтому выводятся тут.
-                        else { std::cout << "[ОТВЕТ СЕРВЕРА] " << message << std::endl; }
-
-                    }
-                    // Входящее личное сообщение, когда мы не в чате с этим пользователем
-                    else if (prefix == "MSG_FROM" && (!G_inChatMode.load() || G_currentChatPartner != payload.substr(0, payload.find(':'))) && !G_inGroupChatMode.load()) {
-                        std::cout << "<< " << message << " >>" << std::endl; // Показать как уведомление
-                    }
-                    // Игнорируем "остатки" истории, если мы уже не в режиме загрузки/ожидания
-                    else if ((prefix == "HISTORY_START" || prefix == "HIST_MSG" || prefix == "HISTORY_END" || prefix == "NO_HISTORY" ||
-                        prefix == "GROUP_HISTORY_START" || prefix == "GROUP_HIST_MSG" || prefix == "GROUP_HISTORY_END" || prefix == "NO_GROUP_HISTORY")
-                        && !G_inChatMode.load() && !G_inGroupChatMode.load() && !G_waitingForChatInitiation.load() && !chat_history_loading) {
-                        // Просто игнорируем эти сообщения, если они пришли не вовремя
-                    }
-                    // Все остальное, что не было опознано
-                    else if (prefix != "FRIEND_LIST_START" && prefix != "FRIEND" && prefix != "FRIEND_LIST_END" && prefix != "NO_FRIENDS_FOUND" &&
-                        prefix != "MY_GROUPS_START" && prefix != "MY_GROUP_ENTRY" && prefix != "MY_GROUPS_END" && prefix != "NO_GROUPS_JOINED")
-                    {
-                        // Этот блок ловит все, что не было явно обработано выше
-                        // Исключаем состояния явной загрузки списков или ожидания чата
-                        if (!G_inChatMode.load() && !G_inGroupChatMode.load() &&
-                            !G_waitingForChatInitiation.load() && !G_isReceivingFriendList.load() && !G_isReceivingGroupList.load())
-                        {
-                            std::cout << "[НЕИЗВЕСТНЫЙ ОТВЕТ СЕРВЕРА] " << message << std::endl;
-                        }
-                    }
-                } // конец if (!handled)
-            } // конец else if (!message.empty())
+        }
 
-            // Обновляем промпт после обработки сообщения, если клиент все еще работает и не выходит
-            if (G_clientRunning.load() && !G_programShouldExit.load()) {
-                displayPrompt();
-            }
-        } // конец if (selectResult > 0 && FD_ISSET)
+        // Запросы, на которые сервер так и не ответил
+        if (session.msUntilNextDeadline(std::chrono::steady_clock::now()) == 0 && G_clientRunning.load()) {
+            queue.setReceivedAt(std::chrono::steady_clock::now());
+            session.expireRequests(std::chrono::steady_clock::now());
+        }
+        // Все, что принято за итерацию, выводит поток вывода - будим его один раз
+        if (queue.published() != publishedBefore) renderLoop.wake();
     } // конец while (G_clientRunning.load())
 
-    // Сообщение о завершении потока, если это не полный выход из программы
-    if (!G_programShouldExit.load()) {
-        std::lock_guard<std::mutex> lock(G_coutMutex);
-        std::cout << "\r" << std::string(120, ' ') << "\r";
-        std::cout << "[ПРИЕМНИК] Поток приема сообщений завершен." << std::endl;
-    }
+    if (registeredSocket != INVALID_SOCKET_VALUE && registeredSocket == session.socket()) eventLoop.remove(registeredSocket);
+    // О завершении сообщает main - после того, как выведет принятое потоком до конца
 }
 
 
-int main() {
+#if defined(MESSENGER_TRACE) && defined(SIGUSR1)
+// kill -USR1 <pid>: трасса пишется сразу (приемник пишет файл, здесь только флаг и пробуждение)
+void requestTraceDump(int) {
+    G_traceDumpRequested.store(true);
+    if (G_traceEventLoop) G_traceEventLoop->wake();
+}
+#endif
+
+int main(int argc, char* argv[]) {
 #ifdef _WIN32 // Настройка кодировки консоли для Windows
     SetConsoleCP(1251); SetConsoleOutputCP(1251);
     WSADATA wsaData; if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0) { std::cerr << "[СИСТЕМА] WSAStartup не удался." << std::endl; return 1; }
 #endif
 
+    // Нагрузочный режим без интерактивного интерфейса
+    if (argc > 1 && std::string(argv[1]) == "--bench") {
+        int code = runLoadGenerator(argc, argv);
+#ifdef _WIN32
+        WSACleanup();
+#endif
+        return code;
+    }
+
+    // Серверы: --server, затем MESSENGER_SERVER, затем адрес по умолчанию. Список через запятую -
+    // резервные адреса, к которым клиент переходит, если текущий недоступен
+    ServerList servers;
+    StatsDump stats;
+    int historyPage = kDefaultHistoryPage;
+    servers.endpoints.push_back(Endpoint{ kDefaultServerIp, kDefaultServerPort });
+    if (const char* endpoints = std::getenv("MESSENGER_SERVER")) {
+        if (!parseEndpointList(endpoints, kDefaultServerPort, servers.endpoints)) {
+            std::cerr << "[СИСТЕМА] Некорректный MESSENGER_SERVER: " << endpoints << std::endl;
+            return 1;
+        }
+    }
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--server" && hasValue && parseEndpointList(argv[i + 1], kDefaultServerPort, servers.endpoints)) { ++i; }
+        else if (arg == "--connect-timeout" && hasValue && std::atoi(argv[i + 1]) > 0) {
+            servers.connectTimeout = std::chrono::milliseconds(std::atoi(argv[++i]));
+        }
+        else if (arg == "--stats-dump" && hasValue) { stats.path = argv[++i]; }
+        else if (arg == "--stats-interval" && hasValue && std::atoi(argv[i + 1]) > 0) {
+            stats.interval = std::chrono::seconds(std::atoi(argv[++i]));
+        }
+        else if (arg == "--history-page" && hasValue && std::atoi(argv[i + 1]) >= 0) { historyPage = std::atoi(argv[++i]); }
+        else {
+            std::cerr << "Использование: client [--server host[:port][,host[:port]...]] [--connect-timeout мс]" << std::endl;
+            std::cerr << "               [--stats-dump файл] [--stats-interval с] (метрики строкой JSON раз в интервал, 10 с)" << std::endl;
+            std::cerr << "               [--history-page N] (сообщений при открытии чата и на /more, " << kDefaultHistoryPage
+                      << "; 0 - вся история)" << std::endl;
+            std::cerr << "               client --bench [параметры] (см. client --bench --help)" << std::endl;
+            return 1;
+        }
+    }
+
+    EventLoop eventLoop; // Ожидание событий сокета в потоке приемника
+    if (!eventLoop.valid()) { std::cerr << "[СИСТЕМА] Не удалось создать цикл событий." << std::endl; return 1; }
+    traceThreadName("main");
+#if defined(MESSENGER_TRACE) && defined(SIGUSR1)
+    G_traceEventLoop = &eventLoop;
+    std::signal(SIGUSR1, requestTraceDump);
+#endif
+    G_renderer.enableTerminal();
+    ConsoleInput input(G_renderer, G_coutMutex); // В терминале - посимвольный ввод, набранное рисует рендер
+    Session session;     // Консольный интерфейс ведет одну сессию
+    session.setEventLoop(&eventLoop);
+    session.setHistoryPageSize(static_cast<size_t>(historyPage));
+    SearchIndex search;  // Локальный поиск по принятым сообщениям
+    ConsoleView view(session, search);
+    // События сессии идут в ConsoleView через очередь: приемник не ждет терминал
+    SessionEventQueue sessionEvents;
+    session.setListener(&sessionEvents);
+    EventLoop renderLoop; // Ожидание потока вывода: будят приемник и main
+    if (!renderLoop.valid()) { std::cerr << "[СИСТЕМА] Не удалось создать цикл событий." << std::endl; return 1; }
+    stats.next = std::chrono::steady_clock::now() + stats.interval;
+
     // Основной цикл программы: позволяет переподключаться после разрыва соединения
     while (!G_programShouldExit.load()) {
-        // Сброс флагов состояния перед новой попыткой подключения (если это не первый запуск)
-        G_clientRunning = true;
-        G_waitingForChatInitiation = false;
-        G_isReceivingFriendList = false;
-        G_isReceivingGroupList = false;
-        // G_loggedIn и G_currentUsername сбрасываются при реальном дисконнекте/logout
-
-        if (G_clientSocket == INVALID_SOCKET_VALUE) { // Если сокет не создан или был закрыт
-            G_clientSocket = socket(AF_INET, SOCK_STREAM, 0);
-            if (G_clientSocket == INVALID_SOCKET_VALUE) { std::cerr << "[СИСТЕМА] Ошибка создания сокета." << std::endl; return 1; }
-
-            sockaddr_in serverAddress;
-            serverAddress.sin_family = AF_INET;
-            serverAddress.sin_port = htons(8081); // Порт сервера
-            // =================================================================
-            // ========== IP АДРЕС СЕРВЕРА - ИЗМЕНИТЕ ПРИ НЕОБХОДИМОСТИ ==========
-            const char* server_ip = "192.168.0.24"; // или "192.168.0.24" и т.д.
-            // =================================================================
-#ifdef _WIN32
-            if (inet_pton(AF_INET, server_ip, &serverAddress.sin_addr) <= 0) {
-                std::cerr << "[СИСТЕМА] inet_pton ошибка для IP: " << server_ip << std::endl;
-                CLOSE_SOCKET(G_clientSocket); G_clientSocket = INVALID_SOCKET_VALUE; WSACleanup(); return 1;
-            }
-#else
-            if (inet_aton(server_ip, &serverAddress.sin_addr) == 0) {
-                std::cerr << "[СИСТЕМА] inet_aton ошибка для IP: " << server_ip << std::endl;
-                CLOSE_SOCKET(G_clientSocket); G_clientSocket = INVALID_SOCKET_VALUE; return 1;
+        G_clientRunning = true; // Сброс флага перед новой попыткой подключения (если это не первый запуск)
+
+        if (!session.connected()) { // Если сокет не создан или был закрыт
+            // Один проход по списку серверов; если никто не ответил, дальше пробует поток приемника
+            int error_code = 0;
+            bool connected = false;
+            for (size_t attempt = 0; attempt < servers.endpoints.size() && !connected; ++attempt) {
+                {
+                    std::lock_guard<std::mutex> lock(G_coutMutex);
+                    G_screen << "[СИСТЕМА] Попытка подключения к серверу " << servers.endpoint().host << ":" << servers.endpoint().port << "..." << std::endl;
+                    G_renderer.present(true); // Подключение может занять до connectTimeout
+                }
+                connected = connectToServer(session, servers, error_code);
             }
-#endif
-            {
-                std::lock_guard<std::mutex> lock(G_coutMutex);
-                std::cout << "[СИСТЕМА] Попытка подключения к серверу " << server_ip << ":" << ntohs(serverAddress.sin_port) << "..." << std::endl;
+            std::lock_guard<std::mutex> lock(G_coutMutex);
+            if (connected) {
+                G_screen << "[СИСТЕМА] Успешно подключено." << std::endl;
+                session.hello(); // Согласуем расширения протокола до логина
             }
-            if (connect(G_clientSocket, (sockaddr*)&serverAddress, sizeof(serverAddress)) == SOCKET_ERROR_VALUE) {
-                std::lock_guard<std::mutex> lock(G_coutMutex);
-                clearConsoleScreen();
-                std::cerr << "[СИСТЕМА] Подключение к серверу не удалось: " << GET_LAST_ERROR << std::endl;
-                std::cerr << "Нажмите Enter для переподключения или введите EXIT для выхода." << std::endl;
-                CLOSE_SOCKET(G_clientSocket); G_clientSocket = INVALID_SOCKET_VALUE; // Важно сбросить сокет
-
-                std::string temp_input;
-                std::getline(std::cin, temp_input); // Ожидаем ввода от пользователя
-                std::string temp_input_upper = temp_input;
-                std::transform(temp_input_upper.begin(), temp_input_upper.end(), temp_input_upper.begin(),
-                    [](unsigned char c) { return std::toupper(c); });
-                if (temp_input_upper == "EXIT") G_programShouldExit = true; // Если пользователь ввел EXIT
-                continue; // Переход к следующей итерации цикла while (!G_programShouldExit.load())
+            else {
+                G_screen << "[СИСТЕМА] Подключение к серверу не удалось: " << error_code << ". Переподключение в фоне." << std::endl;
             }
-            { std::lock_guard<std::mutex> lock(G_coutMutex); std::cout << "[СИСТЕМА] Успешно подключено." << std::endl; }
         }
 
-        std::thread receiverThread;
-        if (!G_programShouldExit.load() && G_clientSocket != INVALID_SOCKET_VALUE) {
-            receiverThread = std::thread(receiveMessagesThreadFunc); // Запускаем поток приемника
-        }
-        else if (G_programShouldExit.load()) { // Если уже принято решение о выходе
-            break;
-        }
+        if (G_programShouldExit.load()) break; // Если уже принято решение о выходе
 
         std::string lineInput; // Для ввода команд пользователя
         // Отображение начального экрана/справки при первом подключении или после переподключения (если не залогинен)
-        if (!G_programShouldExit.load() && !G_loggedIn.load()) {
-            printInitialScreen();
+        if (!G_programShouldExit.load() && !session.loggedIn()) {
+            printInitialScreen(session);
         }
         // Если залогинен, но не в чате - показать общую справку и промпт
-        else if (!G_programShouldExit.load() && !G_inChatMode.load() && !G_inGroupChatMode.load()) {
+        else if (!G_programShouldExit.load() && !session.inConversation()) {
             std::lock_guard<std::mutex> lock(G_coutMutex);
-            printHelp(G_loggedIn.load(), false, false, "");
-            displayPrompt();
+            printHelp(session.loggedIn(), false, false, "");
+            displayPrompt(session);
         }
         // Если в чате, промпт уже отображен потоком приемника при входе в чат
 
+        // Поток приемника запускается после начального экрана, чтобы тот не стер сообщения о переподключении
+        std::thread renderThread(renderThreadFunc, std::ref(renderLoop), std::ref(sessionEvents), std::ref(eventLoop), std::ref(view));
+        std::thread receiverThread(receiveMessagesThreadFunc, std::ref(eventLoop), std::ref(session), std::ref(sessionEvents), std::ref(renderLoop),
+            std::ref(servers), std::ref(stats));
+
         // Цикл обработки команд пользователя
         while (G_clientRunning.load() && !G_programShouldExit.load()) {
-            if (!std::getline(std::cin, lineInput)) { // Ошибка ввода или EOF
-                if (std::cin.eof()) { std::lock_guard<std::mutex> lock(G_coutMutex); std::cout << "\n[СИСТЕМА] EOF получен. Завершение..." << std::endl; }
-                else { std::lock_guard<std::mutex> lock(G_coutMutex); std::cout << "\n[СИСТЕМА] Ошибка ввода. Завершение..." << std::endl; }
+            if (!input.readLine(lineInput)) { // Ошибка ввода или EOF
+                if (input.eof()) { std::lock_guard<std::mutex> lock(G_coutMutex); G_screen << "\n[СИСТЕМА] EOF получен. Завершение..." << std::endl; }
+                else { std::lock_guard<std::mutex> lock(G_coutMutex); G_screen << "\n[СИСТЕМА] Ошибка ввода. Завершение..." << std::endl; }
                 G_programShouldExit = true; // Инициируем полный выход
                 G_clientRunning = false;    // Останавливаем этот цикл и поток приемника
                 break;
             }
             if (!G_clientRunning.load() || G_programShouldExit.load()) break; // Дополнительная проверка флагов
 
+            std::shared_ptr<const SessionState> state = session.state(); // Снимок: поток приемника может менять беседу
+            const Conversation& conversation = state->conversation;
             // --- Режим личного чата ---
-            if (G_inChatMode.load() && !G_inGroupChatMode.load()) {
+            if (conversation.active && conversation.kind == ConversationKind::Private) {
                 if (lineInput == "/exit_chat") {
-                    G_inChatMode = false;
-                    std::string exitedPartner = G_currentChatPartner; G_currentChatPartner.clear();
-                    G_waitingForChatInitiation = false; // Сброс на всякий случай
+                    std::string exitedPartner = session.leaveConversation();
                     std::lock_guard<std::mutex> lock(G_coutMutex);
                     clearConsoleScreen();
-                    std::cout << "[СИСТЕМА] Вы покинули чат с " << exitedPartner << "." << std::endl;
-                    printHelp(G_loggedIn.load(), false, false, ""); // Показать общую справку
-                    displayPrompt();
+                    G_screen << "[СИСТЕМА] Вы покинули чат с " << exitedPartner << "." << std::endl;
+                    printHelp(session.loggedIn(), false, false, ""); // Показать общую справку
+                    displayPrompt(session);
                 }
+                else if (lineInput == "/stats") printStats(session, sessionEvents);
+                else if (lineInput == "/more") { std::lock_guard<std::mutex> lock(G_coutMutex); view.showOlderHistory(); }
                 else if (!lineInput.empty()) { // Отправка сообщения в личный чат
-                    if (G_clientSocket != INVALID_SOCKET_VALUE) {
-                        clientSendMessage(G_clientSocket, "SEND_PRIVATE " + G_currentChatPartner + " " + lineInput);
-                        std::lock_guard<std::mutex> lock(G_coutMutex);
-                        std::cout << "\r" << std::string(120, ' ') << "\r"; // Очистка строки
-                        displayChatMessageClient(getCurrentLocalTimestampForChatDisplay(), G_currentUsername, lineInput); // Отображаем свое сообщение
-                        displayPrompt();
+                    if (session.connected()) {
+                        session.sendPrivate(conversation.name, lineInput);
+                        warnIfSendBacklog(session);
+                        TRACE_LOCK(lock, G_coutMutex, "lock G_coutMutex (send)");
+                        displayChatMessageClient(state->username, currentLocalTimeForDisplay().view(), state->username, lineInput); // Отображаем свое сообщение
+                        displayPrompt(session);
                     }
                     else {
                         std::lock_guard<std::mutex> lock(G_coutMutex);
-                        std::cout << "[СИСТЕМА] Нет соединения для отправки." << std::endl; displayPrompt();
+                        G_screen << "[СИСТЕМА] Нет соединения для отправки." << std::endl; displayPrompt(session);
                     }
                 }
                 else { // Пустой ввод в чате - просто обновить промпт
-                    std::lock_guard<std::mutex> lock(G_coutMutex); displayPrompt();
+                    std::lock_guard<std::mutex> lock(G_coutMutex); displayPrompt(session);
                 }
                 continue; // Пропускаем дальнейший парсинг команд
             }
             // --- Режим группового чата ---
-            else if (G_inGroupChatMode.load()) {
+            else if (conversation.active) {
                 if (lineInput == "/exit_chat") {
-                    G_inGroupChatMode = false;
-                    std::string exitedGroup = G_currentGroupName; G_currentGroupName.clear();
-                    G_waitingForChatInitiation = false;
+                    std::string exitedGroup = session.leaveConversation();
                     std::lock_guard<std::mutex> lock(G_coutMutex);
                     clearConsoleScreen();
-                    std::cout << "[СИСТЕМА] Вы покинули группу '" << exitedGroup << "'." << std::endl;
-                    printHelp(G_loggedIn.load(), false, false, "");
-                    displayPrompt();
+                    G_screen << "[СИСТЕМА] Вы покинули группу '" << exitedGroup << "'." << std::endl;
+                    printHelp(session.loggedIn(), false, false, "");
+                    displayPrompt(session);
                 }
+                else if (lineInput == "/stats") printStats(session, sessionEvents);
+                else if (lineInput == "/more") { std::lock_guard<std::mutex> lock(G_coutMutex); view.showOlderHistory(); }
                 else if (!lineInput.empty()) { // Отправка сообщения в группу
-                    if (G_clientSocket != INVALID_SOCKET_VALUE) {
-                        clientSendMessage(G_clientSocket, "SEND_GROUP " + G_currentGroupName + " " + lineInput);
-                        std::lock_guard<std::mutex> lock(G_coutMutex);
-                        std::cout << "\r" << std::string(120, ' ') << "\r";
-                        displayChatMessageClient(getCurrentLocalTimestampForChatDisplay(), G_currentUsername, lineInput);
-                        displayPrompt();
+                    if (session.connected()) {
+                        session.sendGroup(conversation.name, lineInput);
+                        warnIfSendBacklog(session);
+                        TRACE_LOCK(lock, G_coutMutex, "lock G_coutMutex (send)");
+                        displayChatMessageClient(state->username, currentLocalTimeForDisplay().view(), state->username, lineInput);
+                        displayPrompt(session);
                     }
                     else {
                         std::lock_guard<std::mutex> lock(G_coutMutex);
-                        std::cout << "[СИСТЕМА] Нет соединения для отправки." << std::endl; displayPrompt();
+                        G_screen << "[СИСТЕМА] Нет соединения для отправки." << std::endl; displayPrompt(session);
                     }
                 }
                 else {
-                    std::lock_guard<std::mutex> lock(G_coutMutex); displayPrompt();
+                    std::lock_guard<std::mutex> lock(G_coutMutex); displayPrompt(session);
                 }
                 continue; // Пропускаем дальнейший парсинг команд
             }
@@ -802,13 +1247,13 @@ int main() {
             std::transform(cmd_token_upper.begin(), cmd_token_upper.end(), cmd_token_upper.begin(),
                 [](unsigned char c) { return ::toupper(c); });
 
-            if (lineInput.empty()) { std::lock_guard<std::mutex> lock(G_coutMutex); displayPrompt(); continue; }
+            if (lineInput.empty()) { std::lock_guard<std::mutex> lock(G_coutMutex); displayPrompt(session); continue; }
 
             bool logout_initiated_by_user = false; // Флаг, что пользователь ввел EXIT/LOGOUT
 
             if (cmd_token_upper == "EXIT") {
-                if (G_loggedIn.load()) { // Если залогинен, сначала отправляем LOGOUT серверу
-                    if (G_clientSocket != INVALID_SOCKET_VALUE) clientSendMessage(G_clientSocket, "LOGOUT");
+                if (session.loggedIn()) { // Если залогинен, сначала отправляем LOGOUT серверу
+                    session.logout();
                     logout_initiated_by_user = true; // Флаг для ожидания ответа от сервера и корректного выхода
                     // G_clientRunning = false будет установлено после ожидания или таймаута
                 }
@@ -819,97 +1264,108 @@ int main() {
             }
             else if (cmd_token_upper == "HELP") {
                 std::lock_guard<std::mutex> lock(G_coutMutex);
-                std::string target = G_inGroupChatMode.load() ? G_currentGroupName : (G_inChatMode.load() ? G_currentChatPartner : "");
-                printHelp(G_loggedIn.load(), G_inChatMode.load(), G_inGroupChatMode.load(), target);
-                displayPrompt();
+                printSessionHelp(session);
+                displayPrompt(session);
             }
             else if (cmd_token_upper == "FRIENDS") { // Запрос списка друзей
-                if (!G_loggedIn.load()) { std::lock_guard<std::mutex> lock(G_coutMutex); std::cout << "[СИСТЕМА] Сначала войдите в систему." << std::endl; displayPrompt(); }
-                else if (G_clientSocket != INVALID_SOCKET_VALUE) { clientSendMessage(G_clientSocket, "GET_CHAT_PARTNERS"); std::lock_guard<std::mutex> lock(G_coutMutex); displayPrompt(); }
-                else { std::lock_guard<std::mutex> lock(G_coutMutex); std::cout << "[СИСТЕМА] Нет соединения." << std::endl; displayPrompt(); }
+                if (!session.loggedIn()) { std::lock_guard<std::mutex> lock(G_coutMutex); G_screen << "[СИСТЕМА] Сначала войдите в систему." << std::endl; displayPrompt(session); }
+                else if (session.connected()) { session.requestFriendList(); std::lock_guard<std::mutex> lock(G_coutMutex); displayPrompt(session); }
+                else { std::lock_guard<std::mutex> lock(G_coutMutex); G_screen << "[СИСТЕМА] Нет соединения." << std::endl; displayPrompt(session); }
+            }
+            else if (cmd_token_upper == "UNREAD") {
+                std::lock_guard<std::mutex> lock(G_coutMutex);
+                if (!session.loggedIn()) G_screen << "[СИСТЕМА] Сначала войдите." << std::endl;
+                else view.printUnread();
+                displayPrompt(session);
+            }
+            else if (cmd_token_upper == "/STATS") printStats(session, sessionEvents);
+            else if (cmd_token_upper == "SEARCH") {
+                if (!session.loggedIn()) { std::lock_guard<std::mutex> lock(G_coutMutex); G_screen << "[СИСТЕМА] Сначала войдите." << std::endl; displayPrompt(session); }
+                else if (cmd_args.empty()) { std::lock_guard<std::mutex> lock(G_coutMutex); G_screen << "[СИСТЕМА] Укажите слова: SEARCH <слова> [in <чат>]" << std::endl; displayPrompt(session); }
+                else runSearch(search, session, cmd_args);
             }
             else if (cmd_token_upper == "CREATE_GROUP") {
-                if (!G_loggedIn.load()) { std::lock_guard<std::mutex> lock(G_coutMutex); std::cout << "[СИСТЕМА] Сначала войдите." << std::endl; displayPrompt(); }
-                else if (cmd_args.empty()) { std::lock_guard<std::mutex> lock(G_coutMutex); std::cout << "[СИСТЕМА] Укажите название группы: CREATE_GROUP <название>" << std::endl; displayPrompt(); }
-                else { clientSendMessage(G_clientSocket, "CREATE_GROUP " + cmd_args); std::lock_guard<std::mutex> lock(G_coutMutex); displayPrompt(); }
+                if (!session.loggedIn()) { std::lock_guard<std::mutex> lock(G_coutMutex); G_screen << "[СИСТЕМА] Сначала войдите." << std::endl; displayPrompt(session); }
+                else if (cmd_args.empty()) { std::lock_guard<std::mutex> lock(G_coutMutex); G_screen << "[СИСТЕМА] Укажите название группы: CREATE_GROUP <название>" << std::endl; displayPrompt(session); }
+                else { session.createGroup(cmd_args); std::lock_guard<std::mutex> lock(G_coutMutex); displayPrompt(session); }
             }
             else if (cmd_token_upper == "JOIN_GROUP") {
-                if (!G_loggedIn.load()) { std::lock_guard<std::mutex> lock(G_coutMutex); std::cout << "[СИСТЕМА] Сначала войдите." << std::endl; displayPrompt(); }
-                else if (cmd_args.empty()) { std::lock_guard<std::mutex> lock(G_coutMutex); std::cout << "[СИСТЕМА] Укажите название группы: JOIN_GROUP <название>" << std::endl; displayPrompt(); }
-                else { clientSendMessage(G_clientSocket, "JOIN_GROUP " + cmd_args); std::lock_guard<std::mutex> lock(G_coutMutex); displayPrompt(); }
+                if (!session.loggedIn()) { std::lock_guard<std::mutex> lock(G_coutMutex); G_screen << "[СИСТЕМА] Сначала войдите." << std::endl; displayPrompt(session); }
+                else if (cmd_args.empty()) { std::lock_guard<std::mutex> lock(G_coutMutex); G_screen << "[СИСТЕМА] Укажите название группы: JOIN_GROUP <название>" << std::endl; displayPrompt(session); }
+                else { session.joinGroup(cmd_args); std::lock_guard<std::mutex> lock(G_coutMutex); displayPrompt(session); }
             }
             else if (cmd_token_upper == "GROUPCHAT") { // Вход в групповой чат (запрос истории)
-                if (!G_loggedIn.load()) { std::lock_guard<std::mutex> lock(G_coutMutex); std::cout << "[СИСТЕМА] Сначала войдите." << std::endl; displayPrompt(); }
-                else if (cmd_args.empty()) { std::lock_guard<std::mutex> lock(G_coutMutex); std::cout << "[СИСТЕМА] Укажите название группы: GROUPCHAT <название>" << std::endl; displayPrompt(); }
-                else {
-                    std::lock_guard<std::mutex> lock(G_coutMutex); // Защищаем G_currentGroupName и др.
-                    G_currentGroupName = cmd_args;
-                    G_waitingForChatInitiation = true; // Ожидаем ответа с историей
-                    G_inChatMode = false; G_currentChatPartner.clear(); // Выходим из личного чата, если были
-
-                    clientSendMessage(G_clientSocket, "GROUPCHAT " + G_currentGroupName);
-                    std::cout << "\r" << std::string(120, ' ') << "\r";
-                    std::cout << "[СИСТЕМА] Запрос группового чата '" << G_currentGroupName << "'..." << std::endl;
-                    displayPrompt();
+                if (!session.loggedIn()) { std::lock_guard<std::mutex> lock(G_coutMutex); G_screen << "[СИСТЕМА] Сначала войдите." << std::endl; displayPrompt(session); }
+                else if (cmd_args.empty()) { std::lock_guard<std::mutex> lock(G_coutMutex); G_screen << "[СИСТЕМА] Укажите название группы: GROUPCHAT <название>" << std::endl; displayPrompt(session); }
+                else if (session.connected()) {
+                    {
+                        std::lock_guard<std::mutex> lock(G_coutMutex); // История из кэша выводится под ним же
+                        session.openConversation(ConversationKind::Group, cmd_args, &view); // Выходим из личного чата, если были
+                        // Без кэша группа откроется с приходом истории
+                        if (!session.inConversation()) G_screen << "[СИСТЕМА] Запрос группового чата '" << cmd_args << "'..." << std::endl;
+                        displayPrompt(session);
+                    }
+                    warnIfSendBacklog(session); // Вне G_coutMutex: предупреждение выводится под ним
                 }
+                else { std::lock_guard<std::mutex> lock(G_coutMutex); G_screen << "[СИСТЕМА] Нет соединения." << std::endl; displayPrompt(session); }
             }
             else if (cmd_token_upper == "LIST_MY_GROUPS") {
-                if (!G_loggedIn.load()) { std::lock_guard<std::mutex> lock(G_coutMutex); std::cout << "[СИСТЕМА] Сначала войдите." << std::endl; displayPrompt(); }
-                else { clientSendMessage(G_clientSocket, "LIST_MY_GROUPS"); std::lock_guard<std::mutex> lock(G_coutMutex); displayPrompt(); }
+                if (!session.loggedIn()) { std::lock_guard<std::mutex> lock(G_coutMutex); G_screen << "[СИСТЕМА] Сначала войдите." << std::endl; displayPrompt(session); }
+                else { session.requestGroupList(); std::lock_guard<std::mutex> lock(G_coutMutex); displayPrompt(session); }
             }
             else if (cmd_token_upper == "CHAT") { // Вход в личный чат (запрос истории)
-                if (!G_loggedIn.load()) { std::lock_guard<std::mutex> lock(G_coutMutex); std::cout << "[СИСТЕМА] Сначала войдите." << std::endl; displayPrompt(); }
-                else if (cmd_args.empty()) { std::lock_guard<std::mutex> lock(G_coutMutex); std::cout << "[СИСТЕМА] Укажите имя пользователя: CHAT <username>" << std::endl; displayPrompt(); }
-                else if (cmd_args == G_currentUsername) { std::lock_guard<std::mutex> lock(G_coutMutex); std::cout << "[СИСТЕМА] Нельзя начать чат с самим собой." << std::endl; displayPrompt(); }
+                if (!session.loggedIn()) { std::lock_guard<std::mutex> lock(G_coutMutex); G_screen << "[СИСТЕМА] Сначала войдите." << std::endl; displayPrompt(session); }
+                else if (cmd_args.empty()) { std::lock_guard<std::mutex> lock(G_coutMutex); G_screen << "[СИСТЕМА] Укажите имя пользователя: CHAT <username>" << std::endl; displayPrompt(session); }
+                else if (cmd_args == session.username()) { std::lock_guard<std::mutex> lock(G_coutMutex); G_screen << "[СИСТЕМА] Нельзя начать чат с самим собой." << std::endl; displayPrompt(session); }
                 else {
-                    if (G_clientSocket != INVALID_SOCKET_VALUE) {
-                        std::lock_guard<std::mutex> lock(G_coutMutex);
-                        G_currentChatPartner = cmd_args;
-                        G_waitingForChatInitiation = true;
-                        G_inGroupChatMode = false; G_currentGroupName.clear(); // Выходим из группового, если были
-
-                        clientSendMessage(G_clientSocket, "GET_HISTORY " + G_currentChatPartner);
-                        std::cout << "\r" << std::string(120, ' ') << "\r";
-                        std::cout << "[СИСТЕМА] Запрос чата с " << G_currentChatPartner << "..." << std::endl;
-                        displayPrompt();
+                    if (session.connected()) {
+                        {
+                            std::lock_guard<std::mutex> lock(G_coutMutex);
+                            session.openConversation(ConversationKind::Private, cmd_args, &view); // Выходим из группового, если были
+                            if (!session.inConversation()) G_screen << "[СИСТЕМА] Запрос чата с " << cmd_args << "..." << std::endl;
+                            displayPrompt(session);
+                        }
+                        warnIfSendBacklog(session);
                     }
-                    else { std::lock_guard<std::mutex> lock(G_coutMutex); std::cout << "[СИСТЕМА] Нет соединения." << std::endl; displayPrompt(); }
+                    else { std::lock_guard<std::mutex> lock(G_coutMutex); G_screen << "[СИСТЕМА] Нет соединения." << std::endl; displayPrompt(session); }
                 }
             }
             else if (cmd_token_upper == "LOGIN" || cmd_token_upper == "REGISTRATION") {
-                std::string msg_to_send = cmd_token_upper; // LOGIN или REGISTRATION
-                if (!cmd_args.empty()) msg_to_send += " " + cmd_args; // Добавляем <username> <password>
+                auto [username, password] = splitFirstWord(cmd_args); // <username> <password>
 
-                if (G_clientSocket == INVALID_SOCKET_VALUE) { std::lock_guard<std::mutex> lock(G_coutMutex); std::cout << "[СИСТЕМА] Нет соединения." << std::endl; displayPrompt(); }
-                else { clientSendMessage(G_clientSocket, msg_to_send); std::lock_guard<std::mutex> lock(G_coutMutex); displayPrompt(); }
+                if (username.empty() || password.empty()) {
+                    std::lock_guard<std::mutex> lock(G_coutMutex);
+                    G_screen << "[СИСТЕМА] Использование: " << cmd_token_upper << " <имя_пользователя> <пароль>" << std::endl;
+                    displayPrompt(session);
+                }
+                else if (!session.connected()) { std::lock_guard<std::mutex> lock(G_coutMutex); G_screen << "[СИСТЕМА] Нет соединения." << std::endl; displayPrompt(session); }
+                else {
+                    // Стартовые запросы уходят сразу за LOGIN, не дожидаясь ответа: сервер обработает их по порядку
+                    // уже после входа. Если вход не удастся, их ошибки не показываем
+                    if (cmd_token_upper == "LOGIN") session.login(username, password);
+                    else session.registerUser(username, password);
+                    session.requestFriendList(true);
+                    session.requestGroupList(true);
+                    std::lock_guard<std::mutex> lock(G_coutMutex); displayPrompt(session);
+                }
             }
             else { // Неизвестная команда
                 std::lock_guard<std::mutex> lock(G_coutMutex);
-                std::cout << "[СИСТЕМА] Неизвестная команда: '" << lineInput << "'" << std::endl;
-                displayPrompt();
+                G_screen << "[СИСТЕМА] Неизвестная команда: '" << lineInput << "'" << std::endl;
+                displayPrompt(session);
             }
 
             // Обработка выхода по команде EXIT/LOGOUT
             if (logout_initiated_by_user) {
                 // Даем потоку приемника шанс обработать OK_LOGOUT от сервера
-                auto logout_start_time = std::chrono::steady_clock::now();
-                bool server_confirmed_logout = false;
-                while (std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - logout_start_time).count() < 700) { // Таймаут ожидания
-                    if (!G_loggedIn.load()) { // Если G_loggedIn стал false (обработано потоком приемника)
-                        server_confirmed_logout = true;
-                        break;
-                    }
-                    std::this_thread::sleep_for(std::chrono::milliseconds(50));
-                }
+                // Поток приемника будит нас сразу, как только сессия сбросит вход
+                bool server_confirmed_logout = session.waitForLogout(std::chrono::milliseconds(700)); // Таймаут ожидания
 
                 if (!server_confirmed_logout) { // Если сервер не подтвердил выход или таймаут
-                    std::lock_guard<std::mutex> lock(G_coutMutex); // Защищаем сброс глобальных переменных
+                    std::lock_guard<std::mutex> lock(G_coutMutex);
                     // Принудительно сбрасываем состояние, так как сервер мог не ответить или ответ потерялся
-                    G_loggedIn = false; G_currentUsername.clear();
-                    G_inChatMode = false; G_currentChatPartner.clear();
-                    G_inGroupChatMode = false; G_currentGroupName.clear();
-                    G_waitingForChatInitiation = false;
-                    std::cout << "[СИСТЕМА] Выход из учетной записи (таймаут ответа от сервера)." << std::endl;
+                    session.resetLogin();
+                    G_screen << "[СИСТЕМА] Выход из учетной записи (таймаут ответа от сервера)." << std::endl;
                 }
                 G_clientRunning = false; // Останавливаем основной цикл и поток приемника для этой сессии
                 // Это приведет к переподключению или выходу из программы, если G_programShouldExit true
@@ -918,42 +1374,43 @@ int main() {
 
         // Завершение текущей сессии клиента (не обязательно всей программы)
         G_clientRunning = false; // Сигнал потоку приемника на завершение
+        eventLoop.wake();        // Поток приемника спит в ожидании событий без таймаута - будим
+        renderLoop.wake();       // Как и поток вывода
         if (receiverThread.joinable()) {
             receiverThread.join(); // Ожидаем завершения потока приемника
         }
+        if (renderThread.joinable()) renderThread.join();
 
-        // Закрываем сокет, если он был открыт и программа не должна полностью завершаться
-        // (чтобы при следующей итерации внешнего цикла создался новый)
-        // Если G_programShouldExit true, сокет закроется перед выходом из main.
-        if (G_clientSocket != INVALID_SOCKET_VALUE && !G_programShouldExit.load()) {
-            CLOSE_SOCKET(G_clientSocket);
-            G_clientSocket = INVALID_SOCKET_VALUE;
-        }
-        else if (G_programShouldExit.load() && G_clientSocket != INVALID_SOCKET_VALUE) {
-            // Если полный выход, тоже закрываем сокет здесь, чтобы не делать это дважды.
-            CLOSE_SOCKET(G_clientSocket); G_clientSocket = INVALID_SOCKET_VALUE;
-        }
-
-        // Сброс состояний перед возможным переподключением, если программа не завершается
-        if (!G_programShouldExit.load()) {
-            // Эти флаги уже должны быть false после выхода из чатов/логаута, но для надежности
-            G_loggedIn = false; G_currentUsername.clear();
-            G_inChatMode = false; G_currentChatPartner.clear();
-            G_inGroupChatMode = false; G_currentGroupName.clear();
-            G_waitingForChatInitiation = false;
-            G_isReceivingFriendList = false; G_isReceivingGroupList = false;
+        // Закрываем сокет и сбрасываем вход, беседу и запросы: при следующей итерации внешнего цикла
+        // создастся новое соединение (или программа завершится)
+        session.disconnect();
+        {
+            // Недоставленное выводим сейчас, а не поверх начального экрана следующего соединения
+            std::lock_guard<std::mutex> lock(G_coutMutex);
+            while (deliverEvents(sessionEvents, view) > 0) {}
+            view.reset();
+            displayPrompt(session); // finishBatch после G_clientRunning = false промпт уже не перерисовывает
+            // Сообщение о завершении потока приемника, если это не полный выход из программы
+            if (!G_programShouldExit.load()) G_screen << "[ПРИЕМНИК] Поток приема сообщений завершен." << std::endl;
         }
     } // конец while (!G_programShouldExit.load()) - главный цикл программы
 
     // Финальное завершение
+    if (!stats.path.empty()) stats.write(session, sessionEvents); // Итог за весь запуск
     {
         std::lock_guard<std::mutex> lock(G_coutMutex);
-        std::cout << "\r" << std::string(120, ' ') << "\r";
-        std::cout << "[СИСТЕМА] Завершение работы клиента..." << std::endl;
+        G_screen << "[СИСТЕМА] Завершение работы клиента..." << std::endl;
+        if (kTraceEnabled) {
+            std::string tracePath = traceDefaultPath();
+            if (traceDump(tracePath)) G_screen << "[СИСТЕМА] Трасса записана в " << tracePath << std::endl;
+            else G_screen << "[СИСТЕМА] Не удалось записать трассу в " << tracePath << std::endl;
+        }
     }
 #ifdef _WIN32
     WSACleanup();
 #endif
-    std::cout << "[СИСТЕМА] Клиент завершил работу. До новых встреч!" << std::endl;
+    G_screen << "[СИСТЕМА] Клиент завершил работу. До новых встреч!" << std::endl;
+    G_renderer.setPrompt({}); // Строку ввода после выхода не оставляем
+    G_renderer.present(true);
     return 0;
 }
\ No newline at end of file
@@ -1,8 +1,42 @@
-﻿// messengerclient.h : включаемый файл для стандартных системных включаемых файлов
-// или включаемые файлы для конкретного проекта.
+﻿// messengerclient.h : сокеты платформы и общие определения библиотеки messenger.
+// Консольного ввода-вывода здесь нет - его подключает только консольный клиент.
 
 #pragma once
 
-#include <iostream>
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <windows.h>
+#pragma comment(lib, "ws2_32.lib")
+#else
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/select.h>
+#endif
 
-// TODO: установите здесь ссылки на дополнительные заголовки, требующиеся для программы.
+// Кросс-платформенные определения
+#ifdef _WIN32
+typedef SOCKET SocketType;
+#define INVALID_SOCKET_VALUE INVALID_SOCKET
+#define SOCKET_ERROR_VALUE SOCKET_ERROR
+#define CLOSE_SOCKET closesocket
+#define GET_LAST_ERROR WSAGetLastError()
+#else
+typedef int SocketType;
+#define INVALID_SOCKET_VALUE -1
+#define SOCKET_ERROR_VALUE -1
+#define CLOSE_SOCKET close
+#define GET_LAST_ERROR errno
+#endif
+
+// Сервер по умолчанию
+constexpr const char* kDefaultServerIp = "192.168.0.24";
+constexpr unsigned short kDefaultServerPort = 8081;
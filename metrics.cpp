@@ -0,0 +1,199 @@
+﻿#include "metrics.h"
+
+#include <algorithm> // std::min
+#include <cstdio>    // std::snprintf
+#include <iterator>  // std::size
+
+#include "protocol.h"
+
+namespace {
+
+// Ответы сервера, которые знает Session::dispatch; два последних места - ERROR_* и все остальное
+constexpr std::string_view kServerVerbs[] = {
+    "CAPS", "OK_LOGIN", "OK_REGISTERED", "OK_LOGOUT", "OK_GROUP_CREATED", "OK_JOINED_GROUP", "OK_SENT",
+    "OK_GROUP_MSG_SENT", "HISTORY_START", "HIST_MSG", "HISTORY_END", "NO_HISTORY", "GROUP_HISTORY_START",
+    "GROUP_HIST_MSG", "GROUP_HISTORY_END", "NO_GROUP_HISTORY", "MSG_FROM", "GROUP_MSG_FROM", "USER_JOINED_GROUP",
+    "INFO_ADDED_TO_GROUP", "FRIEND_LIST_START", "FRIEND", "FRIEND_LIST_END", "NO_FRIENDS_FOUND", "MY_GROUPS_START",
+    "MY_GROUP_ENTRY", "MY_GROUPS_END", "NO_GROUPS_JOINED",
+};
+constexpr size_t kServerError = std::size(kServerVerbs);
+constexpr size_t kServerOther = kServerError + 1;
+
+// Команды, которые отправляет Session; последнее место - все остальное
+constexpr std::string_view kClientVerbs[] = {
+    "HELLO", "FRAMES", "LOGIN", "REGISTRATION", "LOGOUT", "GET_CHAT_PARTNERS", "LIST_MY_GROUPS", "GET_HISTORY",
+    "GET_HISTORY_SINCE", "GROUPCHAT", "GROUPCHAT_SINCE", "SEND_PRIVATE", "SEND_GROUP", "CREATE_GROUP", "JOIN_GROUP",
+};
+constexpr size_t kClientOther = std::size(kClientVerbs);
+
+constexpr VerbTable<uint8_t, std::size(kServerVerbs)> kServerIndex(kServerVerbs);
+constexpr VerbTable<uint8_t, std::size(kClientVerbs)> kClientIndex(kClientVerbs);
+
+std::string_view serverVerbName(size_t index) {
+    if (index < kServerError) return kServerVerbs[index];
+    return index == kServerError ? "ERROR_*" : "OTHER";
+}
+
+std::string_view clientVerbName(size_t index) {
+    return index < kClientOther ? kClientVerbs[index] : "OTHER";
+}
+
+struct LatencyInfo {
+    const char* title; // Для /stats
+    const char* key;   // Для JSON
+};
+
+constexpr LatencyInfo kLatencyInfo[] = {
+    { "HELLO -> CAPS (сеть)", "handshake" },
+    { "отправка -> OK_SENT", "send_ack" },
+    { "открытие истории", "history_open" },
+    { "прием -> экран", "render" },
+};
+static_assert(std::size(kLatencyInfo) == kLatencyMetricCount, "Описание каждой гистограммы");
+
+void appendFormat(std::string& out, const char* format, double a, double b = 0, double c = 0, double d = 0) {
+    char buffer[64];
+    int length = std::snprintf(buffer, sizeof(buffer), format, a, b, c, d);
+    if (length > 0) out.append(buffer, static_cast<size_t>(std::min<int>(length, sizeof(buffer) - 1)));
+}
+
+void appendBytes(std::string& out, uint64_t bytes) {
+    if (bytes < 1024) { out += std::to_string(bytes); out += " Б"; }
+    else if (bytes < 1024 * 1024) appendFormat(out, "%.1f КБ", static_cast<double>(bytes) / 1024.0);
+    else appendFormat(out, "%.1f МБ", static_cast<double>(bytes) / (1024.0 * 1024.0));
+}
+
+// Дописывает текст и пробелы до ширины width символов (UTF-8: русские буквы - по два байта)
+void appendPadded(std::string& out, std::string_view text, size_t width) {
+    size_t chars = 0;
+    for (char c : text) chars += (static_cast<unsigned char>(c) & 0xC0) != 0x80;
+    out += text;
+    if (chars < width) out.append(width - chars, ' ');
+}
+
+double toMs(uint64_t us) {
+    return static_cast<double>(us) / 1000.0;
+}
+
+} // namespace
+
+static_assert(std::size(kServerVerbs) + 2 == Metrics::kServerVerbSlots, "Место на каждый глагол сервера");
+static_assert(std::size(kClientVerbs) + 1 == Metrics::kClientVerbSlots, "Место на каждую команду");
+
+void Metrics::countReceived(std::string_view verb) {
+    size_t index = kServerIndex.find(verb, UINT8_MAX);
+    if (index == UINT8_MAX) index = startsWith(verb, "ERROR_") ? kServerError : kServerOther;
+    m_received[index].fetch_add(1, std::memory_order_relaxed);
+}
+
+void Metrics::countSent(std::string_view verb, size_t bytes) {
+    size_t index = kClientIndex.find(verb, UINT8_MAX);
+    if (index == UINT8_MAX) index = kClientOther;
+    m_sent[index].fetch_add(1, std::memory_order_relaxed);
+    m_sentBytes[index].fetch_add(bytes, std::memory_order_relaxed);
+}
+
+void Metrics::recordLatency(LatencyMetric metric, Clock::duration elapsed) {
+    auto us = std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count();
+    m_latency[static_cast<size_t>(metric)].record(us > 0 ? static_cast<uint64_t>(us) : 0);
+}
+
+void Metrics::appendReport(std::string& out) const {
+    double uptime = std::chrono::duration<double>(Clock::now() - m_started).count();
+    uint64_t bytesSent = 0;
+    for (const auto& bytes : m_sentBytes) bytesSent += bytes.load(std::memory_order_relaxed);
+
+    appendFormat(out, "--- Статистика за %.0f с ---\n", uptime);
+    out += "Сеть: принято ";
+    appendBytes(out, m_bytesReceived.load(std::memory_order_relaxed));
+    out += ", отправлено ";
+    appendBytes(out, bytesSent);
+    out += '\n';
+
+    // Сеть: HELLO -> CAPS. Намного больше у отправки и истории - сервер; у "прием -> экран" - терминал
+    appendPadded(out, "Задержки, мс", 30);
+    out += "   число      p50      p90      p99     макс\n";
+    for (size_t i = 0; i < kLatencyMetricCount; ++i) {
+        LatencyHistogram histogram = m_latency[i].snapshot();
+        char line[128];
+        std::snprintf(line, sizeof(line), " %7llu %8.2f %8.2f %8.2f %8.2f\n", static_cast<unsigned long long>(histogram.count()),
+            toMs(histogram.percentile(0.5)), toMs(histogram.percentile(0.9)), toMs(histogram.percentile(0.99)), toMs(histogram.max()));
+        out += "  ";
+        appendPadded(out, kLatencyInfo[i].title, 28);
+        out += line;
+    }
+
+    out += "Ответы сервера:";
+    bool any = false;
+    for (size_t i = 0; i < m_received.size(); ++i) {
+        uint64_t count = m_received[i].load(std::memory_order_relaxed);
+        if (count == 0) continue;
+        out += any ? ", " : " ";
+        out += serverVerbName(i);
+        out += ' ';
+        out += std::to_string(count);
+        any = true;
+    }
+    out += any ? "\n" : " нет\n";
+
+    out += "Команды:";
+    any = false;
+    for (size_t i = 0; i < m_sent.size(); ++i) {
+        uint64_t count = m_sent[i].load(std::memory_order_relaxed);
+        if (count == 0) continue;
+        out += any ? ", " : " ";
+        out += clientVerbName(i);
+        out += ' ';
+        out += std::to_string(count);
+        out += " (";
+        appendBytes(out, m_sentBytes[i].load(std::memory_order_relaxed));
+        out += ')';
+        any = true;
+    }
+    out += any ? "\n" : " нет\n";
+}
+
+void Metrics::appendJson(std::string& out) const {
+    uint64_t bytesSent = 0;
+    for (const auto& bytes : m_sentBytes) bytesSent += bytes.load(std::memory_order_relaxed);
+    appendFormat(out, "{\"uptime_s\":%.3f", std::chrono::duration<double>(Clock::now() - m_started).count());
+    out += ",\"bytes_in\":" + std::to_string(m_bytesReceived.load(std::memory_order_relaxed));
+    out += ",\"bytes_out\":" + std::to_string(bytesSent);
+
+    out += ",\"received\":{";
+    bool first = true;
+    for (size_t i = 0; i < m_received.size(); ++i) {
+        uint64_t count = m_received[i].load(std::memory_order_relaxed);
+        if (count == 0) continue;
+        if (!first) out += ',';
+        out += '"';
+        out += serverVerbName(i);
+        out += "\":" + std::to_string(count);
+        first = false;
+    }
+    out += "},\"sent\":{";
+    first = true;
+    for (size_t i = 0; i < m_sent.size(); ++i) {
+        uint64_t count = m_sent[i].load(std::memory_order_relaxed);
+        if (count == 0) continue;
+        if (!first) out += ',';
+        out += '"';
+        out += clientVerbName(i);
+        out += "\":{\"count\":" + std::to_string(count) + ",\"bytes\":" + std::to_string(m_sentBytes[i].load(std::memory_order_relaxed)) + "}";
+        first = false;
+    }
+    out += "},\"latency_us\":{";
+    for (size_t i = 0; i < kLatencyMetricCount; ++i) {
+        LatencyHistogram histogram = m_latency[i].snapshot();
+        if (i) out += ',';
+        out += '"';
+        out += kLatencyInfo[i].key;
+        out += "\":{\"count\":" + std::to_string(histogram.count());
+        out += ",\"p50\":" + std::to_string(histogram.percentile(0.5));
+        out += ",\"p90\":" + std::to_string(histogram.percentile(0.9));
+        out += ",\"p99\":" + std::to_string(histogram.percentile(0.99));
+        out += ",\"max\":" + std::to_string(histogram.max());
+        out += ",\"mean\":" + std::to_string(static_cast<uint64_t>(histogram.mean())) + "}";
+    }
+    out += "}}";
+}
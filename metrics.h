@@ -0,0 +1,58 @@
+﻿// metrics.h : встроенные метрики клиента - команда /stats и периодический дамп (--stats-dump).
+// Счетчики по глаголам (ответы сервера и команды клиента), байты по сети и гистограммы задержек,
+// по которым видно, где теряется время: в сети, на сервере или в терминале.
+// Пишет поток цикла событий (и интерфейс - задержку вывода), читает любой поток: счетчики атомарные
+// (relaxed), гистограммы - ConcurrentHistogram, запись ничего не блокирует и не выделяет память.
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+#include "histogram.h"
+
+enum class LatencyMetric : uint8_t {
+    Handshake,   // HELLO -> CAPS: сервер почти ничего не делает, это время сети
+    SendAck,     // SEND_PRIVATE/SEND_GROUP -> OK_SENT/OK_GROUP_MSG_SENT: сеть и сервер
+    HistoryOpen, // GET_HISTORY/GROUPCHAT[_SINCE] -> *_HISTORY_END или NO_*_HISTORY: сеть, сервер и объем истории
+    Render,      // recv() -> кадр на терминале: очередь кадров и сам терминал
+    Count
+};
+
+constexpr size_t kLatencyMetricCount = static_cast<size_t>(LatencyMetric::Count);
+
+class Metrics {
+public:
+    using Clock = std::chrono::steady_clock;
+    static constexpr size_t kServerVerbSlots = 30; // Глаголы сервера + ERROR_* + прочие (списки - в metrics.cpp)
+    static constexpr size_t kClientVerbSlots = 16; // Команды клиента + прочие
+
+    Metrics() : m_started(Clock::now()) {}
+    Metrics(const Metrics&) = delete;
+    Metrics& operator=(const Metrics&) = delete;
+
+    // Ответ сервера (глагол строки или кадра); все ERROR_* - одним счетчиком, незнакомые - другим
+    void countReceived(std::string_view verb);
+    // Команда клиента, поставленная в очередь отправки (bytes - как уйдет в сеть)
+    void countSent(std::string_view verb, size_t bytes);
+    void addBytesReceived(size_t bytes) { m_bytesReceived.fetch_add(bytes, std::memory_order_relaxed); }
+    void recordLatency(LatencyMetric metric, Clock::duration elapsed);
+
+    // Текст для /stats (несколько строк, с '\n')
+    void appendReport(std::string& out) const;
+    // Одна строка JSON (без '\n') для дампа
+    void appendJson(std::string& out) const;
+
+private:
+    Clock::time_point m_started;
+    std::array<std::atomic<uint64_t>, kServerVerbSlots> m_received{};
+    std::array<std::atomic<uint64_t>, kClientVerbSlots> m_sent{};
+    std::array<std::atomic<uint64_t>, kClientVerbSlots> m_sentBytes{};
+    std::atomic<uint64_t> m_bytesReceived{ 0 };
+    std::array<ConcurrentHistogram, kLatencyMetricCount> m_latency; // Микросекунды
+};
@@ -0,0 +1,43 @@
+﻿#include "nametable.h"
+
+std::string_view NameTable::internView(std::string_view name, NameId& id) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_ids.find(name);
+    if (it != m_ids.end()) { id = it->second; return it->first; }
+    m_names.emplace_back(name);
+    id = static_cast<NameId>(m_names.size());
+    std::string_view stored = m_names.back();
+    m_ids.emplace(stored, id);
+    return stored;
+}
+
+NameId NameTable::intern(std::string_view name) {
+    if (name.empty()) return kNoName;
+    NameId id = kNoName;
+    internView(name, id);
+    return id;
+}
+
+NameId NameTable::find(std::string_view name) const {
+    if (name.empty()) return kNoName;
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_ids.find(name);
+    return it == m_ids.end() ? kNoName : it->second;
+}
+
+std::string NameTable::name(NameId id) const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return id == kNoName || id > m_names.size() ? std::string() : m_names[id - 1];
+}
+
+size_t NameTable::size() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_names.size();
+}
+
+NameId NameCache::miss(std::string_view name) {
+    NameId id = kNoName;
+    std::string_view stored = m_table.internView(name, id);
+    m_ids.emplace(stored, id);
+    return id;
+}
@@ -0,0 +1,57 @@
+﻿// nametable.h : интернирование имен пользователей и групп.
+// Каждое различное имя один раз получает компактный номер NameId; дальше фильтрация, непрочитанные и
+// вывод сравнивают номера, а не строки. Номера не переиспользуются, и таблица только растет: различных
+// имен у пользователя - сотни, а повторяются они в каждом сообщении.
+// NameTable потокобезопасна (мьютекс - только здесь, на редком пути). Поток, который интернирует имя
+// каждого сообщения, держит перед ней NameCache: известное имя там находится одним поиском в хеш-таблице
+// без блокировки и без выделения памяти.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+using NameId = uint32_t;
+constexpr NameId kNoName = 0; // Пустое имя (или неизвестное для NameTable::find)
+
+class NameTable {
+public:
+    // Номер имени; новое имя получает следующий номер. Пустое имя - kNoName
+    NameId intern(std::string_view name);
+    // Номер уже встречавшегося имени, иначе kNoName (таблица не растет)
+    NameId find(std::string_view name) const;
+    std::string name(NameId id) const;
+    size_t size() const;
+
+private:
+    friend class NameCache;
+    // Номер и строка в таблице: она не перемещается, пока жива таблица
+    std::string_view internView(std::string_view name, NameId& id);
+
+    mutable std::mutex m_mutex;
+    std::deque<std::string> m_names;                      // [id - 1]; deque не перемещает строки при росте
+    std::unordered_map<std::string_view, NameId> m_ids;   // Ключи смотрят в m_names
+};
+
+// Копия таблицы для одного потока: заполняется по мере встречи имен
+class NameCache {
+public:
+    explicit NameCache(NameTable& table) : m_table(table) {}
+
+    NameId intern(std::string_view name) {
+        if (name.empty()) return kNoName;
+        auto it = m_ids.find(name);
+        return it != m_ids.end() ? it->second : miss(name);
+    }
+
+private:
+    NameId miss(std::string_view name);
+
+    NameTable& m_table;
+    std::unordered_map<std::string_view, NameId> m_ids; // Ключи смотрят в строки NameTable
+};
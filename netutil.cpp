@@ -0,0 +1,159 @@
+﻿#include "netutil.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#endif
+
+bool setSocketNonBlocking(SocketType socket) {
+#ifdef _WIN32
+    u_long nonBlocking = 1;
+    return ioctlsocket(socket, FIONBIO, &nonBlocking) == 0;
+#else
+    int flags = fcntl(socket, F_GETFL, 0);
+    return flags >= 0 && fcntl(socket, F_SETFL, flags | O_NONBLOCK) == 0;
+#endif
+}
+
+bool isWouldBlockError(int errorCode) {
+#ifdef _WIN32
+    return errorCode == WSAEWOULDBLOCK || errorCode == WSAEINTR;
+#else
+    return errorCode == EAGAIN || errorCode == EWOULDBLOCK || errorCode == EINTR;
+#endif
+}
+
+// Переводит сокет обратно в блокирующий режим
+static bool setSocketBlocking(SocketType socket) {
+#ifdef _WIN32
+    u_long nonBlocking = 0;
+    return ioctlsocket(socket, FIONBIO, &nonBlocking) == 0;
+#else
+    int flags = fcntl(socket, F_GETFL, 0);
+    return flags >= 0 && fcntl(socket, F_SETFL, flags & ~O_NONBLOCK) == 0;
+#endif
+}
+
+// Ждет завершения неблокирующего connect(). 0 - соединение установлено, иначе код ошибки
+static int waitForConnect(SocketType socketFd, std::chrono::milliseconds timeout) {
+    int ready = 0;
+#ifdef _WIN32
+    // На Windows неудачный connect() отмечается в exceptfds, а не в writefds
+    fd_set writeSet, errorSet;
+    FD_ZERO(&writeSet); FD_ZERO(&errorSet);
+    FD_SET(socketFd, &writeSet); FD_SET(socketFd, &errorSet);
+    timeval tv{ static_cast<long>(timeout.count() / 1000), static_cast<long>((timeout.count() % 1000) * 1000) };
+    ready = select(0, nullptr, &writeSet, &errorSet, &tv);
+#else
+    pollfd pfd{ socketFd, POLLOUT, 0 }; // poll, а не select: у нагрузочного режима дескрипторов больше FD_SETSIZE
+    do {
+        ready = poll(&pfd, 1, static_cast<int>(timeout.count()));
+    } while (ready < 0 && errno == EINTR);
+#endif
+    if (ready < 0) return GET_LAST_ERROR;
+#ifdef _WIN32
+    if (ready == 0) return WSAETIMEDOUT;
+#else
+    if (ready == 0) return ETIMEDOUT;
+#endif
+    int socketError = 0;
+    socklen_t length = sizeof(socketError);
+    if (getsockopt(socketFd, SOL_SOCKET, SO_ERROR, reinterpret_cast<char*>(&socketError), &length) == SOCKET_ERROR_VALUE) {
+        return GET_LAST_ERROR;
+    }
+    return socketError;
+}
+
+SocketType connectTcp(const std::string& host, unsigned short port, int& errorCode, std::chrono::milliseconds timeout) {
+    errorCode = 0;
+    sockaddr_in serverAddress{};
+    serverAddress.sin_family = AF_INET;
+    serverAddress.sin_port = htons(port);
+    if (inet_pton(AF_INET, host.c_str(), &serverAddress.sin_addr) <= 0) { errorCode = -1; return INVALID_SOCKET_VALUE; }
+
+    SocketType socketFd = socket(AF_INET, SOCK_STREAM, 0);
+    if (socketFd == INVALID_SOCKET_VALUE) { errorCode = GET_LAST_ERROR; return INVALID_SOCKET_VALUE; }
+    // Недоступный хост не должен держать вызывающего десятки секунд (системный таймаут SYN)
+    if (!setSocketNonBlocking(socketFd)) { errorCode = GET_LAST_ERROR; CLOSE_SOCKET(socketFd); return INVALID_SOCKET_VALUE; }
+    if (connect(socketFd, (sockaddr*)&serverAddress, sizeof(serverAddress)) == SOCKET_ERROR_VALUE) {
+        int connectError = GET_LAST_ERROR;
+#ifdef _WIN32
+        bool inProgress = connectError == WSAEWOULDBLOCK;
+#else
+        bool inProgress = connectError == EINPROGRESS || connectError == EINTR;
+#endif
+        errorCode = inProgress ? waitForConnect(socketFd, timeout) : connectError;
+    }
+    if (errorCode == 0 && !setSocketBlocking(socketFd)) errorCode = GET_LAST_ERROR;
+    if (errorCode != 0) {
+        CLOSE_SOCKET(socketFd);
+        return INVALID_SOCKET_VALUE;
+    }
+    // Строки протокола короткие - отключаем алгоритм Нейгла, чтобы не ждать ACK
+    int noDelay = 1;
+    setsockopt(socketFd, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char*>(&noDelay), sizeof(noDelay));
+    return socketFd;
+}
+
+SocketType listenTcp(const std::string& host, unsigned short port, unsigned short& boundPort, int& errorCode) {
+    errorCode = 0;
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    if (inet_pton(AF_INET, host.c_str(), &address.sin_addr) <= 0) { errorCode = -1; return INVALID_SOCKET_VALUE; }
+
+    SocketType socketFd = socket(AF_INET, SOCK_STREAM, 0);
+    if (socketFd == INVALID_SOCKET_VALUE) { errorCode = GET_LAST_ERROR; return INVALID_SOCKET_VALUE; }
+    int reuse = 1; // Перезапуск сразу после остановки, не дожидаясь TIME_WAIT
+    setsockopt(socketFd, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<const char*>(&reuse), sizeof(reuse));
+    socklen_t addressLength = sizeof(address);
+    if (bind(socketFd, (sockaddr*)&address, sizeof(address)) == SOCKET_ERROR_VALUE ||
+        listen(socketFd, SOMAXCONN) == SOCKET_ERROR_VALUE ||
+        getsockname(socketFd, (sockaddr*)&address, &addressLength) == SOCKET_ERROR_VALUE) {
+        errorCode = GET_LAST_ERROR;
+        CLOSE_SOCKET(socketFd);
+        return INVALID_SOCKET_VALUE;
+    }
+    boundPort = ntohs(address.sin_port);
+    return socketFd;
+}
+
+bool parseEndpoint(std::string_view text, std::string& host, unsigned short& port) {
+    size_t colon = text.rfind(':');
+    std::string_view hostPart = text.substr(0, colon);
+    if (hostPart.empty()) return false;
+    if (colon != std::string_view::npos) {
+        std::string_view portPart = text.substr(colon + 1);
+        unsigned long value = 0;
+        if (portPart.empty() || portPart.size() > 5) return false;
+        for (char c : portPart) {
+            if (c < '0' || c > '9') return false;
+            value = value * 10 + static_cast<unsigned long>(c - '0');
+        }
+        if (value == 0 || value > 65535) return false;
+        port = static_cast<unsigned short>(value);
+    }
+    host = std::string(hostPart);
+    return true;
+}
+
+bool parseEndpointList(std::string_view text, unsigned short defaultPort, std::vector<Endpoint>& endpoints) {
+    std::vector<Endpoint> parsed;
+    while (!text.empty()) {
+        size_t comma = text.find(',');
+        std::string_view item = text.substr(0, comma);
+        Endpoint endpoint;
+        endpoint.port = defaultPort;
+        in_addr address{};
+        if (!parseEndpoint(item, endpoint.host, endpoint.port) || inet_pton(AF_INET, endpoint.host.c_str(), &address) <= 0) {
+            return false;
+        }
+        parsed.push_back(std::move(endpoint));
+        if (comma == std::string_view::npos) break;
+        text.remove_prefix(comma + 1);
+    }
+    if (parsed.empty()) return false;
+    endpoints = std::move(parsed);
+    return true;
+}
@@ -0,0 +1,42 @@
+﻿// netutil.h : вспомогательные функции для сокетов, общие для консольного клиента и нагрузочного режима.
+
+#pragma once
+
+#include <chrono>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "messengerclient.h"
+
+// Флаги send(): на Linux не получаем SIGPIPE при записи в закрытый сервером сокет
+#ifdef MSG_NOSIGNAL
+constexpr int kSendFlags = MSG_NOSIGNAL;
+#else
+constexpr int kSendFlags = 0;
+#endif
+
+bool setSocketNonBlocking(SocketType socket);
+// Ошибка recv()/send() означает лишь "попробуйте позже" (EAGAIN/EWOULDBLOCK/EINTR)
+bool isWouldBlockError(int errorCode);
+// Сколько ждать установления соединения по умолчанию
+constexpr std::chrono::milliseconds kConnectTimeout{ 2000 };
+
+// Подключение по IPv4 не дольше timeout (неблокирующий connect() + ожидание готовности к записи).
+// Возвращает сокет в блокирующем режиме; при ошибке - INVALID_SOCKET_VALUE, код ошибки - в errorCode
+// (-1 - адрес не разобран, ETIMEDOUT/WSAETIMEDOUT - таймаут)
+SocketType connectTcp(const std::string& host, unsigned short port, int& errorCode,
+    std::chrono::milliseconds timeout = kConnectTimeout);
+// Слушающий сокет IPv4 (port == 0 - любой свободный). Фактический порт возвращается в boundPort
+SocketType listenTcp(const std::string& host, unsigned short port, unsigned short& boundPort, int& errorCode);
+// Разбирает "host" или "host:port"; порт, если не указан, не меняется
+bool parseEndpoint(std::string_view text, std::string& host, unsigned short& port);
+
+struct Endpoint {
+    std::string host;
+    unsigned short port = 0;
+};
+
+// Разбирает список "host[:port][,host[:port]...]"; порт по умолчанию - defaultPort.
+// false - пустой список, некорректный элемент или адрес, не являющийся IPv4
+bool parseEndpointList(std::string_view text, unsigned short defaultPort, std::vector<Endpoint>& endpoints);
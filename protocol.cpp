@@ -0,0 +1,171 @@
+﻿#include "protocol.h"
+
+namespace {
+
+inline bool isSpace(char c) { return c == ' ' || c == '\t'; }
+
+inline bool isDigit(char c) { return c >= '0' && c <= '9'; }
+
+// YYYY-MM-DD HH:MM:SS
+bool looksLikeTimestamp(std::string_view text) {
+    if (text.size() < 19) return false;
+    static constexpr char kPattern[] = "dddd-dd-dd dd:dd:dd";
+    for (size_t i = 0; i < 19; ++i) {
+        if (kPattern[i] == 'd' ? !isDigit(text[i]) : text[i] != kPattern[i]) return false;
+    }
+    return true;
+}
+
+constexpr std::pair<std::string_view, uint32_t> kCapabilityEntries[] = {
+    { "history_since", kCapHistorySince },
+    { "binary_frames", kCapBinaryFrames },
+    { "compressed_streams", kCapCompressedStreams },
+    { "history_pages", kCapHistoryPages },
+};
+constexpr auto kCapabilities = makeVerbTable(kCapabilityEntries);
+
+// Как аргументы глагола записываются в текстовом протоколе
+enum class TextLayout {
+    Words,          // Через пробел
+    History,        // "метка:отправитель:текст"
+    SenderText,     // "отправитель: текст"
+    GroupMessage,   // "группа отправитель: текст"
+    Welcome,        // "Welcome, имя!"
+    Goodbye         // "Goodbye, имя!"
+};
+
+constexpr std::pair<std::string_view, TextLayout> kTextLayoutEntries[] = {
+    { "HIST_MSG",       TextLayout::History },
+    { "GROUP_HIST_MSG", TextLayout::History },
+    { "MSG_FROM",       TextLayout::SenderText },
+    { "GROUP_MSG_FROM", TextLayout::GroupMessage },
+    { "OK_LOGIN",       TextLayout::Welcome },
+    { "OK_REGISTERED",  TextLayout::Welcome },
+    { "OK_LOGOUT",      TextLayout::Goodbye },
+};
+constexpr auto kTextLayouts = makeVerbTable(kTextLayoutEntries);
+
+} // namespace
+
+ServerLine splitServerLine(std::string_view message) {
+    ServerLine line;
+    line.message = message;
+    size_t space_pos = message.find(' ');
+    if (space_pos != std::string_view::npos) {
+        line.prefix = message.substr(0, space_pos);
+        line.payload = message.substr(space_pos + 1);
+    }
+    else {
+        line.prefix = message; // Сообщение без аргументов
+    }
+    return line;
+}
+
+ServerLine splitServerFrame(const Frame& frame) {
+    ServerLine line;
+    line.prefix = frame.verb();
+    line.frame = &frame;
+    line.payload = line.arg(0);
+    return line;
+}
+
+void appendServerText(std::string& out, const std::string_view* fields, size_t count) {
+    if (count == 0) return;
+    out.append(fields[0]);
+    if (count == 1) return;
+    out.push_back(' ');
+    auto field = [&](size_t i) { return i < count ? fields[i] : std::string_view(); };
+    switch (kTextLayouts.find(fields[0], TextLayout::Words)) {
+    case TextLayout::History:
+        out.append(field(1)).append(":").append(field(2)).append(":").append(field(3));
+        break;
+    case TextLayout::SenderText:
+        out.append(field(1)).append(": ").append(field(2));
+        break;
+    case TextLayout::GroupMessage:
+        out.append(field(1)).append(" ").append(field(2)).append(": ").append(field(3));
+        break;
+    case TextLayout::Welcome:
+        out.append("Welcome, ").append(field(1)).append("!");
+        break;
+    case TextLayout::Goodbye:
+        out.append("Goodbye, ").append(field(1)).append("!");
+        break;
+    case TextLayout::Words:
+        for (size_t i = 1; i < count; ++i) {
+            if (i > 1) out.push_back(' ');
+            out.append(fields[i]);
+        }
+        break;
+    }
+}
+
+bool parseHistoryEntry(std::string_view payload, HistoryEntry& entry) {
+    std::string_view rest;
+    // Во временной метке сервера есть свои ':', поэтому полный формат отрезаем по длине
+    if (looksLikeTimestamp(payload) && payload.size() > 19 && payload[19] == ':') {
+        entry.timestamp = payload.substr(0, 19);
+        rest = payload.substr(20);
+    }
+    else {
+        size_t colon_pos = payload.find(':');
+        if (colon_pos == std::string_view::npos) { entry = { payload, {}, {} }; return false; }
+        entry.timestamp = payload.substr(0, colon_pos);
+        rest = payload.substr(colon_pos + 1);
+    }
+
+    size_t colon_pos = rest.find(':');
+    if (colon_pos == std::string_view::npos) { entry.sender = rest; entry.text = {}; return false; }
+    entry.sender = rest.substr(0, colon_pos);
+    entry.text = rest.substr(colon_pos + 1);
+    return true;
+}
+
+bool parseSenderText(std::string_view payload, SenderText& result) {
+    size_t colon_pos = payload.find(':');
+    if (colon_pos == std::string_view::npos) return false; // Сервер должен слать "sender: text"
+    result.sender = payload.substr(0, colon_pos);
+    // Текст начинается после ": "
+    result.text = colon_pos + 2 <= payload.size() ? payload.substr(colon_pos + 2) : std::string_view();
+    return true;
+}
+
+GroupMessage parseGroupMessage(std::string_view payload) {
+    GroupMessage result;
+    auto [group, senderAndText] = splitFirstWord(payload);
+    result.group = group;
+    result.senderAndText = senderAndText;
+    result.hasMessage = parseSenderText(senderAndText, result.message);
+    return result;
+}
+
+std::string_view parseWelcomeUsername(std::string_view message) {
+    static constexpr std::string_view kWelcome = "Welcome, ";
+    std::string_view rest = splitServerLine(message).payload;
+    if (!startsWith(rest, kWelcome)) return {};
+    rest.remove_prefix(kWelcome.size());
+    size_t end = rest.rfind('!'); // Ищем '!' с конца
+    if (end == std::string_view::npos || end == 0) return {};
+    return rest.substr(0, end);
+}
+
+std::pair<std::string_view, std::string_view> splitFirstWord(std::string_view text) {
+    size_t begin = 0;
+    while (begin < text.size() && isSpace(text[begin])) ++begin;
+    size_t end = begin;
+    while (end < text.size() && !isSpace(text[end])) ++end;
+    size_t rest = end;
+    while (rest < text.size() && isSpace(text[rest])) ++rest;
+    return { text.substr(begin, end - begin), text.substr(rest) };
+}
+
+uint32_t parseCapabilities(std::string_view list) {
+    uint32_t caps = 0;
+    while (!list.empty()) {
+        auto [name, rest] = splitFirstWord(list);
+        if (name.empty()) break;
+        caps |= kCapabilities.find(name, 0u);
+        list = rest;
+    }
+    return caps;
+}
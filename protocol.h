@@ -0,0 +1,139 @@
+﻿// protocol.h : разбор строк текстового протокола сервера (и кадров, frame.h) без выделения памяти.
+// Все функции возвращают string_view внутрь исходной строки.
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <utility>
+
+#include "frame.h"
+
+// Строка сервера "<ГЛАГОЛ> <payload>" или кадр с теми же глаголом и аргументами в отдельных полях
+struct ServerLine {
+    std::string_view message; // Вся строка целиком (у кадра - пусто)
+    std::string_view prefix;  // Глагол (OK_LOGIN, MSG_FROM, ...)
+    std::string_view payload; // Все после первого пробела (может быть пустым); у кадра - первый аргумент
+    const Frame* frame = nullptr; // Кадр, из которого взяты поля (nullptr - строка текстового протокола)
+
+    // Аргумент кадра (0 - первый после глагола), пусто - нет такого
+    std::string_view arg(size_t index) const {
+        return frame && index + 1 < frame->count ? frame->fields[index + 1] : std::string_view();
+    }
+};
+
+// HIST_MSG / GROUP_HIST_MSG: "timestamp:sender:text"
+struct HistoryEntry {
+    std::string_view timestamp;
+    std::string_view sender;
+    std::string_view text;
+};
+
+// MSG_FROM: "sender: text"
+struct SenderText {
+    std::string_view sender;
+    std::string_view text;
+};
+
+// GROUP_MSG_FROM: "group sender: text"
+struct GroupMessage {
+    std::string_view group;
+    std::string_view senderAndText; // "sender: text" целиком (для уведомлений)
+    SenderText message;
+    bool hasMessage = false;        // false, если в senderAndText нет ':'
+};
+
+// Возможности сервера, согласуемые при подключении: клиент шлет "HELLO <список>",
+// новый сервер отвечает "CAPS <список>", старый - ошибкой (тогда возможностей нет)
+enum ServerCapability : uint32_t {
+    kCapHistorySince = 1u << 0, // GET_HISTORY_SINCE / GROUPCHAT_SINCE <имя> <метка>: история начиная с метки
+    // Двоичные кадры (frame.h): сервер шлет их сразу после строки CAPS, клиент - после строки FRAMES.
+    // Поля кадров - те же аргументы, что и в тексте, по одному на поле:
+    //   HIST_MSG/GROUP_HIST_MSG: метка, отправитель, текст;  MSG_FROM: отправитель, текст;
+    //   GROUP_MSG_FROM: группа, отправитель, текст;  OK_LOGIN/OK_REGISTERED/OK_LOGOUT: имя;
+    //   FRIEND: имя, статус;  USER_JOINED_GROUP: группа, пользователь;  ERROR_*: текст ошибки
+    kCapBinaryFrames = 1u << 1,
+    // Сжатие записей истории и списков (streamcodec.h). Только вместе с binary_frames
+    kCapCompressedStreams = 1u << 2,
+    // GET_HISTORY_PAGE / GROUPCHAT_PAGE <имя> <число> [<метка>]: последние <число> сообщений не новее метки
+    // (без нее - самые новые) обычным потоком *_HISTORY_START..END по возрастанию времени
+    kCapHistoryPages = 1u << 3,
+};
+constexpr std::string_view kClientCapabilities = "history_since binary_frames compressed_streams history_pages"; // Что клиент предлагает в HELLO
+constexpr std::string_view kFramesCommand = "FRAMES"; // Последняя текстовая строка клиента перед кадрами
+
+ServerLine splitServerLine(std::string_view message);
+ServerLine splitServerFrame(const Frame& frame);
+// Дописывает в out строку текстового протокола (без '\n') с тем же смыслом, что у кадра из полей fields
+void appendServerText(std::string& out, const std::string_view* fields, size_t count);
+bool parseHistoryEntry(std::string_view payload, HistoryEntry& entry);
+bool parseSenderText(std::string_view payload, SenderText& result);
+GroupMessage parseGroupMessage(std::string_view payload);
+// Список возможностей из CAPS -> битовая маска ServerCapability (неизвестные пропускаются)
+uint32_t parseCapabilities(std::string_view list);
+// Имя пользователя из "OK_LOGIN Welcome, <имя>!" / "OK_REGISTERED Welcome, <имя>!" (пусто, если формат другой)
+std::string_view parseWelcomeUsername(std::string_view message);
+// Первое слово и остаток после пробелов ("name status", "group user")
+std::pair<std::string_view, std::string_view> splitFirstWord(std::string_view text);
+
+inline bool startsWith(std::string_view text, std::string_view prefix) {
+    return text.substr(0, prefix.size()) == prefix;
+}
+
+// FNV-1a, вычисляется и во время компиляции
+constexpr uint32_t hashVerb(std::string_view verb) {
+    uint32_t hash = 2166136261u;
+    for (char c : verb) { hash ^= static_cast<unsigned char>(c); hash *= 16777619u; }
+    return hash;
+}
+
+// Таблица "глагол -> значение" с открытой адресацией, строится во время компиляции.
+// Поиск - один хеш и в среднем одно сравнение строк, без выделения памяти.
+template <typename Value, size_t N>
+class VerbTable {
+public:
+    using Entry = std::pair<std::string_view, Value>;
+
+    constexpr VerbTable(const Entry (&entries)[N]) {
+        for (size_t i = 0; i < N; ++i) insert(entries[i].first, entries[i].second);
+    }
+    // Глагол -> его номер в списке verbs (для счетчиков по глаголам)
+    constexpr VerbTable(const std::string_view (&verbs)[N]) {
+        for (size_t i = 0; i < N; ++i) insert(verbs[i], static_cast<Value>(i));
+    }
+
+    // Возвращает значение для глагола или fallback, если глагол неизвестен
+    constexpr Value find(std::string_view verb, Value fallback = Value{}) const {
+        size_t slot = hashVerb(verb) & (kBuckets - 1);
+        while (m_slots[slot].used) {
+            if (m_slots[slot].verb == verb) return m_slots[slot].value;
+            slot = (slot + 1) & (kBuckets - 1);
+        }
+        return fallback;
+    }
+
+private:
+    constexpr void insert(std::string_view verb, Value value) {
+        size_t slot = hashVerb(verb) & (kBuckets - 1);
+        while (m_slots[slot].used) slot = (slot + 1) & (kBuckets - 1);
+        m_slots[slot] = { verb, value, true };
+    }
+
+    static constexpr size_t roundUpPow2(size_t n) { size_t p = 1; while (p < n) p <<= 1; return p; }
+    static constexpr size_t kBuckets = roundUpPow2(N * 2); // Заполнение не больше 50%
+
+    struct Slot {
+        std::string_view verb;
+        Value value{};
+        bool used = false;
+    };
+    std::array<Slot, kBuckets> m_slots{};
+};
+
+template <typename Value, size_t N>
+constexpr VerbTable<Value, N> makeVerbTable(const std::pair<std::string_view, Value> (&entries)[N]) {
+    return VerbTable<Value, N>(entries);
+}
@@ -0,0 +1,99 @@
+﻿#include "requesttracker.h"
+
+#include <algorithm>
+
+const char* describeRequest(RequestKind kind) {
+    switch (kind) {
+    case RequestKind::Hello:          return "согласование протокола";
+    case RequestKind::Login:          return "вход";
+    case RequestKind::Logout:         return "выход";
+    case RequestKind::FriendList:     return "список друзей";
+    case RequestKind::GroupList:      return "список групп";
+    case RequestKind::PrivateHistory: return "история чата";
+    case RequestKind::GroupHistory:   return "история группы";
+    case RequestKind::SendPrivate:    return "отправка сообщения";
+    case RequestKind::SendGroup:      return "отправка в группу";
+    case RequestKind::CreateGroup:    return "создание группы";
+    case RequestKind::JoinGroup:      return "вступление в группу";
+    default:                          return "запрос";
+    }
+}
+
+uint64_t RequestTracker::open(RequestKind kind, std::string target, bool delta, bool quiet, std::chrono::milliseconds timeout) {
+    PendingRequest request;
+    request.kind = kind;
+    request.target = std::move(target);
+    request.delta = delta;
+    request.quiet = quiet;
+    return open(std::move(request), timeout);
+}
+
+uint64_t RequestTracker::open(PendingRequest request, std::chrono::milliseconds timeout) {
+    request.sent = Clock::now();
+    request.deadline = request.sent + timeout;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    request.id = m_nextId++;
+    m_pending.push_back(std::move(request));
+    return m_pending.back().id;
+}
+
+std::optional<PendingRequest> RequestTracker::take(RequestKind kind, std::string_view target) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = std::find_if(m_pending.begin(), m_pending.end(), [&](const PendingRequest& request) {
+        return request.kind == kind && (target.empty() || request.target == target);
+    });
+    if (it == m_pending.end()) return std::nullopt;
+    PendingRequest request = std::move(*it);
+    m_pending.erase(it);
+    return request;
+}
+
+std::optional<PendingRequest> RequestTracker::takeOldest() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_pending.empty()) return std::nullopt;
+    PendingRequest request = std::move(m_pending.front());
+    m_pending.pop_front();
+    return request;
+}
+
+bool RequestTracker::isPending(RequestKind kind, std::string_view target) const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return std::any_of(m_pending.begin(), m_pending.end(), [&](const PendingRequest& request) {
+        return request.kind == kind && (target.empty() || request.target == target);
+    });
+}
+
+bool RequestTracker::empty() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_pending.empty();
+}
+
+size_t RequestTracker::size() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_pending.size();
+}
+
+std::vector<PendingRequest> RequestTracker::expire(Clock::time_point now) {
+    std::vector<PendingRequest> expired;
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (auto it = m_pending.begin(); it != m_pending.end();) {
+        if (it->deadline <= now) { expired.push_back(std::move(*it)); it = m_pending.erase(it); }
+        else ++it;
+    }
+    return expired;
+}
+
+int RequestTracker::msUntilNextDeadline(Clock::time_point now) const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_pending.empty()) return -1;
+    Clock::time_point next = m_pending.front().deadline;
+    for (const PendingRequest& request : m_pending) next = std::min(next, request.deadline);
+    if (next <= now) return 0;
+    return static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(next - now).count()) + 1;
+}
+
+void RequestTracker::clear() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_pending.clear();
+}
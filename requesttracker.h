@@ -0,0 +1,80 @@
+﻿// requesttracker.h : учет запросов, ожидающих ответа сервера.
+// Протокол не несет идентификаторов запросов, но сервер отвечает на команды по порядку. Поэтому
+// каждая отправленная команда занимает слот в очереди, а ответ закрывает самый старый слот своего вида
+// (и своей беседы - для истории). Так FRIENDS, LIST_MY_GROUPS и открытие чатов могут идти одновременно.
+
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+enum class RequestKind : uint8_t {
+    Hello,          // HELLO -> CAPS
+    Login,          // LOGIN/REGISTRATION -> OK_LOGIN/OK_REGISTERED
+    Logout,         // LOGOUT -> OK_LOGOUT
+    FriendList,     // GET_CHAT_PARTNERS -> FRIEND_LIST_START..END | NO_FRIENDS_FOUND
+    GroupList,      // LIST_MY_GROUPS -> MY_GROUPS_START..END | NO_GROUPS_JOINED
+    PrivateHistory, // GET_HISTORY[_SINCE|_PAGE] -> HISTORY_START..END | NO_HISTORY
+    GroupHistory,   // GROUPCHAT[_SINCE|_PAGE] -> GROUP_HISTORY_START..END | NO_GROUP_HISTORY
+    SendPrivate,    // SEND_PRIVATE -> OK_SENT
+    SendGroup,      // SEND_GROUP -> OK_GROUP_MSG_SENT
+    CreateGroup,    // CREATE_GROUP -> OK_GROUP_CREATED
+    JoinGroup,      // JOIN_GROUP -> OK_JOINED_GROUP
+    Count
+};
+
+constexpr size_t kRequestKindCount = static_cast<size_t>(RequestKind::Count);
+
+// Описание запроса для сообщений пользователю ("список друзей", "история чата", ...)
+const char* describeRequest(RequestKind kind);
+
+struct PendingRequest {
+    uint64_t id = 0;
+    RequestKind kind = RequestKind::Hello;
+    std::string target;   // Собеседник/группа для истории, иначе пусто
+    bool delta = false;   // История запрошена только с последней сохраненной метки
+    bool older = false;   // Страница истории раньше показанной (/more), а не открытие беседы
+    bool quiet = false;   // Фоновый запрос: ошибки и таймауты не показываем
+    std::chrono::steady_clock::time_point sent;     // Для задержки ответа (metrics.h)
+    std::chrono::steady_clock::time_point deadline;
+};
+
+class RequestTracker {
+public:
+    using Clock = std::chrono::steady_clock;
+    static constexpr std::chrono::milliseconds kDefaultTimeout{ 10000 };
+
+    // Регистрирует отправленную команду. Вызывать до отправки, чтобы ответ не опередил слот
+    uint64_t open(RequestKind kind, std::string target = {}, bool delta = false, bool quiet = false,
+        std::chrono::milliseconds timeout = kDefaultTimeout);
+    // То же для запроса, описанного целиком (id, sent и deadline заполняются здесь)
+    uint64_t open(PendingRequest request, std::chrono::milliseconds timeout = kDefaultTimeout);
+
+    // Забирает самый старый запрос вида kind (и беседы target, если она не пуста)
+    std::optional<PendingRequest> take(RequestKind kind, std::string_view target = {});
+    // Забирает самый старый запрос любого вида - адресат ответа ERROR_*
+    std::optional<PendingRequest> takeOldest();
+
+    bool isPending(RequestKind kind, std::string_view target = {}) const;
+    bool empty() const;
+    size_t size() const;
+
+    // Забирает запросы, не получившие ответа к now
+    std::vector<PendingRequest> expire(Clock::time_point now);
+    // Миллисекунд до ближайшего таймаута (-1 - ждать нечего)
+    int msUntilNextDeadline(Clock::time_point now) const;
+
+    void clear();
+
+private:
+    mutable std::mutex m_mutex;
+    std::deque<PendingRequest> m_pending; // В порядке отправки
+    uint64_t m_nextId = 1;
+};
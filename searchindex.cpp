@@ -0,0 +1,924 @@
+﻿#include "searchindex.h"
+
+#include <algorithm>  // std::sort, std::find, std::any_of, std::reverse
+#include <chrono>
+#include <cmath>      // std::log
+#include <cstdio>
+#include <cstdlib>    // std::strtoul
+#include <cstring>    // std::memcpy
+#include <filesystem>
+#include <functional> // std::greater
+#include <queue>      // std::priority_queue
+#include <system_error>
+
+#include "protocol.h" // startsWith
+
+namespace fs = std::filesystem;
+
+// Формат файлов индекса (каталог <кэш>/<аккаунт>/search):
+//   docs.dat          - документы подряд: [беседа varint][метка, секунды varint][флаги][отправитель][текст],
+//                       строки - длина varint и байты. Флаг 1 - живое сообщение
+//   conversations.dat - беседы подряд, номер - порядковый: [вид][имя]
+//   seg_N.idx         - kSegmentMagic, число слов u32, смещения записей слов u32[число + 1], записи:
+//                       [слово][документов varint][смещения документов дельтами varint]
+//   index.meta        - kManifestMagic, конец журнала, покрытый сегментами, документов в них, номер
+//                       следующего сегмента, номера сегментов и метки истории бесед (см. acceptHistory)
+
+struct SearchIndex::Conversation {
+    ConversationKind kind = ConversationKind::Private;
+    std::string name;
+    bool hasHistory = false;
+    uint64_t historyMark = 0;               // Метка последней проиндексированной записи истории
+    std::vector<uint64_t> markFingerprints; // Записи истории с этой меткой (отправитель и текст)
+};
+
+// Сегмент на диске, отображенный в память
+struct SearchIndex::Segment {
+    uint32_t number = 0;
+    MappedFile file;
+    uint32_t terms = 0;
+    const char* offsets = nullptr; // u32[terms + 1]
+    const char* entries = nullptr;
+
+    bool open(const std::string& path);
+    uint32_t offset(uint32_t index) const;
+    // Запись слова: само слово, число документов и список смещений
+    std::string_view term(uint32_t index, uint32_t& count, std::string_view& postings) const;
+    bool find(std::string_view word, uint32_t& count, std::string_view& postings) const;
+};
+
+namespace {
+
+constexpr std::string_view kSegmentMagic = "DGSEG1\n";
+constexpr std::string_view kManifestMagic = "DGIDX1\n";
+constexpr size_t kBatchMessages = 4096;                       // Пачка, которая будит поток индекса сразу
+constexpr std::chrono::milliseconds kBatchInterval{ 200 };    // Иначе - пачка за такой интервал
+constexpr uint8_t kLiveFlag = 1;
+constexpr uint64_t kLiveDuplicateWindow = 15 * 60;            // Живое сообщение и оно же в истории - в пределах
+constexpr size_t kMaxQueryTerms = 8;
+constexpr size_t kMaxTermBytes = 64; // Длиннее - не слово (ссылки, base64), не индексируется
+
+// --- varint (64 бит, как в кадрах) ---
+
+void appendVarint64(std::string& out, uint64_t value) {
+    while (value >= 0x80) {
+        out.push_back(static_cast<char>((value & 0x7F) | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<char>(value));
+}
+
+// 0 - varint обрезан
+size_t readVarint64(std::string_view data, uint64_t& value) {
+    value = 0;
+    size_t limit = data.size() < 10 ? data.size() : 10;
+    for (size_t i = 0; i < limit; ++i) {
+        auto byte = static_cast<unsigned char>(data[i]);
+        value |= uint64_t(byte & 0x7F) << (7 * i);
+        if (!(byte & 0x80)) return i + 1;
+    }
+    return 0;
+}
+
+void appendString(std::string& out, std::string_view text) {
+    appendVarint64(out, text.size());
+    out.append(text);
+}
+
+bool readString(std::string_view& data, std::string_view& text) {
+    uint64_t size = 0;
+    size_t used = readVarint64(data, size);
+    if (used == 0 || data.size() - used < size) return false;
+    text = data.substr(used, static_cast<size_t>(size));
+    data.remove_prefix(used + static_cast<size_t>(size));
+    return true;
+}
+
+bool readNumber(std::string_view& data, uint64_t& value) {
+    size_t used = readVarint64(data, value);
+    data.remove_prefix(used);
+    return used != 0;
+}
+
+void appendU32(std::string& out, uint32_t value) {
+    for (int i = 0; i < 4; ++i) out.push_back(static_cast<char>(value >> (8 * i)));
+}
+
+uint32_t readU32(const char* p) {
+    const auto* bytes = reinterpret_cast<const unsigned char*>(p);
+    return uint32_t(bytes[0]) | (uint32_t(bytes[1]) << 8) | (uint32_t(bytes[2]) << 16) | (uint32_t(bytes[3]) << 24);
+}
+
+// --- Документ журнала ---
+
+struct StoredDocument {
+    uint64_t conversation = 0;
+    uint64_t seconds = 0;
+    uint64_t flags = 0;
+    std::string_view sender;
+    std::string_view text;
+};
+
+// Разбирает документ в начале data, отрезая его. false - документ обрезан
+bool readDocument(std::string_view& data, StoredDocument& document) {
+    return readNumber(data, document.conversation) && readNumber(data, document.seconds) && readNumber(data, document.flags)
+        && readString(data, document.sender) && readString(data, document.text);
+}
+
+uint64_t fingerprint(std::string_view sender, std::string_view text) {
+    uint64_t hash = 1469598103934665603ull; // FNV-1a
+    auto mix = [&hash](std::string_view part) {
+        for (char c : part) { hash ^= static_cast<unsigned char>(c); hash *= 1099511628211ull; }
+        hash ^= 0xFF; hash *= 1099511628211ull; // Граница между отправителем и текстом
+    };
+    mix(sender);
+    mix(text);
+    return hash;
+}
+
+// --- Метки времени: YYYY-MM-DD HH:MM:SS <-> секунды (без часового пояса, как их шлет сервер) ---
+
+int64_t daysFromCivil(int64_t year, unsigned month, unsigned day) {
+    year -= month <= 2;
+    int64_t era = (year >= 0 ? year : year - 399) / 400;
+    auto yoe = static_cast<unsigned>(year - era * 400);
+    unsigned doy = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+    unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + static_cast<int64_t>(doe) - 719468;
+}
+
+void civilFromDays(int64_t days, int& year, unsigned& month, unsigned& day) {
+    days += 719468;
+    int64_t era = (days >= 0 ? days : days - 146096) / 146097;
+    auto doe = static_cast<unsigned>(days - era * 146097);
+    unsigned yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    unsigned doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    unsigned mp = (5 * doy + 2) / 153;
+    day = doy - (153 * mp + 2) / 5 + 1;
+    month = mp < 10 ? mp + 3 : mp - 9;
+    year = static_cast<int>(static_cast<int64_t>(yoe) + era * 400 + (month <= 2));
+}
+
+uint64_t civilSeconds(int year, unsigned month, unsigned day, unsigned hour, unsigned minute, unsigned second) {
+    int64_t seconds = daysFromCivil(year, month, day) * 86400 + hour * 3600 + minute * 60 + second;
+    return seconds > 0 ? static_cast<uint64_t>(seconds) : 0;
+}
+
+// 0 - формат не распознан
+uint64_t parseTimestamp(std::string_view ts) {
+    if (ts.size() != 19 || ts[4] != '-' || ts[7] != '-' || ts[10] != ' ' || ts[13] != ':' || ts[16] != ':') return 0;
+    auto number = [&ts](size_t pos, size_t digits) {
+        unsigned value = 0;
+        for (size_t i = pos; i < pos + digits; ++i) {
+            if (ts[i] < '0' || ts[i] > '9') return ~0u;
+            value = value * 10 + static_cast<unsigned>(ts[i] - '0');
+        }
+        return value;
+    };
+    unsigned year = number(0, 4), month = number(5, 2), day = number(8, 2);
+    unsigned hour = number(11, 2), minute = number(14, 2), second = number(17, 2);
+    if (year > 9999 || month < 1 || month > 12 || day < 1 || day > 31 || hour > 23 || minute > 59 || second > 60) return 0;
+    return civilSeconds(static_cast<int>(year), month, day, hour, minute, second);
+}
+
+std::string formatTimestamp(uint64_t seconds) {
+    if (seconds == 0) return {};
+    int year;
+    unsigned month, day;
+    civilFromDays(static_cast<int64_t>(seconds / 86400), year, month, day);
+    unsigned rest = static_cast<unsigned>(seconds % 86400);
+    char buffer[32];
+    std::snprintf(buffer, sizeof(buffer), "%04d-%02u-%02u %02u:%02u:%02u", year, month, day, rest / 3600, rest / 60 % 60, rest % 60);
+    return buffer;
+}
+
+// Локальное время приема живого сообщения - в тех же секундах, что и метки сервера
+uint64_t localSeconds(std::time_t time) {
+    std::tm local;
+#ifdef _WIN32
+    localtime_s(&local, &time);
+#else
+    localtime_r(&time, &local);
+#endif
+    return civilSeconds(local.tm_year + 1900, static_cast<unsigned>(local.tm_mon + 1), static_cast<unsigned>(local.tm_mday),
+        static_cast<unsigned>(local.tm_hour), static_cast<unsigned>(local.tm_min), static_cast<unsigned>(local.tm_sec));
+}
+
+// --- Слова ---
+
+// Длина символа UTF-8 по первому байту (битый байт - 1)
+size_t utf8Length(unsigned char lead) {
+    if (lead < 0xC0) return 1;
+    if (lead < 0xE0) return 2;
+    if (lead < 0xF0) return 3;
+    return 4;
+}
+
+// Символ входит в слово: ASCII буквы и цифры, многобайтные символы, кроме знаков препинания
+// и значков (U+0080..U+00BF, U+2000..U+2BFF, эмодзи)
+bool isWordChar(const unsigned char* c, size_t length) {
+    if (length == 1) return (c[0] >= '0' && c[0] <= '9') || ((c[0] | 0x20) >= 'a' && (c[0] | 0x20) <= 'z');
+    if (length == 2) return c[0] != 0xC2;
+    if (length == 3) return !(c[0] == 0xE2 && c[1] < 0xB0);
+    return false;
+}
+
+// Дописывает символ в нижнем регистре (ASCII и кириллица, "ё" -> "е")
+void appendLower(std::string& out, const unsigned char* c, size_t length) {
+    if (length == 1) { out += static_cast<char>(c[0] >= 'A' && c[0] <= 'Z' ? c[0] + 32 : c[0]); return; }
+    if (length == 2 && c[0] == 0xD0) {
+        if (c[1] >= 0x90 && c[1] <= 0x9F) { out += '\xD0'; out += static_cast<char>(c[1] + 0x20); return; } // А..П
+        if (c[1] >= 0xA0 && c[1] <= 0xAF) { out += '\xD1'; out += static_cast<char>(c[1] - 0x20); return; } // Р..Я
+        if (c[1] == 0x81) { out += "\xD0\xB5"; return; }                                                 // Ё
+    }
+    if (length == 2 && c[0] == 0xD1 && c[1] == 0x91) { out += "\xD0\xB5"; return; }                      // ё
+    out.append(reinterpret_cast<const char*>(c), length);
+}
+
+// Слова текста для индекса и запроса: func(std::string_view слово)
+template <typename Func>
+void forEachTerm(std::string_view text, std::string& scratch, Func&& func) {
+    const auto* data = reinterpret_cast<const unsigned char*>(text.data());
+    size_t size = text.size();
+    scratch.clear();
+    for (size_t i = 0; i < size;) {
+        size_t length = utf8Length(data[i]);
+        if (i + length > size) length = size - i;
+        if (isWordChar(data + i, length)) appendLower(scratch, data + i, length);
+        else if (!scratch.empty()) {
+            if (scratch.size() <= kMaxTermBytes) func(std::string_view(scratch));
+            scratch.clear();
+        }
+        i += length;
+    }
+    if (!scratch.empty() && scratch.size() <= kMaxTermBytes) func(std::string_view(scratch));
+    scratch.clear();
+}
+
+// --- Запись сегмента ---
+
+class SegmentWriter {
+public:
+    void beginTerm(std::string_view term, uint64_t count) {
+        m_offsets.push_back(static_cast<uint32_t>(m_entries.size()));
+        appendString(m_entries, term);
+        appendVarint64(m_entries, count);
+        m_last = 0;
+    }
+    void appendDocument(uint64_t offset) {
+        appendVarint64(m_entries, offset - m_last);
+        m_last = offset;
+    }
+    // Пишет во временный файл и переименовывает: сегмент на диске всегда целый
+    bool write(const fs::path& path) {
+        std::string header(kSegmentMagic);
+        appendU32(header, static_cast<uint32_t>(m_offsets.size()));
+        for (uint32_t offset : m_offsets) appendU32(header, offset);
+        appendU32(header, static_cast<uint32_t>(m_entries.size()));
+        fs::path temp = path;
+        temp += ".tmp";
+        std::FILE* file = std::fopen(temp.string().c_str(), "wb");
+        if (!file) return false;
+        bool ok = std::fwrite(header.data(), 1, header.size(), file) == header.size()
+            && std::fwrite(m_entries.data(), 1, m_entries.size(), file) == m_entries.size();
+        ok = std::fclose(file) == 0 && ok;
+        std::error_code ec;
+        if (ok) fs::rename(temp, path, ec);
+        if (!ok || ec) { fs::remove(temp, ec); return false; }
+        return true;
+    }
+
+private:
+    std::string m_entries;
+    std::vector<uint32_t> m_offsets;
+    uint64_t m_last = 0;
+};
+
+// Перебор смещений документов одного списка (дельты varint)
+class PostingReader {
+public:
+    PostingReader() = default;
+    explicit PostingReader(std::string_view postings) : m_rest(postings) {}
+    bool next(uint64_t& offset) {
+        uint64_t delta;
+        size_t used = readVarint64(m_rest, delta);
+        if (used == 0) return false;
+        m_rest.remove_prefix(used);
+        m_value += delta;
+        offset = m_value;
+        return true;
+    }
+
+private:
+    std::string_view m_rest;
+    uint64_t m_value = 0;
+};
+
+// Список слова в одном блоке (сегменте на диске или в памяти) по возрастанию смещений
+class TermCursor {
+public:
+    double idf = 0;
+    uint64_t current = 0;
+    bool done = true;
+
+    void startSegment(std::string_view postings) { m_memory = nullptr; m_reader = PostingReader(postings); advance(); }
+    void startMemory(const std::vector<uint64_t>& memory) { m_memory = &memory; m_memoryPos = 0; advance(); }
+    void stop() { done = true; }
+    void advance() {
+        if (!m_memory) { done = !m_reader.next(current); return; }
+        done = m_memoryPos == m_memory->size();
+        if (!done) current = (*m_memory)[m_memoryPos++];
+    }
+
+private:
+    PostingReader m_reader;
+    const std::vector<uint64_t>* m_memory = nullptr;
+    size_t m_memoryPos = 0;
+};
+
+std::string conversationKey(ConversationKind kind, std::string_view name) {
+    std::string key(kind == ConversationKind::Group ? "g:" : "p:");
+    key.append(name);
+    return key;
+}
+
+} // namespace
+
+// --- Сегмент ---
+
+bool SearchIndex::Segment::open(const std::string& path) {
+    if (!file.map(path)) return false;
+    std::string_view data = file.contents();
+    if (data.size() < kSegmentMagic.size() + 8 || data.substr(0, kSegmentMagic.size()) != kSegmentMagic) return false;
+    terms = readU32(data.data() + kSegmentMagic.size());
+    size_t tableSize = (static_cast<size_t>(terms) + 1) * 4;
+    size_t headerSize = kSegmentMagic.size() + 4 + tableSize;
+    if (data.size() < headerSize) return false;
+    offsets = data.data() + kSegmentMagic.size() + 4;
+    entries = data.data() + headerSize;
+    return readU32(offsets + terms * 4) == data.size() - headerSize; // Последнее смещение - конец записей
+}
+
+uint32_t SearchIndex::Segment::offset(uint32_t index) const {
+    return readU32(offsets + static_cast<size_t>(index) * 4);
+}
+
+std::string_view SearchIndex::Segment::term(uint32_t index, uint32_t& count, std::string_view& postings) const {
+    std::string_view entry(entries + offset(index), offset(index + 1) - offset(index));
+    std::string_view word;
+    uint64_t documents = 0;
+    if (!readString(entry, word) || !readNumber(entry, documents)) { count = 0; postings = {}; return word; }
+    count = static_cast<uint32_t>(documents);
+    postings = entry;
+    return word;
+}
+
+bool SearchIndex::Segment::find(std::string_view word, uint32_t& count, std::string_view& postings) const {
+    uint32_t low = 0, high = terms;
+    while (low < high) { // Словарь отсортирован: двоичный поиск прямо по отображенному файлу
+        uint32_t middle = low + (high - low) / 2;
+        std::string_view current = term(middle, count, postings);
+        if (current == word) return true;
+        if (current < word) low = middle + 1;
+        else high = middle;
+    }
+    return false;
+}
+
+// --- Открытие и закрытие ---
+
+SearchIndex::SearchIndex() = default;
+
+SearchIndex::~SearchIndex() {
+    close();
+}
+
+bool SearchIndex::open(const std::string& root, std::string_view account) {
+    close();
+    if (account.empty()) return false;
+    m_dir = (fs::path(HistoryStore::accountDirectory(root, account)) / "search").string();
+    {
+        std::lock_guard<std::mutex> lock(m_queueMutex);
+        m_accepting = true;
+        m_stop = false;
+        m_busy = true; // До конца загрузки sync() ждет
+    }
+    m_worker = std::thread(&SearchIndex::run, this);
+    return true;
+}
+
+void SearchIndex::close() {
+    if (!m_worker.joinable()) return;
+    {
+        std::lock_guard<std::mutex> lock(m_queueMutex);
+        m_accepting = false;
+        m_stop = true;
+    }
+    m_queueWake.notify_one();
+    m_worker.join();
+
+    std::lock_guard<std::mutex> lock(m_indexMutex);
+    m_loaded = false;
+    m_conversations.clear();
+    m_conversationIds.clear();
+    m_segments.clear();
+    m_memory.clear();
+    m_memoryDocs = 0;
+    m_segmentsEnd = m_documentsEnd = 0;
+    m_documents = 0;
+    m_nextSegment = 0;
+    m_documentsMap.unmap();
+}
+
+void SearchIndex::add(ConversationKind kind, std::string_view conversation, std::string_view timestamp,
+    std::string_view sender, std::string_view text) {
+    std::lock_guard<std::mutex> lock(m_queueMutex);
+    if (!m_accepting) return;
+    m_queue.push_back({ kind, timestamp.empty() ? std::time(nullptr) : 0, static_cast<uint32_t>(conversation.size()),
+        static_cast<uint32_t>(timestamp.size()), static_cast<uint32_t>(sender.size()), static_cast<uint32_t>(text.size()) });
+    m_queueText.append(conversation).append(timestamp).append(sender).append(text);
+    if (m_queue.size() == kBatchMessages) m_queueWake.notify_one(); // Меньшую пачку поток заберет по таймеру
+}
+
+void SearchIndex::sync() {
+    std::unique_lock<std::mutex> lock(m_queueMutex);
+    if (!m_worker.joinable()) return;
+    ++m_syncWaiters;
+    m_queueWake.notify_one();
+    m_queueIdle.wait(lock, [this] { return m_queue.empty() && !m_busy; });
+    --m_syncWaiters;
+}
+
+size_t SearchIndex::documents() const {
+    std::lock_guard<std::mutex> lock(m_indexMutex);
+    return m_documents;
+}
+
+bool SearchIndex::loaded() const {
+    std::lock_guard<std::mutex> lock(m_indexMutex);
+    return m_loaded;
+}
+
+bool SearchIndex::hasHistory(ConversationKind kind, std::string_view conversation) const {
+    std::lock_guard<std::mutex> lock(m_indexMutex);
+    auto it = m_conversationIds.find(conversationKey(kind, conversation));
+    return it != m_conversationIds.end() && m_conversations[it->second]->hasHistory;
+}
+
+// --- Поток индекса ---
+
+void SearchIndex::run() {
+    load();
+    if (m_memoryDocs >= kSegmentDocs) flushSegment(); // Большой хвост журнала (индекс строился заново)
+    std::vector<QueuedMessage> batch;
+    std::string text;
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(m_queueMutex);
+            m_busy = false;
+            if (m_queue.empty()) m_queueIdle.notify_all();
+            m_queueWake.wait_for(lock, kBatchInterval, [this] {
+                return m_stop || m_syncWaiters > 0 || m_queue.size() >= kBatchMessages;
+            });
+            if (m_queue.empty()) {
+                if (m_stop) break;
+                continue;
+            }
+            batch.swap(m_queue); // Память обеих очередей переиспользуется
+            text.swap(m_queueText);
+            m_busy = true;
+        }
+        indexBatch(batch, text);
+        batch.clear();
+        text.clear();
+        if (m_memoryDocs >= kSegmentDocs && flushSegment() && m_segments.size() > kMaxSegments) mergeSegments();
+    }
+    if (m_memoryDocs > 0) flushSegment();
+    if (m_documentsFile) { std::fclose(m_documentsFile); m_documentsFile = nullptr; }
+    if (m_conversationsFile) { std::fclose(m_conversationsFile); m_conversationsFile = nullptr; }
+}
+
+// Загрузка: беседы, сегменты из index.meta и индексация хвоста журнала, который в сегменты не попал
+void SearchIndex::load() {
+    std::error_code ec;
+    fs::create_directories(m_dir, ec);
+    fs::path dir(m_dir);
+    std::lock_guard<std::mutex> lock(m_indexMutex);
+
+    MappedFile conversations;
+    std::string conversationsPath = (dir / "conversations.dat").string();
+    if (conversations.map(conversationsPath)) {
+        std::string_view data = conversations.contents();
+        uint64_t valid = 0;
+        while (!data.empty()) {
+            uint64_t kind = 0;
+            std::string_view name;
+            if (!readNumber(data, kind) || !readString(data, name)) break;
+            valid = conversations.contents().size() - data.size();
+            ConversationKind conversationKind = kind == 1 ? ConversationKind::Group : ConversationKind::Private;
+            m_conversationIds.emplace(conversationKey(conversationKind, name), static_cast<uint32_t>(m_conversations.size()));
+            m_conversations.push_back(std::make_unique<Conversation>());
+            m_conversations.back()->kind = conversationKind;
+            m_conversations.back()->name = name;
+        }
+        if (valid != conversations.contents().size()) { conversations.unmap(); fs::resize_file(conversationsPath, valid, ec); }
+    }
+
+    // Сегменты и метки истории на момент последнего сброса
+    MappedFile manifest;
+    std::vector<uint32_t> live;
+    if (manifest.map((dir / "index.meta").string()) && startsWith(manifest.contents(), kManifestMagic)) {
+        std::string_view data = manifest.contents().substr(kManifestMagic.size());
+        uint64_t segmentsEnd = 0, documents = 0, nextSegment = 0, segments = 0, count = 0;
+        bool ok = readNumber(data, segmentsEnd) && readNumber(data, documents) && readNumber(data, nextSegment) && readNumber(data, segments);
+        for (uint64_t i = 0; ok && i < segments; ++i) {
+            uint64_t number = 0;
+            ok = readNumber(data, number);
+            auto segment = std::make_unique<Segment>();
+            segment->number = static_cast<uint32_t>(number);
+            ok = ok && segment->open((dir / ("seg_" + std::to_string(number) + ".idx")).string());
+            if (ok) { live.push_back(segment->number); m_segments.push_back(std::move(segment)); }
+        }
+        ok = ok && readNumber(data, count) && count <= m_conversations.size();
+        for (uint64_t i = 0; ok && i < count; ++i) {
+            Conversation& conversation = *m_conversations[i];
+            uint64_t mark = 0, fingerprints = 0;
+            ok = readNumber(data, mark) && readNumber(data, fingerprints) && data.size() >= fingerprints * 8;
+            if (!ok) break;
+            conversation.hasHistory = mark != 0;
+            conversation.historyMark = mark ? mark - 1 : 0;
+            for (uint64_t f = 0; f < fingerprints; ++f) {
+                uint64_t value;
+                std::memcpy(&value, data.data() + f * 8, 8);
+                conversation.markFingerprints.push_back(value);
+            }
+            data.remove_prefix(static_cast<size_t>(fingerprints) * 8);
+        }
+        if (ok) {
+            m_segmentsEnd = segmentsEnd;
+            m_documents = static_cast<size_t>(documents);
+            m_nextSegment = static_cast<uint32_t>(nextSegment);
+        }
+        else { // Индекс поврежден - строим заново по журналу
+            live.clear();
+            rebuild();
+        }
+    }
+    for (const auto& entry : fs::directory_iterator(dir, ec)) { // Недописанные и слитые сегменты
+        std::string name = entry.path().filename().string();
+        if (!startsWith(name, "seg_")) continue;
+        uint32_t number = static_cast<uint32_t>(std::strtoul(name.c_str() + 4, nullptr, 10));
+        if (name.size() < 8 || name.compare(name.size() - 4, 4, ".idx") != 0 || std::find(live.begin(), live.end(), number) == live.end()) {
+            fs::remove(entry.path(), ec);
+        }
+    }
+
+    // Хвост журнала после сегментов - в сегмент в памяти
+    std::string documentsPath = (dir / "docs.dat").string();
+    MappedFile documents;
+    documents.map(documentsPath);
+    std::string_view data = documents.contents();
+    if (m_segmentsEnd > data.size()) rebuild(); // Журнал короче индекса - индекс от другого журнала
+    uint64_t offset = m_segmentsEnd;
+    std::string_view rest = data.substr(static_cast<size_t>(offset));
+    while (!rest.empty()) {
+        StoredDocument document;
+        std::string_view record = rest;
+        if (!readDocument(rest, document) || document.conversation >= m_conversations.size()) break;
+        if (!(document.flags & kLiveFlag)) acceptHistory(*m_conversations[document.conversation], document.seconds, document.sender, document.text);
+        indexText(offset, document.text);
+        offset += record.size() - rest.size();
+    }
+    documents.unmap();
+    if (offset != data.size()) fs::resize_file(documentsPath, offset, ec); // Недописанный документ
+
+    m_documentsEnd = offset;
+    m_documentsFile = std::fopen(documentsPath.c_str(), "ab");
+    m_conversationsFile = std::fopen(conversationsPath.c_str(), "ab");
+    remapDocuments();
+    m_loaded = m_documentsFile && m_conversationsFile;
+}
+
+// Сегменты и метки истории - заново по журналу (load проиндексирует его с начала)
+void SearchIndex::rebuild() {
+    m_segments.clear();
+    m_segmentsEnd = 0;
+    m_documents = 0;
+    for (auto& conversation : m_conversations) {
+        conversation->hasHistory = false;
+        conversation->markFingerprints.clear();
+    }
+}
+
+uint32_t SearchIndex::conversationId(ConversationKind kind, std::string_view name) {
+    m_key.assign(kind == ConversationKind::Group ? "g:" : "p:").append(name);
+    auto it = m_conversationIds.find(m_key);
+    if (it != m_conversationIds.end()) return it->second;
+    auto id = static_cast<uint32_t>(m_conversations.size());
+    m_conversationIds.emplace(m_key, id);
+    m_conversations.push_back(std::make_unique<Conversation>());
+    m_conversations.back()->kind = kind;
+    m_conversations.back()->name = name;
+    std::string record;
+    appendVarint64(record, kind == ConversationKind::Group ? 1 : 0);
+    appendString(record, name);
+    if (m_conversationsFile) std::fwrite(record.data(), 1, record.size(), m_conversationsFile);
+    return id;
+}
+
+// История беседы приходит по возрастанию времени (из кэша, полностью или дельтой с метки включительно).
+// Запись старше метки беседы уже в индексе; с той же меткой - если совпадает отпечаток
+bool SearchIndex::acceptHistory(Conversation& conversation, uint64_t seconds, std::string_view sender, std::string_view text) {
+    uint64_t print = fingerprint(sender, text);
+    if (conversation.hasHistory && seconds < conversation.historyMark) return false;
+    if (conversation.hasHistory && seconds == conversation.historyMark) {
+        auto& prints = conversation.markFingerprints;
+        if (std::find(prints.begin(), prints.end(), print) != prints.end()) return false;
+        prints.push_back(print);
+        return true;
+    }
+    conversation.hasHistory = true;
+    conversation.historyMark = seconds;
+    conversation.markFingerprints.assign(1, print);
+    return true;
+}
+
+void SearchIndex::indexText(uint64_t offset, std::string_view text) {
+    forEachTerm(text, m_term, [&](std::string_view term) {
+        m_key.assign(term);
+        auto it = m_memory.find(m_key);
+        if (it == m_memory.end()) it = m_memory.emplace(m_key, std::vector<uint64_t>()).first;
+        if (it->second.empty() || it->second.back() != offset) it->second.push_back(offset); // Повтор слова в тексте
+    });
+    ++m_memoryDocs;
+    ++m_documents;
+}
+
+void SearchIndex::indexBatch(const std::vector<QueuedMessage>& batch, const std::string& text) {
+    std::lock_guard<std::mutex> lock(m_indexMutex);
+    if (!m_loaded) return;
+    std::string out;
+    const char* strings = text.data();
+    for (const QueuedMessage& message : batch) {
+        std::string_view conversation(strings, message.conversationSize);
+        std::string_view timestamp(strings += message.conversationSize, message.timestampSize);
+        std::string_view sender(strings += message.timestampSize, message.senderSize);
+        std::string_view body(strings += message.senderSize, message.textSize);
+        strings += message.textSize;
+
+        uint32_t id = conversationId(message.kind, conversation);
+        bool live = timestamp.empty();
+        uint64_t seconds = live ? localSeconds(message.received) : parseTimestamp(timestamp);
+        if (!live && !acceptHistory(*m_conversations[id], seconds, sender, body)) continue;
+
+        uint64_t offset = m_documentsEnd + out.size();
+        appendVarint64(out, id);
+        appendVarint64(out, seconds);
+        appendVarint64(out, live ? kLiveFlag : 0);
+        appendString(out, sender);
+        appendString(out, body);
+        indexText(offset, body);
+    }
+    if (m_conversationsFile) std::fflush(m_conversationsFile); // Беседы - раньше документов, которые на них ссылаются
+    if (m_documentsFile && !out.empty()) {
+        std::fwrite(out.data(), 1, out.size(), m_documentsFile);
+        std::fflush(m_documentsFile);
+    }
+    m_documentsEnd += out.size();
+    remapDocuments();
+}
+
+void SearchIndex::remapDocuments() {
+    m_documentsMap.map((fs::path(m_dir) / "docs.dat").string());
+}
+
+// --- Сегменты ---
+
+// Сегмент в памяти - на диск. Слова сортируются, списки смещений уже по возрастанию
+bool SearchIndex::flushSegment() {
+    // Поток индекса - единственный, кто меняет m_memory, поэтому читать его можно без блокировки
+    std::vector<const std::pair<const std::string, std::vector<uint64_t>>*> terms;
+    terms.reserve(m_memory.size());
+    for (const auto& entry : m_memory) terms.push_back(&entry);
+    std::sort(terms.begin(), terms.end(), [](const auto* a, const auto* b) { return a->first < b->first; });
+    SegmentWriter writer;
+    for (const auto* entry : terms) {
+        writer.beginTerm(entry->first, entry->second.size());
+        for (uint64_t offset : entry->second) writer.appendDocument(offset);
+    }
+    uint32_t number = m_nextSegment;
+    fs::path path = fs::path(m_dir) / ("seg_" + std::to_string(number) + ".idx");
+    auto segment = std::make_unique<Segment>();
+    segment->number = number;
+    if (!writer.write(path) || !segment->open(path.string())) return false;
+
+    std::lock_guard<std::mutex> lock(m_indexMutex);
+    m_segments.push_back(std::move(segment));
+    m_nextSegment = number + 1;
+    m_memory.clear();
+    m_memoryDocs = 0;
+    m_segmentsEnd = m_documentsEnd;
+    return writeManifest();
+}
+
+// Все сегменты - в один. Сегменты покрывают идущие подряд части журнала, поэтому списки слова
+// просто склеиваются: перекодируется только первая дельта каждой следующей части
+bool SearchIndex::mergeSegments() {
+    struct Cursor { const Segment* segment; uint32_t index; std::string_view term; };
+    std::vector<Cursor> cursors;
+    for (const auto& segment : m_segments) {
+        if (segment->terms == 0) continue;
+        uint32_t count;
+        std::string_view postings;
+        cursors.push_back({ segment.get(), 0, segment->term(0, count, postings) });
+    }
+    SegmentWriter writer;
+    while (!cursors.empty()) {
+        std::string_view term = cursors[0].term;
+        for (const Cursor& cursor : cursors) term = std::min(term, cursor.term);
+        uint64_t total = 0;
+        for (const Cursor& cursor : cursors) {
+            if (cursor.term != term) continue;
+            uint32_t count;
+            std::string_view postings;
+            cursor.segment->term(cursor.index, count, postings);
+            total += count;
+        }
+        writer.beginTerm(term, total);
+        for (size_t i = 0; i < cursors.size();) { // По порядку сегментов - по возрастанию смещений
+            Cursor& cursor = cursors[i];
+            if (cursor.term != term) { ++i; continue; }
+            uint32_t count;
+            std::string_view postings;
+            cursor.segment->term(cursor.index, count, postings);
+            PostingReader reader(postings);
+            for (uint64_t offset; reader.next(offset);) writer.appendDocument(offset);
+            if (++cursor.index < cursor.segment->terms) { cursor.term = cursor.segment->term(cursor.index, count, postings); ++i; }
+            else cursors.erase(cursors.begin() + static_cast<std::ptrdiff_t>(i));
+        }
+    }
+    uint32_t number = m_nextSegment;
+    fs::path path = fs::path(m_dir) / ("seg_" + std::to_string(number) + ".idx");
+    auto merged = std::make_unique<Segment>();
+    merged->number = number;
+    if (!writer.write(path) || !merged->open(path.string())) return false;
+
+    std::vector<std::unique_ptr<Segment>> old;
+    {
+        std::lock_guard<std::mutex> lock(m_indexMutex);
+        old.swap(m_segments);
+        m_segments.push_back(std::move(merged));
+        m_nextSegment = number + 1;
+        if (!writeManifest()) return false;
+    }
+    std::error_code ec;
+    for (auto& segment : old) {
+        uint32_t oldNumber = segment->number;
+        segment.reset(); // Отображение снимаем до удаления (Windows не удаляет отображенный файл)
+        fs::remove(fs::path(m_dir) / ("seg_" + std::to_string(oldNumber) + ".idx"), ec);
+    }
+    return true;
+}
+
+// index.meta: сегменты и метки истории бесед на момент, когда сегмент в памяти пуст
+bool SearchIndex::writeManifest() {
+    std::string out(kManifestMagic);
+    appendVarint64(out, m_segmentsEnd);
+    appendVarint64(out, m_documents);
+    appendVarint64(out, m_nextSegment);
+    appendVarint64(out, m_segments.size());
+    for (const auto& segment : m_segments) appendVarint64(out, segment->number);
+    appendVarint64(out, m_conversations.size());
+    for (const auto& conversation : m_conversations) {
+        appendVarint64(out, conversation->hasHistory ? conversation->historyMark + 1 : 0);
+        appendVarint64(out, conversation->markFingerprints.size());
+        for (uint64_t print : conversation->markFingerprints) out.append(reinterpret_cast<const char*>(&print), 8);
+    }
+    fs::path path = fs::path(m_dir) / "index.meta";
+    fs::path temp = path;
+    temp += ".tmp";
+    std::FILE* file = std::fopen(temp.string().c_str(), "wb");
+    if (!file) return false;
+    bool ok = std::fwrite(out.data(), 1, out.size(), file) == out.size();
+    ok = std::fclose(file) == 0 && ok;
+    std::error_code ec;
+    if (ok) fs::rename(temp, path, ec);
+    return ok && !ec;
+}
+
+// --- Поиск ---
+
+std::vector<SearchHit> SearchIndex::search(std::string_view query, std::string_view conversation, size_t limit) {
+    std::vector<SearchHit> hits;
+    std::vector<std::string> terms;
+    std::string scratch;
+    forEachTerm(query, scratch, [&](std::string_view term) {
+        if (terms.size() < kMaxQueryTerms && std::find(terms.begin(), terms.end(), term) == terms.end()) terms.emplace_back(term);
+    });
+    if (terms.empty() || limit == 0) return hits;
+
+    std::lock_guard<std::mutex> lock(m_indexMutex);
+    if (!m_loaded || m_documents == 0) return hits;
+    std::vector<char> allowed; // Фильтр "in <чат>": номера подходящих бесед
+    if (!conversation.empty()) {
+        allowed.assign(m_conversations.size(), 0);
+        bool any = false;
+        for (size_t i = 0; i < m_conversations.size(); ++i) {
+            if (m_conversations[i]->name == conversation) { allowed[i] = 1; any = true; }
+        }
+        if (!any) return hits;
+    }
+
+    // Списки слов по блокам: сегменты на диске по порядку, последний блок - сегмент в памяти
+    size_t blocks = m_segments.size() + 1;
+    std::vector<TermCursor> cursors;
+    std::vector<std::string_view> lists; // blocks - 1 списков на слово (пустой - слова в сегменте нет)
+    std::vector<const std::vector<uint64_t>*> memoryLists;
+    double maxScore = 0;
+    for (const std::string& term : terms) {
+        size_t first = lists.size();
+        lists.resize(first + m_segments.size());
+        uint64_t frequency = 0;
+        for (size_t i = 0; i < m_segments.size(); ++i) {
+            uint32_t count;
+            std::string_view postings;
+            if (m_segments[i]->find(term, count, postings)) { lists[first + i] = postings; frequency += count; }
+        }
+        auto it = m_memory.find(term);
+        const std::vector<uint64_t>* memory = it != m_memory.end() && !it->second.empty() ? &it->second : nullptr;
+        if (memory) frequency += memory->size();
+        if (frequency == 0) { lists.resize(first); continue; }
+        TermCursor cursor;
+        cursor.idf = std::log(1.0 + static_cast<double>(m_documents) / static_cast<double>(frequency)); // Редкие слова весят больше
+        maxScore += cursor.idf;
+        cursors.push_back(cursor);
+        memoryLists.push_back(memory);
+    }
+
+    // Блоки - от новых к старым, внутри блока списки сливаются по возрастанию смещений; лучшие - в куче
+    // (наименьший счет и самый старый сверху). Кандидатов берем с запасом: среди них могут быть живые копии
+    // сообщений истории. Когда куча полна документами со всеми словами запроса, старые блоки ее уже не
+    // изменят (счет не больше, документ старее) - частое слово не требует обхода всего индекса
+    std::string_view documents = m_documentsMap.contents();
+    size_t candidates = limit * 2;
+    using Candidate = std::pair<double, uint64_t>;
+    std::priority_queue<Candidate, std::vector<Candidate>, std::greater<Candidate>> best;
+    for (size_t block = blocks; block-- > 0;) {
+        for (size_t t = 0; t < cursors.size(); ++t) {
+            TermCursor& cursor = cursors[t];
+            if (block == m_segments.size()) {
+                if (memoryLists[t]) cursor.startMemory(*memoryLists[t]); else cursor.stop();
+            } else {
+                std::string_view postings = lists[t * m_segments.size() + block];
+                if (!postings.empty()) cursor.startSegment(postings); else cursor.stop();
+            }
+        }
+        for (;;) {
+            uint64_t offset = UINT64_MAX;
+            for (const TermCursor& cursor : cursors) if (!cursor.done) offset = std::min(offset, cursor.current);
+            if (offset == UINT64_MAX) break;
+            double score = 0;
+            for (TermCursor& cursor : cursors) {
+                if (cursor.done || cursor.current != offset) continue;
+                score += cursor.idf; // Тот же порядок сложения, что у maxScore: документ со всеми словами дает ровно maxScore
+                cursor.advance();
+            }
+            if (best.size() == candidates && Candidate(score, offset) < best.top()) continue;
+            if (!allowed.empty()) {
+                uint64_t id = 0;
+                if (offset >= documents.size() || readVarint64(documents.substr(static_cast<size_t>(offset)), id) == 0
+                    || id >= allowed.size() || !allowed[id]) continue;
+            }
+            best.emplace(score, offset);
+            if (best.size() > candidates) best.pop();
+        }
+        if (best.size() == candidates && best.top().first >= maxScore) break;
+    }
+
+    struct Found { double score; StoredDocument document; };
+    std::vector<Found> found;
+    for (; !best.empty(); best.pop()) {
+        uint64_t offset = best.top().second;
+        if (offset >= documents.size()) continue;
+        std::string_view record = documents.substr(static_cast<size_t>(offset));
+        Found item{ best.top().first, {} };
+        if (readDocument(record, item.document) && item.document.conversation < m_conversations.size()) found.push_back(item);
+    }
+    std::reverse(found.begin(), found.end()); // Лучшие - первыми
+    for (const Found& item : found) {
+        const StoredDocument& document = item.document;
+        if (document.flags & kLiveFlag) { // Живое сообщение, которое потом пришло и в истории, - один раз
+            bool duplicate = std::any_of(found.begin(), found.end(), [&](const Found& other) {
+                const StoredDocument& history = other.document;
+                uint64_t distance = history.seconds > document.seconds ? history.seconds - document.seconds : document.seconds - history.seconds;
+                return !(history.flags & kLiveFlag) && history.conversation == document.conversation
+                    && distance <= kLiveDuplicateWindow && history.sender == document.sender && history.text == document.text;
+            });
+            if (duplicate) continue;
+        }
+        const Conversation& owner = *m_conversations[document.conversation];
+        hits.push_back({ owner.kind, owner.name, formatTimestamp(document.seconds), std::string(document.sender), std::string(document.text), item.score });
+        if (hits.size() == limit) break;
+    }
+    return hits;
+}
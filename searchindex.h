@@ -0,0 +1,121 @@
+﻿// searchindex.h : локальный полнотекстовый поиск по принятым сообщениям (команда SEARCH).
+// Сообщения (история с сервера и живые MSG_FROM/GROUP_MSG_FROM) дописываются в журнал документов
+// docs.dat; идентификатор документа - его смещение в журнале. Обратный индекс "слово -> документы"
+// лежит в неизменяемых сегментах (seg_N.idx: отсортированный словарь и списки смещений дельтами
+// varint), свежие документы - в сегменте в памяти, который сбрасывается на диск каждые kSegmentDocs.
+// Документы идут в журнал по возрастанию смещений, поэтому список слова в нескольких сегментах - это
+// просто их конкатенация, и слияние сегментов не требует сортировки.
+// Индексирует отдельный поток пачками: add() из потока приемника только кладет сообщение в очередь.
+// Журнал - источник истины: то, что не успело попасть в сегменты до выхода, индексируется при open().
+
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <ctime>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "historystore.h"
+
+struct SearchHit {
+    ConversationKind kind = ConversationKind::Private;
+    std::string conversation; // Группа или собеседник
+    std::string timestamp;    // YYYY-MM-DD HH:MM:SS (у живых сообщений - локальное время приема)
+    std::string sender;
+    std::string text;
+    double score = 0;         // Сумма idf найденных слов
+};
+
+class SearchIndex {
+public:
+    static constexpr size_t kSegmentDocs = 64 * 1024; // Документов в сегменте в памяти до сброса на диск
+    static constexpr size_t kMaxSegments = 8;         // Больше - сегменты сливаются в один
+    static constexpr size_t kMaxHits = 20;
+
+    SearchIndex();
+    ~SearchIndex(); // close()
+    SearchIndex(const SearchIndex&) = delete;
+    SearchIndex& operator=(const SearchIndex&) = delete;
+
+    // Индекс аккаунта в root (см. HistoryStore::defaultRoot). Загрузка идет в потоке индекса:
+    // до ее конца search() ничего не находит, а add() уже можно вызывать
+    bool open(const std::string& root, std::string_view account);
+    // Индексирует очередь, сбрасывает сегмент в памяти и останавливает поток
+    void close();
+    bool isOpen() const { return m_worker.joinable(); }
+
+    // Сообщение для индекса (из любого потока, дешево). timestamp пустой - живое сообщение, время - сейчас.
+    // История приходит по возрастанию времени: записи не новее уже проиндексированных для беседы пропускаются
+    void add(ConversationKind kind, std::string_view conversation, std::string_view timestamp,
+        std::string_view sender, std::string_view text);
+    // Ждет, пока очередь будет проиндексирована
+    void sync();
+
+    // Лучшие совпадения: документы с большим числом редких слов запроса, при равенстве - новее.
+    // conversation непусто - только беседы с таким именем
+    std::vector<SearchHit> search(std::string_view query, std::string_view conversation = {}, size_t limit = kMaxHits);
+    size_t documents() const;
+    bool loaded() const;
+    // История беседы уже есть в индексе (тогда ее повтор из кэша индексировать не нужно)
+    bool hasHistory(ConversationKind kind, std::string_view conversation) const;
+
+private:
+    struct Conversation;
+    struct Segment;
+    struct QueuedMessage {
+        ConversationKind kind;
+        std::time_t received;         // Для живых сообщений
+        uint32_t conversationSize, timestampSize, senderSize, textSize; // Строки подряд в m_queueText
+    };
+
+    void run();
+    void load();
+    void rebuild();
+    void indexBatch(const std::vector<QueuedMessage>& batch, const std::string& text);
+    bool acceptHistory(Conversation& conversation, uint64_t seconds, std::string_view sender, std::string_view text);
+    void indexText(uint64_t offset, std::string_view text);
+    uint32_t conversationId(ConversationKind kind, std::string_view name);
+    bool flushSegment();
+    bool mergeSegments();
+    bool writeManifest();
+    void remapDocuments();
+
+    std::string m_dir;
+
+    // Очередь: add() дописывает, поток индекса забирает целиком
+    std::mutex m_queueMutex;
+    std::condition_variable m_queueWake;   // Очередь набрала пачку, ее ждет sync() или остановка
+    std::condition_variable m_queueIdle;   // Очередь проиндексирована (для sync)
+    std::vector<QueuedMessage> m_queue;
+    std::string m_queueText;
+    bool m_accepting = false;              // Индекс открыт - add() принимает сообщения
+    bool m_stop = false;
+    bool m_busy = false;                   // Поток индекса загружает индекс или обрабатывает пачку
+    size_t m_syncWaiters = 0;
+    std::thread m_worker;
+
+    // Индекс: пишет только поток индекса, search() читает под тем же мьютексом
+    mutable std::mutex m_indexMutex;
+    bool m_loaded = false;
+    std::vector<std::unique_ptr<Conversation>> m_conversations; // Номер беседы - индекс в векторе
+    std::unordered_map<std::string, uint32_t> m_conversationIds;   // "g:name"/"p:name" -> номер
+    std::vector<std::unique_ptr<Segment>> m_segments;
+    std::unordered_map<std::string, std::vector<uint64_t>> m_memory; // Сегмент в памяти: слово -> смещения
+    size_t m_memoryDocs = 0;
+    uint64_t m_segmentsEnd = 0;   // Документы до этого смещения журнала - в сегментах на диске
+    uint64_t m_documentsEnd = 0;  // Конец журнала
+    size_t m_documents = 0;
+    uint32_t m_nextSegment = 0;
+    MappedFile m_documentsMap;    // Журнал для чтения найденных документов
+    std::FILE* m_documentsFile = nullptr;
+    std::FILE* m_conversationsFile = nullptr;
+    std::string m_term, m_key;    // Память переиспользуется
+};
@@ -0,0 +1,91 @@
+﻿#include "sendqueue.h"
+
+#include <algorithm> // std::remove
+#include <iterator>  // std::make_move_iterator
+
+#include "netutil.h"
+
+#ifndef _WIN32
+#include <sys/uio.h> // iovec
+#endif
+
+bool SendQueue::push(std::string message) {
+    // Убираем '\r' на случай ввода с CRLF - на месте, без копии
+    message.erase(std::remove(message.begin(), message.end(), '\r'), message.end());
+    message.push_back('\n');
+    return enqueue(std::move(message));
+}
+
+bool SendQueue::pushFrame(std::string frame) {
+    return enqueue(std::move(frame));
+}
+
+bool SendQueue::enqueue(std::string message) {
+    size_t bytes = message.size();
+    std::lock_guard<std::mutex> lock(m_mutex);
+    bool wasEmpty = m_incoming.empty();
+    m_incoming.push_back(std::move(message));
+    m_depth.fetch_add(1, std::memory_order_relaxed);
+    m_bytes.fetch_add(bytes, std::memory_order_relaxed);
+    return wasEmpty;
+}
+
+FlushStatus SendQueue::flush(SocketType socket) {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_sending.empty()) m_sending.swap(m_incoming);
+        else {
+            m_sending.insert(m_sending.end(), std::make_move_iterator(m_incoming.begin()), std::make_move_iterator(m_incoming.end()));
+            m_incoming.clear();
+        }
+    }
+
+    while (!m_sending.empty()) {
+        // Собираем пачку: все накопленные строки уходят одним системным вызовом
+        size_t count = std::min(m_sending.size(), kMaxBatchBuffers);
+#ifdef _WIN32
+        WSABUF buffers[kMaxBatchBuffers];
+        for (size_t i = 0; i < count; ++i) {
+            size_t offset = i == 0 ? m_sendOffset : 0;
+            buffers[i].buf = const_cast<char*>(m_sending[i].data() + offset);
+            buffers[i].len = static_cast<ULONG>(m_sending[i].size() - offset);
+        }
+        DWORD sentBytes = 0;
+        long sent = WSASend(socket, buffers, static_cast<DWORD>(count), &sentBytes, 0, nullptr, nullptr) == 0 ? static_cast<long>(sentBytes) : -1;
+#else
+        iovec buffers[kMaxBatchBuffers];
+        for (size_t i = 0; i < count; ++i) {
+            size_t offset = i == 0 ? m_sendOffset : 0;
+            buffers[i].iov_base = const_cast<char*>(m_sending[i].data() + offset);
+            buffers[i].iov_len = m_sending[i].size() - offset;
+        }
+        msghdr message{};
+        message.msg_iov = buffers;
+        message.msg_iovlen = count;
+        long sent = static_cast<long>(sendmsg(socket, &message, kSendFlags)); // writev с флагами (без SIGPIPE)
+#endif
+        if (sent < 0) return isWouldBlockError(GET_LAST_ERROR) ? FlushStatus::Blocked : FlushStatus::Error;
+
+        // Снимаем отправленное; строка, записанная частично, остается первой со смещением
+        m_bytes.fetch_sub(static_cast<size_t>(sent), std::memory_order_relaxed);
+        size_t remaining = static_cast<size_t>(sent);
+        while (remaining > 0) {
+            size_t left = m_sending.front().size() - m_sendOffset;
+            if (remaining < left) { m_sendOffset += remaining; break; }
+            remaining -= left;
+            m_sending.pop_front();
+            m_sendOffset = 0;
+            m_depth.fetch_sub(1, std::memory_order_relaxed);
+        }
+    }
+    return FlushStatus::Drained;
+}
+
+void SendQueue::clear() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_incoming.clear();
+    m_sending.clear();
+    m_sendOffset = 0;
+    m_depth = 0;
+    m_bytes = 0;
+}
@@ -0,0 +1,49 @@
+﻿// sendqueue.h : очередь исходящих строк протокола.
+// Поток ввода только кладет сообщения в очередь; отправляет поток с циклом событий - пачкой
+// одним sendmsg()/WSASend() на много буферов, с продолжением после частичной записи и EAGAIN.
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <string>
+
+#include "messengerclient.h"
+
+enum class FlushStatus {
+    Drained, // Очередь пуста
+    Blocked, // Буфер сокета заполнен - продолжить, когда сокет станет доступен для записи
+    Error    // Ошибка сокета
+};
+
+class SendQueue {
+public:
+    static constexpr size_t kMaxBatchBuffers = 64; // Буферов в одном системном вызове
+
+    // Добавляет сообщение (строка перемещается, а не копируется), убирает '\r' и дописывает '\n'.
+    // Возвращает true, если входящая очередь была пуста - поток отправки нужно разбудить
+    bool push(std::string message);
+    // Добавляет готовый двоичный кадр как есть (frame.h)
+    bool pushFrame(std::string frame);
+
+    // Отправляет все, что возможно без блокировки. Вызывается только из потока отправки
+    FlushStatus flush(SocketType socket);
+
+    // Сбрасывает очередь (разрыв соединения). Только из потока отправки или когда он не работает
+    void clear();
+
+    size_t depth() const { return m_depth.load(std::memory_order_relaxed); }        // Сообщений, еще не отправленных целиком
+    size_t pendingBytes() const { return m_bytes.load(std::memory_order_relaxed); } // Байт, еще не отправленных
+
+private:
+    bool enqueue(std::string bytes);
+
+    std::mutex m_mutex;
+    std::deque<std::string> m_incoming; // Под m_mutex: добавленные, но еще не взятые в отправку
+    std::deque<std::string> m_sending;  // Только поток отправки
+    size_t m_sendOffset = 0;            // Уже отправленная часть m_sending.front()
+    std::atomic<size_t> m_depth{ 0 };
+    std::atomic<size_t> m_bytes{ 0 };
+};
@@ -0,0 +1,951 @@
+﻿#include "session.h"
+
+#include <algorithm> // std::min, std::replace
+#include <utility>
+
+#include "eventloop.h"
+#include "netutil.h"
+#include "trace.h"
+
+namespace {
+
+// Команда строкой текстового протокола. Перевод строки разрезал бы ее на две команды - заменяем пробелом
+std::string commandText(std::initializer_list<std::string_view> command) {
+    std::string text;
+    for (std::string_view field : command) {
+        if (!text.empty()) text.push_back(' ');
+        text.append(field);
+    }
+    std::replace(text.begin(), text.end(), '\n', ' ');
+    return text;
+}
+
+// Текстовый вид ответа сервера для показа: у кадра его приходится собрать в storage
+std::string_view serverText(const ServerLine& line, std::string& storage) {
+    if (!line.frame) return line.message;
+    appendServerText(storage, line.frame->fields.data(), line.frame->count);
+    return storage;
+}
+
+} // namespace
+
+Session::~Session() {
+    m_listener = &m_nullListener; // Слушатель уже может быть разрушен
+    disconnect();
+}
+
+bool Session::connect(const std::string& host, unsigned short port, int& errorCode, std::chrono::milliseconds timeout) {
+    disconnect();
+    SocketType socket = connectTcp(host, port, errorCode, timeout);
+    if (socket == INVALID_SOCKET_VALUE) return false;
+    setSocketNonBlocking(socket); // Дальше сокет обслуживает только цикл событий
+    m_serverCaps = 0;
+    m_socket = socket;
+    return true;
+}
+
+void Session::disconnect() {
+    SocketType socket = m_socket.exchange(INVALID_SOCKET_VALUE);
+    if (socket != INVALID_SOCKET_VALUE) CLOSE_SOCKET(socket);
+    {
+        std::lock_guard<std::mutex> lock(m_sendMutex);
+        m_sendQueue.clear(); // Недоставленное этому соединению следующему не отправляем
+        m_framesOut = false; // Новое соединение снова начинает с текста
+    }
+    m_reader.reset();
+    m_framesIn = false;
+    m_compressedIn = false;
+    m_requests.clear();  // Ответов на запросы закрытого соединения не будет
+    resetStreams();
+    closeHistoryCache();
+    {
+        std::lock_guard<std::mutex> lock(m_pageMutex);
+        m_opening = m_olderInFlight = m_olderWanted = m_prefetchedReady = false;
+        m_prefetched.clear();
+    }
+    bool loggedIn;
+    {
+        std::lock_guard<std::mutex> lock(m_stateMutex);
+        std::shared_ptr<const SessionState> state = m_state.load();
+        loggedIn = state->loggedIn;
+        if (loggedIn) m_resumeConversation = state->conversation; // Откроется снова после resume()
+        m_pendingLogin.reset();
+    }
+    if (loggedIn) resetLogin();
+    if (socket != INVALID_SOCKET_VALUE) m_listener->onDisconnected(); // Повторный disconnect() - без события
+}
+
+// --- Отправка ---
+
+bool Session::send(Command command) {
+    if (!connected()) return false;
+    TRACE_SCOPE("send");
+    bool wake;
+    size_t bytes;
+    {
+        TRACE_LOCK(lock, m_sendMutex, "lock m_sendMutex");
+        if (m_framesOut) {
+            std::string frame;
+            appendFrame(frame, command);
+            bytes = frame.size();
+            wake = m_sendQueue.pushFrame(std::move(frame));
+        }
+        else {
+            std::string text = commandText(command);
+            bytes = text.size() + 1; // С '\n'
+            wake = m_sendQueue.push(std::move(text));
+        }
+    }
+    m_metrics.countSent(*command.begin(), bytes);
+    if (wake) { // Будим только на первом сообщении пачки
+        if (EventLoop* eventLoop = m_eventLoop.load()) eventLoop->wake();
+    }
+    return true;
+}
+
+bool Session::request(RequestKind kind, Command command, std::string target, bool delta, bool quiet,
+    std::chrono::milliseconds timeout) {
+    if (!connected()) return false;
+    m_requests.open(kind, std::move(target), delta, quiet, timeout);
+    return send(command);
+}
+
+bool Session::sendCredentials(RequestKind kind, std::string_view verb, std::string_view username, std::string_view password) {
+    if (!connected()) return false;
+    {
+        std::lock_guard<std::mutex> lock(m_stateMutex); // Для resume() после успешного входа
+        m_pendingLogin = Credentials{ std::string(username), std::string(password) };
+    }
+    return request(kind, { verb, username, password });
+}
+
+bool Session::sendsFrames() const {
+    std::lock_guard<std::mutex> lock(m_sendMutex);
+    return m_framesOut;
+}
+
+// Строки, уже стоящие в очереди, уйдут раньше FRAMES; все, что поставлено после, - кадрами
+void Session::startFrames() {
+    m_framesIn = true; // Сервер перешел на кадры сразу после строки CAPS
+    bool wake;
+    {
+        std::lock_guard<std::mutex> lock(m_sendMutex);
+        wake = m_sendQueue.push(std::string(kFramesCommand));
+        m_framesOut = true;
+    }
+    m_metrics.countSent(kFramesCommand, kFramesCommand.size() + 1);
+    if (wake) {
+        if (EventLoop* eventLoop = m_eventLoop.load()) eventLoop->wake();
+    }
+}
+
+bool Session::hello() {
+    // Старый сервер не знает HELLO и ответит ошибкой - запрос "тихий", ее не показываем
+    return request(RequestKind::Hello, { "HELLO", kClientCapabilities }, {}, false, true, std::chrono::milliseconds(3000));
+}
+
+bool Session::login(std::string_view username, std::string_view password) {
+    return sendCredentials(RequestKind::Login, "LOGIN", username, password);
+}
+
+bool Session::registerUser(std::string_view username, std::string_view password) {
+    return sendCredentials(RequestKind::Login, "REGISTRATION", username, password);
+}
+
+bool Session::logout() {
+    {
+        std::lock_guard<std::mutex> lock(m_stateMutex); // Пользователь вышел сам - после разрыва не входим снова
+        m_resumeLogin.reset();
+        m_resumeConversation = Conversation();
+    }
+    return request(RequestKind::Logout, { "LOGOUT" });
+}
+
+bool Session::requestFriendList(bool quiet) {
+    return request(RequestKind::FriendList, { "GET_CHAT_PARTNERS" }, {}, false, quiet);
+}
+
+bool Session::requestGroupList(bool quiet) {
+    return request(RequestKind::GroupList, { "LIST_MY_GROUPS" }, {}, false, quiet);
+}
+
+bool Session::createGroup(std::string_view group) {
+    return request(RequestKind::CreateGroup, { "CREATE_GROUP", group });
+}
+
+bool Session::joinGroup(std::string_view group) {
+    return request(RequestKind::JoinGroup, { "JOIN_GROUP", group });
+}
+
+// Многострочный текст доходит целиком только в кадрах: в тексте переводы строк заменяются пробелами
+bool Session::sendPrivate(std::string_view to, std::string_view text) {
+    return request(RequestKind::SendPrivate, { "SEND_PRIVATE", to, text });
+}
+
+bool Session::sendGroup(std::string_view group, std::string_view text) {
+    return request(RequestKind::SendGroup, { "SEND_GROUP", group, text });
+}
+
+bool Session::openConversation(ConversationKind kind, std::string name, SessionListener* cacheListener) {
+    if (!connected()) return false;
+    SessionListener& listener = cacheListener ? *cacheListener : *m_listener;
+    {
+        NameId id = m_names.intern(name);
+        std::lock_guard<std::mutex> lock(m_stateMutex);
+        m_state.update([&](SessionState& state) { state.conversation = Conversation{ kind, name, false, id }; });
+    }
+
+    // Сохраненная история показывается сразу, не дожидаясь сервера. Со страницами - только последняя
+    size_t pageSize = m_pageSize.load();
+    HistoryCursor cursor;
+    std::string lastTimestamp;
+    std::string page;
+    bool cached = false;
+    {
+        // Страница копируется под m_pageMutex, и отображение закрывается до вывода: ответ на прежнее открытие
+        // этой же беседы может еще идти, и полная история обрежет файл в потоке цикла (openHistoryCache)
+        std::lock_guard<std::mutex> lock(m_pageMutex);
+        HistoryStore cache;
+        if (cache.open(HistoryStore::defaultRoot(), username(), kind, name) && !cache.empty()) {
+            cached = true;
+            std::string_view records = cache.records();
+            if (pageSize) cursor.cacheOffset = historyPageStart(records, records.size(), pageSize);
+            page.assign(records.substr(cursor.cacheOffset));
+            cursor.shown(page);
+            lastTimestamp = std::string(cache.lastTimestamp());
+        }
+        // Страницы прежней беседы больше не нужны
+        m_pageCursor = std::move(cursor);
+        m_prefetched.clear();
+        m_prefetchedReady = m_olderWanted = false;
+        m_opening = true;
+        ++m_pageGeneration;
+    }
+    if (cached) {
+        activateConversation(kind, name); // Беседа открыта из кэша - можно писать сразу
+        listener.onHistoryBegin(kind, name, HistorySource::Cache);
+        size_t entries = emitHistoryEntries(listener, kind, name, page);
+        listener.onHistoryEnd(kind, name, HistorySource::Cache, entries);
+    }
+
+    // Только новые сообщения, если сервер умеет дельту и кэш уже показан, иначе последняя страница
+    // (если сервер умеет страницы) или вся история
+    bool delta = !lastTimestamp.empty() && (serverCaps() & kCapHistorySince);
+    bool group = kind == ConversationKind::Group;
+    RequestKind requestKind = group ? RequestKind::GroupHistory : RequestKind::PrivateHistory;
+    if (delta) return request(requestKind, { group ? "GROUPCHAT_SINCE" : "GET_HISTORY_SINCE", name, lastTimestamp }, name, true);
+    if (pageSize && (serverCaps() & kCapHistoryPages)) {
+        return request(requestKind, { group ? "GROUPCHAT_PAGE" : "GET_HISTORY_PAGE", name, std::to_string(pageSize) }, name);
+    }
+    return request(requestKind, { group ? "GROUPCHAT" : "GET_HISTORY", name }, name);
+}
+
+// --- Страницы истории ---
+
+// Записи кэша (historystore.h) слушателю по одной. Возвращает, сколько их было
+size_t Session::emitHistoryEntries(SessionListener& listener, ConversationKind kind, std::string_view name, std::string_view records) {
+    size_t entries = 0;
+    std::string multiline;
+    forEachHistoryRecord(records, [&](std::string_view record) {
+        HistoryEntry entry;
+        parseHistoryEntry(record, entry);
+        if (entry.text.find('\r') != std::string_view::npos) { // Многострочное сообщение (см. historystore.h)
+            multiline.assign(entry.text);
+            std::replace(multiline.begin(), multiline.end(), '\r', '\n');
+            entry.text = multiline;
+        }
+        ++entries;
+        listener.onHistoryEntry(kind, name, entry);
+    });
+    return entries;
+}
+
+void Session::emitOlderPage(SessionListener& listener, ConversationKind kind, std::string_view name, std::string_view records) {
+    listener.onHistoryBegin(kind, name, HistorySource::Older);
+    size_t entries = emitHistoryEntries(listener, kind, name, records);
+    listener.onHistoryEnd(kind, name, HistorySource::Older, entries);
+}
+
+OlderHistory Session::showOlderHistory(SessionListener* cacheListener) {
+    SessionListener& listener = cacheListener ? *cacheListener : *m_listener;
+    size_t pageSize = m_pageSize.load();
+    std::shared_ptr<const SessionState> state = m_state.load();
+    const Conversation& conversation = state->conversation;
+    if (!pageSize || !conversation.active) return OlderHistory::NoMore;
+
+    std::unique_lock<std::mutex> lock(m_pageMutex);
+    if (m_opening) return OlderHistory::Busy;
+    // Сначала - кэш: он уже на диске, страница читается сразу.
+    // Страница копируется под m_pageMutex, и отображение закрывается до вывода: полная история с сервера
+    // обрезает этот же файл (openHistoryCache) в потоке цикла, а запрашивается она только после m_opening
+    if (m_pageCursor.cacheOffset > 0) {
+        std::string page;
+        {
+            HistoryStore cache;
+            if (cache.open(HistoryStore::defaultRoot(), state->username, conversation.kind, conversation.name)) {
+                std::string_view records = cache.records();
+                size_t end = std::min(m_pageCursor.cacheOffset, records.size());
+                size_t start = historyPageStart(records, end, pageSize);
+                page.assign(records.substr(start, end - start));
+                m_pageCursor.cacheOffset = start;
+            }
+            else m_pageCursor.cacheOffset = 0; // Кэш недоступен - дальше только сервер
+        }
+        if (!page.empty()) {
+            m_pageCursor.shown(page);
+            lock.unlock();
+            emitOlderPage(listener, conversation.kind, conversation.name, page);
+            prefetchOlderPage(); // Кэш кончился - следующую страницу готовит сервер
+            return OlderHistory::Shown;
+        }
+    }
+    if (m_prefetchedReady) {
+        std::string page = std::move(m_prefetched);
+        m_prefetched.clear();
+        m_prefetchedReady = false;
+        if (!page.empty()) {
+            m_pageCursor.shown(page);
+            lock.unlock();
+            emitOlderPage(listener, conversation.kind, conversation.name, page);
+            prefetchOlderPage();
+            return OlderHistory::Shown;
+        }
+    }
+    if (!(serverCaps() & kCapHistoryPages) || !m_pageCursor.serverMore || m_pageCursor.oldest.empty()) return OlderHistory::NoMore;
+    m_olderWanted = true; // Покажет finishOlderPage, когда страница придет
+    if (!m_olderInFlight && !requestOlderPage(conversation, pageSize)) {
+        m_olderWanted = false;
+        return OlderHistory::NoMore;
+    }
+    return OlderHistory::Requested;
+}
+
+bool Session::copyHistoryCache(ConversationKind kind, std::string_view name, std::string& records) {
+    std::lock_guard<std::mutex> lock(m_pageMutex); // См. openHistoryCache
+    HistoryStore cache;
+    if (!cache.open(HistoryStore::defaultRoot(), username(), kind, name)) return false;
+    records.assign(cache.records());
+    return true;
+}
+
+// Запрашивает страницу раньше m_pageCursor. Вызывается под m_pageMutex
+bool Session::requestOlderPage(const Conversation& conversation, size_t pageSize) {
+    if (!connected()) return false;
+    bool group = conversation.kind == ConversationKind::Group;
+    PendingRequest request;
+    request.kind = group ? RequestKind::GroupHistory : RequestKind::PrivateHistory;
+    request.target = conversation.name;
+    request.older = true;
+    request.quiet = true; // Ошибку показываем, только если страницу ждет пользователь (olderPageFailed)
+    m_olderRequested = m_pageCursor.requestCount(pageSize);
+    m_olderGeneration = m_pageGeneration;
+    m_olderInFlight = true;
+    m_requests.open(std::move(request));
+    return send({ group ? "GROUPCHAT_PAGE" : "GET_HISTORY_PAGE", conversation.name, std::to_string(m_olderRequested), m_pageCursor.oldest });
+}
+
+// Следующая более ранняя страница - заранее, пока пользователь читает показанную
+void Session::prefetchOlderPage() {
+    size_t pageSize = m_pageSize.load();
+    if (!pageSize || !(serverCaps() & kCapHistoryPages)) return;
+    std::shared_ptr<const SessionState> state = m_state.load();
+    if (!state->conversation.active) return;
+    std::lock_guard<std::mutex> lock(m_pageMutex);
+    const HistoryCursor& cursor = m_pageCursor;
+    // Пока в кэше есть непоказанное, сервер не нужен: страница кэша читается сразу
+    if (m_opening || m_olderInFlight || m_prefetchedReady || cursor.cacheOffset > 0 || !cursor.serverMore || cursor.oldest.empty()) return;
+    requestOlderPage(state->conversation, pageSize);
+}
+
+// Более ранняя страница принята целиком (m_olderRecords; пусто - NO_*_HISTORY)
+void Session::finishOlderPage(ConversationKind kind, std::string_view name) {
+    size_t received = countHistoryRecords(m_olderRecords);
+    bool show = false;
+    {
+        std::lock_guard<std::mutex> lock(m_pageMutex);
+        m_olderInFlight = false;
+        if (m_olderGeneration != m_pageGeneration || !m_loopState.get().conversation.is(kind, name)) m_olderRecords.clear(); // Беседу сменили
+        else {
+            m_pageCursor.dropRepeats(m_olderRecords);
+            m_pageCursor.serverMore = received >= m_olderRequested; // Страница неполная - дальше истории нет
+            show = m_olderWanted;
+            m_olderWanted = false;
+            if (show) m_pageCursor.shown(m_olderRecords);
+            else {
+                m_prefetched.swap(m_olderRecords);
+                m_prefetchedReady = true;
+            }
+        }
+    }
+    if (show) emitOlderPage(*m_listener, kind, name, m_olderRecords);
+    m_olderRecords.clear();
+    prefetchOlderPage(); // Следующая - или страница беседы, открытой, пока шла эта
+}
+
+void Session::finishOpening(ConversationKind kind, std::string_view name, bool delta) {
+    if (!m_loopState.get().conversation.is(kind, name)) return; // Ответ для беседы, которую уже сменили
+    {
+        std::lock_guard<std::mutex> lock(m_pageMutex);
+        m_opening = false;
+        size_t capacity = m_historyWindow.capacity();
+        // Показанное начинается с окна, а не со страницы кэша из openConversation
+        if (capacity && (!delta || m_historyWindow.dropped() > 0)) {
+            m_pageCursor = HistoryCursor();
+            m_pageCursor.cacheOffset = m_historyWindow.firstOffset();
+            m_pageCursor.shown(m_historyWindow.records());
+            // Вся история пришла и поместилась в окно (или вытесненное есть в кэше) - у сервера раньше ничего нет
+            m_pageCursor.serverMore = delta || (m_historyWindow.dropped() == 0 && m_historyWindow.size() >= capacity);
+        }
+    }
+    prefetchOlderPage();
+}
+
+bool Session::olderPageFailed() {
+    std::lock_guard<std::mutex> lock(m_pageMutex);
+    m_olderInFlight = false;
+    bool wanted = m_olderWanted;
+    m_olderWanted = false;
+    return wanted;
+}
+
+// --- Восстановление после разрыва ---
+
+bool Session::canResume() const {
+    std::lock_guard<std::mutex> lock(m_stateMutex);
+    return m_resumeLogin.has_value();
+}
+
+std::string Session::resumeUsername() const {
+    std::lock_guard<std::mutex> lock(m_stateMutex);
+    return m_resumeLogin ? m_resumeLogin->username : std::string();
+}
+
+bool Session::resume() {
+    std::optional<Credentials> credentials;
+    {
+        std::lock_guard<std::mutex> lock(m_stateMutex);
+        credentials = m_resumeLogin;
+    }
+    if (!credentials) return false;
+    return login(credentials->username, credentials->password);
+}
+
+// --- Состояние ---
+
+void Session::setLoggedIn(std::string username) {
+    {
+        NameId id = m_loopNames.intern(username);
+        std::lock_guard<std::mutex> lock(m_stateMutex);
+        m_state.update([&](SessionState& state) {
+            state.loggedIn = true;
+            state.username = std::move(username);
+            state.usernameId = id;
+        });
+    }
+    m_loginChanged.notify_all();
+}
+
+void Session::resetLogin() {
+    {
+        std::lock_guard<std::mutex> lock(m_stateMutex);
+        m_state.update([](SessionState& state) { state = SessionState(); });
+    }
+    m_requests.clear();
+    m_loginChanged.notify_all();
+}
+
+bool Session::waitForLogout(std::chrono::milliseconds timeout) {
+    std::unique_lock<std::mutex> lock(m_stateMutex);
+    return m_loginChanged.wait_for(lock, timeout, [this] { return !m_state.load()->loggedIn; });
+}
+
+Conversation Session::conversation() const {
+    return m_state.load()->conversation;
+}
+
+bool Session::inConversation() const {
+    return m_state.load()->conversation.active;
+}
+
+bool Session::isConversation(ConversationKind kind, std::string_view name) const {
+    return m_state.load()->conversation.is(kind, name);
+}
+
+bool Session::isActiveConversation(ConversationKind kind, std::string_view name) const {
+    return m_state.load()->conversation.isActive(kind, name);
+}
+
+bool Session::activateConversation(ConversationKind kind, std::string_view name) {
+    std::lock_guard<std::mutex> lock(m_stateMutex); // Проверка и публикация - без другого писателя между ними
+    if (!m_state.load()->conversation.is(kind, name)) return false;
+    m_state.update([](SessionState& state) { state.conversation.active = true; });
+    return true;
+}
+
+std::string Session::leaveConversation() {
+    std::lock_guard<std::mutex> lock(m_stateMutex);
+    std::string name;
+    m_state.update([&](SessionState& state) {
+        name = std::move(state.conversation.name);
+        state.conversation = Conversation();
+    });
+    return name;
+}
+
+// Беседа, которую открывал запрос истории, все еще открыта (или открывается)
+bool Session::isConversationOfRequest(const PendingRequest& request) const {
+    if (request.older) return false; // Более ранняя страница беседу не открывает
+    const Conversation& conversation = m_loopState.get().conversation;
+    if (request.kind == RequestKind::GroupHistory) return conversation.is(ConversationKind::Group, request.target);
+    if (request.kind == RequestKind::PrivateHistory) return conversation.is(ConversationKind::Private, request.target);
+    return false;
+}
+
+bool Session::idle() const {
+    if (m_loopState.get().conversation.active || !m_requests.empty()) return false;
+    for (const auto& stream : m_streams) if (stream) return false;
+    return true;
+}
+
+void Session::resetStreams() {
+    for (auto& stream : m_streams) stream.reset();
+}
+
+// --- Кэш истории ---
+
+// Открывает кэш беседы перед приемом истории. Полная история с сервера заменяет кэш целиком.
+// Обрезка - под m_pageMutex: другие потоки читают файл кэша через mmap только под ним (openConversation,
+// showOlderHistory, copyHistoryCache), а обрезка файла под живым отображением - SIGBUS
+void Session::openHistoryCache(ConversationKind kind, std::string_view name, bool delta) {
+    m_historyDelta = delta;
+    if (m_historyStore.open(HistoryStore::defaultRoot(), username(), kind, name) && !delta) {
+        std::lock_guard<std::mutex> lock(m_pageMutex);
+        m_historyStore.truncate();
+    }
+}
+
+// Сохраняет строку истории в кэш. false - запись уже была в кэше (и уже показана)
+bool Session::storeHistoryRecord(std::string_view record) {
+    if (!m_historyStore.isOpen()) return true;
+    if (m_historyDelta && m_historyStore.hasRecordAtTail(record)) return false;
+    m_historyStore.append(record);
+    return true;
+}
+
+void Session::closeHistoryCache() {
+    m_historyStore.flush();
+    m_historyStore.close();
+}
+
+// --- Прием ---
+
+ReadStatus Session::receive() {
+    ReadStatus status;
+    {
+        TRACE_SCOPE("recv");
+        status = m_reader.fill(m_socket.load()); // Один recv() большим куском
+    }
+    if (status == ReadStatus::Closed || status == ReadStatus::Error) return status;
+    m_metrics.addBytesReceived(m_reader.lastRead());
+
+    // Разбираем все полные строки (кадры), пришедшие за этот recv()
+    for (;;) {
+        bool framed = m_framesIn; // CAPS переключает разбор посреди буфера
+        std::string_view data;
+        status = framed ? m_reader.nextFrame(data) : m_reader.next(data);
+        if (status == ReadStatus::NeedMore) break;
+        if (status == ReadStatus::TooLong) m_listener->onLineTooLong(m_reader.maxLineLength());
+        else if (framed) dispatchFrame(data);
+        else if (!data.empty()) dispatchLine(data); // Пустые строки - keep-alive
+    }
+    return ReadStatus::NeedMore;
+}
+
+void Session::expireRequests(std::chrono::steady_clock::time_point now) {
+    for (const PendingRequest& request : m_requests.expire(now)) {
+        bool wanted = request.older && olderPageFailed(); // Страница, которую ждет пользователь
+        if (request.quiet && !wanted) continue;
+        // Беседу, которая ждала историю и еще не была показана из кэша, закрываем
+        bool closed = isConversationOfRequest(request) && !m_loopState.get().conversation.active;
+        if (closed) leaveConversation();
+        m_listener->onRequestTimeout(request, closed);
+    }
+}
+
+void Session::dispatchLine(std::string_view message) {
+    dispatch(splitServerLine(message));
+}
+
+void Session::dispatchFrame(std::string_view body) {
+    Frame frame;
+    // Поврежденный кадр пропускаем: границу следующего задает длина, поток не сбивается
+    if (!parseFrame(body, frame)) return;
+    if (m_compressedIn) {
+        size_t stream = compressedStreamOf(frame);
+        if (stream != kCompressedStreamCount) { // Сжатая запись: восстанавливаем по предыдущей и разбираем как обычную
+            Frame entry;
+            if (m_streamDecoders[stream].decode(frame, entry)) dispatch(splitServerFrame(entry));
+            return;
+        }
+        stream = compressedStreamStartedBy(frame.verb());
+        if (stream != kCompressedStreamCount) m_streamDecoders[stream].reset();
+    }
+    dispatch(splitServerFrame(frame));
+}
+
+void Session::dispatch(const ServerLine& line) {
+    // Таблица глаголов сервера. Новый ответ сервера = новая строка здесь и его обработчик
+    static constexpr std::pair<std::string_view, Handler> kEntries[] = {
+        { "CAPS",                  &Session::onCapabilities },
+        { "OK_LOGIN",              &Session::onLoggedIn },
+        { "OK_REGISTERED",         &Session::onLoggedIn },
+        { "OK_LOGOUT",             &Session::onLoggedOut },
+        { "OK_GROUP_CREATED",      &Session::onGroupCreated },
+        { "OK_JOINED_GROUP",       &Session::onJoinedGroup },
+        { "OK_SENT",               &Session::onPrivateMessageSent },
+        { "OK_GROUP_MSG_SENT",     &Session::onGroupMessageSent },
+        { "HISTORY_START",         &Session::onHistoryStart },
+        { "HIST_MSG",              &Session::onHistoryMessage },
+        { "HISTORY_END",           &Session::onHistoryEnd },
+        { "NO_HISTORY",            &Session::onNoHistory },
+        { "GROUP_HISTORY_START",   &Session::onGroupHistoryStart },
+        { "GROUP_HIST_MSG",        &Session::onGroupHistoryMessage },
+        { "GROUP_HISTORY_END",     &Session::onGroupHistoryEnd },
+        { "NO_GROUP_HISTORY",      &Session::onNoGroupHistory },
+        { "MSG_FROM",              &Session::onPrivateMessage },
+        { "GROUP_MSG_FROM",        &Session::onGroupMessage },
+        { "USER_JOINED_GROUP",     &Session::onUserJoinedGroup },
+        { "INFO_ADDED_TO_GROUP",   &Session::onUserJoinedGroup },
+        { "FRIEND_LIST_START",     &Session::onFriendListStart },
+        { "FRIEND",                &Session::onFriend },
+        { "FRIEND_LIST_END",       &Session::onFriendListEnd },
+        { "NO_FRIENDS_FOUND",      &Session::onNoFriendsFound },
+        { "MY_GROUPS_START",       &Session::onMyGroupsStart },
+        { "MY_GROUP_ENTRY",        &Session::onMyGroupEntry },
+        { "MY_GROUPS_END",         &Session::onMyGroupsEnd },
+        { "NO_GROUPS_JOINED",      &Session::onNoGroupsJoined },
+    };
+    static constexpr auto kHandlers = makeVerbTable(kEntries);
+
+    TRACE_SCOPE("dispatch");
+    m_metrics.countReceived(line.prefix);
+    Handler handler = kHandlers.find(line.prefix);
+    if (!handler) handler = startsWith(line.prefix, "ERROR_") ? &Session::onServerError : &Session::onUnknownResponse; // Все ERROR_*
+    (this->*handler)(line);
+}
+
+// Время от отправки запроса до ответа на него
+void Session::recordResponseTime(LatencyMetric metric, const PendingRequest& request) {
+    m_metrics.recordLatency(metric, std::chrono::steady_clock::now() - request.sent);
+}
+
+// --- Обработчики ответов сервера ---
+
+void Session::onUnknownResponse(const ServerLine& line) {
+    std::string text;
+    m_listener->onUnknownLine(serverText(line, text), idle()); // Простой - на момент приема, а не вывода
+}
+
+// Сервер отвечает по порядку, поэтому ERROR_* относится к самому старому запросу без ответа
+void Session::onServerError(const ServerLine& line) {
+    std::optional<PendingRequest> request = m_requests.takeOldest();
+    bool wanted = request && request->older && olderPageFailed(); // Страница, которую ждет пользователь
+    if (request && request->quiet && !wanted) return; // Фоновый запрос (например, HELLO у старого сервера)
+    // Не открылась беседа (не найдена, нет доступа) - даже если уже показана из кэша
+    bool closed = request && isConversationOfRequest(*request);
+    if (closed) leaveConversation();
+    std::string text;
+    m_listener->onError(serverText(line, text), request ? &*request : nullptr, closed);
+}
+
+// Ответ на HELLO: список поддерживаемых сервером расширений протокола
+void Session::onCapabilities(const ServerLine& line) {
+    if (std::optional<PendingRequest> request = m_requests.take(RequestKind::Hello)) recordResponseTime(LatencyMetric::Handshake, *request);
+    uint32_t caps = parseCapabilities(line.payload);
+    m_serverCaps = caps;
+    if (!(caps & kCapBinaryFrames) || m_framesIn) return;
+    startFrames();
+    m_compressedIn = (caps & kCapCompressedStreams) != 0;
+}
+
+void Session::onLoggedIn(const ServerLine& line) {
+    m_requests.take(RequestKind::Login);
+    std::string username(line.frame ? line.payload : parseWelcomeUsername(line.message));
+    if (username.empty()) username = "User"; // Fallback
+    Conversation reopen;
+    {
+        std::lock_guard<std::mutex> lock(m_stateMutex);
+        if (m_pendingLogin) {
+            // Беседу после разрыва открываем только той же учетной записи
+            bool sameUser = m_resumeLogin && m_resumeLogin->username == m_pendingLogin->username;
+            if (sameUser) reopen = std::move(m_resumeConversation);
+            m_resumeLogin = std::move(m_pendingLogin);
+            m_pendingLogin.reset();
+        }
+        m_resumeConversation = Conversation();
+    }
+    setLoggedIn(username);
+    m_listener->onLoggedIn(username);
+    if (!reopen.name.empty()) openConversation(reopen.kind, std::move(reopen.name));
+}
+
+void Session::onLoggedOut(const ServerLine& line) {
+    static constexpr std::string_view kGoodbye = "OK_LOGOUT Goodbye, ";
+    const std::string& current = m_loopState.get().username; // Снимок до resetLogin() ниже
+    bool matches = line.frame ? line.payload == current
+        : startsWith(line.message, kGoodbye) && startsWith(line.message.substr(kGoodbye.size()), current);
+    if (current.empty() || !matches) {
+        onUnknownResponse(line);
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_stateMutex);
+        m_resumeLogin.reset();
+    }
+    resetLogin(); // Ответы на запросы прошлой учетной записи уже не нужны
+    resetStreams();
+    closeHistoryCache();
+    m_listener->onLoggedOut();
+}
+
+void Session::onGroupCreated(const ServerLine& line) {
+    m_requests.take(RequestKind::CreateGroup);
+    m_listener->onGroupCreated(line.payload);
+}
+
+void Session::onJoinedGroup(const ServerLine& line) {
+    m_requests.take(RequestKind::JoinGroup);
+    m_listener->onGroupJoined(line.payload);
+}
+
+// Подтверждения доставки закрывают слот запроса; время до них - задержка отправки
+void Session::onPrivateMessageSent(const ServerLine&) {
+    if (std::optional<PendingRequest> request = m_requests.take(RequestKind::SendPrivate)) recordResponseTime(LatencyMetric::SendAck, *request);
+}
+
+void Session::onGroupMessageSent(const ServerLine&) {
+    if (std::optional<PendingRequest> request = m_requests.take(RequestKind::SendGroup)) recordResponseTime(LatencyMetric::SendAck, *request);
+}
+
+// --- История (ждем *_START или NO_*_HISTORY на запрос из openConversation) ---
+
+void Session::beginHistory(const ServerLine& line, RequestKind kind, ConversationKind conversationKind) {
+    auto& stream = streamSlot(kind);
+    stream = m_requests.take(kind, line.payload);
+    if (!stream) return; // Историю не запрашивали - игнорируем
+    if (stream->older) { // Более ранняя страница: не в кэш (он - непрерывный конец истории), слушателю - в конце
+        m_olderRecords.clear();
+        streamEntries(kind) = 0;
+        return;
+    }
+    // Пользователь мог уйти из беседы, пока ответ шел
+    if (!activateConversation(conversationKind, line.payload)) { stream.reset(); return; }
+    openHistoryCache(conversationKind, line.payload, stream->delta);
+    m_historyWindow.reset(m_pageSize.load(), m_historyStore.records().size()); // Поток дописывается в конец кэша
+    streamEntries(kind) = 0;
+    m_listener->onHistoryBegin(conversationKind, line.payload, stream->delta ? HistorySource::ServerDelta : HistorySource::Server);
+}
+
+void Session::noHistory(const ServerLine& line, RequestKind kind, ConversationKind conversationKind) {
+    std::optional<PendingRequest> request = m_requests.take(kind, line.payload);
+    if (request && request->older) { // Раньше показанного ничего нет
+        m_olderRecords.clear();
+        finishOlderPage(conversationKind, line.payload);
+        return;
+    }
+    if (request) recordResponseTime(LatencyMetric::HistoryOpen, *request);
+    if (!request || !activateConversation(conversationKind, line.payload)) return;
+    HistorySource source = request->delta ? HistorySource::ServerDelta : HistorySource::Server;
+    if (!request->delta) { // Истории нет - кэш пуст
+        openHistoryCache(conversationKind, line.payload, false);
+        closeHistoryCache();
+    }
+    m_listener->onHistoryBegin(conversationKind, line.payload, source);
+    m_listener->onHistoryEnd(conversationKind, line.payload, source, 0);
+    m_historyWindow.reset(m_pageSize.load(), 0); // Пустое окно: без дельты - истории нет вовсе
+    finishOpening(conversationKind, line.payload, request->delta);
+}
+
+void Session::historyRecord(const ServerLine& line, RequestKind kind, ConversationKind conversationKind) {
+    const auto& stream = streamSlot(kind);
+    if (!stream || !m_loopState.get().conversation.isActive(conversationKind, stream->target)) return;
+    HistoryEntry entry;
+    std::string_view record = line.payload; // payload это: timestamp:sender:message_text
+    if (line.frame) { // Поля кадра: метка, отправитель, текст. В кэш - в виде строки HIST_MSG
+        entry = { line.arg(0), line.arg(1), line.arg(2) };
+        m_cacheRecord.clear();
+        m_cacheRecord.append(entry.timestamp).append(":").append(entry.sender).append(":").append(entry.text);
+        std::replace(m_cacheRecord.begin(), m_cacheRecord.end(), '\n', '\r');
+        record = m_cacheRecord;
+    }
+    else parseHistoryEntry(line.payload, entry);
+    ++streamEntries(kind);
+    if (stream->older) {
+        m_olderRecords.append(record).push_back('\n');
+        return;
+    }
+    if (!storeHistoryRecord(record)) { --streamEntries(kind); return; }
+    if (!m_historyWindow.capacity()) {
+        m_listener->onHistoryEntry(conversationKind, stream->target, entry);
+        return;
+    }
+    // Со страницами слушателю достанутся только последние записи - в endHistory. Вытесненная из окна
+    // уже не будет показана: о ней - onHistoryStored
+    if (m_historyWindow.full()) {
+        HistoryEntry evicted;
+        parseHistoryEntry(m_historyWindow.front(), evicted);
+        std::string multiline;
+        if (evicted.text.find('\r') != std::string_view::npos) { // Многострочное сообщение (см. historystore.h)
+            multiline.assign(evicted.text);
+            std::replace(multiline.begin(), multiline.end(), '\r', '\n');
+            evicted.text = multiline;
+        }
+        m_listener->onHistoryStored(conversationKind, stream->target, evicted);
+    }
+    m_historyWindow.push(record);
+}
+
+void Session::endHistory(const ServerLine& line, RequestKind kind, ConversationKind conversationKind) {
+    auto& stream = streamSlot(kind);
+    if (!stream || stream->target != line.payload) return;
+    if (stream->older) {
+        stream.reset();
+        finishOlderPage(conversationKind, line.payload);
+        return;
+    }
+    closeHistoryCache();
+    recordResponseTime(LatencyMetric::HistoryOpen, *stream);
+    if (m_historyWindow.capacity()) emitHistoryEntries(*m_listener, conversationKind, line.payload, m_historyWindow.records());
+    // Событие - до сброса слота: получатель еще видит, что история принимается
+    m_listener->onHistoryEnd(conversationKind, line.payload, stream->delta ? HistorySource::ServerDelta : HistorySource::Server, streamEntries(kind));
+    bool delta = stream->delta;
+    stream.reset();
+    finishOpening(conversationKind, line.payload, delta);
+}
+
+void Session::onHistoryStart(const ServerLine& line) { beginHistory(line, RequestKind::PrivateHistory, ConversationKind::Private); }
+void Session::onNoHistory(const ServerLine& line) { noHistory(line, RequestKind::PrivateHistory, ConversationKind::Private); }
+void Session::onHistoryMessage(const ServerLine& line) { historyRecord(line, RequestKind::PrivateHistory, ConversationKind::Private); }
+void Session::onHistoryEnd(const ServerLine& line) { endHistory(line, RequestKind::PrivateHistory, ConversationKind::Private); }
+void Session::onGroupHistoryStart(const ServerLine& line) { beginHistory(line, RequestKind::GroupHistory, ConversationKind::Group); }
+void Session::onNoGroupHistory(const ServerLine& line) { noHistory(line, RequestKind::GroupHistory, ConversationKind::Group); }
+void Session::onGroupHistoryMessage(const ServerLine& line) { historyRecord(line, RequestKind::GroupHistory, ConversationKind::Group); }
+void Session::onGroupHistoryEnd(const ServerLine& line) { endHistory(line, RequestKind::GroupHistory, ConversationKind::Group); }
+
+// --- Входящие сообщения ---
+
+void Session::onPrivateMessage(const ServerLine& line) {
+    ChatMessage message;
+    message.kind = ConversationKind::Private;
+    if (line.frame) { // Поля: отправитель, текст
+        message.conversation = message.sender = line.arg(0);
+        message.text = line.arg(1);
+        message.parsed = true;
+        message.conversationId = message.senderId = m_loopNames.intern(message.sender);
+        m_listener->onMessage(message);
+        return;
+    }
+    SenderText parsed; // payload это: sender_user: message_text
+    message.line = line.message;
+    message.body = line.payload;
+    message.parsed = parseSenderText(line.payload, parsed);
+    message.conversation = parsed.sender;
+    message.sender = parsed.sender;
+    message.text = parsed.text;
+    message.conversationId = message.senderId = m_loopNames.intern(message.sender);
+    m_listener->onMessage(message);
+}
+
+void Session::onGroupMessage(const ServerLine& line) {
+    if (line.frame) { // Поля: группа, отправитель, текст
+        ChatMessage message;
+        message.kind = ConversationKind::Group;
+        message.conversation = line.arg(0);
+        message.sender = line.arg(1);
+        message.text = line.arg(2);
+        message.parsed = true;
+        message.conversationId = m_loopNames.intern(message.conversation);
+        message.senderId = m_loopNames.intern(message.sender);
+        m_listener->onMessage(message);
+        return;
+    }
+    GroupMessage parsed = parseGroupMessage(line.payload); // payload это: groupNamePart sender_user: msg_text_part
+    ChatMessage message;
+    message.kind = ConversationKind::Group;
+    message.conversation = parsed.group;
+    message.sender = parsed.message.sender;
+    message.text = parsed.message.text;
+    message.line = line.message;
+    message.body = parsed.senderAndText;
+    message.parsed = parsed.hasMessage;
+    message.conversationId = m_loopNames.intern(message.conversation);
+    message.senderId = m_loopNames.intern(message.sender);
+    m_listener->onMessage(message);
+}
+
+void Session::onUserJoinedGroup(const ServerLine& line) {
+    if (line.frame) { m_listener->onUserJoinedGroup(line.arg(0), line.arg(1)); return; }
+    auto [group, rest] = splitFirstWord(line.payload); // payload: <GroupName> <Username>
+    m_listener->onUserJoinedGroup(group, splitFirstWord(rest).first);
+}
+
+// --- Списки ---
+
+// Начало списка: слот запроса переходит в прием до *_END.
+// Список, о котором не просили (сервер прислал сам), тоже отдаем
+void Session::beginListStream(RequestKind kind) {
+    auto& stream = streamSlot(kind);
+    stream = m_requests.take(kind);
+    if (!stream) { stream.emplace(); stream->kind = kind; }
+    streamEntries(kind) = 0;
+}
+
+void Session::onFriendListStart(const ServerLine&) {
+    beginListStream(RequestKind::FriendList);
+    m_listener->onFriendListBegin();
+}
+
+void Session::onFriend(const ServerLine& line) {
+    if (!streamSlot(RequestKind::FriendList)) return;
+    ++streamEntries(RequestKind::FriendList);
+    if (line.frame) { m_listener->onFriend(line.arg(0), line.arg(1)); return; }
+    auto [name, rest] = splitFirstWord(line.payload); // payload: <имя> <статус>
+    m_listener->onFriend(name, splitFirstWord(rest).first);
+}
+
+void Session::onFriendListEnd(const ServerLine&) {
+    auto& stream = streamSlot(RequestKind::FriendList);
+    if (!stream) return;
+    stream.reset();
+    m_listener->onFriendListEnd(streamEntries(RequestKind::FriendList));
+}
+
+void Session::onNoFriendsFound(const ServerLine&) {
+    m_requests.take(RequestKind::FriendList);
+    m_listener->onFriendListBegin();
+    m_listener->onFriendListEnd(0);
+}
+
+void Session::onMyGroupsStart(const ServerLine&) {
+    beginListStream(RequestKind::GroupList);
+    m_listener->onGroupListBegin();
+}
+
+void Session::onMyGroupEntry(const ServerLine& line) {
+    if (!streamSlot(RequestKind::GroupList)) return;
+    ++streamEntries(RequestKind::GroupList);
+    m_listener->onGroupListEntry(line.payload);
+}
+
+void Session::onMyGroupsEnd(const ServerLine&) {
+    auto& stream = streamSlot(RequestKind::GroupList);
+    if (!stream) return;
+    stream.reset();
+    m_listener->onGroupListEnd(streamEntries(RequestKind::GroupList));
+}
+
+void Session::onNoGroupsJoined(const ServerLine&) {
+    m_requests.take(RequestKind::GroupList);
+    m_listener->onGroupListBegin();
+    m_listener->onGroupListEnd(0);
+}
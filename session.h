@@ -0,0 +1,309 @@
+﻿// session.h : одно соединение с сервером и состояние пользователя в нем.
+// Сокет, буферы, вход и открытая беседа принадлежат сессии, а не процессу, поэтому один процесс может
+// вести сколько угодно соединений. Своего потока у сессии нет: ее сокет обслуживает внешний цикл событий
+// (flush/receive/expireRequests - только из его потока), а команды и чтение состояния безопасны из любого
+// потока и не блокируются. Ответы сервера приходят в SessionListener.
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+
+#include "messengerclient.h"
+#include "historypage.h"
+#include "historystore.h"
+#include "linereader.h"
+#include "metrics.h"
+#include "nametable.h"
+#include "netutil.h"
+#include "protocol.h"
+#include "requesttracker.h"
+#include "sendqueue.h"
+#include "sessionlistener.h"
+#include "snapshot.h"
+#include "streamcodec.h"
+
+class EventLoop;
+
+// Беседа, которую пользователь открыл или открывает
+struct Conversation {
+    ConversationKind kind = ConversationKind::Private;
+    std::string name;    // Собеседник или группа; пусто - беседы нет
+    bool active = false; // История показана, ввод уходит в беседу
+    NameId id = kNoName; // Номер name в NameTable сессии
+
+    // Это беседа kind/name (открытая или открывающаяся)
+    bool is(ConversationKind otherKind, std::string_view otherName) const { return kind == otherKind && !name.empty() && name == otherName; }
+    bool isActive(ConversationKind otherKind, std::string_view otherName) const { return active && is(otherKind, otherName); }
+    // То же по номеру имени (ChatMessage::conversationId) - без сравнения строк
+    bool is(ConversationKind otherKind, NameId otherId) const { return kind == otherKind && id != kNoName && id == otherId; }
+    bool isActive(ConversationKind otherKind, NameId otherId) const { return active && is(otherKind, otherId); }
+};
+
+// Вход и беседа одним неизменяемым снимком: публикуется целиком при каждом переходе (вход, CHAT,
+// GROUPCHAT, /exit_chat, выход, разрыв), поэтому имя пользователя и беседа в нем всегда согласованы
+struct SessionState {
+    bool loggedIn = false;
+    std::string username;     // Пусто, если не вошли
+    NameId usernameId = kNoName;
+    Conversation conversation;
+};
+
+// Итог Session::showOlderHistory (/more)
+enum class OlderHistory {
+    Shown,     // Страница уже отдана слушателю (из кэша или подгруженная заранее)
+    Requested, // Запрошена у сервера: придет слушателю сессии
+    NoMore,    // Раньше ничего нет (или страниц нет вовсе: historyPageSize() == 0)
+    Busy       // Беседа еще открывается - граница показанного не известна
+};
+
+class Session {
+public:
+    Session() = default;
+    ~Session();
+    Session(const Session&) = delete;
+    Session& operator=(const Session&) = delete;
+
+    // Получатель событий (nullptr - события отбрасываются). Менять, пока цикл событий не обслуживает сессию
+    void setListener(SessionListener* listener) { m_listener = listener ? listener : &m_nullListener; }
+
+    // --- Соединение ---
+    // Подключение не дольше timeout; дальше сокет неблокирующий. При ошибке код - в errorCode
+    bool connect(const std::string& host, unsigned short port, int& errorCode, std::chrono::milliseconds timeout = kConnectTimeout);
+    // Закрывает сокет и сбрасывает все, что относилось к соединению: очередь, буфер, запросы, вход.
+    // Учетные данные и открытая беседа запоминаются для resume()
+    void disconnect();
+    bool connected() const { return m_socket.load() != INVALID_SOCKET_VALUE; }
+    SocketType socket() const { return m_socket.load(); }
+    // Цикл событий, обслуживающий сокет: его будят, когда в пустую очередь попадает сообщение
+    void setEventLoop(EventLoop* eventLoop) { m_eventLoop.store(eventLoop); }
+
+    // --- Поток цикла событий ---
+    FlushStatus flush() { return m_sendQueue.flush(m_socket.load()); }
+    // Один recv() и разбор всех пришедших строк в события. NeedMore - соединение живо,
+    // Closed/Error - сервер отключился (закрыть соединение должен вызывающий)
+    ReadStatus receive();
+    // Сообщает о запросах, оставшихся без ответа к now
+    void expireRequests(std::chrono::steady_clock::time_point now);
+    // Миллисекунд до ближайшего таймаута запроса (-1 - ждать нечего)
+    int msUntilNextDeadline(std::chrono::steady_clock::time_point now) const { return m_requests.msUntilNextDeadline(now); }
+
+    // --- Команды (любой поток, без блокировки). false - нет соединения ---
+    bool hello(); // Согласование расширений протокола, "тихий" запрос
+    bool login(std::string_view username, std::string_view password);
+    bool registerUser(std::string_view username, std::string_view password);
+    bool logout();
+    bool requestFriendList(bool quiet = false);
+    bool requestGroupList(bool quiet = false);
+    bool createGroup(std::string_view group);
+    bool joinGroup(std::string_view group);
+    bool sendPrivate(std::string_view to, std::string_view text);
+    bool sendGroup(std::string_view group, std::string_view text);
+    // Открывает беседу: сохраненная история отдается сразу (HistorySource::Cache, в вызывающем потоке) -
+    // тогда беседа активна и в нее можно писать, затем у сервера запрашивается недостающее.
+    // cacheListener - получатель истории из кэша, если слушатель сессии - очередь другого потока
+    bool openConversation(ConversationKind kind, std::string name, SessionListener* cacheListener = nullptr);
+    // Покидает беседу, возвращает ее имя
+    std::string leaveConversation();
+
+    // --- Страницы истории ---
+    // Сколько последних записей показывать при открытии беседы и в каждой более ранней странице.
+    // 0 (по умолчанию) - история целиком. В кэш с сервера все равно сохраняется все, что пришло, а записи,
+    // не вошедшие в страницу, получает SessionListener::onHistoryStored
+    void setHistoryPageSize(size_t records) { m_pageSize = records; }
+    size_t historyPageSize() const { return m_pageSize.load(); }
+    // Страница раньше показанной в открытой беседе (HistorySource::Older). Из кэша или подгруженная заранее
+    // отдается сразу в вызывающем потоке (в cacheListener, как в openConversation), иначе запрашивается у
+    // сервера с history_pages. Следующая страница сервера после этого подгружается в фоне
+    OlderHistory showOlderHistory(SessionListener* cacheListener = nullptr);
+    // Копия всех записей кэша беседы (например, для индекса поиска). false - кэша нет.
+    // Файлы кэша читаются только через Session: полная история с сервера обрезает их в потоке цикла
+    bool copyHistoryCache(ConversationKind kind, std::string_view name, std::string& records);
+
+    // --- Восстановление после разрыва ---
+    // Вход, которого не отменял logout(), можно повторить на новом соединении
+    bool canResume() const;
+    std::string resumeUsername() const;
+    // Повторный вход с данными последнего успешного входа. После OK_LOGIN беседа, открытая в момент
+    // разрыва, открывается снова: кэш сразу, с сервера - только новое. false - нечего восстанавливать
+    bool resume();
+
+    RequestTracker& requests() { return m_requests; }
+    // Счетчики и задержки соединения (сохраняются между переподключениями); читать можно из любого потока
+    Metrics& metrics() { return m_metrics; }
+    const Metrics& metrics() const { return m_metrics; }
+    const SendQueue& sendQueue() const { return m_sendQueue; }
+
+    // Расширения протокола (ServerCapability), согласованные через HELLO
+    uint32_t serverCaps() const { return m_serverCaps.load(); }
+    // Команды уходят двоичными кадрами (сервер согласовал binary_frames)
+    bool sendsFrames() const;
+
+    // --- Состояние (любой поток) ---
+    // Согласованный снимок входа и беседы. Поля читаются из одного снимка, а не отдельными вызовами ниже
+    std::shared_ptr<const SessionState> state() const { return m_state.load(); }
+    // Для кода, читающего состояние на каждом событии: SnapshotReader<SessionState> над ней не блокируется,
+    // пока состояние не меняется
+    const SnapshotCell<SessionState>& stateCell() const { return m_state; }
+    // Номера имен в ChatMessage и SessionState (сохраняются между переподключениями)
+    const NameTable& names() const { return m_names; }
+
+    // --- Вход ---
+    bool loggedIn() const { return m_state.load()->loggedIn; }
+    std::string username() const { return m_state.load()->username; }
+    // Выход из учетной записи без ответа сервера: сбрасывает вход, беседу и запросы
+    // и будит ждущих в waitForLogout()
+    void resetLogin();
+    // Ждет сброса входа (подтверждение LOGOUT, разрыв). false - таймаут
+    bool waitForLogout(std::chrono::milliseconds timeout);
+
+    // --- Беседа ---
+    Conversation conversation() const;
+    bool inConversation() const;
+    // Беседа kind/name - та, что открыта или открывается сейчас
+    bool isConversation(ConversationKind kind, std::string_view name) const;
+    bool isActiveConversation(ConversationKind kind, std::string_view name) const;
+
+private:
+    using Handler = void (Session::*)(const ServerLine&);
+    // Команда: глагол и аргументы. В тексте - через пробел, в кадре - по полю на каждый
+    using Command = std::initializer_list<std::string_view>;
+
+    struct Credentials {
+        std::string username;
+        std::string password;
+    };
+
+    // Ставит команду в очередь отправки строкой или кадром - как согласовано с сервером
+    bool send(Command command);
+    // Команда, на которую сервер ответит: слот ответа занимается до постановки в очередь
+    bool request(RequestKind kind, Command command, std::string target = {}, bool delta = false, bool quiet = false,
+        std::chrono::milliseconds timeout = RequestTracker::kDefaultTimeout);
+    bool sendCredentials(RequestKind kind, std::string_view verb, std::string_view username, std::string_view password);
+    // Переход на кадры после CAPS с binary_frames (поток цикла событий)
+    void startFrames();
+
+    void dispatch(const ServerLine& line);
+    void dispatchLine(std::string_view message);
+    void dispatchFrame(std::string_view body);
+    std::optional<PendingRequest>& streamSlot(RequestKind kind) { return m_streams[static_cast<size_t>(kind)]; }
+    const std::optional<PendingRequest>& streamSlot(RequestKind kind) const { return m_streams[static_cast<size_t>(kind)]; }
+    size_t& streamEntries(RequestKind kind) { return m_streamEntries[static_cast<size_t>(kind)]; }
+    void resetStreams();
+    void setLoggedIn(std::string username);
+    bool activateConversation(ConversationKind kind, std::string_view name);
+    bool isConversationOfRequest(const PendingRequest& request) const;
+    // Не открыта беседа, нет запросов без ответа и незаконченных списков/истории (поток цикла событий)
+    bool idle() const;
+
+    // Страницы истории. Курсор, подгруженная страница и флаги запроса - под m_pageMutex
+    size_t emitHistoryEntries(SessionListener& listener, ConversationKind kind, std::string_view name, std::string_view records);
+    void emitOlderPage(SessionListener& listener, ConversationKind kind, std::string_view name, std::string_view records);
+    bool requestOlderPage(const Conversation& conversation, size_t pageSize);
+    void prefetchOlderPage();
+    void finishOlderPage(ConversationKind kind, std::string_view name);
+    // Ответ на открытие беседы принят: граница показанного известна, можно подгружать раньше
+    void finishOpening(ConversationKind kind, std::string_view name, bool delta);
+    // Запрос более ранней страницы не удался: true - ее ждет пользователь (ошибку нужно показать)
+    bool olderPageFailed();
+
+    // Кэш истории (только поток цикла событий)
+    void openHistoryCache(ConversationKind kind, std::string_view name, bool delta);
+    bool storeHistoryRecord(std::string_view record);
+    void closeHistoryCache();
+
+    // Обработчики ответов сервера
+    void onUnknownResponse(const ServerLine& line);
+    void onServerError(const ServerLine& line);
+    void onCapabilities(const ServerLine& line);
+    void onLoggedIn(const ServerLine& line);
+    void onLoggedOut(const ServerLine& line);
+    void onGroupCreated(const ServerLine& line);
+    void onJoinedGroup(const ServerLine& line);
+    void onPrivateMessageSent(const ServerLine& line);
+    void onGroupMessageSent(const ServerLine& line);
+    void onHistoryStart(const ServerLine& line);
+    void onNoHistory(const ServerLine& line);
+    void onHistoryMessage(const ServerLine& line);
+    void onHistoryEnd(const ServerLine& line);
+    void onGroupHistoryStart(const ServerLine& line);
+    void onNoGroupHistory(const ServerLine& line);
+    void onGroupHistoryMessage(const ServerLine& line);
+    void onGroupHistoryEnd(const ServerLine& line);
+    void onPrivateMessage(const ServerLine& line);
+    void onGroupMessage(const ServerLine& line);
+    void onUserJoinedGroup(const ServerLine& line);
+    void onFriendListStart(const ServerLine& line);
+    void onFriend(const ServerLine& line);
+    void onFriendListEnd(const ServerLine& line);
+    void onNoFriendsFound(const ServerLine& line);
+    void onMyGroupsStart(const ServerLine& line);
+    void onMyGroupEntry(const ServerLine& line);
+    void onMyGroupsEnd(const ServerLine& line);
+    void onNoGroupsJoined(const ServerLine& line);
+
+    void beginHistory(const ServerLine& line, RequestKind kind, ConversationKind conversationKind);
+    void noHistory(const ServerLine& line, RequestKind kind, ConversationKind conversationKind);
+    void historyRecord(const ServerLine& line, RequestKind kind, ConversationKind conversationKind);
+    void endHistory(const ServerLine& line, RequestKind kind, ConversationKind conversationKind);
+    void beginListStream(RequestKind kind);
+    void recordResponseTime(LatencyMetric metric, const PendingRequest& request);
+
+    SessionListener m_nullListener;
+    SessionListener* m_listener = &m_nullListener;
+
+    std::atomic<SocketType> m_socket{ INVALID_SOCKET_VALUE };
+    std::atomic<EventLoop*> m_eventLoop{ nullptr };
+    SendQueue m_sendQueue;
+    LineReader m_reader;
+    RequestTracker m_requests;
+    Metrics m_metrics;
+    std::atomic<uint32_t> m_serverCaps{ 0 };
+    mutable std::mutex m_sendMutex; // Кодировка команды и ее место в очереди - по одну сторону от перехода на кадры
+    bool m_framesOut = false;       // Под m_sendMutex: команды уходят кадрами
+
+    // Разбор входящего потока (только поток цикла событий)
+    bool m_framesIn = false;     // Сервер шлет кадры, а не строки
+    bool m_compressedIn = false; // Записи истории и списков приходят сжатыми
+    std::array<StreamDecoder, kCompressedStreamCount> m_streamDecoders;
+    std::string m_cacheRecord;   // Запись кэша из кадра истории (память переиспользуется)
+    // Ответы-потоки (*_START .. *_END), принимаемые сейчас: по слоту на вид запроса
+    std::array<std::optional<PendingRequest>, kRequestKindCount> m_streams;
+    HistoryStore m_historyStore; // Кэш беседы, история которой принимается
+    bool m_historyDelta = false; // Сервер шлет только новые сообщения - дописываем кэш, а не перезаписываем
+    std::array<size_t, kRequestKindCount> m_streamEntries{}; // Записей, принятых в каждом потоке
+    HistoryWindow m_historyWindow; // Последние m_pageSize записей принимаемой истории
+    std::string m_olderRecords;    // Принимаемая более ранняя страница
+
+    std::atomic<size_t> m_pageSize{ 0 };
+    std::mutex m_pageMutex;
+    HistoryCursor m_pageCursor;     // Граница показанного в открытой беседе
+    std::string m_prefetched;       // Следующая более ранняя страница, уже принятая с сервера
+    bool m_prefetchedReady = false;
+    bool m_opening = false;         // Ответ на открытие беседы еще не пришел
+    bool m_olderInFlight = false;   // Запрос более ранней страницы ждет ответа
+    bool m_olderWanted = false;     // ... и ее ждет пользователь
+    size_t m_olderRequested = 0;    // Сколько записей в нем запрошено
+    uint64_t m_pageGeneration = 0;  // Растет с каждым openConversation: ответ для прежней беседы не нужен
+    uint64_t m_olderGeneration = 0; // Поколение, для которого запрошена страница
+
+    mutable std::mutex m_stateMutex; // Писатели m_state и учетные данные; пара для m_loginChanged
+    std::condition_variable m_loginChanged;
+    SnapshotCell<SessionState> m_state;             // Пишется только под m_stateMutex
+    mutable SnapshotReader<SessionState> m_loopState{ m_state }; // Снимок для разбора ответов (поток цикла событий)
+    NameTable m_names;
+    NameCache m_loopNames{ m_names }; // Имена входящих сообщений (поток цикла событий)
+    std::optional<Credentials> m_pendingLogin; // Отправленный LOGIN/REGISTRATION, ждущий ответа
+    std::optional<Credentials> m_resumeLogin;  // Последний успешный вход (до logout())
+    Conversation m_resumeConversation;         // Беседа, открытая в момент разрыва
+};
@@ -0,0 +1,430 @@
+﻿#include "sessionevents.h"
+
+#include <array>
+#include <functional> // std::less_equal
+#include <memory_resource>
+#include <string>
+#include <utility>    // std::move
+#include <vector>
+
+enum class SessionEventQueue::EventType : uint8_t {
+    LoggedIn, LoggedOut, Disconnected, Connected, ConnectFailed, SendError, EventLoopError, Message, HistoryBegin, HistoryEntry, HistoryEnd, HistoryStored,
+    FriendListBegin, Friend, FriendListEnd, GroupListBegin, GroupListEntry, GroupListEnd,
+    GroupCreated, GroupJoined, UserJoinedGroup, Error, RequestTimeout, UnknownLine, LineTooLong,
+    Dropped // Уведомление о переполнении (onEventsDropped)
+};
+
+namespace {
+
+// Строка события - отрезок общего буфера слота
+struct Span {
+    uint32_t offset = 0;
+    uint32_t length = 0;
+};
+
+// Буфер слота больше этого после чтения освобождается: одно длинное сообщение не держит память навсегда
+constexpr size_t kSlotKeepBytes = 4096;
+// Столько буфер слота получает при первом использовании: обычное сообщение помещается сразу, и слот
+// не дорастает до своей длины несколькими выделениями за несколько кругов кольца
+constexpr size_t kSlotReserveBytes = 256;
+
+bool contains(std::string_view base, std::string_view part) {
+    std::less_equal<const char*> lessEqual;
+    return !base.empty() && lessEqual(base.data(), part.data()) && lessEqual(part.data() + part.size(), base.data() + base.size());
+}
+
+} // namespace
+
+// Копия вызова слушателя. Строки лежат подряд в data; части строки сервера (отправитель и текст
+// MSG_FROM) ссылаются внутрь уже скопированной строки, а не копируются второй раз
+struct SessionEventQueue::Event {
+    EventType type = EventType::LoggedOut;
+    ConversationKind kind = ConversationKind::Private;
+    HistorySource source = HistorySource::Server;
+    bool flag = false;       // ChatMessage::parsed, conversationClosed или idle
+    bool hasRequest = false; // onError: request не nullptr
+    size_t count = 0;        // entries, count, maxLength, число отброшенных, retryIn в мс
+    int code = 0;            // Код ошибки сокета (onConnectFailed, onSendError, onEventLoopError)
+    std::array<NameId, 2> names{}; // ChatMessage::conversationId и senderId
+    std::pmr::string data;         // Слот кольца - обычная куча, запасной буфер - арена
+    std::array<Span, 5> spans;
+    PendingRequest request;
+    Clock::time_point receivedAt;
+
+    Event() = default;
+    explicit Event(std::pmr::memory_resource* resource) : data(resource) {}
+
+    void begin(EventType eventType, Clock::time_point received) {
+        type = eventType;
+        data.clear();
+        spans.fill(Span{});
+        receivedAt = received;
+    }
+    void pack(size_t index, std::string_view value) {
+        spans[index] = { static_cast<uint32_t>(data.size()), static_cast<uint32_t>(value.size()) };
+        data.append(value);
+    }
+    // value - часть уже упакованной строки base (index baseIndex) или отдельная строка
+    void packWithin(size_t index, std::string_view value, std::string_view base, size_t baseIndex) {
+        if (!contains(base, value)) { pack(index, value); return; }
+        spans[index] = { spans[baseIndex].offset + static_cast<uint32_t>(value.data() - base.data()), static_cast<uint32_t>(value.size()) };
+    }
+    std::string_view view(size_t index) const {
+        return std::string_view(data).substr(spans[index].offset, spans[index].length);
+    }
+    // Сколько событие занимает в запасном буфере (для kOverflowLimitBytes)
+    size_t footprint() const { return sizeof(Event) + data.size(); }
+};
+
+// Кусок запасного буфера: строки его событий - в его арене (объявлена раньше - разрушается позже)
+struct SessionEventQueue::OverflowChunk {
+    std::pmr::monotonic_buffer_resource arena;
+    std::vector<Event> events; // [head, size) ждут места в кольце
+    size_t head = 0;
+};
+
+SessionEventQueue::SessionEventQueue(size_t capacity) : m_ring(std::make_unique<SpscRing<Event>>(capacity)) {}
+
+SessionEventQueue::~SessionEventQueue() = default;
+
+// Место для события: слот кольца или, если кольцо полно (или в запасном буфере уже кто-то ждет), запасной
+// буфер. nullptr - запасной буфер исчерпан и событие отброшено; bulk - сообщения и история, только их
+SessionEventQueue::Event* SessionEventQueue::claim(EventType type, bool bulk) {
+    refill();
+    bool spill = !m_overflow.empty() || m_ring->freeSlots() == 0;
+    if (spill && bulk && m_overflowBytes.load(std::memory_order_relaxed) >= kOverflowLimitBytes) {
+        ++m_dropPending;
+        m_dropped.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+    }
+    if (m_dropPending > 0) { // Сначала - сколько пропущено перед этим событием
+        pushDropNotice();
+        spill = !m_overflow.empty() || m_ring->freeSlots() == 0;
+    }
+    Event* event;
+    if (spill) {
+        if (m_overflow.empty() || m_overflow.back()->events.size() == kOverflowChunkEvents) {
+            m_overflow.push_back(m_spareChunk ? std::move(m_spareChunk) : std::make_unique<OverflowChunk>());
+        }
+        OverflowChunk& chunk = *m_overflow.back();
+        event = &chunk.events.emplace_back(&chunk.arena);
+    }
+    else {
+        event = m_ring->claim();
+        if (event->data.capacity() < kSlotReserveBytes) event->data.reserve(kSlotReserveBytes);
+    }
+    m_claimedOverflow = spill;
+    event->begin(type, m_receivedAt);
+    return event;
+}
+
+void SessionEventQueue::pushDropNotice() {
+    size_t count = m_dropPending;
+    m_dropPending = 0;
+    Event* notice = claim(EventType::Dropped, false);
+    notice->count = count;
+    publish();
+}
+
+void SessionEventQueue::publish() {
+    m_queued.fetch_add(1, std::memory_order_relaxed);
+    if (!m_claimedOverflow) { publishToRing(); return; }
+    m_spilled.fetch_add(1, std::memory_order_relaxed);
+    size_t bytes = m_overflowBytes.load(std::memory_order_relaxed) + m_overflow.back()->events.back().footprint();
+    m_overflowBytes.store(bytes, std::memory_order_relaxed);
+    if (bytes > m_maxOverflowBytes.load(std::memory_order_relaxed)) m_maxOverflowBytes.store(bytes, std::memory_order_relaxed);
+    m_overflowing.store(true, std::memory_order_release);
+}
+
+void SessionEventQueue::publishToRing() {
+    m_ring->publish();
+    ++m_published;
+    size_t depth = m_ring->size();
+    if (depth > m_maxDepth.load(std::memory_order_relaxed)) m_maxDepth.store(depth, std::memory_order_relaxed);
+}
+
+void SessionEventQueue::refill() {
+    if (m_overflow.empty()) return;
+    while (!m_overflow.empty()) {
+        OverflowChunk& chunk = *m_overflow.front();
+        while (chunk.head < chunk.events.size()) {
+            Event* slot = m_ring->claim();
+            if (!slot) return;
+            Event& event = chunk.events[chunk.head++];
+            m_overflowBytes.store(m_overflowBytes.load(std::memory_order_relaxed) - event.footprint(), std::memory_order_relaxed);
+            *slot = std::move(event); // Аллокаторы разные: строка копируется в буфер слота, а не забирается
+            publishToRing();
+        }
+        // Кусок перешел в кольцо целиком: все его строки - одним освобождением арены
+        std::unique_ptr<OverflowChunk> done = std::move(m_overflow.front());
+        m_overflow.pop_front();
+        done->events.clear();
+        done->arena.release();
+        done->head = 0;
+        m_spareChunk = std::move(done);
+    }
+    m_overflowing.store(false, std::memory_order_release);
+}
+
+void SessionEventQueue::onLoggedIn(std::string_view username) {
+    Event* event = claim(EventType::LoggedIn, false);
+    if (!event) return;
+    event->pack(0, username);
+    publish();
+}
+
+void SessionEventQueue::onLoggedOut() {
+    if (claim(EventType::LoggedOut, false)) publish();
+}
+
+void SessionEventQueue::onDisconnected() {
+    if (claim(EventType::Disconnected, false)) publish();
+}
+
+void SessionEventQueue::onConnected(std::string_view endpoint, std::string_view resumeUsername) {
+    Event* event = claim(EventType::Connected, false);
+    if (!event) return;
+    event->pack(0, endpoint);
+    event->pack(1, resumeUsername);
+    publish();
+}
+
+void SessionEventQueue::onConnectFailed(std::string_view endpoint, int errorCode, std::chrono::milliseconds retryIn) {
+    Event* event = claim(EventType::ConnectFailed, false);
+    if (!event) return;
+    event->pack(0, endpoint);
+    event->code = errorCode;
+    event->count = static_cast<size_t>(retryIn.count());
+    publish();
+}
+
+void SessionEventQueue::onSendError(int errorCode) {
+    Event* event = claim(EventType::SendError, false);
+    if (!event) return;
+    event->code = errorCode;
+    publish();
+}
+
+void SessionEventQueue::onEventLoopError(int errorCode) {
+    Event* event = claim(EventType::EventLoopError, false);
+    if (!event) return;
+    event->code = errorCode;
+    publish();
+}
+
+void SessionEventQueue::onMessage(const ChatMessage& message) {
+    Event* event = claim(EventType::Message, true);
+    if (!event) return;
+    event->kind = message.kind;
+    event->flag = message.parsed;
+    event->pack(0, message.line);
+    event->packWithin(1, message.body, message.line, 0);
+    event->packWithin(2, message.sender, message.line, 0);
+    event->packWithin(3, message.text, message.line, 0);
+    event->packWithin(4, message.conversation, message.line, 0);
+    event->names = { message.conversationId, message.senderId };
+    publish();
+}
+
+void SessionEventQueue::onHistoryBegin(ConversationKind kind, std::string_view name, HistorySource source) {
+    Event* event = claim(EventType::HistoryBegin, false);
+    if (!event) return;
+    event->kind = kind;
+    event->source = source;
+    event->pack(0, name);
+    publish();
+}
+
+void SessionEventQueue::onHistoryEntry(ConversationKind kind, std::string_view name, const HistoryEntry& entry) {
+    pushHistoryEntry(EventType::HistoryEntry, kind, name, entry);
+}
+
+void SessionEventQueue::onHistoryStored(ConversationKind kind, std::string_view name, const HistoryEntry& entry) {
+    pushHistoryEntry(EventType::HistoryStored, kind, name, entry);
+}
+
+void SessionEventQueue::pushHistoryEntry(EventType type, ConversationKind kind, std::string_view name, const HistoryEntry& entry) {
+    Event* event = claim(type, true);
+    if (!event) return;
+    event->kind = kind;
+    event->pack(0, name);
+    event->pack(1, entry.timestamp);
+    event->pack(2, entry.sender);
+    event->pack(3, entry.text);
+    publish();
+}
+
+void SessionEventQueue::onHistoryEnd(ConversationKind kind, std::string_view name, HistorySource source, size_t entries) {
+    Event* event = claim(EventType::HistoryEnd, false);
+    if (!event) return;
+    event->kind = kind;
+    event->source = source;
+    event->count = entries;
+    event->pack(0, name);
+    publish();
+}
+
+void SessionEventQueue::onFriendListBegin() {
+    if (claim(EventType::FriendListBegin, false)) publish();
+}
+
+void SessionEventQueue::onFriend(std::string_view name, std::string_view status) {
+    Event* event = claim(EventType::Friend, false);
+    if (!event) return;
+    event->pack(0, name);
+    event->pack(1, status);
+    publish();
+}
+
+void SessionEventQueue::onFriendListEnd(size_t count) {
+    Event* event = claim(EventType::FriendListEnd, false);
+    if (!event) return;
+    event->count = count;
+    publish();
+}
+
+void SessionEventQueue::onGroupListBegin() {
+    if (claim(EventType::GroupListBegin, false)) publish();
+}
+
+void SessionEventQueue::onGroupListEntry(std::string_view group) {
+    Event* event = claim(EventType::GroupListEntry, false);
+    if (!event) return;
+    event->pack(0, group);
+    publish();
+}
+
+void SessionEventQueue::onGroupListEnd(size_t count) {
+    Event* event = claim(EventType::GroupListEnd, false);
+    if (!event) return;
+    event->count = count;
+    publish();
+}
+
+void SessionEventQueue::onGroupCreated(std::string_view group) {
+    Event* event = claim(EventType::GroupCreated, false);
+    if (!event) return;
+    event->pack(0, group);
+    publish();
+}
+
+void SessionEventQueue::onGroupJoined(std::string_view group) {
+    Event* event = claim(EventType::GroupJoined, false);
+    if (!event) return;
+    event->pack(0, group);
+    publish();
+}
+
+void SessionEventQueue::onUserJoinedGroup(std::string_view group, std::string_view user) {
+    Event* event = claim(EventType::UserJoinedGroup, false);
+    if (!event) return;
+    event->pack(0, group);
+    event->pack(1, user);
+    publish();
+}
+
+void SessionEventQueue::onError(std::string_view message, const PendingRequest* request, bool conversationClosed) {
+    Event* event = claim(EventType::Error, false);
+    if (!event) return;
+    event->pack(0, message);
+    event->hasRequest = request != nullptr;
+    if (request) event->request = *request;
+    event->flag = conversationClosed;
+    publish();
+}
+
+void SessionEventQueue::onRequestTimeout(const PendingRequest& request, bool conversationClosed) {
+    Event* event = claim(EventType::RequestTimeout, false);
+    if (!event) return;
+    event->request = request;
+    event->flag = conversationClosed;
+    publish();
+}
+
+void SessionEventQueue::onUnknownLine(std::string_view line, bool idle) {
+    Event* event = claim(EventType::UnknownLine, false);
+    if (!event) return;
+    event->pack(0, line);
+    event->flag = idle;
+    publish();
+}
+
+void SessionEventQueue::onLineTooLong(size_t maxLength) {
+    Event* event = claim(EventType::LineTooLong, false);
+    if (!event) return;
+    event->count = maxLength;
+    publish();
+}
+
+size_t SessionEventQueue::drain(SessionListener& target, size_t maxEvents, Clock::time_point* oldestReceivedAt) {
+    size_t delivered = 0;
+    while (delivered < maxEvents) {
+        Event* event = m_ring->front();
+        if (!event) break;
+        if (delivered == 0 && oldestReceivedAt) *oldestReceivedAt = event->receivedAt;
+        switch (event->type) {
+        case EventType::LoggedIn: target.onLoggedIn(event->view(0)); break;
+        case EventType::LoggedOut: target.onLoggedOut(); break;
+        case EventType::Disconnected: target.onDisconnected(); break;
+        case EventType::Connected: target.onConnected(event->view(0), event->view(1)); break;
+        case EventType::ConnectFailed:
+            target.onConnectFailed(event->view(0), event->code, std::chrono::milliseconds(static_cast<long long>(event->count)));
+            break;
+        case EventType::SendError: target.onSendError(event->code); break;
+        case EventType::EventLoopError: target.onEventLoopError(event->code); break;
+        case EventType::Message: {
+            ChatMessage message;
+            message.kind = event->kind;
+            message.parsed = event->flag;
+            message.line = event->view(0);
+            message.body = event->view(1);
+            message.sender = event->view(2);
+            message.text = event->view(3);
+            message.conversation = event->view(4);
+            message.conversationId = event->names[0];
+            message.senderId = event->names[1];
+            target.onMessage(message);
+            break;
+        }
+        case EventType::HistoryBegin: target.onHistoryBegin(event->kind, event->view(0), event->source); break;
+        case EventType::HistoryEntry:
+            target.onHistoryEntry(event->kind, event->view(0), HistoryEntry{ event->view(1), event->view(2), event->view(3) });
+            break;
+        case EventType::HistoryEnd: target.onHistoryEnd(event->kind, event->view(0), event->source, event->count); break;
+        case EventType::HistoryStored:
+            target.onHistoryStored(event->kind, event->view(0), HistoryEntry{ event->view(1), event->view(2), event->view(3) });
+            break;
+        case EventType::FriendListBegin: target.onFriendListBegin(); break;
+        case EventType::Friend: target.onFriend(event->view(0), event->view(1)); break;
+        case EventType::FriendListEnd: target.onFriendListEnd(event->count); break;
+        case EventType::GroupListBegin: target.onGroupListBegin(); break;
+        case EventType::GroupListEntry: target.onGroupListEntry(event->view(0)); break;
+        case EventType::GroupListEnd: target.onGroupListEnd(event->count); break;
+        case EventType::GroupCreated: target.onGroupCreated(event->view(0)); break;
+        case EventType::GroupJoined: target.onGroupJoined(event->view(0)); break;
+        case EventType::UserJoinedGroup: target.onUserJoinedGroup(event->view(0), event->view(1)); break;
+        case EventType::Error: target.onError(event->view(0), event->hasRequest ? &event->request : nullptr, event->flag); break;
+        case EventType::RequestTimeout: target.onRequestTimeout(event->request, event->flag); break;
+        case EventType::UnknownLine: target.onUnknownLine(event->view(0), event->flag); break;
+        case EventType::LineTooLong: target.onLineTooLong(event->count); break;
+        case EventType::Dropped: target.onEventsDropped(event->count); break;
+        }
+        if (event->data.capacity() > kSlotKeepBytes) std::pmr::string().swap(event->data);
+        m_ring->pop();
+        ++delivered;
+    }
+    return delivered;
+}
+
+SessionEventQueueStats SessionEventQueue::stats() const {
+    SessionEventQueueStats stats;
+    stats.queued = m_queued.load(std::memory_order_relaxed);
+    stats.spilled = m_spilled.load(std::memory_order_relaxed);
+    stats.dropped = m_dropped.load(std::memory_order_relaxed);
+    stats.depth = m_ring->size();
+    stats.maxDepth = m_maxDepth.load(std::memory_order_relaxed);
+    stats.capacity = m_ring->capacity();
+    stats.overflowBytes = m_overflowBytes.load(std::memory_order_relaxed);
+    stats.maxOverflowBytes = m_maxOverflowBytes.load(std::memory_order_relaxed);
+    return stats;
+}
@@ -0,0 +1,127 @@
+﻿// sessionevents.h : события сессии через очередь - поток сети не ждет поток вывода.
+// SessionEventQueue ставится слушателем сессии: каждый вызов SessionListener в потоке, обслуживающем
+// сессию, копируется в слот кольца SpscRing и сразу возвращает управление. Поток вывода забирает события
+// drain() и передает своему слушателю в том же порядке - с теми же аргументами, но уже в своем потоке.
+// Медленный терминал задерживает только вывод: сокет читается дальше, окно TCP не закрывается.
+//
+// Переполнение (вывод отстал на всю емкость кольца, например, пачка истории или поток сообщений в
+// медленный терминал): события копятся в запасном буфере писателя и переходят в кольцо по мере того, как
+// читатель его освобождает (refill), - порядок сохраняется. Запасной буфер состоит из кусков по
+// kOverflowChunkEvents событий, у каждого куска своя монотонная арена (std::pmr) для строк: выделение -
+// сдвиг указателя, а когда кусок целиком перешел в кольцо, его арена освобождается одним вызовом, без
+// free() на каждое событие. Так память возвращается, даже если читатель все время чуть отстает и буфер
+// не пустеет совсем. Запасной буфер ограничен kOverflowLimitBytes;
+// сверх него сообщения и записи истории отбрасываются, остальные события (вход, ошибки, границы истории
+// и списков) принимаются всегда, чтобы состояние слушателя не разошлось с сессией. Сколько отброшено,
+// слушатель узнает из onEventsDropped. История при этом не теряется: Session уже записала ее в кэш.
+//
+// Писатель - один поток (обслуживающий сессию), читатель - один поток. Пока overflowing(), читатель после
+// drain() будит писателя, чтобы тот вызвал refill(). История из кэша (openConversation в другом потоке)
+// в очередь идти не должна: ее получает cacheListener. stats() - из любого потока.
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+
+#include "sessionlistener.h"
+#include "spscring.h"
+
+struct SessionEventQueueStats {
+    uint64_t queued = 0;       // Принято в очередь за все время
+    uint64_t spilled = 0;      // Из них прошло через запасной буфер
+    uint64_t dropped = 0;      // Отброшено сверх kOverflowLimitBytes
+    size_t depth = 0;          // В кольце сейчас
+    size_t maxDepth = 0;       // Наибольшая глубина кольца
+    size_t capacity = 0;       // Емкость кольца
+    size_t overflowBytes = 0;  // В запасном буфере сейчас
+    size_t maxOverflowBytes = 0;
+};
+
+class SessionEventQueue : public SessionListener {
+public:
+    using Clock = std::chrono::steady_clock;
+    static constexpr size_t kDefaultCapacity = 8192;
+    static constexpr size_t kOverflowLimitBytes = 64 * 1024 * 1024;
+    static constexpr size_t kOverflowChunkEvents = 1024;
+
+    explicit SessionEventQueue(size_t capacity = kDefaultCapacity);
+    ~SessionEventQueue() override;
+    SessionEventQueue(const SessionEventQueue&) = delete;
+    SessionEventQueue& operator=(const SessionEventQueue&) = delete;
+
+    // --- Писатель ---
+    // Время приема данных, из которых будут следующие события (задержка "прием -> экран" у читателя)
+    void setReceivedAt(Clock::time_point receivedAt) { m_receivedAt = receivedAt; }
+    // Переносит в кольцо то, что ждет в запасном буфере (сколько поместится)
+    void refill();
+    // Событий, которые стали видны читателю: писатель сравнивает до и после приема, чтобы будить читателя по делу
+    uint64_t published() const { return m_published; }
+
+    void onLoggedIn(std::string_view username) override;
+    void onLoggedOut() override;
+    void onDisconnected() override;
+    void onConnected(std::string_view endpoint, std::string_view resumeUsername) override;
+    void onConnectFailed(std::string_view endpoint, int errorCode, std::chrono::milliseconds retryIn) override;
+    void onSendError(int errorCode) override;
+    void onEventLoopError(int errorCode) override;
+    void onMessage(const ChatMessage& message) override;
+    void onHistoryBegin(ConversationKind kind, std::string_view name, HistorySource source) override;
+    void onHistoryEntry(ConversationKind kind, std::string_view name, const HistoryEntry& entry) override;
+    void onHistoryEnd(ConversationKind kind, std::string_view name, HistorySource source, size_t entries) override;
+    void onHistoryStored(ConversationKind kind, std::string_view name, const HistoryEntry& entry) override;
+    void onFriendListBegin() override;
+    void onFriend(std::string_view name, std::string_view status) override;
+    void onFriendListEnd(size_t count) override;
+    void onGroupListBegin() override;
+    void onGroupListEntry(std::string_view group) override;
+    void onGroupListEnd(size_t count) override;
+    void onGroupCreated(std::string_view group) override;
+    void onGroupJoined(std::string_view group) override;
+    void onUserJoinedGroup(std::string_view group, std::string_view user) override;
+    void onError(std::string_view message, const PendingRequest* request, bool conversationClosed) override;
+    void onRequestTimeout(const PendingRequest& request, bool conversationClosed) override;
+    void onUnknownLine(std::string_view line, bool idle) override;
+    void onLineTooLong(size_t maxLength) override;
+
+    // --- Читатель ---
+    // Передает target не больше maxEvents событий. oldestReceivedAt - время приема самого раннего из них
+    size_t drain(SessionListener& target, size_t maxEvents, Clock::time_point* oldestReceivedAt = nullptr);
+    bool empty() const { return m_ring->size() == 0; }
+    // В запасном буфере писателя есть события: после drain() писателя нужно разбудить
+    bool overflowing() const { return m_overflowing.load(std::memory_order_acquire); }
+
+    SessionEventQueueStats stats() const;
+
+private:
+    enum class EventType : uint8_t;
+    struct Event;
+    struct OverflowChunk;
+
+    Event* claim(EventType type, bool bulk);
+    void pushHistoryEntry(EventType type, ConversationKind kind, std::string_view name, const HistoryEntry& entry);
+    void publish();
+    void publishToRing();
+    void pushDropNotice();
+
+    std::unique_ptr<SpscRing<Event>> m_ring;
+    // --- Писатель ---
+    Clock::time_point m_receivedAt;
+    std::deque<std::unique_ptr<OverflowChunk>> m_overflow; // Запасной буфер: куски, которые ждут места в кольце
+    std::unique_ptr<OverflowChunk> m_spareChunk;           // Последний освобожденный кусок - для следующего
+    bool m_claimedOverflow = false;  // Последний claim() - в запасной буфер
+    size_t m_dropPending = 0;        // Отброшено после последнего уведомления
+    uint64_t m_published = 0;
+    // --- Счетчики (читает любой поток) ---
+    std::atomic<bool> m_overflowing{ false };
+    std::atomic<uint64_t> m_queued{ 0 };
+    std::atomic<uint64_t> m_spilled{ 0 };
+    std::atomic<uint64_t> m_dropped{ 0 };
+    std::atomic<size_t> m_maxDepth{ 0 };
+    std::atomic<size_t> m_overflowBytes{ 0 };
+    std::atomic<size_t> m_maxOverflowBytes{ 0 };
+};
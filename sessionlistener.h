@@ -0,0 +1,94 @@
+﻿// sessionlistener.h : типизированные события сессии для встраивающего кода (консольный клиент, боты, мосты).
+// Обработчики вызываются из потока, обслуживающего сессию (Session::receive/expireRequests), кроме истории
+// из локального кэша - ее Session::openConversation и Session::showOlderHistory отдают сразу в вызывающем
+// потоке - и onDisconnected (поток, вызвавший Session::disconnect). Перенести события в другой поток -
+// SessionEventQueue (sessionevents.h).
+// Все string_view действительны только на время вызова.
+
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <string_view>
+
+#include "historystore.h"
+#include "nametable.h"
+#include "protocol.h"
+#include "requesttracker.h"
+
+// Откуда пришла история беседы
+enum class HistorySource {
+    Cache,      // Локальный кэш: отдается сразу при открытии беседы
+    Server,     // Полная история с сервера (кэш перезаписан ею)
+    ServerDelta, // Только сообщения новее кэша
+    Older        // Страница раньше уже показанного (Session::showOlderHistory): из кэша или с сервера
+};
+
+// Входящее сообщение (MSG_FROM / GROUP_MSG_FROM)
+struct ChatMessage {
+    ConversationKind kind = ConversationKind::Private;
+    std::string_view conversation; // Группа; для личных - отправитель
+    std::string_view sender;
+    std::string_view text;
+    std::string_view line;         // Строка сервера целиком (пусто, если сообщение пришло кадром)
+    std::string_view body;         // "sender: text", как прислал сервер (пусто у кадра)
+    bool parsed = false;           // sender и text заполнены (у кадра - всегда)
+    // Номера conversation и sender в NameTable сессии (Session::names()): сравнивать их, а не строки
+    NameId conversationId = kNoName;
+    NameId senderId = kNoName;
+};
+
+class SessionListener {
+public:
+    virtual ~SessionListener() = default;
+
+    // --- Вход ---
+    virtual void onLoggedIn(std::string_view /*username*/) {}
+    virtual void onLoggedOut() {}
+    // Соединение закрыто (Session::disconnect): ответов на его запросы уже не будет
+    virtual void onDisconnected() {}
+    // Подключение и отправка. Их сообщает не Session, а код, который подключается и вызывает flush() (в клиенте -
+    // поток приемника), - через тот же слушатель, чтобы они шли по порядку с остальными событиями.
+    // endpoint - "host:port"; resumeUsername - под каким именем восстанавливается вход (пусто - без входа)
+    virtual void onConnected(std::string_view /*endpoint*/, std::string_view /*resumeUsername*/) {}
+    virtual void onConnectFailed(std::string_view /*endpoint*/, int /*errorCode*/, std::chrono::milliseconds /*retryIn*/) {}
+    virtual void onSendError(int /*errorCode*/) {}
+    // Ожидание событий сокета не удалось: поток, который его обслуживает, останавливается
+    virtual void onEventLoopError(int /*errorCode*/) {}
+
+    // --- Сообщения и история ---
+    virtual void onMessage(const ChatMessage& /*message*/) {}
+    // История приходит только для беседы, открытой через Session::openConversation, и только новые записи
+    // (кроме Older). При Session::setHistoryPageSize - только последние записи каждого потока
+    virtual void onHistoryBegin(ConversationKind /*kind*/, std::string_view /*name*/, HistorySource /*source*/) {}
+    virtual void onHistoryEntry(ConversationKind /*kind*/, std::string_view /*name*/, const HistoryEntry& /*entry*/) {}
+    virtual void onHistoryEnd(ConversationKind /*kind*/, std::string_view /*name*/, HistorySource /*source*/, size_t /*entries*/) {}
+    // Запись истории с сервера, сохраненная в кэш, но не вошедшая в страницу (onHistoryEntry ее не получит).
+    // Приходит по возрастанию времени, до onHistoryEntry показанных. Например, для индекса поиска
+    virtual void onHistoryStored(ConversationKind /*kind*/, std::string_view /*name*/, const HistoryEntry& /*entry*/) {}
+
+    // --- Списки (NO_FRIENDS_FOUND / NO_GROUPS_JOINED - пустой список) ---
+    virtual void onFriendListBegin() {}
+    virtual void onFriend(std::string_view /*name*/, std::string_view /*status*/) {}
+    virtual void onFriendListEnd(size_t /*count*/) {}
+    virtual void onGroupListBegin() {}
+    virtual void onGroupListEntry(std::string_view /*group*/) {}
+    virtual void onGroupListEnd(size_t /*count*/) {}
+
+    // --- Группы ---
+    virtual void onGroupCreated(std::string_view /*group*/) {}
+    virtual void onGroupJoined(std::string_view /*group*/) {}
+    virtual void onUserJoinedGroup(std::string_view /*group*/, std::string_view /*user*/) {}
+
+    // --- Ошибки (по "тихим" запросам не приходят) ---
+    // ERROR_* сервера. request - запрос, к которому относится ошибка (nullptr - ни к какому).
+    // conversationClosed - это не открылась беседа, и сессия ее покинула
+    virtual void onError(std::string_view /*message*/, const PendingRequest* /*request*/, bool /*conversationClosed*/) {}
+    virtual void onRequestTimeout(const PendingRequest& /*request*/, bool /*conversationClosed*/) {}
+    // Ответ, который клиент не знает. idle - когда он пришел, не было открытой беседы, запросов без ответа
+    // и незаконченных списков/истории (то есть это, скорее всего, не ответ на что-то ожидаемое)
+    virtual void onUnknownLine(std::string_view /*line*/, bool /*idle*/) {}
+    virtual void onLineTooLong(size_t /*maxLength*/) {}
+    // Только от SessionEventQueue: столько событий отброшено при переполнении очереди
+    virtual void onEventsDropped(size_t /*count*/) {}
+};
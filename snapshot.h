@@ -0,0 +1,74 @@
+﻿// snapshot.h : неизменяемые снимки состояния, которые публикуются целиком (в духе RCU).
+// Писатель строит новое значение из копии текущего и публикует его; читатель получает снимок целиком,
+// поэтому поля одного снимка всегда согласованы между собой. Старый снимок живет, пока его держит хоть
+// один читатель (shared_ptr), - освобождать его после "периода ожидания" не нужно.
+// Ячейка берет свой мьютекс только на копирование указателя. Поток, который читает состояние на каждом
+// событии, держит SnapshotReader: пока номер версии не изменился, get() - одна атомарная загрузка без
+// блокировки и без счетчика ссылок; снимок перечитывается только после публикации (редкий переход).
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <utility>
+
+template <typename T>
+class SnapshotCell {
+public:
+    SnapshotCell() : m_value(std::make_shared<const T>()) {}
+    SnapshotCell(const SnapshotCell&) = delete;
+    SnapshotCell& operator=(const SnapshotCell&) = delete;
+
+    // Текущий снимок; действителен, пока жив возвращенный указатель
+    std::shared_ptr<const T> load() const {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_value;
+    }
+    // Номер версии: растет с каждой публикацией
+    uint64_t version() const { return m_version.load(std::memory_order_acquire); }
+
+    // Публикует копию текущего снимка, измененную change(T&). Писателей сериализует вызывающий:
+    // иначе изменение одного из двух одновременных update() потеряется
+    template <typename Change>
+    void update(Change&& change) {
+        std::shared_ptr<const T> current = load();
+        auto next = std::make_shared<T>(*current);
+        change(*next);
+        std::shared_ptr<const T> published = std::move(next);
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_value.swap(published);
+            m_version.store(m_version.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        }
+        // published (прежний снимок) освобождается здесь, вне мьютекса, если его никто не держит
+    }
+
+private:
+    mutable std::mutex m_mutex;
+    std::shared_ptr<const T> m_value;
+    std::atomic<uint64_t> m_version{ 0 };
+};
+
+// Кэш снимка для одного потока (или для кода под одним внешним мьютексом)
+template <typename T>
+class SnapshotReader {
+public:
+    explicit SnapshotReader(const SnapshotCell<T>& cell) : m_cell(cell) {}
+
+    // Последний опубликованный снимок. Ссылка действительна до следующего get() этого читателя
+    const T& get() {
+        uint64_t version = m_cell.version(); // До load(): снимок не старее номера, иначе следующий get() его пропустит
+        if (!m_value || version != m_version) {
+            m_value = m_cell.load();
+            m_version = version;
+        }
+        return *m_value;
+    }
+
+private:
+    const SnapshotCell<T>& m_cell;
+    std::shared_ptr<const T> m_value;
+    uint64_t m_version = 0;
+};
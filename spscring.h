@@ -0,0 +1,71 @@
+﻿// spscring.h : ограниченное кольцо "один писатель - один читатель" без блокировок.
+// Слоты выделяются один раз в конструкторе и переиспользуются: писатель заполняет слот на месте
+// (claim/publish), читатель читает его на месте (front/pop). Поэтому T с std::string внутри в
+// установившемся режиме не выделяет память - строки сохраняют емкость от прошлых кругов.
+// Индексы писателя и читателя - на разных линиях кэша; каждый держит копию чужого индекса и
+// перечитывает его (acquire), только когда по копии кольцо выглядит полным (пустым).
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+
+template <typename T>
+class SpscRing {
+public:
+    // capacity округляется вверх до степени двойки
+    explicit SpscRing(size_t capacity) : m_mask(roundUp(capacity) - 1), m_slots(new T[m_mask + 1]) {}
+    SpscRing(const SpscRing&) = delete;
+    SpscRing& operator=(const SpscRing&) = delete;
+
+    size_t capacity() const { return m_mask + 1; }
+    // Занято слотов. Точно - только из потоков писателя и читателя; из других - оценка
+    size_t size() const {
+        size_t tail = m_tail.load(std::memory_order_acquire); // Сначала хвост: голова не может оказаться позади него
+        return m_head.load(std::memory_order_acquire) - tail;
+    }
+
+    // --- Писатель ---
+    // Свободных слотов (не меньше): по своей копии индекса читателя, перечитывая его при нехватке
+    size_t freeSlots(size_t wanted = 1) {
+        size_t head = m_head.load(std::memory_order_relaxed);
+        size_t free = capacity() - (head - m_cachedTail);
+        if (free < wanted) { m_cachedTail = m_tail.load(std::memory_order_acquire); free = capacity() - (head - m_cachedTail); }
+        return free;
+    }
+    // Следующий свободный слот (nullptr - кольцо полно). Читатель увидит его после publish()
+    T* claim() {
+        if (freeSlots() == 0) return nullptr;
+        return &m_slots[m_head.load(std::memory_order_relaxed) & m_mask];
+    }
+    void publish() { m_head.store(m_head.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+
+    // --- Читатель ---
+    // Самый старый опубликованный слот (nullptr - пусто). Действителен до pop()
+    T* front() {
+        size_t tail = m_tail.load(std::memory_order_relaxed);
+        if (tail == m_cachedHead) {
+            m_cachedHead = m_head.load(std::memory_order_acquire);
+            if (tail == m_cachedHead) return nullptr;
+        }
+        return &m_slots[tail & m_mask];
+    }
+    void pop() { m_tail.store(m_tail.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+
+private:
+    static size_t roundUp(size_t value) {
+        size_t power = 2;
+        while (power < value) power <<= 1;
+        return power;
+    }
+
+    static constexpr size_t kCacheLine = 64;
+
+    const size_t m_mask;
+    const std::unique_ptr<T[]> m_slots;
+    alignas(kCacheLine) std::atomic<size_t> m_head{ 0 }; // Пишет писатель
+    size_t m_cachedTail = 0;                              // Копия m_tail у писателя
+    alignas(kCacheLine) std::atomic<size_t> m_tail{ 0 }; // Пишет читатель
+    size_t m_cachedHead = 0;                              // Копия m_head у читателя
+};
@@ -0,0 +1,168 @@
+﻿#include "streamcodec.h"
+
+#include <algorithm> // std::fill
+#include <cstring>   // std::memcpy
+
+namespace {
+
+constexpr size_t kMinMatch = 4;       // Короче ссылка не окупается (длина и расстояние - 2-4 байта)
+constexpr size_t kHashBits = 12;
+
+// Номер потока в поле глагола: 1..kCompressedStreamCount. Настоящий глагол - не меньше двух букв
+inline char streamTag(size_t stream) { return static_cast<char>(stream + 1); }
+
+inline uint32_t read32(const char* p) {
+    uint32_t value;
+    std::memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+// Чаще всего длины и расстояния умещаются в один байт varint
+inline size_t readLength(std::string_view data, uint32_t& value) {
+    if (!data.empty() && !(data[0] & 0x80)) { value = static_cast<unsigned char>(data[0]); return 1; }
+    return readVarint(data, value);
+}
+
+inline size_t hash4(const char* p) {
+    return (read32(p) * 2654435761u) >> (32 - kHashBits);
+}
+
+} // namespace
+
+size_t compressedStreamStartedBy(std::string_view start) {
+    for (size_t i = 0; i < kCompressedStreamCount; ++i) {
+        if (kCompressedStreams[i].start == start) return i;
+    }
+    return kCompressedStreamCount;
+}
+
+size_t compressedStreamOf(const Frame& frame) {
+    std::string_view verb = frame.verb();
+    if (verb.size() != 1) return kCompressedStreamCount;
+    size_t stream = static_cast<unsigned char>(verb[0]);
+    return stream >= 1 && stream <= kCompressedStreamCount ? stream - 1 : kCompressedStreamCount;
+}
+
+void StreamWindow::trim() {
+    if (m_size + kMaxEntrySize <= m_data.size()) return; // Сдвигаем редко и сразу на половину
+    size_t drop = m_size - kWindowSize;
+    std::memmove(m_data.data(), m_data.data() + drop, kWindowSize);
+    m_size = kWindowSize;
+    m_base += drop;
+}
+
+// --- Сжатие ---
+
+StreamEncoder::StreamEncoder(size_t stream)
+    : m_stream(stream), m_lastSeen(size_t(1) << kHashBits, 0) {
+}
+
+void StreamEncoder::reset() {
+    StreamWindow::reset();
+    std::fill(m_lastSeen.begin(), m_lastSeen.end(), 0);
+}
+
+// Формат сжатого тела: последовательность [литералов (varint)][литералы][длина ссылки - kMinMatch (varint)]
+// [расстояние назад (varint)], последняя - только литералы
+void StreamEncoder::appendEntry(std::string& out, const std::string_view* args, size_t count) {
+    std::string_view verb = kCompressedStreams[m_stream].entry;
+    m_entry.clear();
+    appendVarint(m_entry, static_cast<uint32_t>(verb.size()));
+    m_entry.append(verb);
+    for (size_t i = 0; i < count; ++i) {
+        appendVarint(m_entry, static_cast<uint32_t>(args[i].size()));
+        m_entry.append(args[i]);
+    }
+    if (m_entry.size() > kMaxEntrySize) { // Не влезет в окно распаковки - обычным кадром, окно не меняется
+        size_t header = beginFrame(out);
+        out += m_entry;
+        finishFrame(out, header);
+        return;
+    }
+
+    // Запись дописывается в окно целиком, ссылки ищутся левее текущей позиции
+    trim();
+    size_t begin = m_size;
+    std::memcpy(m_data.data() + begin, m_entry.data(), m_entry.size());
+    m_size += m_entry.size();
+
+    const char* data = m_data.data();
+    size_t end = m_size;
+    size_t anchor = begin, pos = begin;
+    m_packed.clear();
+    while (pos + kMinMatch <= end) {
+        uint64_t& slot = m_lastSeen[hash4(data + pos)];
+        uint64_t candidate = slot; // Абсолютная позиция + 1
+        slot = m_base + pos + 1;
+        if (candidate > m_base && m_base + pos + 1 - candidate <= kWindowSize) {
+            size_t from = static_cast<size_t>(candidate - 1 - m_base);
+            if (read32(data + from) == read32(data + pos)) {
+                size_t length = kMinMatch;
+                while (pos + length < end && data[from + length] == data[pos + length]) ++length;
+                appendVarint(m_packed, static_cast<uint32_t>(pos - anchor));
+                m_packed.append(data + anchor, pos - anchor);
+                appendVarint(m_packed, static_cast<uint32_t>(length - kMinMatch));
+                appendVarint(m_packed, static_cast<uint32_t>(pos - from));
+                for (size_t i = 1; i < length && pos + i + kMinMatch <= end; ++i) { // Позиции внутри ссылки - тоже в таблицу
+                    m_lastSeen[hash4(data + pos + i)] = m_base + pos + i + 1;
+                }
+                pos += length;
+                anchor = pos;
+                continue;
+            }
+        }
+        ++pos;
+    }
+    appendVarint(m_packed, static_cast<uint32_t>(end - anchor));
+    m_packed.append(data + anchor, end - anchor);
+
+    size_t header = beginFrame(out);
+    out += '\x01'; // Поле глагола длиной в один байт - номер потока
+    out += streamTag(m_stream);
+    appendVarint(out, static_cast<uint32_t>(m_packed.size()));
+    out += m_packed;
+    finishFrame(out, header);
+}
+
+// --- Распаковка ---
+
+bool StreamDecoder::decode(const Frame& compressed, Frame& entry) {
+    size_t stream = compressedStreamOf(compressed);
+    if (stream == kCompressedStreamCount || compressed.count != 2) return false;
+    trim();
+    size_t begin = m_size;
+    if (unpack(compressed.fields[1]) && parseFrame(std::string_view(m_data.data() + begin, m_size - begin), entry)
+        && entry.verb() == kCompressedStreams[stream].entry) {
+        return true;
+    }
+    m_size = begin; // Поврежденную запись в окно не берем
+    return false;
+}
+
+bool StreamDecoder::unpack(std::string_view packed) {
+    char* data = m_data.data();
+    size_t limit = m_size + kMaxEntrySize; // trim() оставил в буфере столько места
+    for (;;) {
+        uint32_t literals = 0, length = 0, distance = 0;
+        size_t used = readLength(packed, literals);
+        if (used == 0 || packed.size() - used < literals || limit - m_size < literals) return false;
+        std::memcpy(data + m_size, packed.data() + used, literals);
+        m_size += literals;
+        packed.remove_prefix(used + literals);
+        if (packed.empty()) return true;
+
+        used = readLength(packed, length);
+        if (used == 0) return false;
+        packed.remove_prefix(used);
+        used = readLength(packed, distance);
+        if (used == 0) return false;
+        packed.remove_prefix(used);
+        length += kMinMatch;
+        if (distance == 0 || distance > m_size || distance > kWindowSize || limit - m_size < length) return false;
+        const char* from = data + m_size - distance;
+        char* to = data + m_size;
+        if (distance >= length) std::memcpy(to, from, length);
+        else for (size_t i = 0; i < length; ++i) to[i] = from[i]; // Ссылка на саму себя (повтор)
+        m_size += length;
+    }
+}
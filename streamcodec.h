@@ -0,0 +1,84 @@
+﻿// streamcodec.h : сжатие записей потоковых ответов (расширение compressed_streams, поверх кадров frame.h).
+// В истории и списках соседние записи почти одинаковы: тот же глагол, те же отправители, общий префикс
+// меток времени, повторяющиеся слова. Поэтому тело каждой записи (обычный кадр без заголовка) сжимается
+// LZ77 относительно окна из недавних записей того же потока: литералы и ссылки "длина + расстояние
+// назад". Сжатый кадр вместо глагола несет один байт - номер потока (kCompressedStreams), вторым полем -
+// сжатое тело. Окно начинается заново с каждым *_START потока.
+// Распаковка идет по одной записи: в памяти только окно (kWindowSize), а не весь ответ.
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "frame.h"
+
+// Потоки, записи которых сжимаются: глагол начала (сбрасывает окно) и глагол записи
+struct CompressedStream {
+    std::string_view start;
+    std::string_view entry;
+};
+
+constexpr CompressedStream kCompressedStreams[] = {
+    { "HISTORY_START",       "HIST_MSG" },
+    { "GROUP_HISTORY_START", "GROUP_HIST_MSG" },
+    { "FRIEND_LIST_START",   "FRIEND" },
+    { "MY_GROUPS_START",     "MY_GROUP_ENTRY" },
+};
+constexpr size_t kCompressedStreamCount = sizeof(kCompressedStreams) / sizeof(kCompressedStreams[0]);
+
+// Номер потока, который начинает глагол start (kCompressedStreamCount - не начинает)
+size_t compressedStreamStartedBy(std::string_view start);
+// Номер потока сжатого кадра (kCompressedStreamCount - кадр обычный)
+size_t compressedStreamOf(const Frame& frame);
+
+// Окно недавно переданных записей потока - общее у сжатия и распаковки
+class StreamWindow {
+public:
+    static constexpr size_t kWindowSize = 64 * 1024;  // Насколько далеко назад может ссылаться запись
+    static constexpr size_t kMaxEntrySize = 64 * 1024; // Длиннее запись не сжимается (уходит обычным кадром)
+
+    StreamWindow() : m_data(2 * kWindowSize + kMaxEntrySize) {}
+    void reset() { m_size = 0; m_base = 0; }
+
+protected:
+    // Освобождает место под следующую запись, отбрасывая то, на что она уже не сошлется
+    void trim();
+
+    std::vector<char> m_data; // Хвост потока: m_data[0] - байт номер m_base от начала потока.
+    size_t m_size = 0;        // Буфер выделен один раз, записи копируются в него без проверок роста
+    size_t m_base = 0;
+};
+
+// Сжатие записей одного потока (сервер)
+class StreamEncoder : public StreamWindow {
+public:
+    explicit StreamEncoder(size_t stream);
+    void reset();
+    // Дописывает в out сжатый кадр записи с аргументами args (без глагола)
+    void appendEntry(std::string& out, const std::string_view* args, size_t count);
+    void appendEntry(std::string& out, std::initializer_list<std::string_view> args) { appendEntry(out, args.begin(), args.size()); }
+
+private:
+    size_t m_stream;
+    std::string m_entry;                // Несжатое тело записи (память переиспользуется)
+    std::string m_packed;               // Сжатое тело
+    std::vector<uint64_t> m_lastSeen;   // Хеш 4 байт -> последняя позиция в потоке + 1 (0 - не было)
+};
+
+// Распаковка записей одного потока (клиент)
+class StreamDecoder : public StreamWindow {
+public:
+    // Восстанавливает из сжатого кадра обычный кадр записи. Поля entry действительны до следующего
+    // decode() или reset(). false - кадр поврежден (ссылка за пределы окна, запись длиннее кадра)
+    bool decode(const Frame& compressed, Frame& entry);
+
+private:
+    // Дописывает в окно распакованное тело записи
+    bool unpack(std::string_view packed);
+};
@@ -0,0 +1,95 @@
+﻿#include "timeformat.h"
+
+#include <cstring> // std::memcmp, std::memcpy
+#include <ctime>
+
+namespace {
+
+// Кэш локального времени потока
+struct LocalClockCache {
+    std::time_t dayValidUntil = 0;    // Следующая локальная полночь
+    char todayDay[2] = {};            // DD сегодняшней даты
+    char todayMonth[2] = {};          // MM сегодняшней даты
+    std::time_t minuteValidUntil = 0; // Начало следующей минуты
+    char currentTime[5] = {};         // HH:MM
+};
+
+thread_local LocalClockCache t_clock;
+
+void toLocalTime(std::time_t time, std::tm& out) {
+#ifdef _WIN32
+    localtime_s(&out, &time);
+#else
+    localtime_r(&time, &out); // Потокобезопасно
+#endif
+}
+
+inline void putTwoDigits(char* dst, int value) {
+    dst[0] = static_cast<char>('0' + value / 10);
+    dst[1] = static_cast<char>('0' + value % 10);
+}
+
+// Проверяет, не наступил ли новый день; localtime вызывается раз в сутки
+void refreshToday(std::time_t now) {
+    if (now < t_clock.dayValidUntil) return;
+    std::tm today;
+    toLocalTime(now, today);
+    putTwoDigits(t_clock.todayDay, today.tm_mday);
+    putTwoDigits(t_clock.todayMonth, today.tm_mon + 1);
+
+    std::tm nextMidnight = today;
+    nextMidnight.tm_hour = nextMidnight.tm_min = nextMidnight.tm_sec = 0;
+    nextMidnight.tm_mday += 1;   // mktime нормализует конец месяца/года
+    nextMidnight.tm_isdst = -1;  // Переход на летнее/зимнее время определит mktime
+    std::time_t midnight = std::mktime(&nextMidnight);
+    t_clock.dayValidUntil = midnight > now ? midnight : now + 60;
+}
+
+// HH:MM текущего времени; localtime вызывается раз в минуту
+void refreshCurrentTime(std::time_t now) {
+    if (now < t_clock.minuteValidUntil) return;
+    std::tm local;
+    toLocalTime(now, local);
+    putTwoDigits(t_clock.currentTime, local.tm_hour);
+    t_clock.currentTime[2] = ':';
+    putTwoDigits(t_clock.currentTime + 3, local.tm_min);
+    t_clock.minuteValidUntil = now - local.tm_sec + 60;
+}
+
+} // namespace
+
+DisplayTimestamp formatTimestampForDisplay(std::string_view serverTimestamp) {
+    DisplayTimestamp result;
+    const char* ts = serverTimestamp.data();
+    // Проверка базового формата YYYY-MM-DD HH:MM:SS
+    if (serverTimestamp.size() == 19 && ts[4] == '-' && ts[7] == '-' && ts[10] == ' ' && ts[13] == ':' && ts[16] == ':') {
+        refreshToday(std::time(nullptr));
+        if (std::memcmp(ts + 8, t_clock.todayDay, 2) == 0 && std::memcmp(ts + 5, t_clock.todayMonth, 2) == 0) {
+            std::memcpy(result.m_data, ts + 11, 5); // Сообщение от сегодня - только время
+            result.m_size = 5;
+        }
+        else { // Иначе - дата и время: [DD.MM | HH:MM]
+            char* out = result.m_data;
+            out[0] = '[';
+            std::memcpy(out + 1, ts + 8, 2);
+            out[3] = '.';
+            std::memcpy(out + 4, ts + 5, 2);
+            std::memcpy(out + 6, " | ", 3);
+            std::memcpy(out + 9, ts + 11, 5);
+            out[14] = ']';
+            result.m_size = 15;
+        }
+        return result;
+    }
+    // Короткий формат HH:MM (например, для своих сообщений) и неизвестные форматы - как есть
+    result.m_passthrough = serverTimestamp;
+    return result;
+}
+
+DisplayTimestamp currentLocalTimeForDisplay() {
+    DisplayTimestamp result;
+    refreshCurrentTime(std::time(nullptr));
+    std::memcpy(result.m_data, t_clock.currentTime, 5);
+    result.m_size = 5;
+    return result;
+}
@@ -0,0 +1,31 @@
+﻿// timeformat.h : форматирование временных меток чата без выделения памяти.
+// Сегодняшняя дата кэшируется (в каждом потоке свой кэш) и пересчитывается только после локальной полуночи.
+
+#pragma once
+
+#include <cstddef>
+#include <string_view>
+
+// Отображаемая метка: "HH:MM" или "[DD.MM | HH:MM]" во внутреннем буфере,
+// либо исходная строка как есть, если формат не распознан
+class DisplayTimestamp {
+public:
+    static constexpr size_t kCapacity = 16; // "[DD.MM | HH:MM]" - 15 символов
+
+    std::string_view view() const { return m_passthrough.data() ? m_passthrough : std::string_view(m_data, m_size); }
+
+private:
+    friend DisplayTimestamp formatTimestampForDisplay(std::string_view serverTimestamp);
+    friend DisplayTimestamp currentLocalTimeForDisplay();
+
+    char m_data[kCapacity];
+    size_t m_size = 0;
+    std::string_view m_passthrough; // Неизвестный формат - ссылается на исходную строку
+};
+
+// Форматирует серверный timestamp (YYYY-MM-DD HH:MM:SS) для отображения.
+// Если сегодня, то HH:MM, иначе [DD.MM | HH:MM]
+DisplayTimestamp formatTimestampForDisplay(std::string_view serverTimestamp);
+
+// Текущее локальное время в формате HH:MM для отображения собственных и живых сообщений
+DisplayTimestamp currentLocalTimeForDisplay();
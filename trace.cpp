@@ -0,0 +1,170 @@
+﻿#include "trace.h"
+
+#include <cstdlib> // std::getenv
+
+#ifdef MESSENGER_TRACE
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <vector>
+
+namespace {
+
+using SteadyClock = std::chrono::steady_clock;
+
+// Поля - атомарные (relaxed): traceDump читает буфер, пока поток в него пишет
+struct TraceEvent {
+    std::atomic<const char*> name{ nullptr };
+    std::atomic<uint64_t> start{ 0 };
+    std::atomic<uint64_t> end{ 0 };
+};
+
+// Кольцевой буфер одного потока. Пишет только владелец; head публикуется после записи отрезка
+struct ThreadBuffer {
+    uint32_t id = 0;
+    std::atomic<const char*> name{ nullptr };
+    std::atomic<uint64_t> head{ 0 };
+    std::array<TraceEvent, kTraceEventsPerThread> events;
+};
+
+// Буферы не освобождаются до выхода: трасса нужна и для уже завершившихся потоков
+struct TraceRegistry {
+    std::mutex mutex;
+    std::vector<std::unique_ptr<ThreadBuffer>> threads;
+    uint64_t startTicks = 0; // Первая метка: от нее отсчитывается время в трассе и калибруются такты
+    SteadyClock::time_point startTime;
+};
+
+TraceRegistry& registry() {
+    static TraceRegistry instance;
+    return instance;
+}
+
+thread_local ThreadBuffer* t_buffer = nullptr;
+
+// Первый отрезок потока: регистрация буфера (один раз, под мьютексом)
+ThreadBuffer& registerThread() {
+    TraceRegistry& traces = registry();
+    auto buffer = std::make_unique<ThreadBuffer>();
+    std::lock_guard<std::mutex> lock(traces.mutex);
+    if (traces.threads.empty()) { traces.startTicks = traceNow(); traces.startTime = SteadyClock::now(); }
+    buffer->id = static_cast<uint32_t>(traces.threads.size() + 1);
+    t_buffer = buffer.get();
+    traces.threads.push_back(std::move(buffer));
+    return *t_buffer;
+}
+
+inline ThreadBuffer& threadBuffer() {
+    return t_buffer ? *t_buffer : registerThread();
+}
+
+// Отрезки потока, которые не перезаписаны за время чтения: [head - емкость + 1, head)
+struct CopiedEvent { const char* name; uint64_t start, end; };
+
+void copyEvents(const ThreadBuffer& buffer, std::vector<CopiedEvent>& out) {
+    out.clear();
+    uint64_t head = buffer.head.load(std::memory_order_acquire);
+    uint64_t first = head > kTraceEventsPerThread ? head - kTraceEventsPerThread : 0;
+    for (uint64_t i = first; i < head; ++i) {
+        const TraceEvent& event = buffer.events[i % kTraceEventsPerThread];
+        out.push_back({ event.name.load(std::memory_order_relaxed), event.start.load(std::memory_order_relaxed),
+            event.end.load(std::memory_order_relaxed) });
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    // Поток мог дописать (и начать писать следующий) - их места в кольце уже заняты новыми отрезками
+    uint64_t after = buffer.head.load(std::memory_order_relaxed);
+    uint64_t valid = after + 1 > kTraceEventsPerThread ? after + 1 - kTraceEventsPerThread : 0;
+    if (valid > first) out.erase(out.begin(), out.begin() + static_cast<std::ptrdiff_t>(std::min(valid - first, static_cast<uint64_t>(out.size()))));
+}
+
+// Имя отрезка - строковый литерал из кода; кавычки и '\' все равно экранируем
+void appendJsonString(std::string& out, const char* text) {
+    out += '"';
+    for (const char* c = text ? text : "?"; *c; ++c) {
+        if (*c == '"' || *c == '\\') out += '\\';
+        out += *c;
+    }
+    out += '"';
+}
+
+} // namespace
+
+void traceRecord(const char* name, uint64_t start, uint64_t end) {
+    ThreadBuffer& buffer = threadBuffer();
+    uint64_t index = buffer.head.load(std::memory_order_relaxed);
+    TraceEvent& event = buffer.events[index % kTraceEventsPerThread];
+    event.name.store(name, std::memory_order_relaxed);
+    event.start.store(start, std::memory_order_relaxed);
+    event.end.store(end, std::memory_order_relaxed);
+    buffer.head.store(index + 1, std::memory_order_release);
+}
+
+void traceThreadName(const char* name) {
+    threadBuffer().name.store(name, std::memory_order_relaxed);
+}
+
+bool traceDump(const std::string& path) {
+    TraceRegistry& traces = registry();
+    std::vector<ThreadBuffer*> threads;
+    uint64_t startTicks;
+    SteadyClock::time_point startTime;
+    {
+        std::lock_guard<std::mutex> lock(traces.mutex);
+        for (const auto& buffer : traces.threads) threads.push_back(buffer.get());
+        startTicks = traces.startTicks;
+        startTime = traces.startTime;
+    }
+    // Тактов в микросекунде - по паре (такты, steady_clock) от первой метки до сейчас
+    double elapsedUs = std::chrono::duration<double, std::micro>(SteadyClock::now() - startTime).count();
+    uint64_t nowTicks = traceNow();
+    double ticksPerUs = elapsedUs > 0 && nowTicks > startTicks ? static_cast<double>(nowTicks - startTicks) / elapsedUs : 1000.0;
+
+    std::FILE* file = std::fopen(path.c_str(), "wb");
+    if (!file) return false;
+    std::string out = "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n";
+    bool first = true;
+    std::vector<CopiedEvent> events;
+    char number[96];
+    for (const ThreadBuffer* buffer : threads) {
+        if (const char* name = buffer->name.load(std::memory_order_relaxed)) {
+            out += first ? "" : ",\n";
+            std::snprintf(number, sizeof(number), "{\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"name\":\"thread_name\",\"args\":{\"name\":", buffer->id);
+            out += number;
+            appendJsonString(out, name);
+            out += "}}";
+            first = false;
+        }
+        copyEvents(*buffer, events);
+        for (const CopiedEvent& event : events) {
+            if (event.start < startTicks || event.end < event.start) continue; // Недописанный отрезок
+            out += first ? "" : ",\n";
+            out += "{\"ph\":\"X\",\"pid\":1,\"name\":";
+            appendJsonString(out, event.name);
+            std::snprintf(number, sizeof(number), ",\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}", buffer->id,
+                static_cast<double>(event.start - startTicks) / ticksPerUs, static_cast<double>(event.end - event.start) / ticksPerUs);
+            out += number;
+            first = false;
+            if (out.size() >= 1 << 20) { std::fwrite(out.data(), 1, out.size(), file); out.clear(); } // Пишем порциями
+        }
+    }
+    out += "\n]}\n";
+    bool ok = std::fwrite(out.data(), 1, out.size(), file) == out.size();
+    return std::fclose(file) == 0 && ok;
+}
+
+#else
+
+bool traceDump(const std::string&) {
+    return false;
+}
+
+#endif
+
+std::string traceDefaultPath() {
+    const char* path = std::getenv("MESSENGER_TRACE_FILE");
+    return path && *path ? path : "messenger_trace.json";
+}
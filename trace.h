@@ -0,0 +1,82 @@
+﻿// trace.h : трасса отдельных событий - отрезки времени (spans) для chrome://tracing или ui.perfetto.dev.
+// Счетчики metrics.h показывают средние и хвосты; трасса - конкретное медленное событие: какая
+// история застряла, кто держал G_coutMutex, пока ждал приемник.
+// Включается при сборке (cmake -DMESSENGER_TRACE=ON). Без нее TRACE_SCOPE - пустой оператор, а TRACE_LOCK -
+// обычный lock_guard: код трассы не компилируется вовсе. С ней отрезок - два чтения счетчика тактов (rdtsc)
+// и запись в кольцевой буфер своего потока без блокировок (хранятся последние kTraceEventsPerThread).
+// traceDump() можно вызывать, пока потоки пишут: отрезки, которые успели перезаписать, отбрасываются.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <type_traits>
+
+#ifdef MESSENGER_TRACE
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#else
+#include <chrono>
+#endif
+
+constexpr bool kTraceEnabled = true;
+constexpr size_t kTraceEventsPerThread = size_t(1) << 15;
+
+// Метка времени трассы: такты процессора (на x86), иначе наносекунды steady_clock
+inline uint64_t traceNow() {
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return static_cast<uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count());
+#endif
+}
+
+void traceRecord(const char* name, uint64_t start, uint64_t end);
+// Имя потока в трассе (по умолчанию - номер)
+void traceThreadName(const char* name);
+
+// Отрезок от конструктора до деструктора. name - строковый литерал: сохраняется только указатель
+class TraceSpan {
+public:
+    explicit TraceSpan(const char* name) : m_name(name), m_start(traceNow()) {}
+    ~TraceSpan() { traceRecord(m_name, m_start, traceNow()); }
+    TraceSpan(const TraceSpan&) = delete;
+    TraceSpan& operator=(const TraceSpan&) = delete;
+
+private:
+    const char* m_name;
+    uint64_t m_start;
+};
+
+// Захват мьютекса: ожидание - отдельный отрезок
+template <typename Mutex>
+std::unique_lock<Mutex> traceLock(Mutex& mutex, const char* name) {
+    TraceSpan span(name);
+    return std::unique_lock<Mutex>(mutex);
+}
+
+#define TRACE_JOIN_IMPL(a, b) a##b
+#define TRACE_JOIN(a, b) TRACE_JOIN_IMPL(a, b)
+#define TRACE_SCOPE(name) TraceSpan TRACE_JOIN(traceSpan, __LINE__)(name)
+#define TRACE_LOCK(lock, mutex, name) std::unique_lock<std::remove_reference_t<decltype(mutex)>> lock = traceLock(mutex, name)
+
+#else
+
+constexpr bool kTraceEnabled = false;
+
+inline void traceThreadName(const char*) {}
+
+#define TRACE_SCOPE(name) do {} while (0)
+#define TRACE_LOCK(lock, mutex, name) std::lock_guard<std::remove_reference_t<decltype(mutex)>> lock(mutex)
+
+#endif
+
+// Файл трассы: MESSENGER_TRACE_FILE, иначе messenger_trace.json в текущем каталоге
+std::string traceDefaultPath();
+// Пишет отрезки всех потоков в path (формат Chrome Trace Event). false - трасса выключена или ошибка записи
+bool traceDump(const std::string& path);
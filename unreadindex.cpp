@@ -0,0 +1,67 @@
+﻿#include "unreadindex.h"
+
+#include <algorithm> // std::sort
+
+namespace {
+
+size_t kindSlot(ConversationKind kind) { return kind == ConversationKind::Group ? 0 : 1; }
+
+} // namespace
+
+uint32_t UnreadIndex::slot(ConversationKind kind, NameId id) const {
+    const std::vector<uint32_t>& slots = m_slots[kindSlot(kind)];
+    return id < slots.size() ? slots[id] : 0;
+}
+
+void UnreadIndex::add(ConversationKind kind, NameId id, std::string_view name, std::string_view sender, std::string_view text) {
+    uint32_t position = slot(kind, id);
+    UnreadConversation* conversation;
+    if (position > 0) conversation = &m_conversations[position - 1];
+    else { // Первое сообщение беседы - единственная вставка
+        std::vector<uint32_t>& slots = m_slots[kindSlot(kind)];
+        if (id >= slots.size()) slots.resize(id + 1, 0);
+        conversation = &m_conversations.emplace_back();
+        slots[id] = static_cast<uint32_t>(m_conversations.size());
+        conversation->kind = kind;
+        conversation->name = name;
+    }
+    if (conversation->pending++ == 0) m_pending.push_back(conversation);
+    ++conversation->count;
+    ++m_total;
+    conversation->lastSender = sender; // Память строк переиспользуется
+    conversation->lastText = text;
+}
+
+void UnreadIndex::markRead(ConversationKind kind, NameId id) {
+    uint32_t position = slot(kind, id);
+    if (position == 0) return;
+    UnreadConversation* conversation = &m_conversations[position - 1];
+    m_total -= conversation->count;
+    conversation->count = 0;
+    conversation->pending = 0; // Из очереди сводки уберет drainPending
+}
+
+void UnreadIndex::clear() {
+    m_pending.clear();
+    m_conversations.clear();
+    for (std::vector<uint32_t>& slots : m_slots) slots.clear();
+    m_total = 0;
+}
+
+size_t UnreadIndex::count(ConversationKind kind, NameId id) const {
+    uint32_t position = slot(kind, id);
+    return position > 0 ? m_conversations[position - 1].count : 0;
+}
+
+std::vector<const UnreadConversation*> UnreadIndex::list() const {
+    std::vector<const UnreadConversation*> result;
+    for (const UnreadConversation& conversation : m_conversations) {
+        if (conversation.count > 0) result.push_back(&conversation);
+    }
+    std::sort(result.begin(), result.end(), [](const UnreadConversation* a, const UnreadConversation* b) {
+        if (a->count != b->count) return a->count > b->count;
+        if (a->kind != b->kind) return a->kind == ConversationKind::Group; // Группы, затем личные
+        return a->name < b->name;
+    });
+    return result;
+}
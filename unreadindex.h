@@ -0,0 +1,67 @@
+﻿// unreadindex.h : непрочитанные сообщения неактивных бесед.
+// Счетчик на беседу обновляется за O(1) (массив по виду беседы и номеру ее имени в NameTable), поэтому
+// сотни активных групп не стоят ничего, кроме инкремента: ни хеширования, ни сравнения строк. Уведомления о новых сообщениях не выводятся по одному:
+// беседы с новыми сообщениями копятся в очереди сводки, и интерфейс раз в период выводит по строке
+// на беседу ("группа X: 37 новых"). Класс не потокобезопасен - его защищает владелец.
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "historystore.h"
+#include "nametable.h"
+
+struct UnreadConversation {
+    ConversationKind kind = ConversationKind::Private;
+    std::string name;       // Группа; для личной беседы - собеседник
+    size_t count = 0;       // Непрочитано (с последнего открытия беседы)
+    size_t pending = 0;     // Из них пришло после последней сводки
+    std::string lastSender; // Последнее сообщение - для сводки из одного сообщения
+    std::string lastText;
+};
+
+class UnreadIndex {
+public:
+    // Новое сообщение в неактивной беседе id (name - то же имя строкой, для сводки)
+    void add(ConversationKind kind, NameId id, std::string_view name, std::string_view sender, std::string_view text);
+    // Беседа открыта: ее сообщения прочитаны
+    void markRead(ConversationKind kind, NameId id);
+    // Другой пользователь или выход
+    void clear();
+
+    size_t count(ConversationKind kind, NameId id) const;
+    size_t total() const { return m_total; }
+
+    bool hasPending() const { return !m_pending.empty(); }
+    // Передает visit беседы с новыми сообщениями после прошлой сводки (в порядке первого нового)
+    // и начинает следующую сводку
+    template <typename Visit>
+    void drainPending(Visit&& visit) {
+        for (UnreadConversation* conversation : m_pending) {
+            if (conversation->pending == 0) continue; // Прочитана, пока ждала сводки
+            visit(static_cast<const UnreadConversation&>(*conversation));
+            conversation->pending = 0;
+        }
+        m_pending.clear();
+    }
+
+    // Беседы с непрочитанными, больше всего непрочитанных - первыми
+    std::vector<const UnreadConversation*> list() const;
+
+private:
+    uint32_t slot(ConversationKind kind, NameId id) const; // Позиция в m_conversations + 1, 0 - нет
+
+    // Беседы в порядке первого сообщения. deque не перемещает их при росте, поэтому очередь сводки
+    // хранит указатели. Записи не удаляются: бесед у пользователя немного
+    std::deque<UnreadConversation> m_conversations;
+    // [группа/личная][номер имени] -> позиция в m_conversations + 1 (0 - сообщений еще не было)
+    std::array<std::vector<uint32_t>, 2> m_slots;
+    std::vector<UnreadConversation*> m_pending; // Очередь сводки
+    size_t m_total = 0;
+};